@@ -15,20 +15,155 @@
  ********************************/
 #include <crush/dbfr.h>
 #include <crush/general.h>
+#include <crush/heap.h>
+#include <crush/hll.h>
+#include <crush/topk.h>
 
 #include "aggregate_main.h"
 #include "aggregate.h"
 
 #define AGG_TMP_BUF_SIZE 64
 
+/* initial size of the aggregation table without --expected-keys or
+   --sample-size. */
+#define AGG_HASH_SZ 1024
+
+/* number of Space-Saving counters kept for each key requested with --top-k.
+   the extra counters tighten the error bounds of the keys which are output. */
+#define AGG_TOPK_OVERSAMPLE 4
+
+/* a key found by the first --top-k pass, and its exact aggregations. */
+struct topk_candidate {
+  char *key;
+  double weight;
+  struct aggregation *agg;
+};
+
+/* a group considered for output with --order-by or --limit. */
+struct ordered_group {
+  char *key;
+  struct aggregation *agg;
+  double value;   /* value of the --order-by column. */
+  int has_value;  /* whether the --order-by column has a value. */
+};
+
+static double topk_line_weight(const char *line);
+static void print_topk(topk_t *tk, size_t n);
+static int aggregate_topk_exact(struct cmdargs *args, int argc, char *argv[],
+                                int first_file, topk_t *tk, size_t n);
+static void print_ordered_groups(hashtbl_t *aggregations, char **keys,
+                                 size_t n_keys, int order_col, size_t limit);
+static void aggregate_grouping_sets(hashtbl_t *aggregations, char *line,
+                                    char *key);
+static dbfr_t *next_input(struct cmdargs *args, int argc, char *argv[],
+                          int *optind);
+static int aggregate_sorted(struct cmdargs *args, int argc, char *argv[],
+                            int optind, dbfr_t *in_reader, size_t limit);
+static void aggregate_keyed_line(hashtbl_t *aggregations, char *line,
+                                 char *key);
+static int check_time_args(struct cmdargs *args, const char *prog);
+static int close_window(struct cmdargs *args, hashtbl_t *aggregations,
+                        int order_col, size_t limit);
+
+/* the start of the time bucket of the line whose key was extracted last. */
+static time_t line_bucket;
+static int line_bucket_valid;
+
+/* the --time-ordered window which is being aggregated. */
+static time_t open_window;
+static int window_is_open;
+
+/* initial size of the aggregation table, and of each --time-ordered
+   window's table. */
+static size_t table_size = AGG_HASH_SZ;
+
 char *delim;
 struct agg_conf conf;
 
+/** @brief sets up the grouping sets requested with --rollup or
+  * --grouping-sets.  The key fields must already be configured.
+  *
+  * @param conf the aggregation configuration.
+  * @param args contains the parsed cmd-line options & arguments.
+  *
+  * @return 0 on success, non-zero if the grouping sets are invalid.
+  */
+static int configure_grouping_sets(struct agg_conf *conf,
+                                   struct cmdargs *args) {
+  int *positions = NULL;
+  size_t positions_sz = 0;
+  ssize_t n_positions;
+  char *spec, *set, *next;
+  size_t level;
+  int i;
+
+  if (conf->keys.count == 0)
+    return -1;
+
+  if (args->rollup) {
+    /* all of the keys, then one less at a time down to the grand total. */
+    conf->n_grouping_sets = conf->keys.count + 1;
+    conf->grouping_sets = xcalloc(conf->n_grouping_sets * conf->keys.count,
+                                  sizeof(char));
+    for (level = 0; level < conf->n_grouping_sets; level++) {
+      for (i = 0; i < conf->keys.count - (int) level; i++)
+        conf->grouping_sets[level * conf->keys.count + i] = 1;
+    }
+    return 0;
+  }
+
+  /* sets are separated by colons, and list positions in the key list. */
+  conf->n_grouping_sets = 1;
+  for (spec = args->grouping_sets; *spec; spec++) {
+    if (*spec == ':')
+      conf->n_grouping_sets++;
+  }
+  conf->grouping_sets = xcalloc(conf->n_grouping_sets * conf->keys.count,
+                                sizeof(char));
+
+  spec = xstrdup(args->grouping_sets);
+  set = spec;
+  for (level = 0; level < conf->n_grouping_sets; level++, set = next) {
+    next = strchr(set, ':');
+    if (next)
+      *next++ = '\0';
+    /* an empty set is the grand total. */
+    if (*set == '\0')
+      continue;
+    n_positions = expand_nums(set, &positions, &positions_sz);
+    if (n_positions <= 0) {
+      free(spec);
+      return -1;
+    }
+    for (i = 0; i < n_positions; i++) {
+      if (positions[i] < 1 || positions[i] > conf->keys.count) {
+        free(spec);
+        free(positions);
+        return -1;
+      }
+      conf->grouping_sets[level * conf->keys.count + positions[i] - 1] = 1;
+    }
+  }
+  free(spec);
+  if (positions)
+    free(positions);
+  return 0;
+}
+
+/* expands a list of field numbers without modifying the argument, which is
+ * expanded again for each input file. */
+static ssize_t expand_field_list(const char *arg, int **array, size_t *sz) {
+  char *copy = xstrdup(arg);
+  ssize_t n = expand_nums(copy, array, sz);
+  free(copy);
+  return n;
+}
+
 int configure_aggregation(struct agg_conf *conf, struct cmdargs *args,
                           const char *header, const char *delim) {
   if (args->keys) {
-    conf->keys.count = expand_nums(args->keys, &(conf->keys.indexes),
-                                   &(conf->keys.size));
+    conf->keys.count = expand_field_list(args->keys, &(conf->keys.indexes),
+                                         &(conf->keys.size));
   } else if (args->key_labels) {
     conf->keys.count = expand_label_list(args->key_labels, header,
                                          delim, &(conf->keys.indexes),
@@ -39,9 +174,41 @@ int configure_aggregation(struct agg_conf *conf, struct cmdargs *args,
     return conf->keys.count;
   decrement_values(conf->keys.indexes, conf->keys.count);
 
+  if (args->time_field) {
+    conf->time_field.count = expand_field_list(args->time_field,
+                                               &(conf->time_field.indexes),
+                                               &(conf->time_field.size));
+  } else if (args->time_label) {
+    conf->time_field.count = expand_label_list(args->time_label, header,
+                                               delim,
+                                               &(conf->time_field.indexes),
+                                               &(conf->time_field.size));
+    args->preserve = 1;
+  }
+  if (conf->time_field.count < 0) {
+    return conf->time_field.count;
+  } else if (conf->time_field.count > 1) {
+    return -1;
+  } else if (conf->time_field.count == 1) {
+    decrement_values(conf->time_field.indexes, conf->time_field.count);
+    if (! conf->bucket_width) {
+      conf->bucket_width = timefmt_duration(args->bucket);
+      if (conf->bucket_width <= 0 ||
+          timefmt_compile(&(conf->time_format),
+                          args->time_format ? args->time_format
+                                            : AGG_DEFAULT_TIME_FORMAT) != 0)
+        return -1;
+    }
+  }
+
+  if ((args->rollup || args->grouping_sets) && ! conf->grouping_sets) {
+    if (configure_grouping_sets(conf, args) != 0)
+      return -1;
+  }
+
   if (args->sums) {
-    conf->sums.count = expand_nums(args->sums, &(conf->sums.indexes),
-                                   &(conf->sums.size));
+    conf->sums.count = expand_field_list(args->sums, &(conf->sums.indexes),
+                                         &(conf->sums.size));
   } else if (args->sum_labels) {
     conf->sums.count = expand_label_list(args->sum_labels, header,
                                          delim, &(conf->sums.indexes),
@@ -52,12 +219,14 @@ int configure_aggregation(struct agg_conf *conf, struct cmdargs *args,
     return conf->sums.count;
   } else if (conf->sums.count > 0) {
     decrement_values(conf->sums.indexes, conf->sums.count);
-    conf->sums.precisions = xcalloc(conf->sums.count, sizeof(int));
+    if (! conf->sums.precisions)
+      conf->sums.precisions = xcalloc(conf->sums.count, sizeof(int));
   }
 
   if (args->counts) {
-    conf->counts.count = expand_nums(args->counts, &(conf->counts.indexes),
-                                &(conf->counts.size));
+    conf->counts.count = expand_field_list(args->counts,
+                                           &(conf->counts.indexes),
+                                           &(conf->counts.size));
   } else if (args->count_labels) {
     conf->counts.count = expand_label_list(args->count_labels, header,
                                       delim, &(conf->counts.indexes),
@@ -70,8 +239,9 @@ int configure_aggregation(struct agg_conf *conf, struct cmdargs *args,
     decrement_values(conf->counts.indexes, conf->counts.count);
 
   if (args->averages) {
-    conf->averages.count = expand_nums(args->averages, &(conf->averages.indexes),
-                                  &(conf->averages.size));
+    conf->averages.count = expand_field_list(args->averages,
+                                             &(conf->averages.indexes),
+                                             &(conf->averages.size));
   } else if (args->average_labels) {
     conf->averages.count = expand_label_list(args->average_labels, header,
                                         delim, &(conf->averages.indexes),
@@ -82,12 +252,13 @@ int configure_aggregation(struct agg_conf *conf, struct cmdargs *args,
     return conf->averages.count;
   } else if (conf->averages.count > 0) {
     decrement_values(conf->averages.indexes, conf->averages.count);
-    conf->averages.precisions = xcalloc(conf->averages.count, sizeof(int));
+    if (! conf->averages.precisions)
+      conf->averages.precisions = xcalloc(conf->averages.count, sizeof(int));
   }
 
   if (args->mins) {
-    conf->mins.count = expand_nums(args->mins, &(conf->mins.indexes),
-                              &(conf->mins.size));
+    conf->mins.count = expand_field_list(args->mins, &(conf->mins.indexes),
+                                         &(conf->mins.size));
   } else if (args->min_labels) {
     conf->mins.count = expand_label_list(args->min_labels, header, delim,
                                     &(conf->mins.indexes),
@@ -98,12 +269,13 @@ int configure_aggregation(struct agg_conf *conf, struct cmdargs *args,
     return conf->mins.count;
   } else if (conf->mins.count > 0) {
     decrement_values(conf->mins.indexes, conf->mins.count);
-    conf->mins.precisions = xcalloc(conf->mins.count, sizeof(int));
+    if (! conf->mins.precisions)
+      conf->mins.precisions = xcalloc(conf->mins.count, sizeof(int));
   }
 
   if (args->maxs) {
-    conf->maxs.count = expand_nums(args->maxs, &(conf->maxs.indexes),
-                              &(conf->maxs.size));
+    conf->maxs.count = expand_field_list(args->maxs, &(conf->maxs.indexes),
+                                         &(conf->maxs.size));
   } else if (args->max_labels) {
     conf->maxs.count = expand_label_list(args->max_labels, header, delim,
                                     &(conf->maxs.indexes),
@@ -114,9 +286,83 @@ int configure_aggregation(struct agg_conf *conf, struct cmdargs *args,
     return conf->maxs.count;
   } else if (conf->maxs.count > 0) {
     decrement_values(conf->maxs.indexes, conf->maxs.count);
-    conf->maxs.precisions = xcalloc(conf->maxs.count, sizeof(int));
+    if (! conf->maxs.precisions)
+      conf->maxs.precisions = xcalloc(conf->maxs.count, sizeof(int));
+  }
+
+  if (args->top_by) {
+    conf->top_by.count = expand_field_list(args->top_by,
+                                           &(conf->top_by.indexes),
+                                           &(conf->top_by.size));
+  } else if (args->top_by_label) {
+    conf->top_by.count = expand_label_list(args->top_by_label, header, delim,
+                                           &(conf->top_by.indexes),
+                                           &(conf->top_by.size));
+    args->preserve = 1;
+  }
+  if (conf->top_by.count < 0) {
+    return conf->top_by.count;
+  } else if (conf->top_by.count > 1) {
+    return -1;
+  } else if (conf->top_by.count == 1) {
+    decrement_values(conf->top_by.indexes, conf->top_by.count);
+    /* keep the precision seen in earlier input files. */
+    if (! conf->top_by.precisions)
+      conf->top_by.precisions = xcalloc(1, sizeof(int));
+  }
+
+  return 0;
+}
+
+/** @brief checks that the time bucket options are complete and valid.
+  *
+  * @param args contains the parsed cmd-line options & arguments.
+  * @param prog the program name for error messages.
+  *
+  * @return 0 if the options are usable, non-zero otherwise.
+  */
+static int check_time_args(struct cmdargs *args, const char *prog) {
+  timefmt_t format;
+
+  if (! args->bucket) {
+    if (args->time_field || args->time_label || args->time_format ||
+        args->time_ordered) {
+      fprintf(stderr, "%s: --time-field, --time-label, --time-format, and "
+              "--time-ordered require --bucket.\n", prog);
+      return 1;
+    }
+    return 0;
   }
 
+  if (! args->time_field && ! args->time_label) {
+    fprintf(stderr, "%s: --bucket requires --time-field or --time-label.\n",
+            prog);
+    return 1;
+  }
+  if (timefmt_duration(args->bucket) <= 0) {
+    fprintf(stderr, "%s: invalid --bucket width: %s\n", prog, args->bucket);
+    return 1;
+  }
+  if (args->time_format) {
+    if (timefmt_compile(&format, args->time_format) != 0) {
+      fprintf(stderr, "%s: unsupported --time-format: %s\n", prog,
+              args->time_format);
+      return 1;
+    }
+    timefmt_destroy(&format);
+  }
+  if (args->merge_partials || args->rollup || args->grouping_sets) {
+    fprintf(stderr, "%s: --bucket cannot be used with --merge-partials or "
+            "grouping sets.\n", prog);
+    return 1;
+  }
+  if (args->time_ordered &&
+      (args->top_k || args->assume_sorted || args->emit_partial ||
+       args->state)) {
+    fprintf(stderr, "%s: --time-ordered cannot be used with --top-k, "
+            "--assume-sorted, --emit-partial, or --state.\n", prog);
+    return 1;
+  }
   return 0;
 }
 
@@ -131,13 +377,17 @@ int configure_aggregation(struct agg_conf *conf, struct cmdargs *args,
   */
 int aggregate(struct cmdargs *args, int argc, char *argv[], int optind) {
 
-  int i, n;
+  int i;
 
   hashtbl_t aggregations;
-  struct aggregation *value = NULL;
-  char **key_array;
 
-  size_t n_hash_elems;
+  topk_t heavy_hitters;         /* key weights for --top-k */
+  size_t top_k = 0;
+  int first_file = optind;
+
+  int order_col = -1;           /* aggregation column for --order-by */
+  size_t limit = 0;             /* number of keys to output for --limit */
+  int retval;
 
   FILE *in;                     /* input file */
   dbfr_t *in_reader;
@@ -156,6 +406,72 @@ int aggregate(struct cmdargs *args, int argc, char *argv[], int optind) {
   else
     delim = default_delim;
 
+  if (args->rollup && args->grouping_sets) {
+    fprintf(stderr, "%s: --rollup and --grouping-sets cannot be used "
+            "together.\n", argv[0]);
+    return EXIT_HELP;
+  }
+
+  if (check_time_args(args, argv[0]) != 0)
+    return EXIT_HELP;
+
+  if (args->merge_partials) {
+    if (args->top_k) {
+      fprintf(stderr, "%s: --top-k cannot be used with --merge-partials.\n",
+              argv[0]);
+      return EXIT_HELP;
+    }
+    if (args->state) {
+      fprintf(stderr, "%s: --state cannot be used with --merge-partials.\n",
+              argv[0]);
+      return EXIT_HELP;
+    }
+    return merge_partials(args, argc, argv, optind);
+  }
+
+  if (args->state) {
+    if (args->top_k) {
+      fprintf(stderr, "%s: --top-k cannot be used with --state.\n", argv[0]);
+      return EXIT_HELP;
+    }
+    return aggregate_incremental(args, argc, argv, optind);
+  }
+
+  if (args->top_k) {
+    if (args->rollup || args->grouping_sets) {
+      fprintf(stderr, "%s: --top-k cannot be used with grouping sets.\n",
+              argv[0]);
+      return EXIT_HELP;
+    }
+    if (args->emit_partial) {
+      fprintf(stderr, "%s: --top-k cannot be used with --emit-partial.\n",
+              argv[0]);
+      return EXIT_HELP;
+    }
+    if (sscanf(args->top_k, "%lu", &top_k) != 1 || top_k == 0) {
+      fprintf(stderr, "%s: --top-k must be a positive number.\n", argv[0]);
+      return EXIT_HELP;
+    }
+    if (args->top_k_exact) {
+      /* the input has to be read twice. */
+      if (optind == argc) {
+        fprintf(stderr, "%s: --top-k-exact cannot read from stdin.\n",
+                argv[0]);
+        return EXIT_HELP;
+      }
+      for (i = optind; i < argc; i++) {
+        if (str_eq(argv[i], "-")) {
+          fprintf(stderr, "%s: --top-k-exact cannot read from stdin.\n",
+                  argv[0]);
+          return EXIT_HELP;
+        }
+      }
+    }
+  } else if (args->top_by || args->top_by_label || args->top_k_exact) {
+    fprintf(stderr, "%s: -b, -B, and -e require --top-k.\n", argv[0]);
+    return EXIT_HELP;
+  }
+
   if (optind == argc)
     in = stdin;
   else
@@ -171,6 +487,37 @@ int aggregate(struct cmdargs *args, int argc, char *argv[], int optind) {
     fprintf(stderr, "%s: error parsing field arguments.\n", argv[0]);
     return EXIT_HELP;
   }
+  conf.emit_partial = args->emit_partial;
+
+  if (top_k) {
+    if (AGG_KEY_COLUMNS == 0) {
+      fprintf(stderr, "%s: --top-k requires -k or -K.\n", argv[0]);
+      return EXIT_HELP;
+    }
+    if (! args->top_k_exact &&
+        (conf.sums.count || conf.counts.count || conf.averages.count ||
+         conf.mins.count || conf.maxs.count)) {
+      fprintf(stderr,
+              "%s: other aggregations with --top-k require --top-k-exact.\n",
+              argv[0]);
+      return EXIT_HELP;
+    }
+  }
+
+  if (top_k && (args->order_by || args->limit)) {
+    fprintf(stderr, "%s: --order-by and --limit cannot be used with "
+            "--top-k.\n", argv[0]);
+    return EXIT_HELP;
+  }
+  if (configure_output_order(args, argv[0], &order_col, &limit) != 0)
+    return EXIT_HELP;
+
+  if (args->assume_sorted &&
+      (top_k || conf.n_grouping_sets || order_col >= 0 || args->emit_partial)) {
+    fprintf(stderr, "%s: --assume-sorted cannot be used with --top-k, "
+            "grouping sets, --order-by, or --emit-partial.\n", argv[0]);
+    return EXIT_HELP;
+  }
 
 #ifdef CRUSH_DEBUG
   fprintf(stderr, "%d keys: ", conf.keys.count);
@@ -196,222 +543,936 @@ int aggregate(struct cmdargs *args, int argc, char *argv[], int optind) {
   setlocale(LC_ALL, "");
   setlocale(LC_COLLATE, "");
 
+  if (conf.emit_partial)
+    print_partial_layout(stdout);
+
   if (args->preserve) {
     if (dbfr_getline(in_reader) <= 0) {
       fprintf(stderr, "%s: unexpected end of file\n", getenv("_"));
       exit(EXIT_FILE_ERR);
     }
     chomp(in_reader->current_line);
+    print_header(args, in_reader->current_line, top_k);
+  }
 
-    if (in_reader->current_line_len > outbuf_sz) {
-      outbuf = xrealloc(outbuf, in_reader->current_line_len + 32);
-      outbuf_sz = in_reader->current_line_len + 32;
-    }
+  /* presizing the table avoids rehashing it over and over as it grows. */
+  table_size = hll_presize(args->expected_keys, args->sample_size,
+                           first_file < argc ? argv[first_file] : NULL,
+                           args->preserve, conf.keys.indexes, conf.keys.count,
+                           delim, AGG_HASH_SZ);
+  if (table_size == 0) {
+    fprintf(stderr, "%s: --expected-keys and --sample-size must be positive "
+            "numbers.\n", argv[0]);
+    return EXIT_HELP;
+  }
+  /* each grouping set has its own keys. */
+  if (conf.n_grouping_sets && (args->expected_keys || args->sample_size))
+    table_size *= conf.n_grouping_sets;
+  if (args->verbose)
+    fprintf(stderr, "%s: sizing the aggregation table for %lu keys.\n",
+            argv[0], (unsigned long) table_size);
+
+  ht_init(&aggregations, table_size, NULL, (void (*)) free_agg);
+  if (top_k)
+    topk_init(&heavy_hitters, top_k * AGG_TOPK_OVERSAMPLE);
+
+  if (args->assume_sorted) {
+    retval = aggregate_sorted(args, argc, argv, optind, in_reader, limit);
+    ht_destroy(&aggregations);
+    free(outbuf);
+    return retval;
+  }
 
-    n = 0; // count output columns
-    if (conf.keys.count) {
-      extract_fields_to_string(in_reader->current_line, outbuf, outbuf_sz,
-                               conf.keys.indexes, conf.keys.count, delim, NULL);
-      fputs(outbuf, stdout);
-      n++;
-    }
-    if (args->labels) {
-      printf("%s%s", (n++ > 0 ? delim : ""), args->labels);
-    } else {
-      if (conf.sums.count) {
-        extract_fields_to_string(in_reader->current_line, outbuf, outbuf_sz,
-                                 conf.sums.indexes, conf.sums.count, delim,
-                                 args->auto_label ? "-Sum" : NULL);
-        printf("%s%s", (n++ > 0 ? delim : ""), outbuf);
+  /* loop through all files */
+  while (in_reader != NULL) {
+    /* loop through each line of the file */
+    while (dbfr_getline(in_reader) > 0) {
+      chomp(in_reader->current_line);
+      if (top_k) {
+        double weight = topk_line_weight(in_reader->current_line);
+        /* Space-Saving only works with non-negative weights. */
+        if (weight > 0) {
+          topk_add(&heavy_hitters,
+                   line_key(in_reader->current_line,
+                            in_reader->current_line_len, &outbuf, &outbuf_sz),
+                   weight);
+        }
+        continue;
       }
-
-      if (conf.counts.count) {
-        extract_fields_to_string(in_reader->current_line, outbuf, outbuf_sz,
-                                 conf.counts.indexes, conf.counts.count, delim,
-                                 args->auto_label ? "-Count" : NULL);
-        printf("%s%s", (n++ > 0 ? delim : ""), outbuf);
+      if (args->time_ordered) {
+        line_key(in_reader->current_line, in_reader->current_line_len,
+                 &outbuf, &outbuf_sz);
+        if (close_window(args, &aggregations, order_col, limit) != 0) {
+          fprintf(stderr, "%s: input is not ordered by time: \"%s\".\n",
+                  argv[0], outbuf);
+          return EXIT_FILE_ERR;
+        }
+        aggregate_keyed_line(&aggregations, in_reader->current_line, outbuf);
+      } else {
+        aggregate_line(&aggregations, in_reader->current_line,
+                       in_reader->current_line_len, &outbuf, &outbuf_sz);
       }
+    }
+    dbfr_close(in_reader);
+    in_reader = next_input(args, argc, argv, &optind);
+  }
 
-      if (conf.averages.count) {
-        extract_fields_to_string(in_reader->current_line, outbuf, outbuf_sz,
-                                 conf.averages.indexes, conf.averages.count,
-                                 delim, args->auto_label ? "-Average" : NULL);
-        printf("%s%s", (n++ > 0 ? delim : ""), outbuf);
-      }
+  free(outbuf);
 
-      if (conf.mins.count) {
-        extract_fields_to_string(in_reader->current_line, outbuf, outbuf_sz,
-                                 conf.mins.indexes, conf.mins.count, delim,
-                                 args->auto_label ? "-Min" : NULL);
-        printf("%s%s", (n++ > 0 ? delim : ""), outbuf);
-      }
+  /* Print all of the output. */
+  if (top_k) {
+    retval = EXIT_OKAY;
+    if (args->top_k_exact)
+      retval = aggregate_topk_exact(args, argc, argv, first_file,
+                                    &heavy_hitters, top_k);
+    else
+      print_topk(&heavy_hitters, top_k);
+    topk_destroy(&heavy_hitters);
+    ht_destroy(&aggregations);
+    return retval;
+  }
+
+  print_aggregations(args, &aggregations, order_col, limit);
+  ht_destroy(&aggregations);
 
-      if (conf.maxs.count) {
-        extract_fields_to_string(in_reader->current_line, outbuf, outbuf_sz,
-                                 conf.maxs.indexes, conf.maxs.count, delim,
-                                 args->auto_label ? "-Max" : NULL);
+  return EXIT_OKAY;
+}
+
+/** @brief prints the header line of the output.
+  *
+  * @param args contains the parsed cmd-line options & arguments.
+  * @param header the header line of the input, without a newline.
+  * @param top_k the --top-k count, or 0.
+  */
+void print_header(struct cmdargs *args, char *header, size_t top_k) {
+  char *outbuf;
+  size_t outbuf_sz;
+  int n;
+
+  /* leave room for a label suffix on every field. */
+  outbuf_sz = strlen(header) + 32 +
+              16 * (conf.keys.count + conf.time_field.count +
+                    conf.sums.count + conf.counts.count +
+                    conf.averages.count + conf.mins.count + conf.maxs.count +
+                    conf.top_by.count);
+  outbuf = xmalloc(outbuf_sz);
+  n = 0; // count output columns
+  if (conf.emit_partial)
+    printf("%s%s", AGG_PARTIAL_HEADER, delim);
+  if (conf.n_grouping_sets)
+    printf("Level%s", delim);
+  if (conf.bucket_width) {
+    extract_fields_to_string(header, outbuf, outbuf_sz,
+                             conf.time_field.indexes, 1, delim, NULL);
+    fputs(outbuf, stdout);
+    n++;
+  }
+  if (conf.keys.count) {
+    extract_fields_to_string(header, outbuf, outbuf_sz,
+                             conf.keys.indexes, conf.keys.count, delim, NULL);
+    printf("%s%s", (n++ > 0 ? delim : ""), outbuf);
+  }
+  if (args->labels) {
+    printf("%s%s", (n++ > 0 ? delim : ""), args->labels);
+  } else {
+    if (top_k) {
+      if (conf.top_by.count) {
+        extract_fields_to_string(header, outbuf, outbuf_sz,
+                                 conf.top_by.indexes, conf.top_by.count,
+                                 delim, args->auto_label ? "-Sum" : NULL);
         printf("%s%s", (n++ > 0 ? delim : ""), outbuf);
+      } else {
+        printf("%sCount", (n++ > 0 ? delim : ""));
       }
+      if (! args->top_k_exact)
+        printf("%sError", (n++ > 0 ? delim : ""));
+    }
+
+    if (conf.sums.count) {
+      extract_fields_to_string(header, outbuf, outbuf_sz,
+                               conf.sums.indexes, conf.sums.count, delim,
+                               args->auto_label ? "-Sum" : NULL);
+      printf("%s%s", (n++ > 0 ? delim : ""), outbuf);
     }
 
-    fputs("\n", stdout);
+    if (conf.counts.count) {
+      extract_fields_to_string(header, outbuf, outbuf_sz,
+                               conf.counts.indexes, conf.counts.count, delim,
+                               args->auto_label ? "-Count" : NULL);
+      printf("%s%s", (n++ > 0 ? delim : ""), outbuf);
+    }
+
+    if (conf.averages.count) {
+      extract_fields_to_string(header, outbuf, outbuf_sz,
+                               conf.averages.indexes, conf.averages.count,
+                               delim, args->auto_label ? "-Average" : NULL);
+      printf("%s%s", (n++ > 0 ? delim : ""), outbuf);
+    }
+
+    if (conf.mins.count) {
+      extract_fields_to_string(header, outbuf, outbuf_sz,
+                               conf.mins.indexes, conf.mins.count, delim,
+                               args->auto_label ? "-Min" : NULL);
+      printf("%s%s", (n++ > 0 ? delim : ""), outbuf);
+    }
+
+    if (conf.maxs.count) {
+      extract_fields_to_string(header, outbuf, outbuf_sz,
+                               conf.maxs.indexes, conf.maxs.count, delim,
+                               args->auto_label ? "-Max" : NULL);
+      printf("%s%s", (n++ > 0 ? delim : ""), outbuf);
+    }
   }
 
-  ht_init(&aggregations, 1024, NULL, (void (*)) free_agg);
+  fputs("\n", stdout);
+  free(outbuf);
+}
 
-  n_hash_elems = 0;
-  memset(outbuf, 0, outbuf_sz);
+/* prints the start of a line's time bucket into buf, and notes it in
+   line_bucket.  a line whose time cannot be parsed gets an empty bucket. */
+static size_t format_line_bucket(char *line, char *buf, size_t buf_sz) {
+  char tmpbuf[AGG_TMP_BUF_SIZE];
 
-  /* loop through all files */
-  while (in != NULL) {
-    char tmpbuf[AGG_TMP_BUF_SIZE];
-    size_t tmplen;
-    int in_hash;
+  line_bucket_valid = 0;
+  buf[0] = '\0';
+  if (get_line_field(tmpbuf, line, AGG_TMP_BUF_SIZE - 1,
+                     conf.time_field.indexes[0], delim) <= 0 ||
+      timefmt_parse(&(conf.time_format), tmpbuf, &line_bucket) != 0)
+    return 0;
+  line_bucket = timefmt_floor(line_bucket, conf.bucket_width);
+  line_bucket_valid = 1;
+  return timefmt_format(&(conf.time_format), line_bucket, buf, buf_sz);
+}
 
-    /* loop through each line of the file */
+/** @brief extracts the key fields of a line of input.
+  *
+  * @param line a line of input, without a newline.
+  * @param line_len the length of the line.
+  * @param keybuf a buffer for the key, resized as needed.
+  * @param keybuf_sz the size of keybuf.
+  *
+  * @return the key, which is empty if there are no key fields.
+  */
+char *line_key(char *line, size_t line_len, char **keybuf, size_t *keybuf_sz) {
+  size_t len = 0;
+  if (line_len + 32 + AGG_TMP_BUF_SIZE > *keybuf_sz) {
+    *keybuf_sz = line_len + 32 + AGG_TMP_BUF_SIZE;
+    *keybuf = xrealloc(*keybuf, *keybuf_sz);
+  }
+  **keybuf = '\0';
+  if (conf.bucket_width) {
+    len = format_line_bucket(line, *keybuf, AGG_TMP_BUF_SIZE);
+    if (conf.keys.count) {
+      strcpy(*keybuf + len, delim);
+      len += strlen(delim);
+    }
+  }
+  if (conf.keys.count) {
+    extract_fields_to_string(line, *keybuf + len, *keybuf_sz - len,
+                             conf.keys.indexes, conf.keys.count, delim, NULL);
+  }
+  return *keybuf;
+}
+
+/** @brief adds one line of input to the aggregation for its key.
+  *
+  * @param aggregations the aggregations, indexed by key.
+  * @param line a line of input, without a newline.
+  * @param line_len the length of the line.
+  * @param keybuf a buffer for the key, resized as needed.
+  * @param keybuf_sz the size of keybuf.
+  */
+void aggregate_line(hashtbl_t *aggregations, char *line, size_t line_len,
+                    char **keybuf, size_t *keybuf_sz) {
+  aggregate_keyed_line(aggregations, line,
+                       line_key(line, line_len, keybuf, keybuf_sz));
+}
+
+/* adds a line to the aggregation for a key which was already extracted. */
+static void aggregate_keyed_line(hashtbl_t *aggregations, char *line,
+                                 char *key) {
+  struct aggregation *value;
+
+  if (conf.n_grouping_sets) {
+    aggregate_grouping_sets(aggregations, line, key);
+    return;
+  }
+
+  value = ht_get(aggregations, key);
+
+  if (! value) {
+    value = alloc_agg(conf.sums.count, conf.counts.count,
+                      conf.averages.count, conf.mins.count,
+                      conf.maxs.count);
+    if (ht_put(aggregations, key, value) != 0)
+      fprintf(stderr, "%s: failed to store value in hashtable.\n",
+              getenv("_"));
+  }
+  accumulate_line(value, line);
+}
+
+/* opens the next input file, reconfigures the fields for it (needed if
+   labels were used), and skips its header.  returns NULL when there are no
+   more files. */
+static dbfr_t *next_input(struct cmdargs *args, int argc, char *argv[],
+                          int *optind) {
+  dbfr_t *in_reader;
+  FILE *in = nextfile(argc, argv, optind, "r");
+
+  if (! in)
+    return NULL;
+  in_reader = dbfr_init(in);
+  if (configure_aggregation(&conf, args, in_reader->next_line, delim) != 0) {
+    fprintf(stderr, "%s: error parsing field arguments.\n", argv[0]);
+    exit(EXIT_HELP);
+  }
+  if (args->preserve)
+    dbfr_getline(in_reader);
+  return in_reader;
+}
+
+/* with --time-ordered, prints and frees the groups of the open window once
+   a line from a later window arrives.  lines whose time cannot be parsed
+   stay in the open window.  returns non-zero if the line belongs to a window
+   which was already closed. */
+static int close_window(struct cmdargs *args, hashtbl_t *aggregations,
+                        int order_col, size_t limit) {
+  if (! line_bucket_valid)
+    return 0;
+  if (window_is_open && line_bucket != open_window) {
+    if (line_bucket < open_window)
+      return 1;
+    print_aggregations(args, aggregations, order_col, limit);
+    ht_destroy(aggregations);
+    ht_init(aggregations, table_size, NULL, (void (*)) free_agg);
+  }
+  open_window = line_bucket;
+  window_is_open = 1;
+  return 0;
+}
+
+/** @brief aggregates input which is sorted by key, printing each group as
+  * soon as its key changes, so that memory use does not depend on the
+  * number of keys.
+  *
+  * @param args contains the parsed cmd-line options & arguments.
+  * @param argc number of cmd-line arguments.
+  * @param argv list of cmd-line arguments
+  * @param optind index of the next input file in argv.
+  * @param in_reader the reader for the first input file.
+  * @param limit the number of groups to print, or 0 for all of them.
+  *
+  * @return exit status for main() to return.
+  */
+static int aggregate_sorted(struct cmdargs *args, int argc, char *argv[],
+                            int optind, dbfr_t *in_reader, size_t limit) {
+  struct aggregation *value = NULL;
+  char *key = NULL, *group_key = NULL, *tmp;
+  size_t key_sz = 0, group_key_sz = 0, tmp_sz, n_groups = 0;
+  int retval = EXIT_OKAY;
+
+  while (in_reader != NULL) {
     while (dbfr_getline(in_reader) > 0) {
       chomp(in_reader->current_line);
-      if (conf.keys.count) {
-        if (in_reader->current_line_len > outbuf_sz) {
-          outbuf = xrealloc(outbuf, in_reader->current_line_len + 32);
-          outbuf_sz = in_reader->current_line_len + 32;
+      line_key(in_reader->current_line, in_reader->current_line_len,
+               &key, &key_sz);
+
+      if (value && ! str_eq(key, group_key)) {
+        if (key_strcmp(&group_key, &key) > 0) {
+          fprintf(stderr, "%s: input is not sorted by key: \"%s\" follows "
+                  "\"%s\".\n", argv[0], key, group_key);
+          retval = EXIT_FILE_ERR;
+          break;
         }
-        extract_fields_to_string(in_reader->current_line, outbuf, outbuf_sz,
-                                 conf.keys.indexes, conf.keys.count, delim, NULL);
-
-        value = (struct aggregation *) ht_get(&aggregations, outbuf);
+        print_keys_and_agg_vals(group_key, value);
+        free_agg(value);
+        value = NULL;
+        if (limit && ++n_groups == limit)
+          break;
       }
 
-      if (!value) {
-        in_hash = 0;
+      if (! value) {
         value = alloc_agg(conf.sums.count, conf.counts.count,
                           conf.averages.count, conf.mins.count,
                           conf.maxs.count);
-      } else {
-        in_hash = 1;
+        /* hold on to this group's key, and read the next one into the
+           other buffer. */
+        tmp = group_key;
+        tmp_sz = group_key_sz;
+        group_key = key;
+        group_key_sz = key_sz;
+        key = tmp;
+        key_sz = tmp_sz;
       }
+      accumulate_line(value, in_reader->current_line);
+    }
+    dbfr_close(in_reader);
+    if (retval != EXIT_OKAY || (limit && n_groups == limit))
+      break;
+    in_reader = next_input(args, argc, argv, &optind);
+  }
 
-      /* sums */
-      for (i = 0; i < conf.sums.count; i++) {
-        tmplen =
-          get_line_field(tmpbuf, in_reader->current_line,
-                         AGG_TMP_BUF_SIZE - 1, conf.sums.indexes[i], delim);
-        if (tmplen > 0) {
-          n = float_str_precision(tmpbuf);
-          if (conf.sums.precisions[i] < n)
-            conf.sums.precisions[i] = n;
-          value->sums[i] += atof(tmpbuf);
-        }
-      }
+  if (value) {
+    if (retval == EXIT_OKAY)
+      print_keys_and_agg_vals(AGG_KEY_COLUMNS ? group_key : NULL, value);
+    free_agg(value);
+  }
+  if (key)
+    free(key);
+  if (group_key)
+    free(group_key);
+  return retval;
+}
 
-      /* averages */
-      for (i = 0; i < conf.averages.count; i++) {
-        tmplen = get_line_field(tmpbuf, in_reader->current_line,
-                                AGG_TMP_BUF_SIZE - 1, conf.averages.indexes[i],
-                                delim);
-        if (tmplen > 0) {
-          n = float_str_precision(tmpbuf);
-          if (conf.averages.precisions[i] < n)
-            conf.averages.precisions[i] = n;
-          value->average_sums[i] += atof(tmpbuf);
-          value->average_counts[i] += 1;
-        }
-      }
+/** @brief parses the --order-by and --limit options.  The aggregation
+  * fields must already be configured.
+  *
+  * @param args contains the parsed cmd-line options & arguments.
+  * @param prog the program name for error messages.
+  * @param order_col set to the 0-based aggregation column to order by, or
+  *                  -1 to order by key.
+  * @param limit set to the number of groups to output, or 0 for all.
+  *
+  * @return 0 on success, non-zero if the options are invalid.
+  */
+int configure_output_order(struct cmdargs *args, const char *prog,
+                           int *order_col, size_t *limit) {
+  ssize_t n_agg_cols = conf.sums.count + conf.counts.count +
+                       conf.averages.count + conf.mins.count +
+                       conf.maxs.count;
+  *order_col = -1;
+  *limit = 0;
+
+  if (! args->order_by && ! args->limit)
+    return 0;
 
-      /* counts */
-      for (i = 0; i < conf.counts.count; i++) {
-        tmplen = get_line_field(tmpbuf, in_reader->current_line,
-                                AGG_TMP_BUF_SIZE - 1, conf.counts.indexes[i],
-                                delim);
-        if (tmplen > 0) {
-          value->counts[i] += 1;
-        }
-      }
+  if (args->emit_partial) {
+    fprintf(stderr, "%s: --order-by and --limit cannot be used with "
+            "--emit-partial.\n", prog);
+    return 1;
+  }
+  if (args->limit &&
+      (sscanf(args->limit, "%lu", limit) != 1 || *limit == 0)) {
+    fprintf(stderr, "%s: --limit must be a positive number.\n", prog);
+    return 1;
+  }
+  if (args->order_by) {
+    /* the output columns are the keys followed by the aggregations. */
+    if (sscanf(args->order_by, "%d", order_col) != 1 ||
+        *order_col <= AGG_KEY_COLUMNS ||
+        *order_col > AGG_KEY_COLUMNS + n_agg_cols) {
+      fprintf(stderr,
+              "%s: --order-by must be the index of an aggregation column "
+              "in the output.\n", prog);
+      return 1;
+    }
+    *order_col -= AGG_KEY_COLUMNS + 1;
+  }
+  return 0;
+}
 
-      /* mins */
-      for (i = 0; i < conf.mins.count; i++) {
-        tmplen = get_line_field(tmpbuf, in_reader->current_line,
-                                AGG_TMP_BUF_SIZE - 1, conf.mins.indexes[i],
-                                delim);
-        if (tmplen > 0) {
-          double cur_val;
-          n = sscanf(tmpbuf, "%lf", &cur_val);
-          if (n) {
-            if (cur_val < value->numeric_mins[i] ||
-                ! value->mins_initialized[i]) {
-              value->numeric_mins[i] = cur_val;
-              conf.mins.precisions[i] = float_str_precision(tmpbuf);
-            }
-            value->mins_initialized[i] = 1;
-          }
-        }
-      }
+/* prints the aggregations for a list of keys in the requested order. */
+static void print_key_list(struct cmdargs *args, hashtbl_t *aggregations,
+                           char **keys, size_t n_keys, int order_col,
+                           size_t limit) {
+  size_t i;
 
-      /* maxs */
-      for (i = 0; i < conf.maxs.count; i++) {
-        tmplen = get_line_field(tmpbuf, in_reader->current_line,
-                                AGG_TMP_BUF_SIZE - 1, conf.maxs.indexes[i],
-                                delim);
-        if (tmplen > 0) {
-          double cur_val;
-          n = sscanf(tmpbuf, "%lf", &cur_val);
-          if (n) {
-            if (cur_val > value->numeric_maxs[i] ||
-                ! value->maxs_initialized[i]) {
-              value->numeric_maxs[i] = cur_val;
-              conf.maxs.precisions[i] = float_str_precision(tmpbuf);
-            }
-            value->maxs_initialized[i] = 1;
-          }
-        }
-      }
+  if (order_col >= 0 || (limit && ! args->nosort)) {
+    print_ordered_groups(aggregations, keys, n_keys, order_col, limit);
+    return;
+  }
+
+  /* with -n, any N keys will do. */
+  if (limit && n_keys > limit)
+    n_keys = limit;
+  if (! args->nosort) {
+    qsort(keys, n_keys, sizeof(char *),
+          (int (*)(const void *, const void *)) key_strcmp);
+  }
+  for (i = 0; i < n_keys; i++)
+    print_keys_and_agg_vals(keys[i], ht_get(aggregations, keys[i]));
+}
+
+/** @brief prints the aggregated values for every group.
+  *
+  * @param args contains the parsed cmd-line options & arguments.
+  * @param aggregations the aggregations, indexed by key.
+  * @param order_col the 0-based aggregation column to order by, or -1 to
+  *                  order by key.
+  * @param limit the number of groups to print, or 0 for all of them.
+  */
+void print_aggregations(struct cmdargs *args, hashtbl_t *aggregations,
+                        int order_col, size_t limit) {
+  struct aggregation *value;
+  char **key_array;
+  size_t i, n_keys = aggregations->nelems;
+
+  if (conf.emit_partial)
+    print_partial_precisions(stdout);
 
-      if (!in_hash) {
-        if (ht_put(&aggregations, outbuf, value) != 0)
-          fprintf(stderr, "%s: failed to store value in hashtable.\n",
-                  getenv("_"));
-        n_hash_elems++;
+  if (AGG_KEY_COLUMNS == 0) {
+    /* the whole input is aggregated under an empty key. */
+    value = ht_get(aggregations, "");
+    if (value)
+      print_keys_and_agg_vals(NULL, value);
+    return;
+  }
+
+  key_array = xmalloc(sizeof(char *) * (n_keys + 1));
+  ht_keys(aggregations, key_array);
+  if (conf.n_grouping_sets) {
+    /* the grouping sets are output one after another, each in the usual
+       order.  a key's grouping set number is its first field. */
+    char **level_keys = xmalloc(sizeof(char *) * (n_keys + 1));
+    size_t level, n_level_keys;
+    for (level = 0; level < conf.n_grouping_sets; level++) {
+      n_level_keys = 0;
+      for (i = 0; i < n_keys; i++) {
+        if (strtoul(key_array[i], NULL, 10) == level)
+          level_keys[n_level_keys++] = key_array[i];
       }
+      print_key_list(args, aggregations, level_keys, n_level_keys,
+                     order_col, limit);
+    }
+    free(level_keys);
+  } else {
+    print_key_list(args, aggregations, key_array, n_keys, order_col, limit);
+  }
+  free(key_array);
+}
+
+/* the values found in one kind of aggregation field of a line. */
+struct agg_row_field {
+  double *values;
+  int *precisions;
+  char *present;  /* whether the field held a usable value. */
+};
+
+/* the values parsed from one line of input.  they are kept apart from the
+   aggregations so that a line can be added to one aggregation per grouping
+   set without being parsed again. */
+struct agg_row {
+  struct agg_row_field sums;
+  struct agg_row_field averages;
+  struct agg_row_field counts;
+  struct agg_row_field mins;
+  struct agg_row_field maxs;
+};
+
+static struct agg_row row;
+
+static void alloc_row_field(struct agg_row_field *field, ssize_t count) {
+  field->values = xcalloc(count + 1, sizeof(double));
+  field->precisions = xcalloc(count + 1, sizeof(int));
+  field->present = xcalloc(count + 1, sizeof(char));
+}
+
+/* parses the aggregation fields of one kind.  sums and averages are output
+   with the greatest precision seen, so that is tracked here. */
+static void parse_row_field(const char *line, struct agg_conf_field *conf_field,
+                            struct agg_row_field *field, int numeric,
+                            int track_precision) {
+  char tmpbuf[AGG_TMP_BUF_SIZE];
+  int i, n;
 
+  for (i = 0; i < conf_field->count; i++) {
+    field->present[i] = 0;
+    if (get_line_field(tmpbuf, line, AGG_TMP_BUF_SIZE - 1,
+                       conf_field->indexes[i], delim) <= 0)
+      continue;
+    if (! numeric) {
+      field->present[i] = 1;
+    } else if (track_precision) {
+      n = float_str_precision(tmpbuf);
+      if (conf_field->precisions[i] < n)
+        conf_field->precisions[i] = n;
+      field->values[i] = atof(tmpbuf);
+      field->present[i] = 1;
+    } else if (sscanf(tmpbuf, "%lf", &(field->values[i])) == 1) {
+      field->precisions[i] = float_str_precision(tmpbuf);
+      field->present[i] = 1;
     }
-    dbfr_close(in_reader);
-    in = nextfile(argc, argv, &optind, "r");
-    if (in) {
-      in_reader = dbfr_init(in);
-      /* reconfigure fields (needed if labels were used) */
-      if (configure_aggregation(&conf, args, in_reader->next_line, delim) != 0) {
-        fprintf(stderr, "%s: error parsing field arguments.\n", argv[0]);
-        return EXIT_HELP;
+  }
+}
+
+/* parses the aggregation fields of a line into the row buffer. */
+static void parse_row(const char *line) {
+  if (! row.sums.values) {
+    alloc_row_field(&row.sums, conf.sums.count);
+    alloc_row_field(&row.averages, conf.averages.count);
+    alloc_row_field(&row.counts, conf.counts.count);
+    alloc_row_field(&row.mins, conf.mins.count);
+    alloc_row_field(&row.maxs, conf.maxs.count);
+  }
+  parse_row_field(line, &conf.sums, &row.sums, 1, 1);
+  parse_row_field(line, &conf.averages, &row.averages, 1, 1);
+  parse_row_field(line, &conf.counts, &row.counts, 0, 0);
+  parse_row_field(line, &conf.mins, &row.mins, 1, 0);
+  parse_row_field(line, &conf.maxs, &row.maxs, 1, 0);
+}
+
+/* adds the values in the row buffer to an aggregation. */
+static void apply_row(struct aggregation *value) {
+  int i;
+
+  for (i = 0; i < conf.sums.count; i++) {
+    if (row.sums.present[i])
+      value->sums[i] += row.sums.values[i];
+  }
+
+  for (i = 0; i < conf.averages.count; i++) {
+    if (row.averages.present[i]) {
+      value->average_sums[i] += row.averages.values[i];
+      value->average_counts[i] += 1;
+    }
+  }
+
+  for (i = 0; i < conf.counts.count; i++) {
+    if (row.counts.present[i])
+      value->counts[i] += 1;
+  }
+
+  /* mins & maxs are output with the precision of the chosen value. */
+  for (i = 0; i < conf.mins.count; i++) {
+    if (! row.mins.present[i])
+      continue;
+    if (row.mins.values[i] < value->numeric_mins[i] ||
+        ! value->mins_initialized[i]) {
+      value->numeric_mins[i] = row.mins.values[i];
+      conf.mins.precisions[i] = row.mins.precisions[i];
+    }
+    value->mins_initialized[i] = 1;
+  }
+
+  for (i = 0; i < conf.maxs.count; i++) {
+    if (! row.maxs.present[i])
+      continue;
+    if (row.maxs.values[i] > value->numeric_maxs[i] ||
+        ! value->maxs_initialized[i]) {
+      value->numeric_maxs[i] = row.maxs.values[i];
+      conf.maxs.precisions[i] = row.maxs.precisions[i];
+    }
+    value->maxs_initialized[i] = 1;
+  }
+}
+
+/* the key of a line for one grouping set. */
+static char *set_key = NULL;
+static size_t set_key_sz = 0;
+
+/* adds a line to the aggregation for its key in every grouping set.  the
+   line's fields are only split and parsed once. */
+static void aggregate_grouping_sets(hashtbl_t *aggregations, char *line,
+                                    char *key) {
+  static const char **field_starts = NULL;
+  static size_t *field_lens = NULL;
+  struct aggregation *value;
+  size_t delim_len = strlen(delim), key_len = strlen(key);
+  size_t level;
+  char *p, *end;
+  int i;
+
+  if (! field_starts) {
+    field_starts = xmalloc(sizeof(char *) * conf.keys.count);
+    field_lens = xmalloc(sizeof(size_t) * conf.keys.count);
+  }
+  /* room for the grouping set number and every key field. */
+  if (key_len + 32 > set_key_sz) {
+    set_key_sz = key_len + 32;
+    set_key = xrealloc(set_key, set_key_sz);
+  }
+
+  p = key;
+  for (i = 0; i < conf.keys.count; i++) {
+    end = (i == conf.keys.count - 1) ? NULL : strstr(p, delim);
+    field_starts[i] = p;
+    field_lens[i] = end ? end - p : strlen(p);
+    p = end ? end + delim_len : p + field_lens[i];
+  }
+
+  parse_row(line);
+
+  for (level = 0; level < conf.n_grouping_sets; level++) {
+    const char *kept = conf.grouping_sets + level * conf.keys.count;
+    p = set_key + sprintf(set_key, "%lu", (unsigned long) level);
+    for (i = 0; i < conf.keys.count; i++) {
+      memcpy(p, delim, delim_len);
+      p += delim_len;
+      if (kept[i]) {
+        memcpy(p, field_starts[i], field_lens[i]);
+        p += field_lens[i];
       }
-      if (args->preserve)
-        dbfr_getline(in_reader);
     }
+    *p = '\0';
+
+    value = ht_get(aggregations, set_key);
+    if (! value) {
+      value = alloc_agg(conf.sums.count, conf.counts.count,
+                        conf.averages.count, conf.mins.count,
+                        conf.maxs.count);
+      if (ht_put(aggregations, set_key, value) != 0)
+        fprintf(stderr, "%s: failed to store value in hashtable.\n",
+                getenv("_"));
+    }
+    apply_row(value);
   }
+}
 
-  free(outbuf);
+/** @brief adds the values in one line of input to an aggregation.
+  *
+  * @param value the aggregation for the line's key.
+  * @param line a line of input.
+  */
+void accumulate_line(struct aggregation *value, const char *line) {
+  parse_row(line);
+  apply_row(value);
+}
 
-  /* Print all of the output. */
-  if (conf.keys.count) {
-    key_array = xmalloc(sizeof(char *) * n_hash_elems);
-    ht_keys(&aggregations, key_array);
-    if (! args->nosort) {
-      qsort(key_array, n_hash_elems, sizeof(char *),
-            (int (*)(const void *, const void *)) key_strcmp);
+/* the weight a line contributes to its key in --top-k mode. */
+static double topk_line_weight(const char *line) {
+  char tmpbuf[AGG_TMP_BUF_SIZE];
+  int n;
+
+  if (conf.top_by.count == 0)
+    return 1;
+
+  if (get_line_field(tmpbuf, line, AGG_TMP_BUF_SIZE - 1,
+                     conf.top_by.indexes[0], delim) <= 0)
+    return 0;
+  n = float_str_precision(tmpbuf);
+  if (conf.top_by.precisions[0] < n)
+    conf.top_by.precisions[0] = n;
+  return atof(tmpbuf);
+}
+
+/* prints the N heaviest keys from a Space-Saving summary along with their
+   estimated weights and error bounds. */
+static void print_topk(topk_t *tk, size_t n) {
+  topk_counter_t **counters;
+  size_t i, n_counters;
+  int precision = conf.top_by.count ? conf.top_by.precisions[0] : 0;
+
+  counters = xmalloc(sizeof(topk_counter_t *) * (tk->n_counters + 1));
+  n_counters = topk_sorted(tk, counters);
+  for (i = 0; i < n && i < n_counters; i++) {
+    printf("%s%s%.*f%s%.*f\n", counters[i]->key,
+           delim, precision, counters[i]->weight,
+           delim, precision, counters[i]->error);
+  }
+  free(counters);
+}
+
+static int topk_candidate_cmp(struct topk_candidate **a,
+                              struct topk_candidate **b) {
+  if ((*a)->weight > (*b)->weight)
+    return -1;
+  if ((*a)->weight < (*b)->weight)
+    return 1;
+  return key_strcmp(&((*a)->key), &((*b)->key));
+}
+
+/** @brief re-reads the input to compute exact weights and aggregations for
+  * the keys tracked by the first --top-k pass, then prints the N heaviest.
+  *
+  * @param args contains the parsed cmd-line options & arguments.
+  * @param argc number of cmd-line arguments.
+  * @param argv list of cmd-line arguments
+  * @param first_file index in argv of the first input file.
+  * @param tk the summary built by the first pass.
+  * @param n the number of keys to print.
+  *
+  * @return exit status for main() to return.
+  */
+static int aggregate_topk_exact(struct cmdargs *args, int argc, char *argv[],
+                                int first_file, topk_t *tk, size_t n) {
+  hashtbl_t candidates;
+  struct topk_candidate *cand_list, **cand_order;
+  topk_counter_t **counters;
+  size_t i, n_counters;
+  int file_index = first_file;
+  int precision;
+
+  FILE *in;
+  dbfr_t *in_reader;
+  char *outbuf = NULL;
+  size_t outbuf_sz = 0;
+
+  counters = xmalloc(sizeof(topk_counter_t *) * (tk->n_counters + 1));
+  n_counters = topk_sorted(tk, counters);
+
+  cand_list = xcalloc(n_counters + 1, sizeof(struct topk_candidate));
+  cand_order = xmalloc(sizeof(struct topk_candidate *) * (n_counters + 1));
+  ht_init(&candidates, n_counters + 1, NULL, NULL);
+  for (i = 0; i < n_counters; i++) {
+    cand_list[i].key = counters[i]->key;
+    cand_list[i].agg = alloc_agg(conf.sums.count, conf.counts.count,
+                                 conf.averages.count, conf.mins.count,
+                                 conf.maxs.count);
+    cand_order[i] = &(cand_list[i]);
+    ht_put(&candidates, cand_list[i].key, &(cand_list[i]));
+  }
+
+  while ((in = nextfile(argc, argv, &file_index, "r")) != NULL) {
+    in_reader = dbfr_init(in);
+    if (configure_aggregation(&conf, args, in_reader->next_line, delim) != 0) {
+      fprintf(stderr, "%s: error parsing field arguments.\n", argv[0]);
+      return EXIT_HELP;
     }
-    for (i = 0; i < n_hash_elems; i++) {
-      value = (struct aggregation *) ht_get(&aggregations, key_array[i]);
-      print_keys_and_agg_vals(key_array[i], value);
+    /* the header was already printed during the first pass. */
+    if (args->preserve)
+      dbfr_getline(in_reader);
+
+    while (dbfr_getline(in_reader) > 0) {
+      struct topk_candidate *cand;
+      chomp(in_reader->current_line);
+      cand = ht_get(&candidates,
+                    line_key(in_reader->current_line,
+                             in_reader->current_line_len, &outbuf,
+                             &outbuf_sz));
+      if (! cand)
+        continue;
+      cand->weight += topk_line_weight(in_reader->current_line);
+      accumulate_line(cand->agg, in_reader->current_line);
     }
-    free(key_array);
-  } else {
-    print_keys_and_agg_vals(NULL, value);
+    dbfr_close(in_reader);
   }
 
-  ht_destroy(&aggregations);
+  qsort(cand_order, n_counters, sizeof(struct topk_candidate *),
+        (int (*)(const void *, const void *)) topk_candidate_cmp);
 
+  /* the exact weight goes between the keys and the other aggregations. */
+  precision = conf.top_by.count ? conf.top_by.precisions[0] : 0;
+  for (i = 0; i < n && i < n_counters; i++) {
+    size_t len = strlen(cand_order[i]->key) + strlen(delim) + 64;
+    if (len > outbuf_sz) {
+      outbuf_sz = len;
+      outbuf = xrealloc(outbuf, outbuf_sz);
+    }
+    snprintf(outbuf, outbuf_sz, "%s%s%.*f", cand_order[i]->key, delim,
+             precision, cand_order[i]->weight);
+    print_keys_and_agg_vals(outbuf, cand_order[i]->agg);
+  }
+
+  for (i = 0; i < n_counters; i++)
+    free_agg(cand_list[i].agg);
+  ht_destroy(&candidates);
+  free(cand_list);
+  free(cand_order);
+  free(counters);
+  free(outbuf);
   return EXIT_OKAY;
 }
 
+/* gets the value of the COL'th aggregation in output order.  returns 0 if
+   the aggregation has no value, e.g. a min over fields which were all
+   empty. */
+static int agg_column_value(struct aggregation *val, int col, double *value) {
+  if (col < conf.sums.count) {
+    *value = val->sums[col];
+    return 1;
+  }
+  col -= conf.sums.count;
+  if (col < conf.counts.count) {
+    *value = val->counts[col];
+    return 1;
+  }
+  col -= conf.counts.count;
+  if (col < conf.averages.count) {
+    if (val->average_counts[col] == 0)
+      return 0;
+    *value = val->average_sums[col] / val->average_counts[col];
+    return 1;
+  }
+  col -= conf.averages.count;
+  if (col < conf.mins.count) {
+    *value = val->numeric_mins[col];
+    return val->mins_initialized[col];
+  }
+  col -= conf.mins.count;
+  *value = val->numeric_maxs[col];
+  return val->maxs_initialized[col];
+}
+
+/* output order for --order-by: largest value first, groups without a value
+   last, and ties broken by key. */
+static int ordered_group_cmp(const void *a, const void *b) {
+  const struct ordered_group *ga = *((struct ordered_group **) a),
+                             *gb = *((struct ordered_group **) b);
+  if (ga->has_value != gb->has_value)
+    return gb->has_value - ga->has_value;
+  if (ga->has_value) {
+    if (ga->value > gb->value)
+      return -1;
+    if (ga->value < gb->value)
+      return 1;
+  }
+  return key_strcmp((char **) &(ga->key), (char **) &(gb->key));
+}
+
+/* puts the group which would be output last on top of the heap. */
+static int ordered_group_heap_cmp(const void *a, const void *b) {
+  return ordered_group_cmp(&b, &a);
+}
+
+/** @brief prints groups ordered by an aggregation column or by key, keeping
+  * only the first LIMIT groups in a bounded heap rather than sorting all of
+  * them.
+  *
+  * @param aggregations the aggregations, indexed by key.
+  * @param keys the keys of the aggregations table.
+  * @param n_keys the number of keys.
+  * @param order_col the 0-based aggregation column to order by, or -1 to
+  *                  order by key.
+  * @param limit the number of groups to print, or 0 for all of them.
+  */
+static void print_ordered_groups(hashtbl_t *aggregations, char **keys,
+                                 size_t n_keys, int order_col, size_t limit) {
+  struct ordered_group *groups, **order;
+  heap_t kept;
+  size_t i, n_kept;
+
+  if (limit == 0 || limit > n_keys)
+    limit = n_keys;
+
+  groups = xmalloc(sizeof(struct ordered_group) * (limit + 1));
+  order = xmalloc(sizeof(struct ordered_group *) * (limit + 1));
+  heap_init(&kept, limit + 1, ordered_group_heap_cmp);
+
+  /* the heap holds the best groups seen so far, with the worst of them on
+     top.  a new group only gets in by beating it. */
+  n_kept = 0;
+  for (i = 0; i < n_keys; i++) {
+    struct ordered_group candidate, *group;
+    candidate.key = keys[i];
+    candidate.agg = ht_get(aggregations, keys[i]);
+    candidate.has_value = order_col >= 0 &&
+                          agg_column_value(candidate.agg, order_col,
+                                           &(candidate.value));
+    if (n_kept < limit) {
+      group = &(groups[n_kept++]);
+      *group = candidate;
+      heap_push(&kept, group);
+    } else {
+      struct ordered_group *c = &candidate;
+      group = heap_peek(&kept);
+      if (ordered_group_cmp(&c, &group) < 0) {
+        *group = candidate;
+        heap_replace_top(&kept, group);
+      }
+    }
+  }
+
+  /* the heap gives up its groups from last to first. */
+  for (i = n_kept; i > 0; i--)
+    order[i - 1] = heap_pop(&kept);
+  for (i = 0; i < n_kept; i++)
+    print_keys_and_agg_vals(order[i]->key, order[i]->agg);
+
+  heap_destroy(&kept);
+  free(order);
+  free(groups);
+}
+
 int key_strcmp(char **a, char **b) {
   char fa[256], fb[256];
   int retval = 0;
@@ -455,6 +1516,8 @@ int float_str_precision(char *d) {
 
 int print_keys_and_agg_vals(char *key, struct aggregation *val) {
   int i, n = 0;
+  if (conf.emit_partial)
+    return print_partial_vals(stdout, key, val);
   if (key) {
     fputs(key, stdout);
     n++;
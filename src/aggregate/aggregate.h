@@ -20,9 +20,11 @@
 #include <assert.h>
 #include <locale.h>
 
+#include <crush/dbfr.h>
 #include <crush/ffutils.h>
 #include <crush/hashtbl.h>
 #include <crush/linklist.h>
+#include <crush/timefmt.h>
 
 #ifndef AGGREGATE_H
 #define AGGREGATE_H
@@ -43,8 +45,22 @@ struct agg_conf {
   struct agg_conf_field averages;
   struct agg_conf_field mins;
   struct agg_conf_field maxs;
+  struct agg_conf_field top_by;  /**< weight field for --top-k. */
+  int emit_partial;  /**< print partial state rather than final values. */
+  size_t n_grouping_sets;  /**< number of --rollup/--grouping-sets levels. */
+  char *grouping_sets;  /**< for each grouping set, a flag for each key
+                             field saying whether it is kept. */
+  struct agg_conf_field time_field;  /**< date field for --bucket. */
+  long bucket_width;  /**< --bucket width in seconds, or 0. */
+  timefmt_t time_format;  /**< format of the time field and the bucket. */
 };
 
+/* the number of key columns in the output.  grouping sets add a column
+   holding the grouping set number, and --bucket a column holding the start
+   of each line's time bucket. */
+#define AGG_KEY_COLUMNS (conf.keys.count + (conf.n_grouping_sets ? 1 : 0) + \
+                         (conf.bucket_width ? 1 : 0))
+
 struct aggregation {
   u_int32_t *counts;
   double *sums;
@@ -60,17 +76,63 @@ struct aggregation {
   /* char *string_maxs; */
 };
 
+/* the format of --time-field when --time-format is not given; the same as
+   the input format of convdate. */
+#define AGG_DEFAULT_TIME_FORMAT "%m-%d-%Y-%T"
+
+/* first field of the lines describing a partial aggregation state. */
+#define AGG_PARTIAL_MAGIC "#aggregate-partial-v1"
+#define AGG_PARTIAL_HEADER "#header"
+#define AGG_PARTIAL_PRECISIONS "#precisions"
+#define AGG_PARTIAL_INPUT "#input"
+
+/* how far an input file was read by an incremental aggregation. */
+struct partial_input {
+  char *path;       /**< the name of the file on the command line. */
+  dev_t dev;        /**< device holding the file. */
+  ino_t ino;        /**< inode of the file. */
+  off_t offset;     /**< number of bytes aggregated so far. */
+  struct partial_input *next;
+};
+
+extern char *delim;
+extern struct agg_conf conf;
+
 int configure_aggregation(struct agg_conf *conf, struct cmdargs *args,
                           const char *header, const char *delim);
+int configure_output_order(struct cmdargs *args, const char *prog,
+                           int *order_col, size_t *limit);
+void print_aggregations(struct cmdargs *args, hashtbl_t *aggregations,
+                        int order_col, size_t limit);
 void extract_fields_to_string(char *line, char *destbuf, size_t destbuf_sz,
                               int *fields, size_t nfields, char *delim,
                               char *suffix);
 void decrement_values(int *array, size_t sz);
+void print_header(struct cmdargs *args, char *header, size_t top_k);
+char *line_key(char *line, size_t line_len, char **keybuf, size_t *keybuf_sz);
+void aggregate_line(hashtbl_t *aggregations, char *line, size_t line_len,
+                    char **keybuf, size_t *keybuf_sz);
+void accumulate_line(struct aggregation *value, const char *line);
 int print_keys_and_agg_vals(char *key, struct aggregation *val);
 void ht_print_keys_and_agg_vals(void *htelem);
 int key_strcmp(char **a, char **b);
 int float_str_precision(char *d);
 
+/* partial.c */
+void print_partial_layout(FILE *out);
+void print_partial_precisions(FILE *out);
+int print_partial_vals(FILE *out, char *key, struct aggregation *val);
+void write_partial_state(FILE *out, hashtbl_t *aggregations,
+                         struct partial_input *inputs);
+int merge_partial_file(const char *prog, const char *filename,
+                       dbfr_t *in_reader, hashtbl_t *aggregations, int first,
+                       char **header, struct partial_input **inputs);
+int merge_partials(struct cmdargs *args, int argc, char *argv[], int optind);
+
+/* incremental.c */
+int aggregate_incremental(struct cmdargs *args, int argc, char *argv[],
+                          int optind);
+
 
 /** @brief allocates and initializes an aggregation struct
   *
@@ -0,0 +1,244 @@
+/********************************
+   Copyright 2010 Google Inc.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ ********************************/
+
+/* Incremental aggregation of append-only files.
+
+   The state file is a partial aggregation state (see partial.c) which also
+   records the device, inode, and number of bytes already aggregated for
+   each input file.  On the next run, input files which are still the same
+   file and have not shrunk are read from the saved offset, so the cost of a
+   run depends only on how much data was appended.  A file which has been
+   replaced or truncated is treated as new, and read from the start. */
+
+#include <errno.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <crush/general.h>
+
+#include "aggregate_main.h"
+#include "aggregate.h"
+
+static struct partial_input *find_input(struct partial_input *inputs,
+                                        const char *path) {
+  for (; inputs; inputs = inputs->next) {
+    if (str_eq(inputs->path, path))
+      return inputs;
+  }
+  return NULL;
+}
+
+/* loads the saved state, if there is one.  returns an exit status. */
+static int load_state(const char *prog, const char *state_file,
+                      hashtbl_t *aggregations,
+                      struct partial_input **inputs) {
+  dbfr_t *reader;
+  char *header = NULL;
+  int retval;
+
+  reader = dbfr_open(state_file);
+  if (! reader) {
+    if (errno == ENOENT)
+      return EXIT_OKAY;
+    fprintf(stderr, "%s: %s: %s\n", prog, state_file, strerror(errno));
+    return EXIT_FILE_ERR;
+  }
+  retval = merge_partial_file(prog, state_file, reader, aggregations, 0,
+                              &header, inputs);
+  dbfr_close(reader);
+  if (header)
+    free(header);
+  return retval;
+}
+
+/* writes the new state to a temporary file and renames it over the old one,
+   so that an interrupted run leaves the previous state intact. */
+static int save_state(const char *prog, const char *state_file,
+                      hashtbl_t *aggregations, struct partial_input *inputs) {
+  FILE *out;
+  char *tmp_file = xmalloc(strlen(state_file) + 8);
+
+  sprintf(tmp_file, "%s.tmp", state_file);
+  if ((out = fopen(tmp_file, "w")) == NULL) {
+    fprintf(stderr, "%s: %s: %s\n", prog, tmp_file, strerror(errno));
+    free(tmp_file);
+    return EXIT_FILE_ERR;
+  }
+  write_partial_state(out, aggregations, inputs);
+  if (fclose(out) != 0 || rename(tmp_file, state_file) != 0) {
+    fprintf(stderr, "%s: %s: %s\n", prog, state_file, strerror(errno));
+    unlink(tmp_file);
+    free(tmp_file);
+    return EXIT_FILE_ERR;
+  }
+  free(tmp_file);
+  return EXIT_OKAY;
+}
+
+/* aggregates the part of one input file which has not been seen yet. */
+static int aggregate_new_data(struct cmdargs *args, const char *prog,
+                              const char *path, hashtbl_t *aggregations,
+                              struct partial_input **inputs, int first,
+                              char **keybuf, size_t *keybuf_sz) {
+  struct partial_input *input;
+  struct stat st;
+  FILE *in;
+  dbfr_t *reader;
+  off_t offset = 0;
+
+  if ((in = fopen(path, "r")) == NULL || fstat(fileno(in), &st) != 0) {
+    fprintf(stderr, "%s: %s: %s\n", prog, path, strerror(errno));
+    return EXIT_FILE_ERR;
+  }
+
+  /* the header is needed to configure labeled fields, even when it has
+     already been aggregated. */
+  reader = dbfr_init(in);
+  if (configure_aggregation(&conf, args, reader->next_line, delim) != 0) {
+    fprintf(stderr, "%s: error parsing field arguments.\n", prog);
+    dbfr_close(reader);
+    return EXIT_HELP;
+  }
+  if (first && args->preserve) {
+    if (reader->next_line_len <= 0) {
+      fprintf(stderr, "%s: %s: unexpected end of file\n", prog, path);
+      dbfr_close(reader);
+      return EXIT_FILE_ERR;
+    }
+    chomp(reader->next_line);
+    print_header(args, reader->next_line, 0);
+  }
+
+  input = find_input(*inputs, path);
+  if (input && input->dev == st.st_dev && input->ino == st.st_ino &&
+      input->offset <= st.st_size) {
+    offset = input->offset;
+  } else if (! input) {
+    input = xcalloc(1, sizeof(struct partial_input));
+    input->path = xstrdup(path);
+    input->next = *inputs;
+    *inputs = input;
+  }
+  input->dev = st.st_dev;
+  input->ino = st.st_ino;
+
+  if (offset > 0) {
+    /* the reader has already buffered the start of the file. */
+    dbfr_close(reader);
+    if ((in = fopen(path, "r")) == NULL ||
+        fseeko(in, offset, SEEK_SET) != 0) {
+      fprintf(stderr, "%s: %s: %s\n", prog, path, strerror(errno));
+      return EXIT_FILE_ERR;
+    }
+    reader = dbfr_init(in);
+  } else if (args->preserve && dbfr_getline(reader) > 0) {
+    offset += reader->current_line_len;
+  }
+
+  while (dbfr_getline(reader) > 0) {
+    char *line = reader->current_line;
+    ssize_t len = reader->current_line_len;
+    /* a line which is still being written will be read next time. */
+    if (line[len - 1] != '\n')
+      break;
+    offset += len;
+    chomp(line);
+    aggregate_line(aggregations, line, len, keybuf, keybuf_sz);
+  }
+  input->offset = offset;
+  dbfr_close(reader);
+  return EXIT_OKAY;
+}
+
+/** @brief aggregates new data in the input files into a saved state.
+  *
+  * @param args contains the parsed cmd-line options & arguments.
+  * @param argc number of cmd-line arguments.
+  * @param argv list of cmd-line arguments
+  * @param optind index of the first non-option cmd-line argument.
+  *
+  * @return exit status for main() to return.
+  */
+int aggregate_incremental(struct cmdargs *args, int argc, char *argv[],
+                          int optind) {
+  hashtbl_t aggregations;
+  struct partial_input *inputs = NULL, *next;
+  char *keybuf = NULL;
+  size_t keybuf_sz = 0, limit;
+  int i, order_col, retval = EXIT_OKAY;
+
+  if (optind == argc) {
+    fprintf(stderr, "%s: --state requires named input files.\n", argv[0]);
+    return EXIT_HELP;
+  }
+  for (i = optind; i < argc; i++) {
+    if (str_eq(argv[i], "-")) {
+      fprintf(stderr, "%s: --state cannot read from stdin.\n", argv[0]);
+      return EXIT_HELP;
+    }
+  }
+
+  ht_init(&aggregations, 1024, NULL, (void (*)) free_agg);
+  memset(&conf, 0, sizeof(conf));
+  conf.emit_partial = args->emit_partial;
+
+  setlocale(LC_ALL, "");
+  setlocale(LC_COLLATE, "");
+
+  for (i = optind; i < argc && retval == EXIT_OKAY; i++) {
+    if (i == optind) {
+      /* the fields must be configured before the state can be checked
+         against them. */
+      dbfr_t *reader = dbfr_open(argv[i]);
+      if (! reader) {
+        fprintf(stderr, "%s: %s: %s\n", argv[0], argv[i], strerror(errno));
+        retval = EXIT_FILE_ERR;
+        break;
+      }
+      if (configure_aggregation(&conf, args, reader->next_line, delim) != 0) {
+        fprintf(stderr, "%s: error parsing field arguments.\n", argv[0]);
+        retval = EXIT_HELP;
+      }
+      dbfr_close(reader);
+      if (retval == EXIT_OKAY &&
+          configure_output_order(args, argv[0], &order_col, &limit) != 0)
+        retval = EXIT_HELP;
+      if (retval == EXIT_OKAY)
+        retval = load_state(argv[0], args->state, &aggregations, &inputs);
+      if (retval != EXIT_OKAY)
+        break;
+      if (conf.emit_partial)
+        print_partial_layout(stdout);
+    }
+    retval = aggregate_new_data(args, argv[0], argv[i], &aggregations,
+                                &inputs, i == optind, &keybuf, &keybuf_sz);
+  }
+
+  if (retval == EXIT_OKAY)
+    retval = save_state(argv[0], args->state, &aggregations, inputs);
+  if (retval == EXIT_OKAY)
+    print_aggregations(args, &aggregations, order_col, limit);
+
+  for (; inputs; inputs = next) {
+    next = inputs->next;
+    free(inputs->path);
+    free(inputs);
+  }
+  if (keybuf)
+    free(keybuf);
+  ht_destroy(&aggregations);
+  return retval;
+}
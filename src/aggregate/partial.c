@@ -0,0 +1,472 @@
+/********************************
+   Copyright 2010 Google Inc.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ ********************************/
+
+/* Partial aggregation state.
+
+   With --emit-partial, aggregate writes everything needed to combine its
+   results with those of other runs, in the same delimited format as the
+   input:
+
+     #aggregate-partial-v1 <nkeys> <nsums> <ncounts> <naverages> <nmins> <nmaxs>
+     #header <the normal header line>                   (only with -p)
+     #input <device> <inode> <offset> <path>            (only with --state)
+     #precisions <sums...> <averages...> <mins...> <maxs...>
+     <keys...> <sums...> <counts...> <sum count>... <mins...> <maxs...>
+
+   Averages are written as a running sum and count.  Unset mins and maxs
+   are written as empty fields.  --merge-partials reads any number of these
+   files and prints the final values, or another partial state if
+   --emit-partial is also given. */
+
+#include <crush/dbfr.h>
+#include <crush/general.h>
+
+#include "aggregate_main.h"
+#include "aggregate.h"
+
+/* the number of values held in a partial state line for each kind of
+   aggregation, in line order. */
+#define AGG_PARTIAL_N_KINDS 6
+
+/* the precisions of one partial state file. */
+struct partial_precisions {
+  int *sums;
+  int *averages;
+  int *mins;
+  int *maxs;
+};
+
+void print_partial_layout(FILE *out) {
+  fprintf(out, "%s%s%ld%s%ld%s%ld%s%ld%s%ld%s%ld\n", AGG_PARTIAL_MAGIC,
+         delim, (long) AGG_KEY_COLUMNS, delim, (long) conf.sums.count,
+         delim, (long) conf.counts.count, delim, (long) conf.averages.count,
+         delim, (long) conf.mins.count, delim, (long) conf.maxs.count);
+}
+
+void print_partial_precisions(FILE *out) {
+  int i;
+  fputs(AGG_PARTIAL_PRECISIONS, out);
+  for (i = 0; i < conf.sums.count; i++)
+    fprintf(out, "%s%d", delim, conf.sums.precisions[i]);
+  for (i = 0; i < conf.averages.count; i++)
+    fprintf(out, "%s%d", delim, conf.averages.precisions[i]);
+  for (i = 0; i < conf.mins.count; i++)
+    fprintf(out, "%s%d", delim, conf.mins.precisions[i]);
+  for (i = 0; i < conf.maxs.count; i++)
+    fprintf(out, "%s%d", delim, conf.maxs.precisions[i]);
+  fputs("\n", out);
+}
+
+int print_partial_vals(FILE *out, char *key, struct aggregation *val) {
+  int i, n = 0;
+  if (key) {
+    fputs(key, out);
+    n++;
+  }
+  /* %.17g keeps every bit of a double. */
+  for (i = 0; i < conf.sums.count; i++)
+    fprintf(out, "%s%.17g", (n++ > 0 ? delim : ""), val->sums[i]);
+  for (i = 0; i < conf.counts.count; i++)
+    fprintf(out, "%s%u", (n++ > 0 ? delim : ""), val->counts[i]);
+  for (i = 0; i < conf.averages.count; i++) {
+    fprintf(out, "%s%.17g%s%u", (n++ > 0 ? delim : ""),
+            val->average_sums[i], delim, val->average_counts[i]);
+  }
+  for (i = 0; i < conf.mins.count; i++) {
+    if (n++ > 0)
+      fputs(delim, out);
+    if (val->mins_initialized[i])
+      fprintf(out, "%.17g", val->numeric_mins[i]);
+  }
+  for (i = 0; i < conf.maxs.count; i++) {
+    if (n++ > 0)
+      fputs(delim, out);
+    if (val->maxs_initialized[i])
+      fprintf(out, "%.17g", val->numeric_maxs[i]);
+  }
+  fputs("\n", out);
+  return 0;
+}
+
+/** @brief writes a complete partial aggregation state.
+  *
+  * @param out the file to write to.
+  * @param aggregations the aggregations, indexed by key.
+  * @param inputs input file positions to record, or NULL.
+  */
+void write_partial_state(FILE *out, hashtbl_t *aggregations,
+                         struct partial_input *inputs) {
+  char **keys;
+  size_t i, n_keys;
+
+  print_partial_layout(out);
+  for (; inputs; inputs = inputs->next) {
+    fprintf(out, "%s%s%lu%s%lu%s%llu%s%s\n", AGG_PARTIAL_INPUT,
+            delim, (unsigned long) inputs->dev,
+            delim, (unsigned long) inputs->ino,
+            delim, (unsigned long long) inputs->offset,
+            delim, inputs->path);
+  }
+  print_partial_precisions(out);
+
+  keys = xmalloc(sizeof(char *) * (aggregations->nelems + 1));
+  n_keys = ht_keys(aggregations, keys);
+  for (i = 0; i < n_keys; i++) {
+    print_partial_vals(out, AGG_KEY_COLUMNS ? keys[i] : NULL,
+                       ht_get(aggregations, keys[i]));
+  }
+  free(keys);
+}
+
+/* returns the field at *cursor, terminating it in place and advancing
+   *cursor to the next field, or NULL if there are no more fields. */
+static char *next_field(char **cursor) {
+  char *field = *cursor, *end;
+  if (field == NULL)
+    return NULL;
+  end = strstr(field, delim);
+  if (end) {
+    *end = '\0';
+    *cursor = end + strlen(delim);
+  } else {
+    *cursor = NULL;
+  }
+  return field;
+}
+
+/* parses the next field as a number.  returns 0 if it is missing or
+   empty. */
+static int next_number(char **cursor, double *value) {
+  char *field = next_field(cursor), *end;
+  if (field == NULL || *field == '\0')
+    return 0;
+  *value = strtod(field, &end);
+  return end != field;
+}
+
+/** @brief combines partial aggregation state files.
+  *
+  * @param args contains the parsed cmd-line options & arguments.
+  * @param argc number of cmd-line arguments.
+  * @param argv list of cmd-line arguments
+  * @param optind index of the first non-option cmd-line argument.
+  *
+  * @return exit status for main() to return.
+  */
+int merge_partials(struct cmdargs *args, int argc, char *argv[], int optind) {
+  hashtbl_t aggregations;
+  FILE *in;
+  dbfr_t *in_reader;
+  char *header = NULL;
+  int order_col, first = 1, retval = EXIT_OKAY;
+  size_t limit;
+
+  if (args->keys || args->key_labels || args->sums || args->sum_labels ||
+      args->counts || args->count_labels || args->averages ||
+      args->average_labels || args->mins || args->min_labels ||
+      args->maxs || args->max_labels || args->rollup ||
+      args->grouping_sets) {
+    fprintf(stderr, "%s: the fields to merge are defined by the partial "
+            "state files.\n", argv[0]);
+    return EXIT_HELP;
+  }
+
+  memset(&conf, 0, sizeof(conf));
+  conf.emit_partial = args->emit_partial;
+  ht_init(&aggregations, 1024, NULL, (void (*)) free_agg);
+
+  if (optind == argc)
+    in = stdin;
+  else
+    in = nextfile(argc, argv, &optind, "r");
+
+  while (in != NULL) {
+    in_reader = dbfr_init(in);
+    retval = merge_partial_file(argv[0],
+                                in == stdin ? "stdin" : argv[optind - 1],
+                                in_reader, &aggregations, first, &header,
+                                NULL);
+    dbfr_close(in_reader);
+    if (retval != EXIT_OKAY)
+      break;
+    first = 0;
+    in = nextfile(argc, argv, &optind, "r");
+  }
+
+  if (retval == EXIT_OKAY && first) {
+    fprintf(stderr, "%s: no partial state to merge.\n", argv[0]);
+    retval = EXIT_FILE_ERR;
+  }
+
+  if (retval == EXIT_OKAY &&
+      configure_output_order(args, argv[0], &order_col, &limit) != 0)
+    retval = EXIT_HELP;
+
+  if (retval == EXIT_OKAY) {
+    if (conf.emit_partial)
+      print_partial_layout(stdout);
+    if (header) {
+      if (conf.emit_partial)
+        printf("%s%s", AGG_PARTIAL_HEADER, delim);
+      puts(header);
+    }
+    print_aggregations(args, &aggregations, order_col, limit);
+  }
+
+  if (header)
+    free(header);
+  ht_destroy(&aggregations);
+  return retval;
+}
+
+/* reads the layout line of a partial state file, configuring the number of
+   each kind of aggregation from the first file and checking that later
+   files match it. */
+static int read_partial_layout(const char *prog, const char *filename,
+                               char *line, int first) {
+  struct agg_conf_field *kinds[AGG_PARTIAL_N_KINDS] = {
+    &conf.keys, &conf.sums, &conf.counts,
+    &conf.averages, &conf.mins, &conf.maxs
+  };
+  char *cursor = line, *field;
+  int i;
+
+  field = next_field(&cursor);
+  if (! field || ! str_eq(field, AGG_PARTIAL_MAGIC)) {
+    fprintf(stderr, "%s: %s: not a partial aggregation state.\n",
+            prog, filename);
+    return EXIT_FILE_ERR;
+  }
+  for (i = 0; i < AGG_PARTIAL_N_KINDS; i++) {
+    long count;
+    field = next_field(&cursor);
+    if (! field || sscanf(field, "%ld", &count) != 1 || count < 0) {
+      fprintf(stderr, "%s: %s: malformed partial state layout.\n",
+              prog, filename);
+      return EXIT_FILE_ERR;
+    }
+    if (first) {
+      kinds[i]->count = count;
+      kinds[i]->precisions = xcalloc(count + 1, sizeof(int));
+    } else if ((i == 0 ? AGG_KEY_COLUMNS : kinds[i]->count) != count) {
+      fprintf(stderr, "%s: %s: partial state has different fields than "
+              "the first input.\n", prog, filename);
+      return EXIT_FILE_ERR;
+    }
+  }
+  return EXIT_OKAY;
+}
+
+/* reads the precisions line of a partial state file into prec. */
+static int read_partial_precisions(char *line, struct partial_precisions *prec) {
+  struct {
+    struct agg_conf_field *field;
+    int *file_prec;
+  } kinds[] = {
+    { &conf.sums, prec->sums }, { &conf.averages, prec->averages },
+    { &conf.mins, prec->mins }, { &conf.maxs, prec->maxs }
+  };
+  char *cursor = line, *field;
+  int i, j;
+
+  next_field(&cursor);
+  for (i = 0; i < 4; i++) {
+    for (j = 0; j < kinds[i].field->count; j++) {
+      field = next_field(&cursor);
+      if (! field || sscanf(field, "%d", &(kinds[i].file_prec[j])) != 1)
+        return 1;
+      /* sums and averages are printed with the greatest precision seen. */
+      if ((kinds[i].field == &conf.sums || kinds[i].field == &conf.averages)
+          && kinds[i].field->precisions[j] < kinds[i].file_prec[j])
+        kinds[i].field->precisions[j] = kinds[i].file_prec[j];
+    }
+  }
+  return 0;
+}
+
+/* adds the values in one partial state line to the aggregation for its
+   key. */
+static int merge_partial_line(char *line, hashtbl_t *aggregations,
+                              struct partial_precisions *prec) {
+  struct aggregation *value;
+  char *cursor, *key = "";
+  double d;
+  int i;
+
+  if (AGG_KEY_COLUMNS) {
+    key = line;
+    cursor = field_start(line, AGG_KEY_COLUMNS + 1, delim);
+    if (! cursor)
+      return 1;
+    cursor[-strlen(delim)] = '\0';
+  } else {
+    cursor = line;
+  }
+
+  value = ht_get(aggregations, key);
+  if (! value) {
+    value = alloc_agg(conf.sums.count, conf.counts.count, conf.averages.count,
+                      conf.mins.count, conf.maxs.count);
+    ht_put(aggregations, key, value);
+  }
+
+  for (i = 0; i < conf.sums.count; i++) {
+    if (next_number(&cursor, &d))
+      value->sums[i] += d;
+  }
+  for (i = 0; i < conf.counts.count; i++) {
+    if (next_number(&cursor, &d))
+      value->counts[i] += (u_int32_t) d;
+  }
+  for (i = 0; i < conf.averages.count; i++) {
+    if (next_number(&cursor, &d))
+      value->average_sums[i] += d;
+    if (next_number(&cursor, &d))
+      value->average_counts[i] += (u_int32_t) d;
+  }
+  /* like the input fields they came from, the precision of a min or max
+     follows the value which was chosen. */
+  for (i = 0; i < conf.mins.count; i++) {
+    if (next_number(&cursor, &d)) {
+      if (! value->mins_initialized[i] || d < value->numeric_mins[i]) {
+        value->numeric_mins[i] = d;
+        conf.mins.precisions[i] = prec->mins[i];
+      }
+      value->mins_initialized[i] = 1;
+    }
+  }
+  for (i = 0; i < conf.maxs.count; i++) {
+    if (next_number(&cursor, &d)) {
+      if (! value->maxs_initialized[i] || d > value->numeric_maxs[i]) {
+        value->numeric_maxs[i] = d;
+        conf.maxs.precisions[i] = prec->maxs[i];
+      }
+      value->maxs_initialized[i] = 1;
+    }
+  }
+  return 0;
+}
+
+/* reads an input position line into a new list entry. */
+static struct partial_input *read_partial_input(char *line) {
+  struct partial_input *input;
+  char *cursor = line, *dev, *ino, *offset;
+  unsigned long long n_dev, n_ino, n_offset;
+
+  next_field(&cursor);
+  dev = next_field(&cursor);
+  ino = next_field(&cursor);
+  offset = next_field(&cursor);
+  if (! offset || ! cursor ||
+      sscanf(dev, "%llu", &n_dev) != 1 ||
+      sscanf(ino, "%llu", &n_ino) != 1 ||
+      sscanf(offset, "%llu", &n_offset) != 1)
+    return NULL;
+
+  input = xcalloc(1, sizeof(struct partial_input));
+  input->dev = n_dev;
+  input->ino = n_ino;
+  input->offset = n_offset;
+  /* the path is last, so that it may contain anything. */
+  input->path = xstrdup(cursor);
+  return input;
+}
+
+/** @brief merges a single partial state file into an aggregations table.
+  *
+  * @param prog the program name for error messages.
+  * @param filename the name of the file, for error messages.
+  * @param in_reader a reader positioned at the start of the file.
+  * @param aggregations the aggregations, indexed by key.
+  * @param first non-zero if the layout of the file should configure the
+  *              aggregation fields, zero if it must match them.
+  * @param header set to a copy of the file's header line, if it has one and
+  *               *header is NULL.
+  * @param inputs if not NULL, the file's input positions are prepended to
+  *               this list.
+  *
+  * @return exit status for main() to return.
+  */
+int merge_partial_file(const char *prog, const char *filename,
+                       dbfr_t *in_reader, hashtbl_t *aggregations, int first,
+                       char **header, struct partial_input **inputs) {
+  struct partial_precisions prec;
+  size_t header_len = strlen(AGG_PARTIAL_HEADER);
+  size_t input_len = strlen(AGG_PARTIAL_INPUT);
+  size_t prec_len = strlen(AGG_PARTIAL_PRECISIONS);
+  int retval = EXIT_OKAY;
+
+  if (dbfr_getline(in_reader) <= 0) {
+    fprintf(stderr, "%s: %s: unexpected end of file\n", prog, filename);
+    return EXIT_FILE_ERR;
+  }
+  chomp(in_reader->current_line);
+  retval = read_partial_layout(prog, filename, in_reader->current_line, first);
+  if (retval != EXIT_OKAY)
+    return retval;
+
+  prec.sums = xcalloc(conf.sums.count + 1, sizeof(int));
+  prec.averages = xcalloc(conf.averages.count + 1, sizeof(int));
+  prec.mins = xcalloc(conf.mins.count + 1, sizeof(int));
+  prec.maxs = xcalloc(conf.maxs.count + 1, sizeof(int));
+
+  while (dbfr_getline(in_reader) > 0) {
+    char *line = in_reader->current_line;
+    chomp(line);
+
+    if (strncmp(line, AGG_PARTIAL_HEADER, header_len) == 0 &&
+        strncmp(line + header_len, delim, strlen(delim)) == 0) {
+      if (*header == NULL)
+        *header = xstrdup(line + header_len + strlen(delim));
+    } else if (strncmp(line, AGG_PARTIAL_INPUT, input_len) == 0 &&
+               strncmp(line + input_len, delim, strlen(delim)) == 0) {
+      struct partial_input *input = read_partial_input(line);
+      if (! input) {
+        fprintf(stderr, "%s: %s: malformed partial state input: %s\n",
+                prog, filename, line);
+        retval = EXIT_FILE_ERR;
+        break;
+      }
+      if (inputs) {
+        input->next = *inputs;
+        *inputs = input;
+      } else {
+        free(input->path);
+        free(input);
+      }
+    } else if (strncmp(line, AGG_PARTIAL_PRECISIONS, prec_len) == 0 &&
+               (line[prec_len] == '\0' ||
+                strncmp(line + prec_len, delim, strlen(delim)) == 0)) {
+      if (read_partial_precisions(line, &prec) != 0) {
+        fprintf(stderr, "%s: %s: malformed partial state precisions.\n",
+                prog, filename);
+        retval = EXIT_FILE_ERR;
+        break;
+      }
+    } else if (merge_partial_line(line, aggregations, &prec) != 0) {
+      fprintf(stderr, "%s: %s: malformed partial state line: %s\n",
+              prog, filename, line);
+      retval = EXIT_FILE_ERR;
+      break;
+    }
+  }
+
+  free(prec.sums);
+  free(prec.averages);
+  free(prec.mins);
+  free(prec.maxs);
+  return retval;
+}
@@ -0,0 +1,49 @@
+test_number=12
+description="top-k heavy hitters"
+
+expected="$test_dir/test_$test_number.0.expected"
+outfile="$test_dir/test_$test_number.0.actual"
+$bin -p -K Text-2 -t 2 "$test_dir/test.in" > "$outfile"
+if [ $? -ne 0 ] ||
+   [ "`diff -q $outfile $expected`" ]; then
+  test_status $test_number 1 "$description (counts)" FAIL
+else
+  test_status $test_number 1 "$description (counts)" PASS
+  rm "$outfile"
+fi
+
+expected="$test_dir/test_$test_number.1.expected"
+outfile="$test_dir/test_$test_number.1.actual"
+$bin -p -L -K Text-2 -t 2 -B Numeric-2 "$test_dir/test.in" > "$outfile"
+if [ $? -ne 0 ] ||
+   [ "`diff -q $outfile $expected`" ]; then
+  test_status $test_number 2 "$description (weighted)" FAIL
+else
+  test_status $test_number 2 "$description (weighted)" PASS
+  rm "$outfile"
+fi
+
+expected="$test_dir/test_$test_number.2.expected"
+outfile="$test_dir/test_$test_number.2.actual"
+$bin -p -K Text-2 -t 2 -B Numeric-2 -e -S Numeric-1 -C Numeric-1 \
+     "$test_dir/test.in" "$test_dir/test.in2" > "$outfile"
+if [ $? -ne 0 ] ||
+   [ "`diff -q $outfile $expected`" ]; then
+  test_status $test_number 3 "$description (exact)" FAIL
+else
+  test_status $test_number 3 "$description (exact)" PASS
+  rm "$outfile"
+fi
+
+# index lists are expanded again for the second pass.
+expected="$test_dir/test_$test_number.3.expected"
+outfile="$test_dir/test_$test_number.3.actual"
+$bin -p -k 1,2 -t 2 -b 4 -e -s 4,3 "$test_dir/test.in" "$test_dir/test.in" \
+     > "$outfile"
+if [ $? -ne 0 ] ||
+   [ "`diff -q $outfile $expected`" ]; then
+  test_status $test_number 4 "$description (exact, field numbers)" FAIL
+else
+  test_status $test_number 4 "$description (exact, field numbers)" PASS
+  rm "$outfile"
+fi
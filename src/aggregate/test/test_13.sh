@@ -0,0 +1,37 @@
+test_number=13
+description="order by aggregation with limit"
+
+expected="$test_dir/test_$test_number.0.expected"
+outfile="$test_dir/test_$test_number.0.actual"
+$bin -p -K Text-2 -S Numeric-2 -C Numeric-1 -o 2 -m 2 \
+     "$test_dir/test.in" > "$outfile"
+if [ $? -ne 0 ] ||
+   [ "`diff -q $outfile $expected`" ]; then
+  test_status $test_number 1 "$description (sum)" FAIL
+else
+  test_status $test_number 1 "$description (sum)" PASS
+  rm "$outfile"
+fi
+
+expected="$test_dir/test_$test_number.1.expected"
+outfile="$test_dir/test_$test_number.1.actual"
+$bin -p -K Text-2 -N Numeric-1 -X Numeric-2 -o 3 \
+     "$test_dir/test.in" > "$outfile"
+if [ $? -ne 0 ] ||
+   [ "`diff -q $outfile $expected`" ]; then
+  test_status $test_number 2 "$description (max, no limit)" FAIL
+else
+  test_status $test_number 2 "$description (max, no limit)" PASS
+  rm "$outfile"
+fi
+
+expected="$test_dir/test_$test_number.2.expected"
+outfile="$test_dir/test_$test_number.2.actual"
+$bin -p -K Text-2 -S Numeric-2 -m 3 "$test_dir/test.in" > "$outfile"
+if [ $? -ne 0 ] ||
+   [ "`diff -q $outfile $expected`" ]; then
+  test_status $test_number 3 "$description (limit by key)" FAIL
+else
+  test_status $test_number 3 "$description (limit by key)" PASS
+  rm "$outfile"
+fi
@@ -0,0 +1,40 @@
+test_number=14
+description="partial aggregation state"
+
+fields="-K Text-2 -S Numeric-2 -C Numeric-1 -A Numeric-1 -N Numeric-2 -X Numeric-2"
+
+expected="$test_dir/test_$test_number.0.expected"
+outfile="$test_dir/test_$test_number.0.actual"
+$bin -p -P $fields "$test_dir/test.in" > "$outfile"
+if [ $? -ne 0 ] ||
+   [ "`diff -q $outfile $expected`" ]; then
+  test_status $test_number 1 "$description (emit)" FAIL
+else
+  test_status $test_number 1 "$description (emit)" PASS
+fi
+
+# the second input has its columns in a different order.
+partial_2="$test_dir/test_$test_number.2.actual"
+$bin -p -P $fields "$test_dir/test.in2" > "$partial_2"
+
+expected="$test_dir/test_$test_number.1.expected"
+merged="$test_dir/test_$test_number.1.actual"
+$bin -M "$outfile" "$partial_2" > "$merged"
+if [ $? -ne 0 ] ||
+   [ "`diff -q $merged $expected`" ]; then
+  test_status $test_number 2 "$description (merge)" FAIL
+else
+  test_status $test_number 2 "$description (merge)" PASS
+  rm "$merged"
+fi
+
+# merging partial states again must give the same result.
+merged="$test_dir/test_$test_number.3.actual"
+$bin -M -P "$outfile" | $bin -M - "$partial_2" > "$merged"
+if [ $? -ne 0 ] ||
+   [ "`diff -q $merged $expected`" ]; then
+  test_status $test_number 3 "$description (re-merge)" FAIL
+else
+  test_status $test_number 3 "$description (re-merge)" PASS
+  rm "$merged" "$outfile" "$partial_2"
+fi
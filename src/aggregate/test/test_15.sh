@@ -0,0 +1,74 @@
+test_number=15
+description="incremental aggregation"
+
+fields="-K Text-2 -S Numeric-2 -A Numeric-1 -X Numeric-2"
+infile="$test_dir/test_$test_number.in.actual"
+statefile="$test_dir/test_$test_number.state.actual"
+rm -f "$statefile"
+
+expected="$test_dir/test_$test_number.0.expected"
+outfile="$test_dir/test_$test_number.0.actual"
+head -4 "$test_dir/test.in" > "$infile"
+$bin -I "$statefile" $fields "$infile" > "$outfile"
+if [ $? -ne 0 ] ||
+   [ "`diff -q $outfile $expected`" ]; then
+  test_status $test_number 1 "$description (first run)" FAIL
+else
+  test_status $test_number 1 "$description (first run)" PASS
+  rm "$outfile"
+fi
+
+# append the rest of the file, plus a line which is still being written.
+expected="$test_dir/test_$test_number.1.expected"
+outfile="$test_dir/test_$test_number.1.actual"
+tail -n +5 "$test_dir/test.in" >> "$infile"
+printf "second text value\te\t3" >> "$infile"
+$bin -I "$statefile" $fields "$infile" > "$outfile"
+if [ $? -ne 0 ] ||
+   [ "`diff -q $outfile $expected`" ]; then
+  test_status $test_number 2 "$description (appended data)" FAIL
+else
+  test_status $test_number 2 "$description (appended data)" PASS
+  rm "$outfile"
+fi
+
+# finish the partial line.
+expected="$test_dir/test_$test_number.2.expected"
+outfile="$test_dir/test_$test_number.2.actual"
+printf "\t4\n" >> "$infile"
+$bin -I "$statefile" $fields "$infile" > "$outfile"
+if [ $? -ne 0 ] ||
+   [ "`diff -q $outfile $expected`" ]; then
+  test_status $test_number 3 "$description (completed line)" FAIL
+else
+  test_status $test_number 3 "$description (completed line)" PASS
+  rm "$outfile" "$infile" "$statefile"
+fi
+
+# field numbers must give the same fields on every run.
+fields="-p -k 1,2 -s 4,3"
+rm -f "$statefile"
+
+expected="$test_dir/test_$test_number.3.expected"
+outfile="$test_dir/test_$test_number.3.actual"
+head -4 "$test_dir/test.in" > "$infile"
+$bin -I "$statefile" $fields "$infile" > "$outfile"
+if [ $? -ne 0 ] ||
+   [ "`diff -q $outfile $expected`" ]; then
+  test_status $test_number 4 "$description (field numbers, first run)" FAIL
+else
+  test_status $test_number 4 "$description (field numbers, first run)" PASS
+  rm "$outfile"
+fi
+
+expected="$test_dir/test_$test_number.4.expected"
+outfile="$test_dir/test_$test_number.4.actual"
+tail -n +5 "$test_dir/test.in" >> "$infile"
+$bin -I "$statefile" $fields "$infile" > "$outfile"
+if [ $? -ne 0 ] ||
+   [ "`diff -q $outfile $expected`" ]; then
+  test_status $test_number 5 "$description (field numbers, appended data)" FAIL
+else
+  test_status $test_number 5 "$description (field numbers, appended data)" PASS
+  rm "$outfile" "$infile" "$statefile"
+fi
@@ -0,0 +1,25 @@
+test_number=16
+description="grouping sets"
+
+expected="$test_dir/test_$test_number.0.expected"
+outfile="$test_dir/test_$test_number.0.actual"
+$bin -K Text-1,Text-2 -R -S Numeric-2 -A Numeric-1 \
+     "$test_dir/test.in" > "$outfile"
+if [ $? -ne 0 ] ||
+   [ "`diff -q $outfile $expected`" ]; then
+  test_status $test_number 1 "$description (rollup)" FAIL
+else
+  test_status $test_number 1 "$description (rollup)" PASS
+  rm "$outfile"
+fi
+
+expected="$test_dir/test_$test_number.1.expected"
+outfile="$test_dir/test_$test_number.1.actual"
+$bin -p -k 1,2 -g '2:1,2' -s 4 -o 4 -m 1 "$test_dir/test.in" > "$outfile"
+if [ $? -ne 0 ] ||
+   [ "`diff -q $outfile $expected`" ]; then
+  test_status $test_number 2 "$description (ordered sets)" FAIL
+else
+  test_status $test_number 2 "$description (ordered sets)" PASS
+  rm "$outfile"
+fi
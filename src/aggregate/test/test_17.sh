@@ -0,0 +1,34 @@
+test_number=17
+description="sorted input"
+
+expected="$test_dir/test_$test_number.0.expected"
+outfile="$test_dir/test_$test_number.0.actual"
+$bin -O -K Text-2 -S Numeric-2 -A Numeric-1 -N Numeric-2 \
+     "$test_dir/test.in" > "$outfile"
+if [ $? -ne 0 ] ||
+   [ "`diff -q $outfile $expected`" ]; then
+  test_status $test_number 1 "$description (streaming)" FAIL
+else
+  test_status $test_number 1 "$description (streaming)" PASS
+  rm "$outfile"
+fi
+
+expected="$test_dir/test_$test_number.1.expected"
+outfile="$test_dir/test_$test_number.1.actual"
+$bin -O -K Text-2 -S Numeric-2 -m 2 "$test_dir/test.in" > "$outfile"
+if [ $? -ne 0 ] ||
+   [ "`diff -q $outfile $expected`" ]; then
+  test_status $test_number 2 "$description (limit)" FAIL
+else
+  test_status $test_number 2 "$description (limit)" PASS
+  rm "$outfile"
+fi
+
+# the keys start over in the second file.
+$bin -O -K Text-2 -S Numeric-2 "$test_dir/test.in" "$test_dir/test.in2" \
+     > /dev/null 2>&1
+if [ $? -eq 0 ]; then
+  test_status $test_number 3 "$description (unsorted input)" FAIL
+else
+  test_status $test_number 3 "$description (unsorted input)" PASS
+fi
@@ -0,0 +1,46 @@
+test_number=18
+description="time buckets"
+
+expected="$test_dir/test_$test_number.0.expected"
+outfile="$test_dir/test_$test_number.0.actual"
+$bin -F Time -w 5m -i "%F %T" -K Host -S Bytes "$test_dir/test.in4" \
+     > "$outfile"
+if [ $? -ne 0 ] ||
+   [ "`diff -q $outfile $expected`" ]; then
+  test_status $test_number 1 "$description (labels)" FAIL
+else
+  test_status $test_number 1 "$description (labels)" PASS
+  rm "$outfile"
+fi
+
+expected="$test_dir/test_$test_number.1.expected"
+outfile="$test_dir/test_$test_number.1.actual"
+$bin -E -F Time -w 5m -i "%F %T" -K Host -S Bytes "$test_dir/test.in4" \
+     > "$outfile"
+if [ $? -ne 0 ] ||
+   [ "`diff -q $outfile $expected`" ]; then
+  test_status $test_number 2 "$description (time-ordered)" FAIL
+else
+  test_status $test_number 2 "$description (time-ordered)" PASS
+  rm "$outfile"
+fi
+
+expected="$test_dir/test_$test_number.2.expected"
+outfile="$test_dir/test_$test_number.2.actual"
+$bin -p -f 1 -w 1h -i "%F %T" -c 2 "$test_dir/test.in4" > "$outfile"
+if [ $? -ne 0 ] ||
+   [ "`diff -q $outfile $expected`" ]; then
+  test_status $test_number 3 "$description (no keys)" FAIL
+else
+  test_status $test_number 3 "$description (no keys)" PASS
+  rm "$outfile"
+fi
+
+# the times start over in the second file.
+$bin -E -p -f 1 -w 5m -i "%F %T" -k 2 -s 3 \
+     "$test_dir/test.in4" "$test_dir/test.in4" > /dev/null 2>&1
+if [ $? -eq 0 ]; then
+  test_status $test_number 4 "$description (unordered input)" FAIL
+else
+  test_status $test_number 4 "$description (unordered input)" PASS
+fi
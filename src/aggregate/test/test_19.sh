@@ -0,0 +1,31 @@
+test_number=19
+description="presized hash table"
+
+expected="$test_dir/test_01.expected"
+outfile="$test_dir/test_$test_number.0.actual"
+$bin -p -k 1,2 -s 3,4 -y 2 "$test_dir/test.in" > "$outfile"
+if [ $? -ne 0 ] ||
+   [ "`diff -q $outfile $expected`" ]; then
+  test_status $test_number 1 "$description (expected keys)" FAIL
+else
+  test_status $test_number 1 "$description (expected keys)" PASS
+  rm "$outfile"
+fi
+
+outfile="$test_dir/test_$test_number.1.actual"
+$bin -p -k 1,2 -s 3,4 -Y 1 "$test_dir/test.in" > "$outfile"
+if [ $? -ne 0 ] ||
+   [ "`diff -q $outfile $expected`" ]; then
+  test_status $test_number 2 "$description (sampled)" FAIL
+else
+  test_status $test_number 2 "$description (sampled)" PASS
+  rm "$outfile"
+fi
+
+$bin -p -k 1,2 -s 3,4 --expected-keys=-1 "$test_dir/test.in" \
+     > /dev/null 2>&1
+if [ $? -eq 0 ]; then
+  test_status $test_number 3 "$description (bad count)" FAIL
+else
+  test_status $test_number 3 "$description (bad count)" PASS
+fi
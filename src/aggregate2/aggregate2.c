@@ -13,12 +13,28 @@
    See the License for the specific language governing permissions and
    limitations under the License.
  ********************************/
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
 #include <err.h>  /* warn() */
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef HAVE_PTHREAD_H
+# include <pthread.h>
+#endif
 #include <crush/dbfr.h>
 #include <crush/ffutils.h>
 #include <crush/general.h>
+#include <crush/timefmt.h>
 #include "aggregate2_main.h"
 
+/* the format of --time-field when --time-format is not given; the same as
+   the input format of convdate. */
+#define AGG2_DEFAULT_TIME_FORMAT "%m-%d-%Y-%T"
+
+/* room for a formatted time bucket. */
+#define AGG2_BUCKET_BUF_SIZE 64
+
 struct agg_conf {
   int *key_fields;
   size_t key_fields_sz;
@@ -30,27 +46,115 @@ struct agg_conf {
   size_t sum_fields_sz;
   int nsums;
   int *sum_precisions;
-  /* averages not implemented in agg2 yet.
-  int *average_fields; 
+  int *average_fields;
   size_t average_fields_sz;
   int naverages;
   int *average_precisions;
-  */
+  int *min_fields;
+  size_t min_fields_sz;
+  int nmins;
+  int *max_fields;
+  size_t max_fields_sz;
+  int nmaxs;
+  int *time_field;        /**< the date field for --bucket. */
+  size_t time_field_sz;
+  int ntime_fields;
+  long bucket_width;      /**< --bucket width in seconds, or 0. */
+  timefmt_t time_format;  /**< format of the time field and the buckets. */
+  int nfields;    /**< number of leading fields to split from each line. */
+  int key_span;   /**< number of leading fields which must hold all keys. */
+};
+
+/* the aggregated values of the current group. */
+struct agg_group {
+  int *counts;
+  double *sums;
+  double *average_sums;
+  int *average_counts;
+  double *mins;
+  int *min_precisions;
+  char *mins_initialized;
+  double *maxs;
+  int *max_precisions;
+  char *maxs_initialized;
+};
+
+/* the time bucket of a line. */
+struct agg_bucket {
+  time_t start;
+  int valid;      /**< whether the line's time could be parsed. */
+};
+
+/* the key of the current group.  it is copied out of the line which starts
+   the group, so that following lines can be compared against it without
+   copying their keys. */
+struct agg_key {
+  char *buf;      /**< the bucket and key fields joined by the delimiter. */
+  size_t sz;      /**< size of buf. */
+  size_t *lens;   /**< length of each key field. */
+  size_t fields_offset;  /**< offset of the first key field in buf. */
+  struct agg_bucket bucket;
+  int initialized;
+};
+
+/* the state of an aggregation over a sequence of lines, which may come from
+   several input files. */
+struct agg_stream {
+  struct agg_conf *conf;
+  struct agg_group group;
+  struct agg_key key;
+  char **fields;        /**< views of the leading fields of the current line. */
+  size_t *field_lens;   /**< length of each field in fields. */
+  int fields_sz;        /**< number of elements in fields. */
+  const char *delim;
+  size_t delim_len;
+  FILE *out;
 };
 
 
 int configure_aggregation(struct agg_conf *conf, struct cmdargs *args,
                           const char *header, const char *delim);
 
-static void print_line(FILE * out,
-                       const char *keys,
-                       const char *delim,
-                       const int *counts,
-                       size_t ncounts,
-                       const double *sums, int nsums, int *sum_precisions);
+static int split_fields(char *line, const char *delim, size_t delim_len,
+                        int nfields, char **fields, size_t *lens);
+
+static void line_bucket(const struct agg_conf *conf, char **fields,
+                        int nfound, struct agg_bucket *bucket);
+
+static int same_key(const struct agg_key *key, const struct agg_conf *conf,
+                    char **fields, size_t *lens, size_t delim_len,
+                    const struct agg_bucket *bucket);
+
+static void retain_key(struct agg_key *key, const struct agg_conf *conf,
+                       char **fields, size_t *lens, const char *delim,
+                       const struct agg_bucket *bucket);
+
+static void alloc_group(struct agg_group *group, const struct agg_conf *conf);
 
-static int extract_keys(char *target, const char *source, const char *delim,
-                        int *keys, size_t nkeys, const char *suffix);
+static void reset_group(struct agg_group *group, const struct agg_conf *conf);
+
+static void free_group(struct agg_group *group);
+
+static void accumulate_fields(struct agg_group *group, struct agg_conf *conf,
+                              char **fields, int nfound);
+
+static void stream_init(struct agg_stream *st, struct agg_conf *conf,
+                        const char *delim, FILE *out);
+
+static int stream_lines(struct agg_stream *st, dbfr_t *reader, off_t limit);
+
+static void stream_finish(struct agg_stream *st);
+
+static int aggregate_threaded(struct cmdargs *args, const char *prog,
+                              const char *path, struct agg_conf *conf,
+                              off_t data_start, FILE *out);
+
+static int print_header(FILE *out, const char *header, const char *delim,
+                        struct cmdargs *args, const struct agg_conf *conf);
+
+static void print_line(FILE *out, const struct agg_key *key,
+                       const char *delim, const struct agg_conf *conf,
+                       const struct agg_group *group);
 
 static int float_precision(char *n);
 
@@ -71,34 +175,77 @@ int aggregate2(struct cmdargs *args, int argc, char *argv[], int optind) {
   dbfr_t *in_reader;
 
   struct agg_conf conf;
+  struct agg_stream stream;
 
-  int cur_precision;
+  char *threads_path = NULL;
+  off_t data_start = 0;
+  int retval;
 
-  char *cur_keys = NULL, *prev_keys = NULL;
-  int prev_keys_initialized = 0;
-  size_t keybuf_sz = 0;
-
-  int *cur_counts = NULL;
-  double *cur_sums = NULL;
-
-  char field_buf[64];
-  double f;                     /* numeric value of sum fields */
-  int i;                        /* counter */
+  if (! (args->keys || args->key_labels || args->bucket)) {
+    fprintf(stderr, "%s: either -k, -K, or --bucket must be specified.\n",
+            argv[0]);
+    return EXIT_HELP;
+  }
 
-  if (! (args->keys || args->key_labels)) {
-    fprintf(stderr, "%s: either -k or -K must be specified.\n", argv[0]);
+  if (args->bucket) {
+    timefmt_t format;
+    if (! args->time_field && ! args->time_label) {
+      fprintf(stderr, "%s: --bucket requires --time-field or --time-label.\n",
+              argv[0]);
+      return EXIT_HELP;
+    }
+    if (timefmt_duration(args->bucket) <= 0) {
+      fprintf(stderr, "%s: invalid --bucket width: %s\n", argv[0],
+              args->bucket);
+      return EXIT_HELP;
+    }
+    if (args->time_format) {
+      if (timefmt_compile(&format, args->time_format) != 0) {
+        fprintf(stderr, "%s: unsupported --time-format: %s\n", argv[0],
+                args->time_format);
+        return EXIT_HELP;
+      }
+      timefmt_destroy(&format);
+    }
+  } else if (args->time_field || args->time_label || args->time_format) {
+    fprintf(stderr, "%s: --time-field, --time-label, and --time-format "
+            "require --bucket.\n", argv[0]);
     return EXIT_HELP;
   }
 
   /* individually these args are not required. */
   if (!(args->sums || args->sum_labels) &&
-      !(args->counts || args->count_labels)) {
+      !(args->counts || args->count_labels) &&
+      !(args->averages || args->average_labels) &&
+      !(args->mins || args->min_labels) &&
+      !(args->maxs || args->max_labels)) {
     fprintf(stderr,
-            "%s: at least one of -s/-S and -c/-C must be specified.\n",
-            argv[0]);
+            "%s: at least one of -s/-S, -c/-C, -a/-A, -n/-N, and -x/-X "
+            "must be specified.\n", argv[0]);
     return EXIT_HELP;
   }
 
+  if (args->threads) {
+    struct stat st;
+    if (atoi(args->threads) < 1) {
+      fprintf(stderr, "%s: -T must be a positive integer.\n", argv[0]);
+      return EXIT_HELP;
+    }
+#ifndef HAVE_PTHREAD_H
+    fprintf(stderr, "%s was compiled without thread support.\n", argv[0]);
+    return EXIT_HELP;
+#endif
+    /* the input is split by byte offset, which needs a single file which
+       can be read from several places at once. */
+    if (argc - optind != 1 || str_eq(argv[optind], "-") ||
+        stat(argv[optind], &st) != 0 || ! S_ISREG(st.st_mode)) {
+      fprintf(stderr, "%s: -T requires a single regular input file.\n",
+              argv[0]);
+      return EXIT_HELP;
+    }
+    threads_path = argv[optind];
+  }
+
   if (!args->delim) {
     if ((args->delim = getenv("DELIMITER")) == NULL)
       args->delim = default_delim;
@@ -131,135 +278,445 @@ int aggregate2(struct cmdargs *args, int argc, char *argv[], int optind) {
     out = stdout;
   }
 
-  if (conf.ncounts > 0)
-    cur_counts = calloc(conf.ncounts, sizeof(int));
-
-  if (conf.nsums > 0)
-    cur_sums = calloc(conf.nsums, sizeof(double));
-
-  /* this can be resized later */
-  cur_keys = xmalloc(sizeof(char) * 1024);
-  prev_keys = xmalloc(sizeof(char) * 1024);
-  keybuf_sz = 1024;
-
   if (args->labels || args->auto_label)
     args->preserve_header = 1;
 
   if (args->preserve_header) {
-    if (dbfr_getline(in_reader) <= 0) {
+    if ((data_start = dbfr_getline(in_reader)) <= 0) {
       DIE("unexpected end of file");
     }
 
     chomp(in_reader->current_line);
-    if (extract_keys(cur_keys, in_reader->current_line, args->delim,
-                     conf.key_fields, conf.nkeys, NULL) != 0) {
+    if (print_header(out, in_reader->current_line, args->delim, args,
+                     &conf) != 0) {
       fprintf(stderr, "%s: malformatted input\n", argv[0]);
       return EXIT_FILE_ERR;
     }
-    fputs(cur_keys, out);
+  }
 
-    if (args->labels) {
-      fprintf(out, "%s%s", args->delim, args->labels);
-    } else {
-      if (conf.nsums > 0) {
-        if (extract_keys(cur_keys, in_reader->current_line, args->delim,
-                         conf.sum_fields, conf.nsums,
-                         args->auto_label ? "-Sum" : NULL) != 0) {
-          fprintf(stderr, "%s: malformatted input\n", argv[0]);
-          return EXIT_FILE_ERR;
-        }
-        fprintf(out, "%s%s", args->delim, cur_keys);
-      }
+  if (threads_path) {
+    dbfr_close(in_reader);
+    retval = aggregate_threaded(args, argv[0], threads_path, &conf,
+                                data_start, out);
+    if (out != stdout)
+      fclose(out);
+    return retval;
+  }
 
-      if (conf.ncounts > 0) {
-        if (extract_keys(cur_keys, in_reader->current_line, args->delim,
-                         conf.count_fields, conf.ncounts,
-                         args->auto_label ? "-Count" : NULL) != 0) {
-          fprintf(stderr, "%s: malformatted input\n", argv[0]);
-          return EXIT_FILE_ERR;
-        }
-        fprintf(out, "%s%s", args->delim, cur_keys);
+  stream_init(&stream, &conf, args->delim, out);
+
+  while (in) {
+    if (stream_lines(&stream, in_reader, -1) != 0) {
+      fprintf(stderr, "%s: malformatted input\n", argv[0]);
+      return EXIT_FILE_ERR;
+    }
+    dbfr_close(in_reader);
+    in = nextfile(argc, argv, &optind, "r");
+    if (in) {
+      in_reader = dbfr_init(in);
+      /* reconfigure fields (needed if labels were used) */
+      if (configure_aggregation(&conf, args, in_reader->next_line, args->delim)
+          != 0) {
+        fprintf(stderr, "%s: error parsing field arguments.\n", argv[0]);
+        return EXIT_HELP;
       }
+      if (args->preserve_header)
+        dbfr_getline(in_reader);
     }
-    fputs("\n", out);
   }
 
-  cur_keys[0] = '\0';
-  prev_keys[0] = '\0';
+  stream_finish(&stream);
 
-  while (in) {
-    while (dbfr_getline(in_reader) > 0) {
-      chomp(in_reader->current_line);
-      if (in_reader->current_line_sz > keybuf_sz) {
-        cur_keys = xrealloc(cur_keys, in_reader->current_line_sz);
-        prev_keys = xrealloc(prev_keys, in_reader->current_line_sz);
-        keybuf_sz = in_reader->current_line_sz;
-      }
+  return EXIT_OKAY;
+}
 
-      if (extract_keys(cur_keys, in_reader->current_line, args->delim,
-                       conf.key_fields, conf.nkeys, NULL) != 0) {
-        fprintf(stderr, "%s: malformatted input\n", argv[0]);
-        return EXIT_FILE_ERR;
-      }
+static void stream_init(struct agg_stream *st, struct agg_conf *conf,
+                        const char *delim, FILE *out) {
+  memset(st, 0, sizeof(struct agg_stream));
+  st->conf = conf;
+  st->delim = delim;
+  st->delim_len = strlen(delim);
+  st->out = out;
+  alloc_group(&(st->group), conf);
+  st->key.lens = xcalloc(conf->nkeys + 1, sizeof(size_t));
+}
 
-      if (prev_keys_initialized && !str_eq(cur_keys, prev_keys)) {
-        print_line(out, prev_keys, args->delim, cur_counts,
-                   conf.ncounts, cur_sums,
-                   conf.nsums, conf.sum_precisions);
+/** @brief aggregates lines from a reader, printing each group when the key
+  * changes.  the current group is kept open across calls, so that a group
+  * may continue into the next input file.
+  *
+  * @param st the aggregation state.
+  * @param reader the input.
+  * @param limit the number of bytes to read, or -1 to read to the end.
+  *
+  * @return 0 on success, or 1 if a line is missing a key field.
+  */
+static int stream_lines(struct agg_stream *st, dbfr_t *reader, off_t limit) {
+  struct agg_conf *conf = st->conf;
+  struct agg_bucket bucket;
+  off_t consumed = 0;
+  ssize_t len;
+  int nfound;
 
-        memset(cur_counts, 0, conf.ncounts * sizeof(int));
-        memset(cur_sums, 0, conf.nsums * sizeof(double));
-      }
+  if (conf->nfields > st->fields_sz) {
+    st->fields = xrealloc(st->fields, sizeof(char *) * conf->nfields);
+    st->field_lens = xrealloc(st->field_lens, sizeof(size_t) * conf->nfields);
+    st->fields_sz = conf->nfields;
+  }
+
+  while ((limit < 0 || consumed < limit) &&
+         (len = dbfr_getline(reader)) > 0) {
+    consumed += len;
+    chomp(reader->current_line);
+    nfound = split_fields(reader->current_line, st->delim, st->delim_len,
+                          conf->nfields, st->fields, st->field_lens);
+    if (nfound < conf->key_span)
+      return 1;
+    line_bucket(conf, st->fields, nfound, &bucket);
+
+    if (! st->key.initialized ||
+        ! same_key(&(st->key), conf, st->fields, st->field_lens,
+                   st->delim_len, &bucket)) {
+      if (st->key.initialized)
+        print_line(st->out, &(st->key), st->delim, conf, &(st->group));
+      reset_group(&(st->group), conf);
+      retain_key(&(st->key), conf, st->fields, st->field_lens, st->delim,
+                 &bucket);
+    }
+
+    accumulate_fields(&(st->group), conf, st->fields, nfound);
+  }
+  return 0;
+}
+
+/* prints the last group and releases the aggregation state. */
+static void stream_finish(struct agg_stream *st) {
+  if (st->key.initialized)
+    print_line(st->out, &(st->key), st->delim, st->conf, &(st->group));
+  free_group(&(st->group));
+  free(st->key.buf);
+  free(st->key.lens);
+  free(st->fields);
+  free(st->field_lens);
+}
+
+#ifdef HAVE_PTHREAD_H
+
+/* one worker of a multi-threaded aggregation. */
+struct agg_worker {
+  pthread_t thread;
+  const char *path;
+  off_t start;        /**< offset of the first line of the worker's range. */
+  off_t end;          /**< offset just past the last line of the range. */
+  struct agg_conf conf;  /**< a copy of the config with its own precisions. */
+  const char *delim;
+  FILE *out;          /**< temporary file holding the worker's output. */
+  int status;         /**< nonzero if the input was malformatted. */
+};
+
+/** @brief finds the start of the first group beginning at or after an
+  * offset, so that no group is split between two workers.
+  *
+  * @param path the input file.
+  * @param pos an offset in the file, past the header.
+  * @param conf the aggregation config.
+  * @param delim the field delimiter.
+  *
+  * @return the offset of the first line at or after pos whose key differs
+  *         from that of the line before it, or the end of the file.
+  */
+static off_t next_group_start(const char *path, off_t pos,
+                              const struct agg_conf *conf, const char *delim) {
+  FILE *in;
+  dbfr_t *reader;
+  struct agg_key key;
+  struct agg_bucket bucket;
+  char **fields;
+  size_t *lens, delim_len = strlen(delim);
+  ssize_t len;
+  int c, nfound;
 
-      for (i = 0; i < conf.ncounts; i++) {
-        get_line_field(field_buf, in_reader->current_line, 63,
-                       conf.count_fields[i], args->delim);
-        if (field_buf[0] != '\0') {
-          cur_counts[i]++;
-        }
+  if ((in = fopen(path, "r")) == NULL)
+    return -1;
+
+  /* move to the start of the line after the one holding pos - 1. */
+  fseeko(in, pos - 1, SEEK_SET);
+  pos--;
+  do {
+    c = getc(in);
+    pos++;
+  } while (c != EOF && c != '\n');
+
+  /* skip the rest of the group which the line belongs to. */
+  reader = dbfr_init(in);
+  memset(&key, 0, sizeof(key));
+  key.lens = xcalloc(conf->nkeys + 1, sizeof(size_t));
+  fields = xmalloc(sizeof(char *) * conf->nfields);
+  lens = xmalloc(sizeof(size_t) * conf->nfields);
+  while ((len = dbfr_getline(reader)) > 0) {
+    chomp(reader->current_line);
+    nfound = split_fields(reader->current_line, delim, delim_len,
+                          conf->nfields, fields, lens);
+    /* a malformatted line is reported by the worker which reads it. */
+    if (nfound < conf->key_span)
+      break;
+    line_bucket(conf, fields, nfound, &bucket);
+    if (! key.initialized)
+      retain_key(&key, conf, fields, lens, delim, &bucket);
+    else if (! same_key(&key, conf, fields, lens, delim_len, &bucket))
+      break;
+    pos += len;
+  }
+
+  dbfr_close(reader);
+  free(key.buf);
+  free(key.lens);
+  free(fields);
+  free(lens);
+  return pos;
+}
+
+/* records in the worker's config the largest precision of each sum and
+   average in its range, so that the workers after it can start from the
+   precisions a single pass would have reached. */
+static void *scan_range(void *arg) {
+  struct agg_worker *w = arg;
+  struct agg_conf *conf = &(w->conf);
+  dbfr_t *reader;
+  FILE *in;
+  char **fields;
+  size_t *lens, delim_len = strlen(w->delim);
+  off_t consumed = 0, limit = w->end - w->start;
+  ssize_t len;
+  int nfound, precision, i;
+
+  if (limit <= 0)
+    return NULL;
+  if ((in = fopen(w->path, "r")) == NULL ||
+      fseeko(in, w->start, SEEK_SET) != 0) {
+    if (in)
+      fclose(in);
+    w->status = 1;
+    return NULL;
+  }
+  reader = dbfr_init(in);
+  fields = xmalloc(sizeof(char *) * conf->nfields);
+  lens = xmalloc(sizeof(size_t) * conf->nfields);
+  while (consumed < limit && (len = dbfr_getline(reader)) > 0) {
+    consumed += len;
+    chomp(reader->current_line);
+    nfound = split_fields(reader->current_line, w->delim, delim_len,
+                          conf->nfields, fields, lens);
+    for (i = 0; i < conf->nsums; i++) {
+      if (conf->sum_fields[i] < nfound) {
+        precision = float_precision(fields[conf->sum_fields[i]]);
+        if (precision > conf->sum_precisions[i])
+          conf->sum_precisions[i] = precision;
       }
+    }
+    for (i = 0; i < conf->naverages; i++) {
+      if (conf->average_fields[i] < nfound) {
+        precision = float_precision(fields[conf->average_fields[i]]);
+        if (precision > conf->average_precisions[i])
+          conf->average_precisions[i] = precision;
+      }
+    }
+  }
+  dbfr_close(reader);
+  free(fields);
+  free(lens);
+  return NULL;
+}
 
-      for (i = 0; i < conf.nsums; i++) {
-        get_line_field(field_buf, in_reader->current_line, 63,
-                       conf.sum_fields[i], args->delim);
-        f = atof(field_buf);
-        cur_sums[i] += f;
+static void *aggregate_range(void *arg) {
+  struct agg_worker *w = arg;
+  struct agg_stream st;
+  dbfr_t *reader;
+  FILE *in;
 
-        cur_precision = float_precision(field_buf);
+  if (w->end <= w->start)
+    return NULL;
+  if ((in = fopen(w->path, "r")) == NULL ||
+      fseeko(in, w->start, SEEK_SET) != 0) {
+    if (in)
+      fclose(in);
+    w->status = 1;
+    return NULL;
+  }
+  reader = dbfr_init(in);
+  stream_init(&st, &(w->conf), w->delim, w->out);
+  w->status = stream_lines(&st, reader, w->end - w->start);
+  stream_finish(&st);
+  dbfr_close(reader);
+  return NULL;
+}
+
+/* runs a function on the first n workers, each in its own thread, and waits
+   for them all.  returns nonzero if a thread could not be started. */
+static int run_workers(struct agg_worker *workers, int n,
+                       void *(*run)(void *)) {
+  int i, started, retval = 0;
+
+  for (started = 0; started < n; started++) {
+    if (pthread_create(&(workers[started].thread), NULL, run,
+                       &(workers[started])) != 0) {
+      retval = 1;
+      break;
+    }
+  }
+  for (i = 0; i < started; i++)
+    pthread_join(workers[i].thread, NULL);
+  return retval;
+}
+
+/* releases the workers and their temporary files. */
+static void free_workers(struct agg_worker *workers, int nthreads) {
+  int i;
+
+  for (i = 0; i < nthreads; i++) {
+    if (workers[i].out)
+      fclose(workers[i].out);
+    free(workers[i].conf.sum_precisions);
+    free(workers[i].conf.average_precisions);
+  }
+  free(workers);
+}
+
+/** @brief aggregates a single regular file using several threads.  the
+  * data is divided into byte ranges, and each boundary is moved forward to
+  * the start of the next group.  each worker aggregates its range into a
+  * temporary file, and the outputs are concatenated in order.
+  *
+  * a single pass prints each group with the largest precisions seen so far,
+  * so the ranges are first scanned for their precisions, and each worker
+  * starts from those of the ranges before it.
+  *
+  * @param args contains the parsed cmd-line options & arguments.
+  * @param prog the program name, for error messages.
+  * @param path the input file.
+  * @param conf the aggregation config.
+  * @param data_start offset of the first line after any header.
+  * @param out the output stream.
+  *
+  * @return exit status for main() to return.
+  */
+static int aggregate_threaded(struct cmdargs *args, const char *prog,
+                              const char *path, struct agg_conf *conf,
+                              off_t data_start, FILE *out) {
+  struct agg_worker *workers;
+  struct stat st;
+  off_t size;
+  char buf[8192];
+  size_t n;
+  int *sum_seed = NULL, *average_seed = NULL;
+  int nthreads, i, j, scanned, retval = EXIT_OKAY;
 
-        if (cur_precision > conf.sum_precisions[i])
-          conf.sum_precisions[i] = cur_precision;
+  if (stat(path, &st) != 0) {
+    warn(path);
+    return EXIT_FILE_ERR;
+  }
+  size = st.st_size;
+  nthreads = atoi(args->threads);
+  workers = xcalloc(nthreads, sizeof(struct agg_worker));
+
+  for (i = 0; i < nthreads; i++) {
+    struct agg_worker *w = &(workers[i]);
+    w->path = path;
+    w->delim = args->delim;
+    w->conf = *conf;
+    w->conf.sum_precisions = xcalloc(conf->nsums + 1, sizeof(int));
+    w->conf.average_precisions = xcalloc(conf->naverages + 1, sizeof(int));
+
+    w->start = (i == 0) ? data_start : workers[i - 1].end;
+    if (i == nthreads - 1) {
+      w->end = size;
+    } else {
+      w->end = data_start + (size - data_start) / nthreads * (i + 1);
+      if (w->end <= w->start)
+        w->end = w->start;
+      else if ((w->end = next_group_start(path, w->end, conf,
+                                          args->delim)) < 0) {
+        warn(path);
+        free_workers(workers, nthreads);
+        return EXIT_FILE_ERR;
       }
+    }
 
-      strcpy(prev_keys, cur_keys);
-      prev_keys_initialized = 1;
+    if ((w->out = tmpfile()) == NULL) {
+      warn("tmpfile");
+      free_workers(workers, nthreads);
+      return EXIT_FILE_ERR;
     }
-    dbfr_close(in_reader);
-    in = nextfile(argc, argv, &optind, "r");
-    if (in) {
-      in_reader = dbfr_init(in);
-      /* reconfigure fields (needed if labels were used) */
-      if (configure_aggregation(&conf, args, in_reader->next_line, args->delim)
-          != 0) {
-        fprintf(stderr, "%s: error parsing field arguments.\n", argv[0]);
-        return EXIT_HELP;
+    if (args->verbose)
+      fprintf(stderr, "%s: thread %d: bytes %lld to %lld\n", prog, i,
+              (long long) w->start, (long long) w->end);
+  }
+
+  /* the last range's precisions are not needed by any other worker. */
+  if (conf->nsums + conf->naverages > 0) {
+    if (run_workers(workers, nthreads - 1, scan_range) != 0) {
+      fprintf(stderr, "%s: failed to start a thread.\n", prog);
+      free_workers(workers, nthreads);
+      return EXIT_HELP;
+    }
+    sum_seed = xcalloc(conf->nsums + 1, sizeof(int));
+    average_seed = xcalloc(conf->naverages + 1, sizeof(int));
+    if (conf->sum_precisions)
+      memcpy(sum_seed, conf->sum_precisions, sizeof(int) * conf->nsums);
+    if (conf->average_precisions)
+      memcpy(average_seed, conf->average_precisions,
+             sizeof(int) * conf->naverages);
+    for (i = 0; i < nthreads; i++) {
+      struct agg_conf *wc = &(workers[i].conf);
+      for (j = 0; j < conf->nsums; j++) {
+        scanned = wc->sum_precisions[j];
+        wc->sum_precisions[j] = sum_seed[j];
+        if (scanned > sum_seed[j])
+          sum_seed[j] = scanned;
+      }
+      for (j = 0; j < conf->naverages; j++) {
+        scanned = wc->average_precisions[j];
+        wc->average_precisions[j] = average_seed[j];
+        if (scanned > average_seed[j])
+          average_seed[j] = scanned;
       }
-      if (args->preserve_header)
-        dbfr_getline(in_reader);
     }
+    free(sum_seed);
+    free(average_seed);
   }
 
-  print_line(out, prev_keys, args->delim, cur_counts, conf.ncounts,
-             cur_sums, conf.nsums, conf.sum_precisions);
+  if (run_workers(workers, nthreads, aggregate_range) != 0) {
+    fprintf(stderr, "%s: failed to start a thread.\n", prog);
+    free_workers(workers, nthreads);
+    return EXIT_HELP;
+  }
 
-  free(cur_counts);
-  free(cur_sums);
-  free(cur_keys);
-  free(prev_keys);
+  for (i = 0; i < nthreads; i++) {
+    struct agg_worker *w = &(workers[i]);
+    if (w->status != 0 && retval == EXIT_OKAY) {
+      fprintf(stderr, "%s: malformatted input\n", prog);
+      retval = EXIT_FILE_ERR;
+    }
+    if (retval == EXIT_OKAY) {
+      rewind(w->out);
+      while ((n = fread(buf, 1, sizeof(buf), w->out)) > 0)
+        fwrite(buf, 1, n, out);
+    }
+  }
+  free_workers(workers, nthreads);
+  return retval;
+}
 
-  return EXIT_OKAY;
+#else
+
+static int aggregate_threaded(struct cmdargs *args, const char *prog,
+                              const char *path, struct agg_conf *conf,
+                              off_t data_start, FILE *out) {
+  return EXIT_HELP;
 }
 
+#endif /* HAVE_PTHREAD_H */
+
 static void decrement_values(int *array, size_t sz) {
   int j;
   if (array == NULL || sz == 0)
@@ -269,114 +726,407 @@ static void decrement_values(int *array, size_t sz) {
   }
 }
 
-int configure_aggregation(struct agg_conf *conf, struct cmdargs *args,
-                          const char *header, const char *delim) {
-  if (args->keys) {
-    conf->nkeys = expand_nums(args->keys, &(conf->key_fields),
-                              &(conf->key_fields_sz));
-  } else if (args->key_labels) {
-    conf->nkeys = expand_label_list(args->key_labels, header,
-                                    delim, &(conf->key_fields),
-                                    &(conf->key_fields_sz));
+/* expands the index or label list for one kind of field into 0-based
+   indexes.  returns the number of fields, or a negative value on error. */
+static int configure_fields(char *indexes, const char *labels,
+                            const char *header, const char *delim,
+                            struct cmdargs *args, int **fields,
+                            size_t *fields_sz) {
+  int n = 0;
+  if (indexes) {
+    n = expand_nums(indexes, fields, fields_sz);
+  } else if (labels) {
+    n = expand_label_list(labels, header, delim, fields, fields_sz);
     args->preserve_header = 1;
   }
+  if (n > 0)
+    decrement_values(*fields, n);
+  return n;
+}
+
+/* widens the range of fields which must be split from each line to include
+   the given fields. */
+static void update_field_span(int *span, const int *fields, int n) {
+  int i;
+  for (i = 0; i < n; i++) {
+    if (fields[i] + 1 > *span)
+      *span = fields[i] + 1;
+  }
+}
+
+int configure_aggregation(struct agg_conf *conf, struct cmdargs *args,
+                          const char *header, const char *delim) {
+  conf->nkeys = configure_fields(args->keys, args->key_labels, header, delim,
+                                 args, &(conf->key_fields),
+                                 &(conf->key_fields_sz));
   if (conf->nkeys < 0)
     return conf->nkeys;
-  decrement_values(conf->key_fields, conf->nkeys);
-
-  if (args->sums) {
-    conf->nsums = expand_nums(args->sums, &(conf->sum_fields),
-                              &(conf->sum_fields_sz));
-  } else if (args->sum_labels) {
-    conf->nsums = expand_label_list(args->sum_labels, header,
-                                    delim, &(conf->sum_fields),
-                                    &(conf->sum_fields_sz));
-    args->preserve_header = 1;
-  }
-  if (conf->nsums < 0) {
+
+  conf->nsums = configure_fields(args->sums, args->sum_labels, header, delim,
+                                 args, &(conf->sum_fields),
+                                 &(conf->sum_fields_sz));
+  if (conf->nsums < 0)
     return conf->nsums;
-  } else if (conf->nsums > 0) {
-    decrement_values(conf->sum_fields, conf->nsums);
-    conf->sum_precisions = xmalloc(sizeof(int) * conf->nsums);
-    memset(conf->sum_precisions, 0, sizeof(int) * conf->nsums);
-  }
-
-  if (args->counts) {
-    conf->ncounts = expand_nums(args->counts, &(conf->count_fields),
-                                &(conf->count_fields_sz));
-  } else if (args->count_labels) {
-    conf->ncounts = expand_label_list(args->count_labels, header,
-                                      delim, &(conf->count_fields),
-                                      &(conf->count_fields_sz));
-    args->preserve_header = 1;
-  }
+
+  conf->ncounts = configure_fields(args->counts, args->count_labels, header,
+                                   delim, args, &(conf->count_fields),
+                                   &(conf->count_fields_sz));
   if (conf->ncounts < 0)
     return conf->ncounts;
-  else if (conf->ncounts > 0)
-    decrement_values(conf->count_fields, conf->ncounts);
-/*
-  if (args->averages) {
-    conf->naverages = expand_nums(args->averages, &(conf->average_fields),
-                                  &(conf->average_fields_sz));
-  } else if (args->average_labels) {
-    conf->naverages = expand_label_list(args->average_labels, header,
-                                        delim, &(conf->average_fields),
-                                        &(conf->average_fields_sz));
-    args->preserve_header = 1;
-  }
-  if (conf->naverages < 0) {
+
+  conf->naverages = configure_fields(args->averages, args->average_labels,
+                                     header, delim, args,
+                                     &(conf->average_fields),
+                                     &(conf->average_fields_sz));
+  if (conf->naverages < 0)
     return conf->naverages;
-  } else if (conf->naverages > 0) {
-    decrement_values(conf->average_fields, conf->naverages);
-    conf->average_precisions = xmalloc(sizeof(int) * conf->naverages);
-    memset(conf->average_precisions, 0, sizeof(int) * conf->naverages);
+
+  conf->nmins = configure_fields(args->mins, args->min_labels, header, delim,
+                                 args, &(conf->min_fields),
+                                 &(conf->min_fields_sz));
+  if (conf->nmins < 0)
+    return conf->nmins;
+
+  conf->nmaxs = configure_fields(args->maxs, args->max_labels, header, delim,
+                                 args, &(conf->max_fields),
+                                 &(conf->max_fields_sz));
+  if (conf->nmaxs < 0)
+    return conf->nmaxs;
+
+  conf->ntime_fields = configure_fields(args->time_field, args->time_label,
+                                        header, delim, args,
+                                        &(conf->time_field),
+                                        &(conf->time_field_sz));
+  if (conf->ntime_fields < 0 || conf->ntime_fields > 1)
+    return -1;
+  if (conf->ntime_fields == 1 && ! conf->bucket_width) {
+    conf->bucket_width = timefmt_duration(args->bucket);
+    if (conf->bucket_width <= 0 ||
+        timefmt_compile(&(conf->time_format),
+                        args->time_format ? args->time_format
+                                          : AGG2_DEFAULT_TIME_FORMAT) != 0)
+      return -1;
   }
-*/
+
+  /* precisions are kept across input files. */
+  if (conf->nsums > 0 && ! conf->sum_precisions)
+    conf->sum_precisions = xcalloc(conf->nsums, sizeof(int));
+  if (conf->naverages > 0 && ! conf->average_precisions)
+    conf->average_precisions = xcalloc(conf->naverages, sizeof(int));
+
+  conf->key_span = 0;
+  update_field_span(&(conf->key_span), conf->key_fields, conf->nkeys);
+  conf->nfields = conf->key_span;
+  update_field_span(&(conf->nfields), conf->sum_fields, conf->nsums);
+  update_field_span(&(conf->nfields), conf->count_fields, conf->ncounts);
+  update_field_span(&(conf->nfields), conf->average_fields, conf->naverages);
+  update_field_span(&(conf->nfields), conf->min_fields, conf->nmins);
+  update_field_span(&(conf->nfields), conf->max_fields, conf->nmaxs);
+  update_field_span(&(conf->nfields), conf->time_field, conf->ntime_fields);
   return 0;
 }
 
-/* assumption: target is at least as big as source, so it cannot be
-   overflowed.
-   TODO(jhinds): this is faulty if the same field is specified multiple times;
-   and when auto_labeling, the suffix might cause an overflow.
- */
-static int extract_keys(char *target, const char *source, const char *delim,
-                        int *keys, size_t nkeys, const char *suffix) {
+/** @brief splits the leading fields of a line in place, replacing each
+  * delimiter with a null character.
+  *
+  * @param line the line to be split; it is modified.
+  * @param delim the field delimiter.
+  * @param delim_len the length of delim.
+  * @param nfields the number of leading fields needed.
+  * @param fields receives a pointer to the start of each field.
+  * @param lens receives the length of each field.
+  *
+  * @return the number of fields found, which is less than nfields if the
+  *         line is short.
+  */
+static int split_fields(char *line, const char *delim, size_t delim_len,
+                        int nfields, char **fields, size_t *lens) {
+  char *p = line, *end;
+  int i;
+
+  for (i = 0; i < nfields; i++) {
+    fields[i] = p;
+    if (delim_len == 1)
+      end = strchr(p, delim[0]);
+    else
+      end = strstr(p, delim);
+    if (end == NULL) {
+      lens[i] = strlen(p);
+      return i + 1;
+    }
+    lens[i] = end - p;
+    *end = '\0';
+    p = end + delim_len;
+  }
+  return nfields;
+}
+
+/* finds the start of a line's time bucket for --bucket. */
+static void line_bucket(const struct agg_conf *conf, char **fields,
+                        int nfound, struct agg_bucket *bucket) {
+  bucket->valid = 0;
+  if (! conf->bucket_width || conf->time_field[0] >= nfound ||
+      timefmt_parse(&(conf->time_format), fields[conf->time_field[0]],
+                    &(bucket->start)) != 0)
+    return;
+  bucket->start = timefmt_floor(bucket->start, conf->bucket_width);
+  bucket->valid = 1;
+}
+
+/* whether the bucket and key fields of a line match the key of the current
+   group. */
+static int same_key(const struct agg_key *key, const struct agg_conf *conf,
+                    char **fields, size_t *lens, size_t delim_len,
+                    const struct agg_bucket *bucket) {
+  const char *p = key->buf + key->fields_offset;
+  int i, f;
+
+  if (bucket->valid != key->bucket.valid ||
+      (bucket->valid && bucket->start != key->bucket.start))
+    return 0;
+
+  for (i = 0; i < conf->nkeys; i++) {
+    f = conf->key_fields[i];
+    if (lens[f] != key->lens[i] || memcmp(fields[f], p, lens[f]) != 0)
+      return 0;
+    p += lens[f] + delim_len;
+  }
+  return 1;
+}
+
+/* copies the bucket and key fields of the line which starts a new group.
+   a line whose time cannot be parsed gets an empty bucket. */
+static void retain_key(struct agg_key *key, const struct agg_conf *conf,
+                       char **fields, size_t *lens, const char *delim,
+                       const struct agg_bucket *bucket) {
+  size_t delim_len = strlen(delim), len = 0, bucket_len = 0;
+  char bucket_buf[AGG2_BUCKET_BUF_SIZE];
+  char *p;
+  int i;
+
+  if (bucket->valid)
+    bucket_len = timefmt_format(&(conf->time_format), bucket->start,
+                                bucket_buf, AGG2_BUCKET_BUF_SIZE);
+  len = bucket_len + delim_len;
+  for (i = 0; i < conf->nkeys; i++)
+    len += lens[conf->key_fields[i]] + delim_len;
+  if (len + 1 > key->sz) {
+    key->sz = len + 1;
+    key->buf = xrealloc(key->buf, key->sz);
+  }
+
+  p = key->buf;
+  if (conf->bucket_width) {
+    memcpy(p, bucket_buf, bucket_len);
+    p += bucket_len;
+    if (conf->nkeys) {
+      memcpy(p, delim, delim_len);
+      p += delim_len;
+    }
+  }
+  key->fields_offset = p - key->buf;
+  key->bucket = *bucket;
+  for (i = 0; i < conf->nkeys; i++) {
+    if (i > 0) {
+      memcpy(p, delim, delim_len);
+      p += delim_len;
+    }
+    key->lens[i] = lens[conf->key_fields[i]];
+    memcpy(p, fields[conf->key_fields[i]], key->lens[i]);
+    p += key->lens[i];
+  }
+  *p = '\0';
+  key->initialized = 1;
+}
+
+static void alloc_group(struct agg_group *group, const struct agg_conf *conf) {
+  group->counts = xcalloc(conf->ncounts + 1, sizeof(int));
+  group->sums = xcalloc(conf->nsums + 1, sizeof(double));
+  group->average_sums = xcalloc(conf->naverages + 1, sizeof(double));
+  group->average_counts = xcalloc(conf->naverages + 1, sizeof(int));
+  group->mins = xcalloc(conf->nmins + 1, sizeof(double));
+  group->min_precisions = xcalloc(conf->nmins + 1, sizeof(int));
+  group->mins_initialized = xcalloc(conf->nmins + 1, sizeof(char));
+  group->maxs = xcalloc(conf->nmaxs + 1, sizeof(double));
+  group->max_precisions = xcalloc(conf->nmaxs + 1, sizeof(int));
+  group->maxs_initialized = xcalloc(conf->nmaxs + 1, sizeof(char));
+}
+
+static void reset_group(struct agg_group *group, const struct agg_conf *conf) {
+  memset(group->counts, 0, conf->ncounts * sizeof(int));
+  memset(group->sums, 0, conf->nsums * sizeof(double));
+  memset(group->average_sums, 0, conf->naverages * sizeof(double));
+  memset(group->average_counts, 0, conf->naverages * sizeof(int));
+  memset(group->mins_initialized, 0, conf->nmins * sizeof(char));
+  memset(group->maxs_initialized, 0, conf->nmaxs * sizeof(char));
+}
+
+static void free_group(struct agg_group *group) {
+  free(group->counts);
+  free(group->sums);
+  free(group->average_sums);
+  free(group->average_counts);
+  free(group->mins);
+  free(group->min_precisions);
+  free(group->mins_initialized);
+  free(group->maxs);
+  free(group->max_precisions);
+  free(group->maxs_initialized);
+}
+
+/* adds the fields of a line to the current group.  fields past the end of a
+   short line are treated as empty. */
+static void accumulate_fields(struct agg_group *group, struct agg_conf *conf,
+                              char **fields, int nfound) {
+  char empty[] = "";
+  char *field, *end;
+  double f;
+  int i, cur_precision;
+
+  for (i = 0; i < conf->ncounts; i++) {
+    field = conf->count_fields[i] < nfound ? fields[conf->count_fields[i]]
+                                           : empty;
+    if (field[0] != '\0')
+      group->counts[i]++;
+  }
+
+  for (i = 0; i < conf->nsums; i++) {
+    field = conf->sum_fields[i] < nfound ? fields[conf->sum_fields[i]] : empty;
+    group->sums[i] += atof(field);
+    cur_precision = float_precision(field);
+    if (cur_precision > conf->sum_precisions[i])
+      conf->sum_precisions[i] = cur_precision;
+  }
+
+  for (i = 0; i < conf->naverages; i++) {
+    field = conf->average_fields[i] < nfound ?
+              fields[conf->average_fields[i]] : empty;
+    if (field[0] == '\0')
+      continue;
+    group->average_sums[i] += atof(field);
+    group->average_counts[i]++;
+    cur_precision = float_precision(field);
+    if (cur_precision > conf->average_precisions[i])
+      conf->average_precisions[i] = cur_precision;
+  }
+
+  /* mins & maxs are output with the precision of the chosen value. */
+  for (i = 0; i < conf->nmins; i++) {
+    field = conf->min_fields[i] < nfound ? fields[conf->min_fields[i]] : empty;
+    f = strtod(field, &end);
+    if (end == field)
+      continue;
+    if (! group->mins_initialized[i] || f < group->mins[i]) {
+      group->mins[i] = f;
+      group->min_precisions[i] = float_precision(field);
+      group->mins_initialized[i] = 1;
+    }
+  }
+
+  for (i = 0; i < conf->nmaxs; i++) {
+    field = conf->max_fields[i] < nfound ? fields[conf->max_fields[i]] : empty;
+    f = strtod(field, &end);
+    if (end == field)
+      continue;
+    if (! group->maxs_initialized[i] || f > group->maxs[i]) {
+      group->maxs[i] = f;
+      group->max_precisions[i] = float_precision(field);
+      group->maxs_initialized[i] = 1;
+    }
+  }
+}
+
+/* prints the given fields of the header, each preceded by the delimiter
+   and followed by the suffix.  returns nonzero if a field is missing. */
+static int print_header_fields(FILE *out, const char *header,
+                               const char *delim, const int *fields, int n,
+                               const char *suffix) {
   int i, s, e; /* iter, start, end */
   int field_len;
 
-  target[0] = '\0';
-  for (i = 0; i < nkeys; i++) {
-  	field_len = get_line_pos(source, keys[i], delim, &s, &e);
+  for (i = 0; i < n; i++) {
+    field_len = get_line_pos(header, fields[i], delim, &s, &e);
     if (field_len < 0)
       return 1;
-    if (field_len > 0)
-      strncat(target, source + s, e - s + 1);
-    if (suffix)
-      strcat(target, suffix);
-    if (i != nkeys - 1)
-      strcat(target, delim);
+    fprintf(out, "%s%.*s%s", delim, field_len > 0 ? e - s + 1 : 0,
+            header + s, suffix ? suffix : "");
   }
   return 0;
 }
 
+static int print_header(FILE *out, const char *header, const char *delim,
+                        struct cmdargs *args, const struct agg_conf *conf) {
+  int i, s, e, field_len, n = 0;
 
+  /* the bucket is labelled by the time field. */
+  for (i = 0; i < conf->ntime_fields + conf->nkeys; i++) {
+    int f = i < conf->ntime_fields ? conf->time_field[i]
+                                   : conf->key_fields[i - conf->ntime_fields];
+    field_len = get_line_pos(header, f, delim, &s, &e);
+    if (field_len < 0)
+      return 1;
+    fprintf(out, "%s%.*s", n++ > 0 ? delim : "",
+            field_len > 0 ? e - s + 1 : 0, header + s);
+  }
+
+  if (args->labels) {
+    fprintf(out, "%s%s", delim, args->labels);
+  } else if (print_header_fields(out, header, delim, conf->sum_fields,
+                                 conf->nsums,
+                                 args->auto_label ? "-Sum" : NULL) ||
+             print_header_fields(out, header, delim, conf->count_fields,
+                                 conf->ncounts,
+                                 args->auto_label ? "-Count" : NULL) ||
+             print_header_fields(out, header, delim, conf->average_fields,
+                                 conf->naverages,
+                                 args->auto_label ? "-Average" : NULL) ||
+             print_header_fields(out, header, delim, conf->min_fields,
+                                 conf->nmins,
+                                 args->auto_label ? "-Min" : NULL) ||
+             print_header_fields(out, header, delim, conf->max_fields,
+                                 conf->nmaxs,
+                                 args->auto_label ? "-Max" : NULL)) {
+    return 1;
+  }
+  fputs("\n", out);
+  return 0;
+}
 
-static void print_line(FILE * out,
-                       const char *keys,
-                       const char *delim,
-                       const int *counts,
-                       size_t ncounts,
-                       const double *sums, int nsums, int *sum_precisions) {
+
+static void print_line(FILE *out, const struct agg_key *key,
+                       const char *delim, const struct agg_conf *conf,
+                       const struct agg_group *group) {
   int i;
-  fputs(keys, out);
+  fputs(key->buf, out);
+
+  for (i = 0; i < conf->nsums; i++) {
+    fprintf(out, "%s%.*f", delim, conf->sum_precisions[i], group->sums[i]);
+  }
+
+  for (i = 0; i < conf->ncounts; i++) {
+    fprintf(out, "%s%d", delim, group->counts[i]);
+  }
+
+  for (i = 0; i < conf->naverages; i++) {
+    if (group->average_counts[i])
+      fprintf(out, "%s%.*f", delim, conf->average_precisions[i] + 2,
+              group->average_sums[i] / group->average_counts[i]);
+    else
+      fputs(delim, out);
+  }
 
-  for (i = 0; i < nsums; i++) {
-    fprintf(out, "%s%.*f", delim, sum_precisions[i], sums[i]);
+  for (i = 0; i < conf->nmins; i++) {
+    if (group->mins_initialized[i])
+      fprintf(out, "%s%.*f", delim, group->min_precisions[i], group->mins[i]);
+    else
+      fputs(delim, out);
   }
 
-  for (i = 0; i < ncounts; i++) {
-    fprintf(out, "%s%d", delim, counts[i]);
+  for (i = 0; i < conf->nmaxs; i++) {
+    if (group->maxs_initialized[i])
+      fprintf(out, "%s%.*f", delim, group->max_precisions[i], group->maxs[i]);
+    else
+      fputs(delim, out);
   }
 
   fputs("\n", out);
@@ -0,0 +1,26 @@
+test_number=09
+description="auto-labels for averages, mins, and maxs"
+
+outfile="$test_dir/test_$test_number.actual"
+expected="$test_dir/test_$test_number.expected"
+
+subtest=1
+$bin -k 1 -a 5 -n 5 -x 5 -L "$test_dir/test.in" > "$outfile"
+if [ $? -ne 0 ] ||
+   [ "`diff -q $outfile $expected`" ]; then
+  test_status $test_number $subtest "$description (indexes)" FAIL
+else
+  test_status $test_number $subtest "$description (indexes)" PASS
+  rm "$outfile"
+fi
+
+subtest=2
+$bin -K Text-1 -A Numeric-3 -N Numeric-3 -X Numeric-3 -L \
+  "$test_dir/test.in" > "$outfile"
+if [ $? -ne 0 ] ||
+   [ "`diff -q $outfile $expected`" ]; then
+  test_status $test_number $subtest "$description (labels)" FAIL
+else
+  test_status $test_number $subtest "$description (labels)" PASS
+  rm "$outfile"
+fi
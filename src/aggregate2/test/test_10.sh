@@ -0,0 +1,49 @@
+test_number=10
+description="multi-threaded aggregation"
+
+infile=$test_dir/test.in
+outfile=$test_dir/test_$test_number.out
+expected=$test_dir/test_01.expected
+
+subtest=1
+$bin -T 3 -p -k 1,2 -s 3,4 $infile > $outfile
+if [ $? -ne 0 ] ||
+   [ "`diff -q $outfile $expected`" ]; then
+  test_status $test_number $subtest "$description (indexes)" FAIL
+else
+  test_status $test_number $subtest "$description (indexes)" PASS
+  rm "$outfile"
+fi
+
+subtest=2
+$bin -T 8 -K Text-1,Text-2 -S Numeric-1,Numeric-2 $infile > $outfile
+if [ $? -ne 0 ] ||
+   [ "`diff -q $outfile $expected`" ]; then
+  test_status $test_number $subtest "$description (labels)" FAIL
+else
+  test_status $test_number $subtest "$description (labels)" PASS
+  rm "$outfile"
+fi
+
+subtest=3
+cat $infile | $bin -T 2 -p -k 1 -s 3 > $outfile 2> /dev/null
+if [ $? -eq 0 ]; then
+  test_status $test_number $subtest "$description (rejects stdin)" FAIL
+else
+  test_status $test_number $subtest "$description (rejects stdin)" PASS
+  rm "$outfile"
+fi
+
+# groups are printed with the precisions a single pass would have reached.
+subtest=4
+infile=$test_dir/test.in4
+expected=$test_dir/test_$test_number.single.out
+$bin -p -K k -S v -A v $infile > $expected
+$bin -T 4 -p -K k -S v -A v $infile > $outfile
+if [ $? -ne 0 ] ||
+   [ "`diff -q $outfile $expected`" ]; then
+  test_status $test_number $subtest "$description (precisions)" FAIL
+else
+  test_status $test_number $subtest "$description (precisions)" PASS
+  rm "$outfile" "$expected"
+fi
@@ -0,0 +1,39 @@
+test_number=11
+description="time buckets"
+
+infile=$test_dir/test.in3
+outfile=$test_dir/test_$test_number.out
+
+subtest=1
+expected=$test_dir/test_$test_number.0.expected
+$bin -F Time -w 5m -i "%F %T" -K Host -S Bytes -A Bytes $infile > $outfile
+if [ $? -ne 0 ] ||
+   [ "`diff -q $outfile $expected`" ]; then
+  test_status $test_number $subtest "$description (labels)" FAIL
+else
+  test_status $test_number $subtest "$description (labels)" PASS
+  rm "$outfile"
+fi
+
+subtest=2
+expected=$test_dir/test_$test_number.1.expected
+$bin -p -f 1 -w 1h -i "%F %T" -c 2 $infile > $outfile
+if [ $? -ne 0 ] ||
+   [ "`diff -q $outfile $expected`" ]; then
+  test_status $test_number $subtest "$description (no keys)" FAIL
+else
+  test_status $test_number $subtest "$description (no keys)" PASS
+  rm "$outfile"
+fi
+
+subtest=3
+expected=$test_dir/test_$test_number.0.expected
+$bin -T 3 -F Time -w 5m -i "%F %T" -K Host -S Bytes -A Bytes $infile \
+  > $outfile
+if [ $? -ne 0 ] ||
+   [ "`diff -q $outfile $expected`" ]; then
+  test_status $test_number $subtest "$description (threads)" FAIL
+else
+  test_status $test_number $subtest "$description (threads)" PASS
+  rm "$outfile"
+fi
@@ -17,6 +17,8 @@
 #include "deltaforce_main.h"
 #include "deltaforce.h"
 
+#include <crush/hashtbl.h>
+
 #ifndef HAVE_OPEN64
 # define open64 open
 #endif
@@ -139,7 +141,10 @@ int deltaforce(struct cmdargs *args, int argc, char *argv[], int optind) {
   setlocale(LC_ALL, "");
   setlocale(LC_COLLATE, "");
 
-  retval = merge_files(left_reader, right_reader, out, args);
+  if (args->hash_delta)
+    retval = hash_delta(left_reader, right_reader, out, args);
+  else
+    retval = merge_files(left_reader, right_reader, out, args);
 
   fclose(left);
   fclose(right);
@@ -154,14 +159,15 @@ int merge_files(dbfr_t *left_reader, dbfr_t *right_reader, FILE * out,
 
   int retval = EXIT_OKAY;
 
-  char field_right[MAX_FIELD_LEN + 1];  /* buffer for holding field values */
-
-  int i;                        /* general-purpose counter */
-
   /** @todo take into account that files a & b might have the same fields in
 	  * a different order.
 	  */
   int keycmp = 0;
+  collkey_cache_t left_keys, right_keys;
+
+  /* each line's key is built once, as it is read. */
+  collkey_cache_init(&left_keys, left_reader, keyfields, nkeys, delim);
+  collkey_cache_init(&right_keys, right_reader, keyfields, nkeys, delim);
 
   /* assume that if there is a header line, it exists
      in both files. */
@@ -171,7 +177,7 @@ int merge_files(dbfr_t *left_reader, dbfr_t *right_reader, FILE * out,
     if (left_reader->current_line == NULL ||
         left_reader->current_line[0] == '\0') {
       /* get a line from the full set */
-      if (dbfr_getline(left_reader) <= 0) {
+      if (collkey_getline(&left_keys, left_reader) <= 0) {
         free(left_reader->current_line);
         left_reader->current_line = NULL;
         break;
@@ -190,15 +196,14 @@ int merge_files(dbfr_t *left_reader, dbfr_t *right_reader, FILE * out,
       }
 
       /* get a line from the delta set */
-      if (dbfr_getline(right_reader) <= 0) {
+      if (collkey_getline(&right_keys, right_reader) <= 0) {
         free(right_reader->current_line);
         right_reader->current_line = NULL;
         continue;
       }
     }
 
-    keycmp = compare_keys(left_reader->current_line,
-                          right_reader->current_line);
+    keycmp = compare_keys(&left_keys.current, &right_keys.current);
 
     switch (keycmp) {
         /* keys equal - print the delta line and scan
@@ -237,6 +242,8 @@ int merge_files(dbfr_t *left_reader, dbfr_t *right_reader, FILE * out,
       Fputs(right_reader->current_line, out);
   }
 
+  collkey_cache_destroy(&left_keys);
+  collkey_cache_destroy(&right_keys);
   if (keyfields)
     free(keyfields);
 
@@ -244,41 +251,155 @@ int merge_files(dbfr_t *left_reader, dbfr_t *right_reader, FILE * out,
 }
 
 
-int compare_keys(char *buffer_left, char *buffer_right) {
-  int keycmp = 0;
-  int i;
-  char field_left[MAX_FIELD_LEN + 1];
-  char field_right[MAX_FIELD_LEN + 1];
+int compare_keys(const collkey_t *key_left, const collkey_t *key_right) {
+  int keycmp = collkey_cmp(key_left, key_right);
 
-  // printf("inside compare_keys([%s], [%s])\n", buffer_left, buffer_right);
-  if (buffer_left == NULL && buffer_right == NULL) {
-    return LEFT_RIGHT_EQUAL;
-  }
+  /* ensure predictable return values */
+  if (keycmp == 0)
+    return 0;
+  if (keycmp < 0)
+    return -1;
+  return 1;
+}
+
+
+/* a line of the delta, which is kept until the full set has been read. */
+struct delta_row {
+  char *line;
+  struct delta_key *key;
+  struct delta_row *next;       /* the next row with the same key */
+};
 
-  /* these special cases may seem counter-intuitive, but saying that
-     a NULL line is greater than a non-NULL line results in
-     the non-NULL line getting printed and a new line read in.
-   */
-  if (buffer_left == NULL)
-    return LEFT_GREATER;
+/* the rows of the delta which share a key. */
+struct delta_key {
+  struct delta_row *first, *last;
+  int replaced;                 /* whether the rows have been printed */
+};
 
-  if (buffer_right == NULL)
-    return RIGHT_GREATER;
+
+/* copies the key fields of a line into a buffer, separated by delim. */
+static void line_key(const char *line, char **buf, size_t *buf_sz) {
+  size_t len = 0, delim_len = strlen(delim), need;
+  int start, end, field_len, i;
 
   for (i = 0; i < nkeys; i++) {
-    get_line_field(field_left, buffer_left, MAX_FIELD_LEN, keyfields[i], delim);
-    get_line_field(field_right, buffer_right, MAX_FIELD_LEN, keyfields[i],
-                   delim);
-    /* printf("Comparing (%s) to (%s) inside compare_keys\n", field_left, field_right); */
-    if ((keycmp = strcoll(field_left, field_right)) != 0)
-      break;
+    field_len = get_line_pos(line, keyfields[i], delim, &start, &end);
+    if (field_len < 0)
+      field_len = 0;
+    need = len + field_len + delim_len + 1;
+    if (need > *buf_sz) {
+      *buf_sz = need * 2;
+      *buf = xrealloc(*buf, *buf_sz);
+    }
+    if (i > 0) {
+      memcpy(*buf + len, delim, delim_len);
+      len += delim_len;
+    }
+    memcpy(*buf + len, line + start, field_len);
+    len += field_len;
   }
+  (*buf)[len] = '\0';
+}
 
-  /* ensure predictable return values */
-  if (keycmp == 0)
-    return 0;
-  if (keycmp < 0)
-    return -1;
-  if (keycmp > 0)
-    return 1;
+
+/* prints a line, ending it with a newline if it has none. */
+static int put_line(const char *line, FILE *out) {
+  Fputs(line, out);
+  if (line[0] == '\0' || line[strlen(line) - 1] != '\n')
+    Fputs("\n", out);
+  return EXIT_OKAY;
+}
+
+
+/** @brief applies a delta which need not be sorted, in one pass over the
+  * full set, which need not be sorted either.
+  *
+  * The delta is held in a hashtable of its keys.  The first line of the
+  * full set having a key in the delta is replaced by the delta's lines for
+  * that key; later lines having the key are dropped.  The delta's lines for
+  * keys not in the full set are printed at the end, in the order they were
+  * read.
+  *
+  * @param full_reader the full set.
+  * @param delta_reader the delta.
+  * @param out the output.
+  * @param args commandline options.
+  *
+  * @return exit status for main() to return.
+  */
+int hash_delta(dbfr_t *full_reader, dbfr_t *delta_reader, FILE *out,
+               struct cmdargs *args) {
+  hashtbl_t ht;
+  struct delta_row *rows = NULL, *row;
+  struct delta_key *dkey;
+  char *key = NULL;
+  size_t key_sz = 0, n_rows = 0, rows_sz = 0, n_keys = 0, i;
+  size_t n_replaced = 0, n_dropped = 0;
+
+  while (dbfr_getline(delta_reader) > 0) {
+    if (n_rows == rows_sz) {
+      rows_sz = rows_sz ? rows_sz * 2 : 1024;
+      rows = xrealloc(rows, sizeof(struct delta_row) * rows_sz);
+    }
+    rows[n_rows++].line = xstrdup(delta_reader->current_line);
+  }
+
+  ht_init(&ht, n_rows > DELTA_HASH_SZ ? n_rows : DELTA_HASH_SZ, NULL, free);
+  for (i = 0; i < n_rows; i++) {
+    row = &rows[i];
+    line_key(row->line, &key, &key_sz);
+    row->next = NULL;
+    if ((dkey = ht_get(&ht, key)) == NULL) {
+      dkey = xmalloc(sizeof(struct delta_key));
+      dkey->first = row;
+      dkey->replaced = 0;
+      ht_put(&ht, key, dkey);
+      n_keys++;
+    } else {
+      dkey->last->next = row;
+    }
+    dkey->last = row;
+    row->key = dkey;
+  }
+  if (args->verbose)
+    fprintf(stderr, "%s: %lu delta lines with %lu keys\n", getenv("_"),
+            (unsigned long) n_rows, (unsigned long) n_keys);
+
+  while (dbfr_getline(full_reader) > 0) {
+    line_key(full_reader->current_line, &key, &key_sz);
+    if ((dkey = ht_get(&ht, key)) == NULL) {
+      if (put_line(full_reader->current_line, out) != EXIT_OKAY)
+        return EXIT_FILE_ERR;
+    } else if (! dkey->replaced) {
+      for (row = dkey->first; row; row = row->next) {
+        if (put_line(row->line, out) != EXIT_OKAY)
+          return EXIT_FILE_ERR;
+      }
+      dkey->replaced = 1;
+      n_replaced++;
+    } else {
+      n_dropped++;
+    }
+  }
+
+  for (i = 0; i < n_rows; i++) {
+    if (! rows[i].key->replaced &&
+        put_line(rows[i].line, out) != EXIT_OKAY)
+      return EXIT_FILE_ERR;
+  }
+  if (args->verbose)
+    fprintf(stderr, "%s: %lu keys replaced, %lu duplicate lines dropped, "
+            "%lu keys appended\n", getenv("_"), (unsigned long) n_replaced,
+            (unsigned long) n_dropped, (unsigned long) (n_keys - n_replaced));
+
+  ht_destroy(&ht);
+  for (i = 0; i < n_rows; i++)
+    free(rows[i].line);
+  if (rows)
+    free(rows);
+  if (key)
+    free(key);
+  if (keyfields)
+    free(keyfields);
+  return EXIT_OKAY;
 }
@@ -19,6 +19,7 @@
 #endif
 
 #include <crush/ffutils.h>
+#include <crush/collkey.h>
 #include <crush/dbfr.h>
 
 #if HAVE_FCNTL_H
@@ -50,8 +51,6 @@
 #ifndef DELTAFORCE_H
 #define DELTAFORCE_H
 
-#define MAX_FIELD_LEN 255
-
 
 /* macros to clarify the semantics of key comparisons. */
 
@@ -68,7 +67,12 @@
 #define LEFT_RIGHT_EQUAL   0
 
 
+/* the smallest hashtable made by hash_delta(). */
+#define DELTA_HASH_SZ 1024
+
 int merge_files(dbfr_t *left, dbfr_t *right, FILE * out, struct cmdargs *args);
-int compare_keys(char *buffer_left, char *buffer_right);
+int hash_delta(dbfr_t *full_reader, dbfr_t *delta_reader, FILE *out,
+               struct cmdargs *args);
+int compare_keys(const collkey_t *key_left, const collkey_t *key_right);
 
 #endif /* DELTAFORCE_H */
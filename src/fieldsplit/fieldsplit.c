@@ -17,6 +17,7 @@
 #include <crush/ffutils.h>
 #include <crush/general.h>
 #include <crush/hashtbl.h>
+#include <crush/hll.h>
 #include <crush/reutils.h>
 
 #include "fieldsplit_main.h"
@@ -108,6 +109,7 @@ int fieldsplit (struct cmdargs *args, int argc, char *argv[], int optind) {
   size_t header_sz = 0, line_sz = 0, field_sz = 0, subst_buffer_sz = 0;
   int field_index, buckets = 0, bucket_len;
   long max_open_files;
+  size_t cache_sz;
 
   char default_delim[] = {0xfe, 0x00};
 
@@ -160,7 +162,23 @@ int fieldsplit (struct cmdargs *args, int argc, char *argv[], int optind) {
   if (max_open_files < 0) {
     max_open_files = FOPEN_MAX;
   }
-  ht_init(&fileptr_cache, max_open_files, strhash32, free);
+  /* the cache never holds more than max_open_files entries, and needs no
+   * more buckets than there are output files. */
+  cache_sz = hll_presize(args->expected_keys, args->sample_size,
+                         args->field_label || optind == argc ?
+                           NULL : argv[optind],
+                         args->keep_header, &field_index, 1, args->delim,
+                         max_open_files);
+  if (cache_sz == 0) {
+    fprintf(stderr, "%s: --expected-keys and --sample-size must be positive "
+            "numbers.\n", getenv("_"));
+    exit(1);
+  }
+  if (buckets && (size_t) buckets < cache_sz)
+    cache_sz = buckets;
+  if (cache_sz > (size_t) max_open_files)
+    cache_sz = max_open_files;
+  ht_init(&fileptr_cache, cache_sz, strhash32, free);
 
   if (optind == argc)
     in_file = stdin;
@@ -20,6 +20,7 @@
 #include <crush/general.h>
 #include <crush/ffutils.h>
 #include <crush/dbfr.h>
+#include <crush/hll.h>
 #include "filterkeys_main.h"
 #include "filterkeys.h"
 
@@ -27,6 +28,8 @@
 #define open64 open
 #endif
 
+#define FILTER_HASH_SZ 1024
+
 char default_delim[2] = { 0xfe, 0x00 };
 char *delim;
 size_t delim_len = 0;
@@ -112,12 +115,13 @@ static int configure_filterkeys(struct fkeys_conf *conf,
 
 /* reconfigure_filterkeys() */
 
-/* load the filter from the filter file */
-static int load_filter(struct fkeys_conf *conf, dbfr_t *filter_reader) {
+/* load the filter from the filter file into a table of filter_sz buckets */
+static int load_filter(struct fkeys_conf *conf, dbfr_t *filter_reader,
+                       size_t filter_sz) {
   char *t_keybuf;
   int i, acum_len;
 
-  ht_init(&conf->filter, 1024, NULL, NULL);
+  ht_init(&conf->filter, filter_sz, NULL, NULL);
   while (dbfr_getline(filter_reader) > 0) {
 
     t_keybuf = (char *) xmalloc(filter_reader->current_line_sz);
@@ -154,6 +158,7 @@ int filterkeys(struct cmdargs *args, int argc, char *argv[], int optind) {
   dbfr_t *filter_reader, *stream_reader;
   char *t_keybuf;
   int i, acum_len;
+  size_t filter_sz;
 
   if (args->outfile) {
     if ((outfile = fopen(args->outfile, "w")) == NULL) {
@@ -195,7 +200,19 @@ int filterkeys(struct cmdargs *args, int argc, char *argv[], int optind) {
     return EXIT_HELP;
   }
 
-  load_filter(&fk_conf, filter_reader);
+  /* presizing the filter avoids rehashing it over and over as it grows.
+   * the filter file only has a header when labels are used. */
+  filter_sz = hll_presize(args->expected_keys, args->sample_size,
+                          args->filter_file, ! (args->akeys && args->bkeys),
+                          fk_conf.aindexes, fk_conf.key_count, delim,
+                          FILTER_HASH_SZ);
+  if (filter_sz == 0) {
+    fprintf(stderr, "%s: --expected-keys and --sample-size must be positive "
+            "numbers.\n", argv[0]);
+    return EXIT_HELP;
+  }
+
+  load_filter(&fk_conf, filter_reader, filter_sz);
   dbfr_close( filter_reader );
 
   if (args->preserve_header) {
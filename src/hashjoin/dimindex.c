@@ -0,0 +1,264 @@
+/********************************
+   Copyright 2010 Google Inc.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ ********************************/
+
+/* Dimension indexes.
+
+   hashjoin --build-index writes the dimension table in a form which later
+   runs can map into memory and probe directly, instead of parsing and
+   hashing the dimension file again:
+
+     header                  struct dim_index_header
+     signature               the key & value arguments, NUL-terminated
+     (padding to 8 bytes)
+     slots                   n_slots struct dim_index_slot
+     records                 key\0value\0 for each key
+
+   The slots are an open-addressed table with linear probing, at most half
+   full.  Each holds the 64-bit FNV-1a hash of a key and the offset of its
+   record + 1, or 0 if the slot is empty.  Integers are in the byte order of
+   the machine which built the index; an index from another byte order is
+   rejected as malformatted. */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <crush/ffutils.h>
+#include <crush/general.h>
+
+#include "hashjoin.h"
+
+#define DIM_INDEX_MAGIC "crushidx"
+#define DIM_INDEX_VERSION 1
+
+struct dim_index_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t n_values;
+  uint64_t source_size;     /* size of the dimension file */
+  int64_t source_mtime;     /* modification time of the dimension file */
+  uint64_t n_keys;
+  uint64_t n_slots;         /* a power of 2 */
+  uint64_t slots_offset;
+  uint64_t records_offset;
+  uint64_t records_size;
+};
+
+struct dim_index_slot {
+  uint64_t hash;
+  uint64_t record;          /* offset in the records + 1, or 0 if empty */
+};
+
+static uint64_t dim_index_hash(const char *key) {
+  uint64_t h = 14695981039346656037ULL;
+  while (*key) {
+    h ^= (unsigned char) *key++;
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+/* writes all of a buffer, returning non-zero on error. */
+static int write_all(FILE *out, const void *buf, size_t len) {
+  return fwrite(buf, 1, len, out) != len;
+}
+
+
+int dim_index_build(const char *path, hashtbl_t *ht, size_t n_values,
+                    const char *source, const char *signature) {
+  struct dim_index_header header;
+  struct dim_index_slot *slots;
+  struct stat st;
+  char **keys, *tmp_path, zeros[8] = { 0 };
+  const char *value;
+  uint64_t offset, mask, i;
+  size_t n_keys, k, pad, signature_len = strlen(signature) + 1;
+  FILE *out;
+  int saved_errno;
+
+  if (stat(source, &st) != 0)
+    return 1;
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, DIM_INDEX_MAGIC, sizeof(header.magic));
+  header.version = DIM_INDEX_VERSION;
+  header.n_values = n_values;
+  header.source_size = st.st_size;
+  header.source_mtime = st.st_mtime;
+  header.n_keys = ht->nelems;
+  for (header.n_slots = 16; header.n_slots < 2 * header.n_keys; )
+    header.n_slots *= 2;
+  mask = header.n_slots - 1;
+  pad = (8 - (sizeof(header) + signature_len) % 8) % 8;
+  header.slots_offset = sizeof(header) + signature_len + pad;
+  header.records_offset = header.slots_offset +
+                          header.n_slots * sizeof(struct dim_index_slot);
+
+  /* place the records in the order of the keys, and fill in the slots. */
+  keys = xmalloc(sizeof(char *) * (ht->nelems + 1));
+  n_keys = ht_keys(ht, keys);
+  slots = xcalloc(header.n_slots, sizeof(struct dim_index_slot));
+  for (offset = 0, k = 0; k < n_keys; k++) {
+    uint64_t h = dim_index_hash(keys[k]);
+    for (i = h & mask; slots[i].record; i = (i + 1) & mask)
+      ;
+    slots[i].hash = h;
+    slots[i].record = offset + 1;
+    value = ht_get(ht, keys[k]);
+    offset += strlen(keys[k]) + strlen(value) + 2;
+  }
+  header.records_size = offset;
+
+  tmp_path = xmalloc(strlen(path) + 5);
+  sprintf(tmp_path, "%s.tmp", path);
+  if ((out = fopen(tmp_path, "w")) == NULL) {
+    free(tmp_path);
+    free(slots);
+    free(keys);
+    return 1;
+  }
+  if (write_all(out, &header, sizeof(header)) ||
+      write_all(out, signature, signature_len) ||
+      write_all(out, zeros, pad) ||
+      write_all(out, slots, header.n_slots * sizeof(struct dim_index_slot)))
+    goto write_error;
+  for (k = 0; k < n_keys; k++) {
+    value = ht_get(ht, keys[k]);
+    if (write_all(out, keys[k], strlen(keys[k]) + 1) ||
+        write_all(out, value, strlen(value) + 1))
+      goto write_error;
+  }
+  if (fclose(out) != 0) {
+    out = NULL;
+    goto write_error;
+  }
+  if (rename(tmp_path, path) != 0) {
+    out = NULL;
+    goto write_error;
+  }
+
+  free(tmp_path);
+  free(slots);
+  free(keys);
+  return 0;
+
+write_error:
+  saved_errno = errno;
+  if (out)
+    fclose(out);
+  unlink(tmp_path);
+  free(tmp_path);
+  free(slots);
+  free(keys);
+  errno = saved_errno;
+  return 1;
+}
+
+
+int dim_index_open(dim_index_t *index, const char *path, const char *source,
+                   const char *signature, size_t *n_values) {
+  const struct dim_index_header *header;
+  struct stat st;
+  size_t signature_len = strlen(signature) + 1;
+  int fd, retval;
+
+  memset(index, 0, sizeof(dim_index_t));
+  if ((fd = open(path, O_RDONLY)) < 0)
+    return DIM_INDEX_ERR_IO;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return DIM_INDEX_ERR_IO;
+  }
+  if (st.st_size < sizeof(struct dim_index_header) + signature_len) {
+    close(fd);
+    return DIM_INDEX_ERR_FORMAT;
+  }
+  index->map_sz = st.st_size;
+  /* a shared, read-only mapping lets concurrent runs share the page cache. */
+  index->map = mmap(NULL, index->map_sz, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (index->map == MAP_FAILED) {
+    index->map = NULL;
+    return DIM_INDEX_ERR_IO;
+  }
+
+  header = index->header = index->map;
+  retval = DIM_INDEX_OK;
+  if (memcmp(header->magic, DIM_INDEX_MAGIC, sizeof(header->magic)) != 0 ||
+      header->version != DIM_INDEX_VERSION ||
+      header->n_slots == 0 || (header->n_slots & (header->n_slots - 1)) ||
+      header->slots_offset > header->records_offset ||
+      header->records_offset - header->slots_offset !=
+        header->n_slots * sizeof(struct dim_index_slot) ||
+      header->records_offset + header->records_size != index->map_sz)
+    retval = DIM_INDEX_ERR_FORMAT;
+  else if (memcmp((const char *) (header + 1), signature, signature_len) != 0)
+    retval = DIM_INDEX_ERR_ARGS;
+  else if (stat(source, &st) != 0)
+    retval = DIM_INDEX_ERR_SOURCE;
+  else if (st.st_size != header->source_size ||
+           st.st_mtime != header->source_mtime)
+    retval = DIM_INDEX_ERR_STALE;
+
+  if (retval != DIM_INDEX_OK) {
+    int saved_errno = errno;
+    dim_index_close(index);
+    errno = saved_errno;
+    return retval;
+  }
+
+  index->slots = (const struct dim_index_slot *)
+                 ((const char *) index->map + header->slots_offset);
+  index->records = (const char *) index->map + header->records_offset;
+  index->mask = header->n_slots - 1;
+  *n_values = header->n_values;
+#ifdef MADV_RANDOM
+  /* probes land anywhere in the table, so read-ahead only wastes I/O. */
+  madvise(index->map, index->map_sz, MADV_RANDOM);
+#endif
+  return DIM_INDEX_OK;
+}
+
+
+const char *dim_index_get(const dim_index_t *index, const char *key) {
+  uint64_t h = dim_index_hash(key), i;
+  const char *record;
+
+  for (i = h & index->mask; index->slots[i].record;
+       i = (i + 1) & index->mask) {
+    if (index->slots[i].hash != h)
+      continue;
+    record = index->records + index->slots[i].record - 1;
+    if (str_eq(record, key))
+      return record + strlen(record) + 1;
+  }
+  return NULL;
+}
+
+
+void dim_index_close(dim_index_t *index) {
+  if (index->map)
+    munmap(index->map, index->map_sz);
+  memset(index, 0, sizeof(dim_index_t));
+}
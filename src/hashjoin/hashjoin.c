@@ -17,23 +17,241 @@
 # include <config.h>
 #endif
 
+#include <ctype.h>
+#include <err.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#ifdef HAVE_SYS_RESOURCE_H
+# include <sys/resource.h>
+#endif
+#ifdef HAVE_PTHREAD_H
+# include <pthread.h>
+#endif
+
+#include <crush/bloom.h>
 #include <crush/dbfr.h>
 #include <crush/ffutils.h>
 #include <crush/general.h>
 #include <crush/hashtbl.h>
+#include <crush/hll.h>
 
 #include "hashjoin_main.h"
+#include "hashjoin.h"
+
+#define DIMENSION_HASH_SZ 1024
 
 char default_delim[] = {0xfe, 0x00};
 
+/* The dimension table: hashed from the dimension file, or mapped from an
+ * index written by --build-index.  A hashed table also gets a Bloom filter
+ * of its keys, which rules out most data lines without a match before
+ * their keys are copied out and looked up, and keeps its values in a value
+ * store. */
+struct dimension {
+  hashtbl_t ht;
+  value_store_t values;
+  dim_index_t index;
+  int mapped;
+  bloom_t filter;
+  int filtered;
+};
+
+/* Counts of data lines, reported with --verbose. */
+struct probe_stats {
+  size_t lines;                 /* data lines looked up */
+  size_t rejected;              /* lines ruled out by the filter */
+  size_t matched;               /* lines having a dimension record */
+};
+
+static const char *dimension_get(struct dimension *dim, char *key) {
+  if (dim->mapped)
+    return dim_index_get(&dim->index, key);
+  return ht_get(&dim->ht, key);
+}
+
 static void extract_fields(int *field_list, size_t n_fields,
                            const char *line, char *target, size_t target_sz,
                            const char *ifs, const char *ofs);
 
-static size_t hash_dimension_file(struct cmdargs *args, hashtbl_t *ht);
+static const char *lookup_line(struct dimension *dim, const char *line,
+                               int *key_fields, size_t n_key_fields,
+                               const char *delim, char *keybuffer,
+                               size_t keybuffer_sz, struct probe_stats *stats);
+
+static void filter_dimension(struct dimension *dim);
+
+static void print_stats(struct dimension *dim, struct probe_stats *stats);
+
+/* the options given for each dimension file, rather than once. */
+#define DIMENSION_OPTIONS "fDklKjJLmy"
+
+/* The DIMENSION_OPTIONS in the order they were given. */
+static struct {
+  int opt;
+  char *arg;
+} *dimension_opts = NULL;
+static size_t n_dimension_opts = 0;
+
+/* A dimension file and the options which apply to it. */
+struct join_spec {
+  struct cmdargs args;
+  struct dimension dim;
+  size_t n_values;
+  char *empty_value;            /* joined for keys not in the table */
+  int *key_fields;              /* the 0-based indexes of the data keys */
+  size_t key_fields_sz;
+  size_t n_key_fields;
+  off_t source_size;            /* the dimension file when it was loaded */
+  time_t source_mtime;
+};
+
+/* What to do with the first line of a data file. */
+enum header_action {
+  HEADER_JOIN,                  /* join it like any other line */
+  HEADER_LABEL,                 /* add the --label-dimensions to it */
+  HEADER_SKIP                   /* skip it, since a header has been printed */
+};
+
+static enum header_action start_data_file(struct join_spec *specs,
+                                          size_t n_specs,
+                                          const char *first_line,
+                                          const char *delim,
+                                          int header_printed);
+
+static void load_dimension(struct join_spec *spec, int intern, int verbose);
+
+static int serve_dimensions(struct cmdargs *args, struct join_spec *specs,
+                            size_t n_specs);
+
+static struct join_spec *split_dimension_specs(struct cmdargs *args,
+                                               size_t *n_specs);
+
+static char *make_empty_value(struct cmdargs *args, size_t n_values);
+
+static void join_line(struct join_spec *specs, size_t n_specs,
+                      const char *line, const char *delim, int header,
+                      char **keybuffer, size_t *keybuffer_sz,
+                      struct probe_stats *stats,
+                      char **out, size_t *out_len, size_t *out_sz);
+
+static void append(char **buf, size_t *len, size_t *sz,
+                   const char *s, size_t s_len);
+
+/* The 0-based indexes of the dimension file's key and value fields. */
+struct dimension_fields {
+  int *keys;
+  int n_keys;
+  int *values;
+  int n_values;
+};
+
+static dbfr_t *open_dimension_file(struct cmdargs *args,
+                                   struct dimension_fields *fields);
+
+static size_t hash_dimension_file(struct cmdargs *args, hashtbl_t *ht,
+                                  value_store_t *values);
+
+static double seconds(void);
+
+static void print_load_stats(struct cmdargs *args, struct dimension *dim,
+                             double elapsed);
+
+#define GRACE_OVERHEAD 4          /* bytes of memory needed to hash each byte
+                                     of the dimension file */
+#define GRACE_MAX_PARTITIONS 512
+
+/* With --memory-limit, a dimension file too large to hash at once is joined
+ * one partition at a time.  The dimension rows and the data lines are
+ * written to temporary files by the hash of their keys; each partition's
+ * dimension rows are then hashed and its data lines joined.  The partition
+ * of every output line is recorded in input order, so that the joined
+ * partitions can be read back in the original order. */
+struct grace {
+  size_t n_parts;
+  FILE **dims;                  /* key\0values\n records of each partition */
+  FILE **data;                  /* key\0line\n records, then joined lines */
+  FILE *route;                  /* the partition of each output line */
+  FILE *passthrough;            /* header lines, which need no join */
+  char *keybuffer;
+  size_t keybuffer_sz;
+};
+
+static double parse_memory_limit(const char *arg);
+
+static size_t grace_partitions(struct cmdargs *args);
+
+static size_t grace_partition_dimension(struct cmdargs *args,
+                                        struct grace *grace, size_t n_parts);
+
+static void grace_printf(struct grace *grace, const char *fmt, ...);
+
+static void grace_partition_lines(struct grace *grace, dbfr_t *reader,
+                                  int *key_fields, size_t n_key_fields,
+                                  const char *delim);
+
+static void grace_join(struct grace *grace, const char *delim,
+                       const char *empty_value, int intern, int verbose,
+                       struct probe_stats *stats);
 
 static void decrement(int *lst, size_t n);
 
+static char *index_signature(struct cmdargs *args);
+
+static size_t load_index(struct cmdargs *args, struct dimension *dim);
+
+#ifdef HAVE_PTHREAD_H
+
+#define PROBE_CHUNK_SZ 65536
+
+/* the states of a chunk of data lines as it moves through the pipeline. */
+enum chunk_state { CHUNK_FREE, CHUNK_READ, CHUNK_DONE };
+
+/* a run of data lines, each chomped and NUL-terminated, and their output. */
+struct probe_chunk {
+  char *lines;
+  size_t lines_len, lines_sz;
+  char *out;
+  size_t out_len, out_sz;
+  enum chunk_state state;
+};
+
+/* The data lines are read into a ring of chunks, numbered in input order.
+ * Workers take the next chunk to be probed, and the writer prints the
+ * chunks as they finish, in order. */
+struct probe_pool {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;          /* broadcast whenever anything changes */
+  struct probe_chunk *ring;
+  size_t n_slots;
+  size_t n_read;                /* chunks handed out to be probed */
+  size_t n_probed;              /* chunks taken by workers */
+  size_t n_written;             /* chunks printed */
+  int finished;                 /* no more chunks will be read */
+
+  pthread_t *workers;
+  int n_workers;
+  pthread_t writer;
+
+  struct join_spec *specs;
+  size_t n_specs;
+  const char *delim;
+  struct probe_stats *stats;    /* the workers' counts, once they finish */
+};
+
+static void probe_pool_start(struct probe_pool *pool, int n_workers,
+                             struct join_spec *specs, size_t n_specs,
+                             const char *delim);
+static void probe_pool_lines(struct probe_pool *pool, dbfr_t *reader);
+static void probe_pool_finish(struct probe_pool *pool,
+                              struct probe_stats *stats);
+
+#endif /* HAVE_PTHREAD_H */
+
 /** @brief Application entry point.
   *
   * @param args contains the parsed cmd-line options & arguments.
@@ -44,30 +262,45 @@ static void decrement(int *lst, size_t n);
   * @return exit status for main() to return.
   */
 int hashjoin (struct cmdargs *args, int argc, char *argv[], int optind) {
-  hashtbl_t dimension;
+  struct join_spec *specs, *spec;
+  size_t n_specs, s;
   FILE *infile;
   dbfr_t *datareader;
   int header_printed = 0;
+  enum header_action action;
 
-  char *keybuffer = NULL;
-  size_t keybuffer_sz = 0;
+  char *keybuffer = NULL, *out = NULL;
+  size_t keybuffer_sz = 0, out_len, out_sz = 0;
 
-  char *value, *empty_value;
-  size_t n_values, i;
+  char *signature;
+  struct probe_stats *stats;
+  struct grace grace;
+  size_t n_parts = 0;
 
-  int *key_fields = NULL;
-  size_t n_key_fields = 0;
+#ifdef HAVE_PTHREAD_H
+  struct probe_pool pool;
+#endif
+  int n_threads = 0;
 
-  if (! args->key_labels &&
-      ! (args->data_key_fields && args->dimension_key_fields)) {
-    fprintf(stderr, "%s: missing key field argument(s)\n", getenv("_"));
-    return EXIT_FAILURE;
+  if (args->connect) {
+    if (n_dimension_opts || args->serve) {
+      fprintf(stderr, "%s: --connect takes no dimension file options; they "
+              "are given to --serve\n", getenv("_"));
+      return EXIT_FAILURE;
+    }
+    return join_client(args->connect, argc, argv, optind);
   }
 
-  if (! args->dimension_field_labels &&
-      ! args->dimension_fields) {
-    fprintf(stderr, "%s: missing dimension field argument\n", getenv("_"));
+  if (args->threads) {
+    n_threads = atoi(args->threads);
+    if (n_threads < 1) {
+      fprintf(stderr, "%s: -T must be a positive integer.\n", getenv("_"));
+      return EXIT_FAILURE;
+    }
+#ifndef HAVE_PTHREAD_H
+    fprintf(stderr, "%s was compiled without thread support.\n", getenv("_"));
     return EXIT_FAILURE;
+#endif
   }
 
   if (! args->delim) {
@@ -77,45 +310,125 @@ int hashjoin (struct cmdargs *args, int argc, char *argv[], int optind) {
     }
   }
   expand_chars(args->delim);
-  if (! args->dimension_delim) {
-    args->dimension_delim = args->delim;
+
+  specs = split_dimension_specs(args, &n_specs);
+  for (s = 0; s < n_specs; s++) {
+    spec = &specs[s];
+    if (! spec->args.key_labels &&
+        ! (spec->args.data_key_fields && spec->args.dimension_key_fields)) {
+      fprintf(stderr, "%s: missing key field argument(s)\n", getenv("_"));
+      return EXIT_FAILURE;
+    }
+
+    if (! spec->args.dimension_field_labels &&
+        ! spec->args.dimension_fields) {
+      fprintf(stderr, "%s: missing dimension field argument\n", getenv("_"));
+      return EXIT_FAILURE;
+    }
+
+    if (! spec->args.dimension_delim) {
+      spec->args.dimension_delim = args->delim;
+    }
   }
 
-  ht_init(&dimension, 1024, NULL, NULL);
-  n_values = hash_dimension_file(args, &dimension);
+  if (args->memory_limit) {
+    if (parse_memory_limit(args->memory_limit) <= 0) {
+      fprintf(stderr, "%s: --memory-limit must be a positive number of "
+              "megabytes, or end in K, M, or G.\n", getenv("_"));
+      return EXIT_FAILURE;
+    }
+    if (args->threads || args->index || args->build_index) {
+      fprintf(stderr, "%s: --memory-limit cannot be used with --threads, "
+              "--index, or --build-index\n", getenv("_"));
+      return EXIT_FAILURE;
+    }
+  }
 
-  if (args->default_values) {
-    size_t default_len = strlen(args->default_values);
-    char *default_buffer = xmalloc(default_len);
-    empty_value = xmalloc(default_len + strlen(args->delim) * n_values);
-    empty_value[0] = '\0';
-    for (i = 0; i < n_values; i++) {
-      get_line_field(default_buffer, args->default_values, default_len, i, ",");
-      strcat(empty_value, default_buffer);
-      if (i < n_values - 1) {
-        strcat(empty_value, args->delim);
-      }
+  if ((args->index || args->build_index) && ! args->dimension_file) {
+    fprintf(stderr, "%s: --index and --build-index require -f\n",
+            getenv("_"));
+    return EXIT_FAILURE;
+  }
+
+  if (n_specs > 1 &&
+      (args->memory_limit || args->index || args->build_index)) {
+    fprintf(stderr, "%s: --memory-limit, --index, and --build-index take a "
+            "single dimension file\n", getenv("_"));
+    return EXIT_FAILURE;
+  }
+
+  if (args->serve) {
+    if (args->threads || args->memory_limit || args->index ||
+        args->build_index) {
+      fprintf(stderr, "%s: --serve cannot be used with --threads, "
+              "--memory-limit, --index, or --build-index\n", getenv("_"));
+      return EXIT_FAILURE;
     }
+    if (argc > optind) {
+      fprintf(stderr, "%s: --serve reads no data files\n", getenv("_"));
+      return EXIT_FAILURE;
+    }
+  }
+
+  memset(&grace, 0, sizeof(grace));
+  if (args->memory_limit)
+    n_parts = grace_partitions(&specs[0].args);
+
+  if (n_parts > 1) {
+    specs[0].n_values = grace_partition_dimension(&specs[0].args, &grace,
+                                                  n_parts);
+    if (args->verbose)
+      fprintf(stderr, "%s: joining in %lu partitions\n", getenv("_"),
+              (unsigned long) n_parts);
+  } else if (args->build_index) {
+    /* hash_dimension_file() consumes the field arguments. */
+    signature = index_signature(&specs[0].args);
+    value_store_init(&specs[0].dim.values, args->intern_values);
+    specs[0].n_values = hash_dimension_file(&specs[0].args,
+                                            &specs[0].dim.ht,
+                                            &specs[0].dim.values);
+    if (dim_index_build(args->build_index, &specs[0].dim.ht,
+                        specs[0].n_values, args->dimension_file,
+                        signature) != 0) {
+      warn(args->build_index);
+      return EXIT_FAILURE;
+    }
+    free(signature);
+    return EXIT_OKAY;
+  } else if (args->index) {
+    specs[0].n_values = load_index(&specs[0].args, &specs[0].dim);
   } else {
-    empty_value = xmalloc(strlen(args->delim) * n_values);
-    empty_value[0] = '\0';
-    for (i = 0; i < n_values - 1; i++) {
-      strcat(empty_value, args->delim);
+    for (s = 0; s < n_specs; s++)
+      load_dimension(&specs[s], args->intern_values, args->verbose);
+  }
+  stats = xcalloc(n_specs, sizeof(struct probe_stats));
+
+  for (s = 0; s < n_specs; s++) {
+    spec = &specs[s];
+    spec->empty_value = make_empty_value(&spec->args, spec->n_values);
+
+    if (! spec->args.key_labels) {
+      /* The user supplied --data-keys (indexes) which stay the same for each
+       * input file. */
+      spec->n_key_fields = expand_nums(spec->args.data_key_fields,
+                                       &spec->key_fields,
+                                       &spec->key_fields_sz);
+      decrement(spec->key_fields, spec->n_key_fields);
     }
   }
 
+  if (args->serve)
+    return serve_dimensions(args, specs, n_specs);
+
   if (argc > optind)
     infile = nextfile(argc, argv, &optind, "r");
   else
     infile = stdin;
 
-  if (! args->key_labels) {
-    /* The user supplied --data-keys (indexes) which stay the same for each
-     * input file. */
-    n_key_fields = expand_nums(args->data_key_fields,
-                               &key_fields, &n_key_fields);
-    decrement(key_fields, n_key_fields);
-  }
+#ifdef HAVE_PTHREAD_H
+  if (n_threads)
+    probe_pool_start(&pool, n_threads, specs, n_specs, args->delim);
+#endif
 
   while (infile) {
     datareader = dbfr_init(infile);
@@ -124,24 +437,27 @@ int hashjoin (struct cmdargs *args, int argc, char *argv[], int optind) {
       continue;
     }
 
-    if (args->key_labels) {
-      /* The user supplied --key-labels which need to be converted to indexes
-       * for each input file. But see TODO below. */
-      n_key_fields = expand_label_list(args->key_labels, datareader->next_line,
-                                       args->delim, &key_fields,
-                                       &n_key_fields);
-      decrement(key_fields, n_key_fields);
-    }
+    /* The pool's workers are idle between files, so the key fields can
+     * change. */
+    action = start_data_file(specs, n_specs, datareader->next_line,
+                             args->delim, header_printed);
 
     /* Add user-supplied dimension labels to the header row. */
-    if (args->dimension_labels && ! args->dimension_field_labels) {
+    if (action == HEADER_LABEL) {
       dbfr_getline(datareader);
       chomp(datareader->current_line);
       /* TODO(jhinds): This does not account for the possibility of multiple
        * input files with different formats. */
-      printf("%s%s%s\n", datareader->current_line,
-             args->delim, args->dimension_labels);
-    } else if (args->dimension_labels || args->key_labels && header_printed) {
+      if (grace.n_parts) {
+        grace_printf(&grace, "%s%s%s\n", datareader->current_line,
+                     args->delim, specs[0].args.dimension_labels);
+      } else {
+        out_len = 0;
+        join_line(specs, n_specs, datareader->current_line, args->delim, 1,
+                  &keybuffer, &keybuffer_sz, stats, &out, &out_len, &out_sz);
+        fwrite(out, 1, out_len, stdout);
+      }
+    } else if (action == HEADER_SKIP) {
       /* The header has already been printed. Skip the first row of subsequent
        * files. */
       dbfr_getline(datareader);
@@ -154,34 +470,268 @@ int hashjoin (struct cmdargs *args, int argc, char *argv[], int optind) {
       continue;
     }
 
-    if (! keybuffer) {
-      keybuffer = xmalloc(datareader->next_line_len);
-      keybuffer_sz = datareader->next_line_len;
+    if (grace.n_parts) {
+      grace_partition_lines(&grace, datareader, specs[0].key_fields,
+                            specs[0].n_key_fields, args->delim);
+      infile = nextfile(argc, argv, &optind, "r");
+      continue;
+    }
+
+#ifdef HAVE_PTHREAD_H
+    if (n_threads) {
+      probe_pool_lines(&pool, datareader);
+      infile = nextfile(argc, argv, &optind, "r");
+      continue;
     }
+#endif
 
     while (dbfr_getline(datareader) > 0) {
-      if (datareader->current_line_len > keybuffer_sz) {
-        keybuffer = xrealloc(keybuffer, datareader->current_line_len);
-        keybuffer_sz = datareader->current_line_len;
-      }
       chomp(datareader->current_line);
-      extract_fields(key_fields, n_key_fields, datareader->current_line,
-                     keybuffer, keybuffer_sz,
-                     args->delim, args->delim);
-
-      value = ht_get(&dimension, keybuffer);
-      if (! value)
-        value = empty_value;
-      printf("%s%s%s\n", datareader->current_line, args->delim, value);
+      out_len = 0;
+      join_line(specs, n_specs, datareader->current_line, args->delim, 0,
+                &keybuffer, &keybuffer_sz, stats, &out, &out_len, &out_sz);
+      fwrite(out, 1, out_len, stdout);
     }
 
     infile = nextfile(argc, argv, &optind, "r");
   }
 
+#ifdef HAVE_PTHREAD_H
+  if (n_threads)
+    probe_pool_finish(&pool, stats);
+#endif
+  if (grace.n_parts)
+    grace_join(&grace, args->delim, specs[0].empty_value, args->intern_values,
+               args->verbose, &stats[0]);
+  for (s = 0; s < n_specs; s++) {
+    spec = &specs[s];
+    if (args->verbose) {
+      if (n_specs > 1)
+        fprintf(stderr, "%s: %s:\n", getenv("_"), spec->args.dimension_file);
+      print_stats(&spec->dim, &stats[s]);
+    }
+    if (spec->dim.mapped)
+      dim_index_close(&spec->dim.index);
+    if (spec->dim.filtered)
+      bloom_destroy(&spec->dim.filter);
+  }
+
   return EXIT_OKAY;
 }
 
 
+/* Sets the member of args for one of the DIMENSION_OPTIONS. */
+static void set_dimension_option(struct cmdargs *args, int opt, char *arg) {
+  switch (opt) {
+    case 'f': args->dimension_file = arg; break;
+    case 'D': args->dimension_delim = arg; break;
+    case 'k': args->data_key_fields = arg; break;
+    case 'l': args->dimension_key_fields = arg; break;
+    case 'K': args->key_labels = arg; break;
+    case 'j': args->dimension_fields = arg; break;
+    case 'J': args->dimension_field_labels = arg; break;
+    case 'L': args->dimension_labels = arg; break;
+    case 'm': args->default_values = arg; break;
+    case 'y': args->expected_keys = arg; break;
+  }
+}
+
+
+void dimension_option(struct cmdargs *args, int opt, char *arg) {
+  dimension_opts = xrealloc(dimension_opts,
+                            sizeof(*dimension_opts) * (n_dimension_opts + 1));
+  dimension_opts[n_dimension_opts].opt = opt;
+  dimension_opts[n_dimension_opts].arg = arg;
+  n_dimension_opts++;
+  /* the last of each option wins when there is one dimension file. */
+  set_dimension_option(args, opt, arg);
+}
+
+
+/* Starts a spec with the options given once for all dimension files. */
+static void init_spec(struct join_spec *spec, struct cmdargs *args) {
+  const char *opt;
+
+  memset(spec, 0, sizeof(struct join_spec));
+  spec->args = *args;
+  for (opt = DIMENSION_OPTIONS; *opt; opt++)
+    set_dimension_option(&spec->args, *opt, NULL);
+}
+
+
+/** @brief Splits the options recorded by dimension_option() among the
+  * dimension files.
+  *
+  * Each -f after the first starts a new dimension file.  Options given
+  * before the first -f belong to it, so that a single dimension file may be
+  * described by options in any order.
+  *
+  * @param args commandline options.
+  * @param n_specs set to the number of dimension files.
+  *
+  * @return a newly-allocated array of the dimension files.
+  */
+static struct join_spec *split_dimension_specs(struct cmdargs *args,
+                                               size_t *n_specs) {
+  struct join_spec *specs = xmalloc(sizeof(struct join_spec));
+  size_t n = 1, i;
+
+  init_spec(&specs[0], args);
+  for (i = 0; i < n_dimension_opts; i++) {
+    if (dimension_opts[i].opt == 'f' && specs[n - 1].args.dimension_file) {
+      specs = xrealloc(specs, sizeof(struct join_spec) * (n + 1));
+      init_spec(&specs[n++], args);
+    }
+    set_dimension_option(&specs[n - 1].args, dimension_opts[i].opt,
+                         dimension_opts[i].arg);
+  }
+  *n_specs = n;
+  return specs;
+}
+
+
+/** @brief Prepares the dimension files for the lines of a new data file.
+  *
+  * @param specs the dimension files, whose --key-labels are found in the
+  *              data file's header.
+  * @param n_specs the number of elements in specs.
+  * @param first_line the first line of the data file.
+  * @param delim the field separator of the data.
+  * @param header_printed whether a data file has been started before.
+  *
+  * @return what to do with the first line.
+  */
+static enum header_action start_data_file(struct join_spec *specs,
+                                          size_t n_specs,
+                                          const char *first_line,
+                                          const char *delim,
+                                          int header_printed) {
+  enum header_action action = HEADER_JOIN;
+  struct join_spec *spec;
+  size_t s;
+
+  for (s = 0; s < n_specs; s++) {
+    spec = &specs[s];
+    if (spec->args.key_labels) {
+      /* The user supplied --key-labels which need to be converted to
+       * indexes for each input file.  But see TODO in hashjoin(). */
+      spec->n_key_fields = expand_label_list(spec->args.key_labels,
+                                             first_line, delim,
+                                             &spec->key_fields,
+                                             &spec->key_fields_sz);
+      decrement(spec->key_fields, spec->n_key_fields);
+    }
+
+    if (spec->args.dimension_labels && ! spec->args.dimension_field_labels)
+      action = HEADER_LABEL;
+    else if (action == HEADER_JOIN &&
+             (spec->args.dimension_labels ||
+              spec->args.key_labels && header_printed))
+      action = HEADER_SKIP;
+  }
+  return action;
+}
+
+
+/** @brief Builds the values joined to data lines whose key is not in a
+  * dimension table: the --default-values, or empty fields.
+  *
+  * @param args the dimension file's options.
+  * @param n_values the number of value fields.
+  *
+  * @return a newly-allocated string.
+  */
+static char *make_empty_value(struct cmdargs *args, size_t n_values) {
+  char *empty_value;
+  size_t i;
+
+  if (args->default_values) {
+    size_t default_len = strlen(args->default_values);
+    char *default_buffer = xmalloc(default_len + 1);
+    empty_value = xmalloc(default_len + strlen(args->delim) * n_values);
+    empty_value[0] = '\0';
+    for (i = 0; i < n_values; i++) {
+      get_line_field(default_buffer, args->default_values, default_len + 1, i,
+                     ",");
+      strcat(empty_value, default_buffer);
+      if (i < n_values - 1) {
+        strcat(empty_value, args->delim);
+      }
+    }
+    free(default_buffer);
+  } else {
+    empty_value = xmalloc(strlen(args->delim) * n_values);
+    empty_value[0] = '\0';
+    for (i = 0; i < n_values - 1; i++) {
+      strcat(empty_value, args->delim);
+    }
+  }
+  return empty_value;
+}
+
+
+/** @brief Appends a data line, followed by the values of each dimension
+  * file in turn, to an output buffer.
+  *
+  * @param specs the dimension files.
+  * @param n_specs the number of elements in specs.
+  * @param line the data line, without its newline.
+  * @param delim the field separator of the data and output.
+  * @param header whether line is the header row, which gets the
+  *               --label-dimensions of the dimension files which have them
+  *               instead of their values.
+  * @param keybuffer a buffer for the keys, grown as needed.
+  * @param keybuffer_sz the size of keybuffer.
+  * @param stats the counts of each dimension file, to be updated.
+  * @param out the output buffer, grown as needed.
+  * @param out_len the length of the output, which is added to.
+  * @param out_sz the size of out.
+  */
+static void join_line(struct join_spec *specs, size_t n_specs,
+                      const char *line, const char *delim, int header,
+                      char **keybuffer, size_t *keybuffer_sz,
+                      struct probe_stats *stats,
+                      char **out, size_t *out_len, size_t *out_sz) {
+  size_t line_len = strlen(line), delim_len = strlen(delim), s;
+  struct join_spec *spec;
+  const char *value;
+
+  if (line_len + 1 > *keybuffer_sz) {
+    *keybuffer_sz = line_len + 1;
+    *keybuffer = xrealloc(*keybuffer, *keybuffer_sz);
+  }
+  append(out, out_len, out_sz, line, line_len);
+  for (s = 0; s < n_specs; s++) {
+    spec = &specs[s];
+    if (header && spec->args.dimension_labels &&
+        ! spec->args.dimension_field_labels) {
+      value = spec->args.dimension_labels;
+    } else {
+      value = lookup_line(&spec->dim, line, spec->key_fields,
+                          spec->n_key_fields, delim, *keybuffer,
+                          *keybuffer_sz, &stats[s]);
+      if (! value)
+        value = spec->empty_value;
+    }
+    append(out, out_len, out_sz, delim, delim_len);
+    append(out, out_len, out_sz, value, strlen(value));
+  }
+  append(out, out_len, out_sz, "\n", 1);
+}
+
+
+/* Appends a string to a growing buffer. */
+static void append(char **buf, size_t *len, size_t *sz,
+                   const char *s, size_t s_len) {
+  if (*len + s_len > *sz) {
+    *sz = (*len + s_len) * 2;
+    *buf = xrealloc(*buf, *sz);
+  }
+  memcpy(*buf + *len, s, s_len);
+  *len += s_len;
+}
+
+
 /** @brief Extracts a list of fields from a string and stores them in a target
   * buffer.
   *
@@ -229,20 +779,179 @@ static void decrement(int *lst, size_t n) {
 }
 
 
-/** @brief Stores key and value fields from a dimension file in a hashtable.
+/** @brief Finds the dimension values to be joined to a data line.
+  *
+  * With a filter, the key is hashed in place, field by field, and only
+  * copied out of the line if the filter says it may be in the table.  The
+  * hash covers the same bytes as the key string built by extract_fields().
+  *
+  * @param dim the dimension table.
+  * @param line the data line.
+  * @param key_fields the 0-based indexes of the data key fields.
+  * @param n_key_fields the number of elements in key_fields.
+  * @param delim the field separator of the data and of the key strings.
+  * @param keybuffer a buffer at least as long as the line.
+  * @param keybuffer_sz the size of keybuffer.
+  * @param stats counts to be updated.
+  *
+  * @return the dimension values, or NULL if the key is not in the table.
+  */
+static const char *lookup_line(struct dimension *dim, const char *line,
+                               int *key_fields, size_t n_key_fields,
+                               const char *delim, char *keybuffer,
+                               size_t keybuffer_sz, struct probe_stats *stats) {
+  const char *value;
+  uint64_t h = BLOOM_HASH_INIT;
+  size_t i, delim_len;
+  int start, end;
+
+  stats->lines++;
+  if (dim->filtered) {
+    delim_len = strlen(delim);
+    for (i = 0; i < n_key_fields; i++) {
+      if (get_line_pos(line, key_fields[i], delim, &start, &end) > 0)
+        h = bloom_hash(h, line + start, end - start + 1);
+      if (i < n_key_fields - 1)
+        h = bloom_hash(h, delim, delim_len);
+    }
+    if (! bloom_check(&dim->filter, h)) {
+      stats->rejected++;
+      return NULL;
+    }
+  }
+
+  extract_fields(key_fields, n_key_fields, line, keybuffer, keybuffer_sz,
+                 delim, delim);
+  if ((value = dimension_get(dim, keybuffer)) != NULL)
+    stats->matched++;
+  return value;
+}
+
+
+/** @brief Builds the Bloom filter of a hashed dimension table's keys.
+  *
+  * @param dim the dimension table.
+  */
+static void filter_dimension(struct dimension *dim) {
+  char **keys = xmalloc(sizeof(char *) * (dim->ht.nelems + 1));
+  size_t n_keys = ht_keys(&dim->ht, keys), i;
+
+  bloom_init(&dim->filter, n_keys);
+  for (i = 0; i < n_keys; i++)
+    bloom_add(&dim->filter,
+              bloom_hash(BLOOM_HASH_INIT, keys[i], strlen(keys[i])));
+  dim->filtered = 1;
+  free(keys);
+}
+
+
+/** @brief Prints the --verbose report of how the data lines were joined.
+  *
+  * @param dim the dimension table.
+  * @param stats the counts of data lines.
+  */
+static void print_stats(struct dimension *dim, struct probe_stats *stats) {
+  size_t unmatched = stats->lines - stats->matched;
+
+  fprintf(stderr, "%s: %lu data lines, %lu matched (%.1f%%)\n", getenv("_"),
+          (unsigned long) stats->lines, (unsigned long) stats->matched,
+          stats->lines ? 100.0 * stats->matched / stats->lines : 0.0);
+  if (dim->filtered) {
+    /* every unmatched line the filter let through was a false positive. */
+    fprintf(stderr, "%s: bloom filter of %lu bytes rejected %lu lines; "
+            "%lu false positives (%.2f%% of unmatched lines)\n", getenv("_"),
+            (unsigned long) (dim->filter.n_blocks * 64),
+            (unsigned long) stats->rejected,
+            (unsigned long) (unmatched - stats->rejected),
+            unmatched ? 100.0 * (unmatched - stats->rejected) / unmatched
+                      : 0.0);
+  }
+}
+
+
+/** @brief Describes the arguments which determine the contents of the
+  * dimension table, so that an index is only used with the arguments it was
+  * built with.
   *
   * @param args commandline options.
-  * @param ht the hashtable to hold the data.
-  * @param filename the name of the dimension file.
   *
-  * @return the number of value fields.  Hackish, but hashjoin() needs to know
-  *         and has no other reason to parse the value arguments.
+  * @return a newly-allocated string.
   */
-static size_t hash_dimension_file(struct cmdargs *args, hashtbl_t *ht) {
-  char *value;
-  char *field_buffer = NULL;
-  size_t field_buffer_len = 0,
-         field_buffer_sz = 0;
+static char *index_signature(struct cmdargs *args) {
+  const char *parts[] = {
+    args->dimension_key_fields, args->key_labels,
+    args->dimension_fields, args->dimension_field_labels,
+    args->dimension_delim, args->delim
+  };
+  size_t i, n_parts = sizeof(parts) / sizeof(parts[0]), len = 0;
+  char *signature;
+
+  for (i = 0; i < n_parts; i++)
+    len += (parts[i] ? strlen(parts[i]) : 0) + 1;
+  signature = xmalloc(len + 1);
+  signature[0] = '\0';
+  /* the arguments cannot contain newlines, which separate them here. */
+  for (i = 0; i < n_parts; i++) {
+    if (parts[i])
+      strcat(signature, parts[i]);
+    strcat(signature, "\n");
+  }
+  return signature;
+}
+
+
+/** @brief Maps the index given with --index instead of hashing the dimension
+  * file.
+  *
+  * @param args commandline options.
+  * @param dim the dimension table to be initialized.
+  *
+  * @return the number of value fields.
+  */
+static size_t load_index(struct cmdargs *args, struct dimension *dim) {
+  char *signature = index_signature(args);
+  size_t n_values = 0;
+
+  switch (dim_index_open(&dim->index, args->index, args->dimension_file,
+                         signature, &n_values)) {
+    case DIM_INDEX_OK:
+      break;
+    case DIM_INDEX_ERR_IO:
+      warn(args->index);
+      exit(EXIT_FAILURE);
+    case DIM_INDEX_ERR_SOURCE:
+      warn(args->dimension_file);
+      exit(EXIT_FAILURE);
+    case DIM_INDEX_ERR_FORMAT:
+      fprintf(stderr, "%s: %s: not a dimension index\n", getenv("_"),
+              args->index);
+      exit(EXIT_FAILURE);
+    case DIM_INDEX_ERR_ARGS:
+      fprintf(stderr, "%s: %s: built with different key or dimension field "
+              "arguments\n", getenv("_"), args->index);
+      exit(EXIT_FAILURE);
+    case DIM_INDEX_ERR_STALE:
+      fprintf(stderr, "%s: %s: %s has changed since the index was built; "
+              "rebuild it with --build-index\n", getenv("_"), args->index,
+              args->dimension_file);
+      exit(EXIT_FAILURE);
+  }
+  free(signature);
+  dim->mapped = 1;
+  return n_values;
+}
+
+
+/** @brief Opens the dimension file and parses the key and value field
+  * arguments against it.
+  *
+  * @param args commandline options.
+  * @param fields the 0-based indexes of the dimension key and value fields.
+  *
+  * @return a reader positioned at the first line of the dimension file.
+  */
+static dbfr_t *open_dimension_file(struct cmdargs *args,
+                                   struct dimension_fields *fields) {
   int *key_fields = NULL,
       *val_fields = NULL;
   size_t key_fields_sz = 0,
@@ -290,6 +999,46 @@ static size_t hash_dimension_file(struct cmdargs *args, hashtbl_t *ht) {
   decrement(key_fields, n_key_fields);
   decrement(val_fields, n_val_fields);
 
+  fields->keys = key_fields;
+  fields->n_keys = n_key_fields;
+  fields->values = val_fields;
+  fields->n_values = n_val_fields;
+  return dim_file;
+}
+
+
+/** @brief Stores key and value fields from a dimension file in a hashtable.
+  *
+  * The hashtable is sized for the expected number of dimension keys up front,
+  * so that it need not be rehashed as it grows.
+  *
+  * @param args commandline options.
+  * @param ht the hashtable to be initialized with the data.
+  * @param values the store in which the table's values are kept.
+  *
+  * @return the number of value fields.  Hackish, but hashjoin() needs to know
+  *         and has no other reason to parse the value arguments.
+  */
+static size_t hash_dimension_file(struct cmdargs *args, hashtbl_t *ht,
+                                  value_store_t *values) {
+  char *value;
+  char *field_buffer = NULL;
+  size_t field_buffer_sz = 0;
+  struct dimension_fields fields;
+  size_t ht_sz;
+  dbfr_t *dim_file = open_dimension_file(args, &fields);
+
+  ht_sz = hll_presize(args->expected_keys, args->sample_size,
+                      args->dimension_file, args->key_labels != NULL,
+                      fields.keys, fields.n_keys, args->dimension_delim,
+                      DIMENSION_HASH_SZ);
+  if (ht_sz == 0) {
+    fprintf(stderr, "%s: --expected-keys and --sample-size must be positive "
+            "numbers.\n", getenv("_"));
+    exit(EXIT_FAILURE);
+  }
+  ht_init(ht, ht_sz, NULL, NULL);
+
   field_buffer = xmalloc(dim_file->next_line_len);
   field_buffer_sz = dim_file->next_line_len;
 
@@ -299,12 +1048,12 @@ static size_t hash_dimension_file(struct cmdargs *args, hashtbl_t *ht) {
       field_buffer_sz = dim_file->current_line_len;
     }
 
-    extract_fields(val_fields, n_val_fields, dim_file->current_line,
+    extract_fields(fields.values, fields.n_values, dim_file->current_line,
                    field_buffer, field_buffer_sz,
                    args->dimension_delim, args->delim);
-    value = xstrdup(field_buffer);
+    value = value_store_add(values, field_buffer);
 
-    extract_fields(key_fields, n_key_fields, dim_file->current_line,
+    extract_fields(fields.keys, fields.n_keys, dim_file->current_line,
                    field_buffer, field_buffer_sz,
                    args->dimension_delim, args->delim);
 
@@ -313,7 +1062,715 @@ static size_t hash_dimension_file(struct cmdargs *args, hashtbl_t *ht) {
 
   dbfr_close(dim_file);
   free(field_buffer);
+  free(fields.keys);
+  free(fields.values);
+
+  return fields.n_values;
+}
+
+
+/* The current time in seconds. */
+static double seconds(void) {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+
+/** @brief Prints the --verbose report of how a dimension file was loaded.
+  *
+  * @param args the dimension file's options.
+  * @param dim the dimension table.
+  * @param elapsed the seconds taken to load it.
+  */
+static void print_load_stats(struct cmdargs *args, struct dimension *dim,
+                             double elapsed) {
+#ifdef HAVE_SYS_RESOURCE_H
+  struct rusage usage;
+#endif
+  value_store_t *values = &dim->values;
+
+  fprintf(stderr, "%s: %s: loaded %lu keys in %.2f s; %lu values stored in "
+          "%lu copies of %.1f MB\n", getenv("_"), args->dimension_file,
+          (unsigned long) dim->ht.nelems, elapsed,
+          (unsigned long) values->n_values, (unsigned long) values->n_copies,
+          values->bytes / 1048576.0);
+#ifdef HAVE_SYS_RESOURCE_H
+  /* ru_maxrss is in kilobytes on Linux and the BSDs. */
+  if (getrusage(RUSAGE_SELF, &usage) == 0)
+    fprintf(stderr, "%s: %s: maximum resident set size %.1f MB\n",
+            getenv("_"), args->dimension_file, usage.ru_maxrss / 1024.0);
+#endif
+}
+
+
+/** @brief Parses a --memory-limit argument.
+  *
+  * @param arg a number of megabytes, or a number followed by K, M, or G.
+  *
+  * @return the limit in bytes, or 0 if the argument is malformatted.
+  */
+static double parse_memory_limit(const char *arg) {
+  char *end;
+  long n;
+
+  if (! isdigit((unsigned char) *arg))
+    return 0;
+  n = strtol(arg, &end, 10);
+  switch (toupper((unsigned char) *end)) {
+    case 'K':
+      return end[1] ? 0 : n * 1024.0;
+    case '\0':
+    case 'M':
+      return *end && end[1] ? 0 : n * 1048576.0;
+    case 'G':
+      return end[1] ? 0 : n * 1073741824.0;
+  }
+  return 0;
+}
+
+
+/** @brief Chooses the number of partitions for --memory-limit.
+  *
+  * @param args commandline options.
+  *
+  * @return the number of partitions, or 1 if the dimension file can be
+  *         hashed at once.
+  */
+static size_t grace_partitions(struct cmdargs *args) {
+  struct stat st;
+  double limit = parse_memory_limit(args->memory_limit);
+  size_t n_parts;
+
+  if (! args->dimension_file || stat(args->dimension_file, &st) != 0 ||
+      ! S_ISREG(st.st_mode))
+    return 1;
+  n_parts = (size_t) (st.st_size * (double) GRACE_OVERHEAD / limit) + 1;
+  return n_parts > GRACE_MAX_PARTITIONS ? GRACE_MAX_PARTITIONS : n_parts;
+}
+
+
+/* Opens an anonymous temporary file in $TMPDIR or /tmp. */
+static FILE *grace_tmpfile(void) {
+  const char *dir = getenv("TMPDIR");
+  char *path;
+  FILE *fp;
+  int fd;
+
+  if (! dir || ! *dir)
+    dir = "/tmp";
+  path = xmalloc(strlen(dir) + 20);
+  sprintf(path, "%s/hashjoin.XXXXXX", dir);
+  if ((fd = mkstemp(path)) < 0 || (fp = fdopen(fd, "w+")) == NULL) {
+    warn(path);
+    exit(EXIT_FAILURE);
+  }
+  unlink(path);
+  free(path);
+  return fp;
+}
+
+
+/* The partition of a key string. */
+static size_t grace_partition(struct grace *grace, const char *key) {
+  return bloom_hash(BLOOM_HASH_INIT, key, strlen(key)) % grace->n_parts;
+}
+
+
+/* Records the partition of the next output line. */
+static void grace_route(struct grace *grace, size_t part) {
+  uint16_t id = part;
+  fwrite(&id, sizeof(id), 1, grace->route);
+}
+
+
+/** @brief Writes the dimension rows to their partitions.
+  *
+  * @param args commandline options.
+  * @param grace the partitions to be initialized.
+  * @param n_parts the number of partitions.
+  *
+  * @return the number of value fields.
+  */
+static size_t grace_partition_dimension(struct cmdargs *args,
+                                        struct grace *grace, size_t n_parts) {
+  struct dimension_fields fields;
+  dbfr_t *dim_file = open_dimension_file(args, &fields);
+  char *value = NULL;
+  size_t value_sz = 0, i, part;
+
+  grace->n_parts = n_parts;
+  grace->dims = xmalloc(sizeof(FILE *) * n_parts);
+  grace->data = xmalloc(sizeof(FILE *) * n_parts);
+  for (i = 0; i < n_parts; i++) {
+    grace->dims[i] = grace_tmpfile();
+    grace->data[i] = grace_tmpfile();
+  }
+  grace->route = grace_tmpfile();
+  grace->passthrough = grace_tmpfile();
+
+  while (dbfr_getline(dim_file) > 0) {
+    if (dim_file->current_line_len > grace->keybuffer_sz) {
+      grace->keybuffer_sz = dim_file->current_line_len;
+      grace->keybuffer = xrealloc(grace->keybuffer, grace->keybuffer_sz);
+      value_sz = grace->keybuffer_sz;
+      value = xrealloc(value, value_sz);
+    }
+    extract_fields(fields.values, fields.n_values, dim_file->current_line,
+                   value, value_sz, args->dimension_delim, args->delim);
+    extract_fields(fields.keys, fields.n_keys, dim_file->current_line,
+                   grace->keybuffer, grace->keybuffer_sz,
+                   args->dimension_delim, args->delim);
+
+    part = grace_partition(grace, grace->keybuffer);
+    fwrite(grace->keybuffer, 1, strlen(grace->keybuffer) + 1,
+           grace->dims[part]);
+    fprintf(grace->dims[part], "%s\n", value);
+  }
+
+  dbfr_close(dim_file);
+  if (value)
+    free(value);
+  free(fields.keys);
+  free(fields.values);
+  return fields.n_values;
+}
+
+
+/** @brief Writes a line which needs no join, such as a header, to the
+  * output in its place among the data lines.
+  *
+  * @param grace the partitions.
+  * @param fmt the printf() format of the line, including its newline.
+  */
+static void grace_printf(struct grace *grace, const char *fmt, ...) {
+  va_list ap;
+
+  va_start(ap, fmt);
+  vfprintf(grace->passthrough, fmt, ap);
+  va_end(ap);
+  grace_route(grace, grace->n_parts);
+}
+
+
+/** @brief Writes the rest of a data file's lines to their partitions.
+  *
+  * @param grace the partitions.
+  * @param reader the data file, positioned after any header.
+  * @param key_fields the 0-based indexes of the data key fields.
+  * @param n_key_fields the number of elements in key_fields.
+  * @param delim the field separator of the data.
+  */
+static void grace_partition_lines(struct grace *grace, dbfr_t *reader,
+                                  int *key_fields, size_t n_key_fields,
+                                  const char *delim) {
+  size_t part;
+
+  while (dbfr_getline(reader) > 0) {
+    if (reader->current_line_len > grace->keybuffer_sz) {
+      grace->keybuffer_sz = reader->current_line_len;
+      grace->keybuffer = xrealloc(grace->keybuffer, grace->keybuffer_sz);
+    }
+    chomp(reader->current_line);
+    extract_fields(key_fields, n_key_fields, reader->current_line,
+                   grace->keybuffer, grace->keybuffer_sz, delim, delim);
+
+    part = grace_partition(grace, grace->keybuffer);
+    fwrite(grace->keybuffer, 1, strlen(grace->keybuffer) + 1,
+           grace->data[part]);
+    fprintf(grace->data[part], "%s\n", reader->current_line);
+    grace_route(grace, part);
+  }
+}
+
+
+/** @brief Joins each partition, then prints the joined lines in input order.
+  *
+  * @param grace the partitions, which are closed.
+  * @param delim the field separator of the data and output.
+  * @param empty_value the joined value for keys not in the dimension file.
+  * @param intern whether to keep one copy of each distinct value.
+  * @param verbose whether to report each partition's size.
+  * @param stats counts to be updated.
+  */
+static void grace_join(struct grace *grace, const char *delim,
+                       const char *empty_value, int intern, int verbose,
+                       struct probe_stats *stats) {
+  hashtbl_t ht;
+  value_store_t values;
+  FILE *out, *in;
+  char *record = NULL, *line;
+  const char *value;
+  size_t record_sz = 0, i;
+  ssize_t len;
+  uint16_t id;
+
+  for (i = 0; i < grace->n_parts; i++) {
+    ht_init(&ht, DIMENSION_HASH_SZ, NULL, NULL);
+    value_store_init(&values, intern);
+    rewind(grace->dims[i]);
+    while ((len = getline(&record, &record_sz, grace->dims[i])) > 0) {
+      record[len - 1] = '\0';
+      ht_put(&ht, record,
+             value_store_add(&values, record + strlen(record) + 1));
+    }
+    fclose(grace->dims[i]);
+    if (verbose)
+      fprintf(stderr, "%s: partition %lu has %lu keys\n", getenv("_"),
+              (unsigned long) i, (unsigned long) ht.nelems);
+
+    /* the joined lines replace the partition's data lines. */
+    out = grace_tmpfile();
+    rewind(grace->data[i]);
+    while ((len = getline(&record, &record_sz, grace->data[i])) > 0) {
+      record[len - 1] = '\0';
+      line = record + strlen(record) + 1;
+      stats->lines++;
+      if ((value = ht_get(&ht, record)) != NULL)
+        stats->matched++;
+      else
+        value = empty_value;
+      fprintf(out, "%s%s%s\n", line, delim, value);
+    }
+    fclose(grace->data[i]);
+    ht_destroy(&ht);
+    value_store_destroy(&values);
+    rewind(out);
+    grace->data[i] = out;
+  }
+
+  rewind(grace->route);
+  rewind(grace->passthrough);
+  while (fread(&id, sizeof(id), 1, grace->route) == 1) {
+    in = id == grace->n_parts ? grace->passthrough : grace->data[id];
+    if ((len = getline(&record, &record_sz, in)) > 0)
+      fwrite(record, 1, len, stdout);
+  }
+
+  for (i = 0; i < grace->n_parts; i++)
+    fclose(grace->data[i]);
+  fclose(grace->route);
+  fclose(grace->passthrough);
+  free(grace->dims);
+  free(grace->data);
+  if (grace->keybuffer)
+    free(grace->keybuffer);
+  if (record)
+    free(record);
+}
+
+
+/** @brief Hashes a dimension file, noting its size and modification time so
+  * that a change to it can be noticed.
+  *
+  * @param spec the dimension file, whose table is initialized.
+  * @param intern whether to keep one copy of each distinct value.
+  * @param verbose whether to report the time and memory taken.
+  */
+static void load_dimension(struct join_spec *spec, int intern, int verbose) {
+  struct cmdargs args = spec->args;
+  struct stat st;
+  double started = seconds();
+
+  /* expand_nums() consumes the field lists, which a reload needs again. */
+  if (args.dimension_key_fields)
+    args.dimension_key_fields = xstrdup(args.dimension_key_fields);
+  if (args.dimension_fields)
+    args.dimension_fields = xstrdup(args.dimension_fields);
 
-  return n_val_fields;
+  if (args.dimension_file && stat(args.dimension_file, &st) == 0) {
+    spec->source_size = st.st_size;
+    spec->source_mtime = st.st_mtime;
+  }
+  value_store_init(&spec->dim.values, intern);
+  spec->n_values = hash_dimension_file(&args, &spec->dim.ht,
+                                       &spec->dim.values);
+  filter_dimension(&spec->dim);
+  if (verbose)
+    print_load_stats(&args, &spec->dim, seconds() - started);
+
+  if (args.dimension_key_fields)
+    free(args.dimension_key_fields);
+  if (args.dimension_fields)
+    free(args.dimension_fields);
+}
+
+
+/* Releases a table loaded by load_dimension(). */
+static void unload_dimension(struct dimension *dim) {
+  ht_destroy(&dim->ht);
+  value_store_destroy(&dim->values);
+  if (dim->filtered)
+    bloom_destroy(&dim->filter);
+}
+
+
+/** @brief Loads again each dimension file whose size or modification time
+  * has changed.  The old table is kept until the new one is ready, and if
+  * the file cannot be found, such as while it is being replaced.
+  *
+  * @param specs the dimension files.
+  * @param n_specs the number of elements in specs.
+  * @param intern whether to keep one copy of each distinct value.
+  * @param verbose whether to report the reloads.
+  */
+static void reload_dimensions(struct join_spec *specs, size_t n_specs,
+                              int intern, int verbose) {
+  struct dimension old;
+  struct stat st;
+  size_t s;
+
+  for (s = 0; s < n_specs; s++) {
+    if (stat(specs[s].args.dimension_file, &st) != 0 ||
+        (st.st_size == specs[s].source_size &&
+         st.st_mtime == specs[s].source_mtime))
+      continue;
+    if (verbose)
+      fprintf(stderr, "%s: reloading %s\n", getenv("_"),
+              specs[s].args.dimension_file);
+    old = specs[s].dim;
+    memset(&specs[s].dim, 0, sizeof(struct dimension));
+    load_dimension(&specs[s], intern, verbose);
+    unload_dimension(&old);
+  }
+}
+
+
+/** @brief Joins the lines sent by one --connect client, until it has no more
+  * or goes away.
+  *
+  * @param fd the client's connection.
+  * @param specs the dimension files.
+  * @param n_specs the number of elements in specs.
+  * @param delim the field separator of the data and output.
+  * @param verbose whether to report how the client's lines were joined.
+  */
+static void serve_client(int fd, struct join_spec *specs, size_t n_specs,
+                         const char *delim, int verbose) {
+  char *msg = NULL, *out = NULL, *keybuffer = NULL, *line, *next, *end;
+  size_t msg_sz = 0, len, out_len, out_sz = 0, keybuffer_sz = 0, s;
+  struct probe_stats *stats = xcalloc(n_specs, sizeof(struct probe_stats));
+  enum header_action action;
+  int header_printed = 0;
+  uint32_t type;
+
+  while (join_receive(fd, &type, &msg, &msg_sz, &len) > 0) {
+    if (type == JOIN_MSG_END) {
+      join_send(fd, JOIN_MSG_END, NULL, 0);
+      break;
+    }
+    if (type != JOIN_MSG_LINES && type != JOIN_MSG_FILE) {
+      const char *error = "unknown message type";
+      join_send(fd, JOIN_MSG_ERROR, error, strlen(error));
+      break;
+    }
+
+    out_len = 0;
+    action = HEADER_JOIN;
+    end = msg + len;
+    for (line = msg; line < end; line = next + 1) {
+      if ((next = memchr(line, '\n', end - line)) == NULL)
+        next = end;
+      *next = '\0';
+
+      if (line == msg && type == JOIN_MSG_FILE) {
+        action = start_data_file(specs, n_specs, line, delim, header_printed);
+        header_printed = 1;
+        if (action == HEADER_SKIP)
+          continue;
+      }
+      join_line(specs, n_specs, line, delim,
+                line == msg && action == HEADER_LABEL, &keybuffer,
+                &keybuffer_sz, stats, &out, &out_len, &out_sz);
+    }
+    if (join_send(fd, JOIN_MSG_JOINED, out, out_len) != 0)
+      break;
+  }
+
+  for (s = 0; verbose && s < n_specs; s++) {
+    if (n_specs > 1)
+      fprintf(stderr, "%s: %s:\n", getenv("_"), specs[s].args.dimension_file);
+    print_stats(&specs[s].dim, &stats[s]);
+  }
+  free(stats);
+  if (msg)
+    free(msg);
+  if (out)
+    free(out);
+  if (keybuffer)
+    free(keybuffer);
+}
+
+
+/* set when --serve is asked to stop. */
+static volatile sig_atomic_t serve_stopped = 0;
+
+static void stop_serving(int signum) {
+  serve_stopped = 1;
+}
+
+
+/** @brief Answers --connect clients, one at a time, until interrupted.
+  * Changed dimension files are reloaded before each client is served.
+  *
+  * @param args commandline options.
+  * @param specs the loaded dimension files.
+  * @param n_specs the number of elements in specs.
+  *
+  * @return exit status for main() to return.
+  */
+static int serve_dimensions(struct cmdargs *args, struct join_spec *specs,
+                            size_t n_specs) {
+  struct sigaction action;
+  int listener, fd;
+
+  if ((listener = join_listen(args->serve)) < 0) {
+    warn("%s", args->serve);
+    return EXIT_FAILURE;
+  }
+
+  /* a client which goes away must not take the server with it, and an
+   * interrupted accept() must return so that the socket is removed. */
+  signal(SIGPIPE, SIG_IGN);
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = stop_serving;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+
+  if (args->verbose)
+    fprintf(stderr, "%s: serving on %s\n", getenv("_"), args->serve);
+  while (! serve_stopped) {
+    if ((fd = accept(listener, NULL, NULL)) < 0) {
+      if (errno == EINTR)
+        continue;
+      warn("%s", args->serve);
+      break;
+    }
+    reload_dimensions(specs, n_specs, args->intern_values, args->verbose);
+    serve_client(fd, specs, n_specs, args->delim, args->verbose);
+    close(fd);
+  }
+
+  close(listener);
+  unlink(args->serve);
+  return serve_stopped ? EXIT_OKAY : EXIT_FAILURE;
+}
+
+
+#ifdef HAVE_PTHREAD_H
+
+/* Joins the dimension values to each line of a chunk, filling its output. */
+static void probe_chunk(struct probe_pool *pool, struct probe_chunk *chunk,
+                        char **keybuffer, size_t *keybuffer_sz,
+                        struct probe_stats *stats) {
+  char *line, *end = chunk->lines + chunk->lines_len;
+
+  chunk->out_len = 0;
+  for (line = chunk->lines; line < end; line += strlen(line) + 1) {
+    join_line(pool->specs, pool->n_specs, line, pool->delim, 0,
+              keybuffer, keybuffer_sz, stats,
+              &chunk->out, &chunk->out_len, &chunk->out_sz);
+  }
+}
+
+
+static void *probe_worker(void *arg) {
+  struct probe_pool *pool = arg;
+  struct probe_chunk *chunk;
+  char *keybuffer = NULL;
+  size_t keybuffer_sz = 0;
+  struct probe_stats *stats = xcalloc(pool->n_specs,
+                                      sizeof(struct probe_stats));
+  size_t s;
+
+  for (;;) {
+    pthread_mutex_lock(&pool->lock);
+    while (pool->n_probed == pool->n_read && ! pool->finished)
+      pthread_cond_wait(&pool->cond, &pool->lock);
+    if (pool->n_probed == pool->n_read) {
+      pthread_mutex_unlock(&pool->lock);
+      break;
+    }
+    chunk = &(pool->ring[pool->n_probed++ % pool->n_slots]);
+    pthread_mutex_unlock(&pool->lock);
+
+    probe_chunk(pool, chunk, &keybuffer, &keybuffer_sz, stats);
+
+    pthread_mutex_lock(&pool->lock);
+    chunk->state = CHUNK_DONE;
+    pthread_cond_broadcast(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
+  }
+
+  pthread_mutex_lock(&pool->lock);
+  for (s = 0; s < pool->n_specs; s++) {
+    pool->stats[s].lines += stats[s].lines;
+    pool->stats[s].rejected += stats[s].rejected;
+    pool->stats[s].matched += stats[s].matched;
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  free(stats);
+  if (keybuffer)
+    free(keybuffer);
+  return NULL;
+}
+
+
+static void *probe_writer(void *arg) {
+  struct probe_pool *pool = arg;
+  struct probe_chunk *chunk;
+
+  for (;;) {
+    pthread_mutex_lock(&pool->lock);
+    chunk = &(pool->ring[pool->n_written % pool->n_slots]);
+    while (! (pool->n_written < pool->n_read && chunk->state == CHUNK_DONE) &&
+           ! (pool->finished && pool->n_written == pool->n_read))
+      pthread_cond_wait(&pool->cond, &pool->lock);
+    if (pool->n_written == pool->n_read) {
+      pthread_mutex_unlock(&pool->lock);
+      break;
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    fwrite(chunk->out, 1, chunk->out_len, stdout);
+
+    pthread_mutex_lock(&pool->lock);
+    chunk->state = CHUNK_FREE;
+    pool->n_written++;
+    pthread_cond_broadcast(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
+  }
+  return NULL;
+}
+
+
+/** @brief Starts the threads which look up data lines in the dimension
+  * table.
+  *
+  * @param pool the pool to be initialized.
+  * @param n_workers the number of threads probing the table.
+  * @param specs the dimension files, whose tables are only read from here
+  *              on.
+  * @param n_specs the number of elements in specs.
+  * @param delim the field separator of the data and output.
+  */
+static void probe_pool_start(struct probe_pool *pool, int n_workers,
+                             struct join_spec *specs, size_t n_specs,
+                             const char *delim) {
+  int i;
+
+  memset(pool, 0, sizeof(struct probe_pool));
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->cond, NULL);
+  /* enough chunks to keep every worker busy while the writer catches up. */
+  pool->n_slots = 2 * n_workers + 2;
+  pool->ring = xcalloc(pool->n_slots, sizeof(struct probe_chunk));
+  pool->specs = specs;
+  pool->n_specs = n_specs;
+  pool->delim = delim;
+  pool->stats = xcalloc(n_specs, sizeof(struct probe_stats));
+
+  pool->n_workers = n_workers;
+  pool->workers = xmalloc(sizeof(pthread_t) * n_workers);
+  for (i = 0; i < n_workers; i++) {
+    if (pthread_create(&(pool->workers[i]), NULL, probe_worker, pool) != 0) {
+      fprintf(stderr, "%s: failed to start a thread.\n", getenv("_"));
+      exit(EXIT_FAILURE);
+    }
+  }
+  if (pthread_create(&pool->writer, NULL, probe_writer, pool) != 0) {
+    fprintf(stderr, "%s: failed to start a thread.\n", getenv("_"));
+    exit(EXIT_FAILURE);
+  }
+}
+
+
+/** @brief Joins the rest of a data file using the pool's threads, returning
+  * once all of its output has been written.
+  *
+  * Chunks always end on a line boundary, and are written in the order they
+  * were read, so the output is the same as that of the single-threaded loop.
+  *
+  * @param pool the pool started by probe_pool_start().
+  * @param reader the data file, positioned after any header.
+  */
+static void probe_pool_lines(struct probe_pool *pool, dbfr_t *reader) {
+  struct probe_chunk *chunk = NULL;
+  ssize_t len;
+
+  while ((len = dbfr_getline(reader)) > 0) {
+    if (! chunk) {
+      pthread_mutex_lock(&pool->lock);
+      chunk = &(pool->ring[pool->n_read % pool->n_slots]);
+      while (chunk->state != CHUNK_FREE)
+        pthread_cond_wait(&pool->cond, &pool->lock);
+      pthread_mutex_unlock(&pool->lock);
+      chunk->lines_len = 0;
+    }
+    chomp(reader->current_line);
+    append(&chunk->lines, &chunk->lines_len, &chunk->lines_sz,
+           reader->current_line, strlen(reader->current_line) + 1);
+
+    if (chunk->lines_len >= PROBE_CHUNK_SZ) {
+      pthread_mutex_lock(&pool->lock);
+      chunk->state = CHUNK_READ;
+      pool->n_read++;
+      pthread_cond_broadcast(&pool->cond);
+      pthread_mutex_unlock(&pool->lock);
+      chunk = NULL;
+    }
+  }
+
+  pthread_mutex_lock(&pool->lock);
+  if (chunk) {
+    chunk->state = CHUNK_READ;
+    pool->n_read++;
+    pthread_cond_broadcast(&pool->cond);
+  }
+  while (pool->n_written < pool->n_read)
+    pthread_cond_wait(&pool->cond, &pool->lock);
+  pthread_mutex_unlock(&pool->lock);
+  fflush(stdout);
+}
+
+
+/** @brief Stops the pool's threads and releases its memory.
+  *
+  * @param pool the pool started by probe_pool_start().
+  * @param stats the counts of each dimension file, to which the workers'
+  *              counts are added.
+  */
+static void probe_pool_finish(struct probe_pool *pool,
+                              struct probe_stats *stats) {
+  size_t i;
+
+  pthread_mutex_lock(&pool->lock);
+  pool->finished = 1;
+  pthread_cond_broadcast(&pool->cond);
+  pthread_mutex_unlock(&pool->lock);
+
+  for (i = 0; i < pool->n_workers; i++)
+    pthread_join(pool->workers[i], NULL);
+  pthread_join(pool->writer, NULL);
+  for (i = 0; i < pool->n_specs; i++) {
+    stats[i].lines += pool->stats[i].lines;
+    stats[i].rejected += pool->stats[i].rejected;
+    stats[i].matched += pool->stats[i].matched;
+  }
+
+  for (i = 0; i < pool->n_slots; i++) {
+    if (pool->ring[i].lines)
+      free(pool->ring[i].lines);
+    if (pool->ring[i].out)
+      free(pool->ring[i].out);
+  }
+  free(pool->ring);
+  free(pool->workers);
+  free(pool->stats);
+  pthread_mutex_destroy(&pool->lock);
+  pthread_cond_destroy(&pool->cond);
 }
 
+#endif /* HAVE_PTHREAD_H */
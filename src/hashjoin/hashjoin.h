@@ -0,0 +1,203 @@
+/*****************************************
+   Copyright 2010 Google Inc.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *****************************************/
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <crush/hashtbl.h>
+#include <crush/mempool.h>
+
+#ifndef HASHJOIN_H
+#define HASHJOIN_H
+
+/* return codes of dim_index_open(). */
+#define DIM_INDEX_OK 0
+#define DIM_INDEX_ERR_IO 1      /**< the index could not be read; see errno. */
+#define DIM_INDEX_ERR_FORMAT 2  /**< not an index, or from another platform. */
+#define DIM_INDEX_ERR_ARGS 3    /**< built with other key or value fields. */
+#define DIM_INDEX_ERR_STALE 4   /**< the dimension file has changed. */
+#define DIM_INDEX_ERR_SOURCE 5  /**< the dimension file could not be read. */
+
+struct cmdargs;
+
+/** @brief handles one of the options which describe a dimension file,
+  * recording it for the -f it follows.  Called while the commandline is
+  * parsed.
+  *
+  * @param args commandline options, whose member for the option is set.
+  * @param opt the short option.
+  * @param arg the option's argument.
+  */
+void dimension_option(struct cmdargs *args, int opt, char *arg);
+
+/** @brief a dimension index mapped into memory.  Members of this struct
+  * should not be modified by user code. */
+typedef struct dim_index {
+  void *map;                                /**< the whole index file. */
+  size_t map_sz;
+  const struct dim_index_header *header;
+  const struct dim_index_slot *slots;       /**< the open-addressed table. */
+  const char *records;                      /**< key\0value\0 pairs. */
+  uint64_t mask;                            /**< number of slots - 1. */
+} dim_index_t;
+
+/** @brief writes the contents of a dimension table to an index file.
+  *
+  * The file is written next to path and renamed into place, so that runs
+  * which have the old index mapped are not disturbed.
+  *
+  * @param path the index file.
+  * @param ht the dimension table, mapping key strings to value strings.
+  * @param n_values the number of value fields in each value string.
+  * @param source the dimension file the table was read from.
+  * @param signature the arguments which determine the table's contents.
+  *
+  * @return 0 on success, or non-zero with errno set.
+  */
+int dim_index_build(const char *path, hashtbl_t *ht, size_t n_values,
+                    const char *source, const char *signature);
+
+/** @brief maps an index file into memory.
+  *
+  * @param index the index to be initialized.
+  * @param path the index file.
+  * @param source the dimension file, whose size and modification time must
+  *               match those it had when the index was built.
+  * @param signature the arguments the index must have been built with.
+  * @param n_values set to the number of value fields in each value string.
+  *
+  * @return DIM_INDEX_OK, or one of the DIM_INDEX_ERR codes.
+  */
+int dim_index_open(dim_index_t *index, const char *path, const char *source,
+                   const char *signature, size_t *n_values);
+
+/** @brief looks up a key in a mapped index.
+  *
+  * @param index the index.
+  * @param key the key string.
+  *
+  * @return the value string, or NULL if the key is not in the index.
+  */
+const char *dim_index_get(const dim_index_t *index, const char *key);
+
+/** @brief unmaps an index.
+  *
+  * @param index the index to be closed.
+  */
+void dim_index_close(dim_index_t *index);
+
+/** @brief the joined values of a dimension table.  They live as long as the
+  * table, so they are copied into a pool rather than allocated one by one.
+  * Members of this struct should not be modified by user code. */
+typedef struct value_store {
+  mempool_t *pool;
+  char **oversize;                          /**< values too long for a page. */
+  size_t n_oversize;
+  struct value_slot *slots;                 /**< the interned values, or NULL
+                                                 if values are not interned. */
+  size_t n_slots;
+  size_t n_values;                          /**< values added. */
+  size_t n_copies;                          /**< values copied. */
+  size_t bytes;                             /**< bytes copied. */
+} value_store_t;
+
+/** @brief initializes a value store.
+  *
+  * @param store the store to be initialized.
+  * @param intern whether to keep one copy of each distinct value.
+  */
+void value_store_init(value_store_t *store, int intern);
+
+/** @brief copies a value into a store.
+  *
+  * @param store the store.
+  * @param value the value string.
+  *
+  * @return the stored copy, which lasts until the store is destroyed.
+  */
+char *value_store_add(value_store_t *store, const char *value);
+
+/** @brief releases every value in a store.
+  *
+  * @param store the store to be destroyed.
+  */
+void value_store_destroy(value_store_t *store);
+
+/* message types of the --serve protocol; see serve.c. */
+#define JOIN_MSG_LINES 1    /**< data lines, each ending in a newline. */
+#define JOIN_MSG_FILE 2     /**< data lines which begin a data file. */
+#define JOIN_MSG_JOINED 3   /**< the joined lines of a LINES or FILE message. */
+#define JOIN_MSG_END 4      /**< the client has no more lines. */
+#define JOIN_MSG_ERROR 5    /**< the lines could not be joined; the payload
+                                 says why. */
+
+/** @brief creates the socket on which a join server listens, replacing any
+  * socket left at path.
+  *
+  * @param path the socket's path.
+  *
+  * @return the listening socket, or -1 with errno set.
+  */
+int join_listen(const char *path);
+
+/** @brief connects to a join server.
+  *
+  * @param path the server's socket.
+  *
+  * @return the connected socket, or -1 with errno set.
+  */
+int join_connect(const char *path);
+
+/** @brief sends a message.
+  *
+  * @param fd a connected socket.
+  * @param type one of the JOIN_MSG types.
+  * @param data the payload.
+  * @param len the length of data.
+  *
+  * @return 0 on success, or non-zero with errno set.
+  */
+int join_send(int fd, uint32_t type, const char *data, size_t len);
+
+/** @brief receives a message.
+  *
+  * @param fd a connected socket.
+  * @param type set to the message type.
+  * @param buf a buffer for the payload, which is grown as needed and
+  *            NUL-terminated.
+  * @param buf_sz the size of buf.
+  * @param len set to the length of the payload.
+  *
+  * @return 1 if a message was received, 0 if the other end closed the
+  *         connection, or -1 with errno set.
+  */
+int join_receive(int fd, uint32_t *type, char **buf, size_t *buf_sz,
+                 size_t *len);
+
+/** @brief joins data files by sending them to a join server, printing the
+  * joined lines.
+  *
+  * @param path the server's socket.
+  * @param argc number of cmd-line arguments.
+  * @param argv list of cmd-line arguments.
+  * @param optind index of the first data file in argv.  stdin is read if
+  *               there are none.
+  *
+  * @return exit status for main() to return.
+  */
+int join_client(const char *path, int argc, char *argv[], int optind);
+
+#endif /* HASHJOIN_H */
@@ -0,0 +1,277 @@
+/********************************
+   Copyright 2010 Google Inc.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ ********************************/
+
+/* The join server protocol.
+
+   hashjoin --serve keeps its dimension tables loaded and joins data lines
+   sent by hashjoin --connect over a Unix domain socket.  Each message is
+
+     type                    uint32_t, one of the JOIN_MSG types
+     length                  uint32_t, the number of bytes which follow
+     payload
+
+   in the byte order of the machine.  A client sends the lines of each data
+   file in batches, the first of which is a JOIN_MSG_FILE so that the server
+   can deal with the file's header, and waits for the JOINED lines of each
+   batch before sending the next.  It ends with JOIN_MSG_END, which the
+   server echoes. */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <err.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include <crush/dbfr.h>
+#include <crush/ffutils.h>
+#include <crush/general.h>
+
+#include "hashjoin_main.h"
+#include "hashjoin.h"
+
+#define JOIN_BATCH_SZ 65536
+
+/* the longest message accepted, so that a corrupt length cannot exhaust
+ * memory. */
+#define JOIN_MSG_MAX (1 << 30)
+
+struct join_msg_header {
+  uint32_t type;
+  uint32_t len;
+};
+
+/* fills in the address of a socket, returning non-zero if path is too
+ * long. */
+static int socket_address(struct sockaddr_un *addr, const char *path) {
+  memset(addr, 0, sizeof(struct sockaddr_un));
+  addr->sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr->sun_path)) {
+    errno = ENAMETOOLONG;
+    return 1;
+  }
+  strcpy(addr->sun_path, path);
+  return 0;
+}
+
+/* writes all of a buffer, returning non-zero on error. */
+static int write_fully(int fd, const void *buf, size_t len) {
+  const char *p = buf;
+  ssize_t n;
+  while (len > 0) {
+    if ((n = write(fd, p, len)) < 0) {
+      if (errno == EINTR)
+        continue;
+      return 1;
+    }
+    p += n;
+    len -= n;
+  }
+  return 0;
+}
+
+/* reads len bytes, returning the number read before end-of-file, or -1 on
+ * error. */
+static ssize_t read_fully(int fd, void *buf, size_t len) {
+  char *p = buf;
+  size_t done = 0;
+  ssize_t n;
+  while (done < len) {
+    if ((n = read(fd, p + done, len - done)) < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    if (n == 0)
+      break;
+    done += n;
+  }
+  return done;
+}
+
+
+int join_listen(const char *path) {
+  struct sockaddr_un addr;
+  struct stat st;
+  int fd;
+
+  if (socket_address(&addr, path) != 0)
+    return -1;
+  /* a socket left behind by a server which was killed. */
+  if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+    unlink(path);
+  if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+    return -1;
+  if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0 ||
+      listen(fd, 16) != 0) {
+    int saved_errno = errno;
+    close(fd);
+    errno = saved_errno;
+    return -1;
+  }
+  return fd;
+}
+
+
+int join_connect(const char *path) {
+  struct sockaddr_un addr;
+  int fd;
+
+  if (socket_address(&addr, path) != 0)
+    return -1;
+  if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+    return -1;
+  if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+    int saved_errno = errno;
+    close(fd);
+    errno = saved_errno;
+    return -1;
+  }
+  return fd;
+}
+
+
+int join_send(int fd, uint32_t type, const char *data, size_t len) {
+  struct join_msg_header header;
+
+  if (len > JOIN_MSG_MAX) {
+    errno = EMSGSIZE;
+    return 1;
+  }
+  header.type = type;
+  header.len = len;
+  if (write_fully(fd, &header, sizeof(header)) ||
+      write_fully(fd, data, len))
+    return 1;
+  return 0;
+}
+
+
+int join_receive(int fd, uint32_t *type, char **buf, size_t *buf_sz,
+                 size_t *len) {
+  struct join_msg_header header;
+  ssize_t n;
+
+  if ((n = read_fully(fd, &header, sizeof(header))) <= 0)
+    return n;
+  if (n < sizeof(header) || header.len > JOIN_MSG_MAX) {
+    errno = EPROTO;
+    return -1;
+  }
+  /* one more byte, so that the payload can be NUL-terminated. */
+  if (header.len + 1 > *buf_sz) {
+    *buf_sz = header.len + 1;
+    *buf = xrealloc(*buf, *buf_sz);
+  }
+  if (read_fully(fd, *buf, header.len) != header.len) {
+    if (errno == 0)
+      errno = EPROTO;
+    return -1;
+  }
+  (*buf)[header.len] = '\0';
+  *type = header.type;
+  *len = header.len;
+  return 1;
+}
+
+
+/* sends a batch of lines and prints the joined lines which come back,
+ * exiting on error. */
+static void exchange(int fd, const char *path, uint32_t type,
+                     const char *batch, size_t batch_len,
+                     char **reply, size_t *reply_sz) {
+  size_t len;
+  int n;
+
+  errno = 0;
+  if (join_send(fd, type, batch, batch_len) != 0 ||
+      (n = join_receive(fd, &type, reply, reply_sz, &len)) < 0) {
+    warn("%s", path);
+    exit(EXIT_FAILURE);
+  }
+  if (n == 0) {
+    fprintf(stderr, "%s: %s: the server closed the connection\n",
+            getenv("_"), path);
+    exit(EXIT_FAILURE);
+  }
+  if (type == JOIN_MSG_ERROR) {
+    fprintf(stderr, "%s: %s: %s\n", getenv("_"), path, *reply);
+    exit(EXIT_FAILURE);
+  }
+  fwrite(*reply, 1, len, stdout);
+}
+
+
+int join_client(const char *path, int argc, char *argv[], int optind) {
+  FILE *infile;
+  dbfr_t *reader;
+  char *batch = NULL, *reply = NULL;
+  size_t batch_len, batch_sz = 0, reply_sz = 0, line_len;
+  uint32_t type;
+  int fd;
+
+  if ((fd = join_connect(path)) < 0) {
+    warn("%s", path);
+    return EXIT_FAILURE;
+  }
+
+  if (argc > optind)
+    infile = nextfile(argc, argv, &optind, "r");
+  else
+    infile = stdin;
+
+  while (infile) {
+    reader = dbfr_init(infile);
+    type = JOIN_MSG_FILE;
+    batch_len = 0;
+    while (dbfr_getline(reader) > 0) {
+      line_len = strlen(reader->current_line);
+      if (batch_len + line_len + 1 > batch_sz) {
+        batch_sz = (batch_len + line_len + 1) * 2;
+        batch = xrealloc(batch, batch_sz);
+      }
+      memcpy(batch + batch_len, reader->current_line, line_len);
+      batch_len += line_len;
+      /* the last line of a file may lack its newline. */
+      if (batch[batch_len - 1] != '\n')
+        batch[batch_len++] = '\n';
+
+      if (batch_len >= JOIN_BATCH_SZ) {
+        exchange(fd, path, type, batch, batch_len, &reply, &reply_sz);
+        type = JOIN_MSG_LINES;
+        batch_len = 0;
+      }
+    }
+    if (batch_len > 0)
+      exchange(fd, path, type, batch, batch_len, &reply, &reply_sz);
+    dbfr_close(reader);
+    infile = nextfile(argc, argv, &optind, "r");
+  }
+
+  exchange(fd, path, JOIN_MSG_END, NULL, 0, &reply, &reply_sz);
+  close(fd);
+  if (batch)
+    free(batch);
+  if (reply)
+    free(reply);
+  return EXIT_OKAY;
+}
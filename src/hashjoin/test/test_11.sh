@@ -0,0 +1,37 @@
+test_number=11
+description="two-key join in several threads"
+
+infile="$test_dir/input_header.log"
+dimfile="$test_dir/dimension_header.log"
+
+subtest=1
+outfile="$test_dir/test_$test_number.$subtest.actual"
+expected="$test_dir/test_01.expected"
+
+$bin -T 3 -k 1,2 -l 1,2 -j 3,4 -f $dimfile $infile \
+  > "$outfile"
+
+if [ $? -ne 0 ] ||
+   [ "`diff -q $outfile $expected`" ]; then
+  test_status $test_number $subtest "$description" FAIL
+else
+  test_status $test_number $subtest "$description" PASS
+  rm "$outfile"
+fi
+
+subtest=2
+outfile="$test_dir/test_$test_number.$subtest.actual"
+expected="$test_dir/test_$test_number.$subtest.expected"
+
+$bin -k 1,2 -l 1,2 -j 3,4 -L "Mine-0${DELIMITER}Mine-1" -f $dimfile \
+  $infile $infile > "$expected" &&
+  $bin -T 2 -k 1,2 -l 1,2 -j 3,4 -L "Mine-0${DELIMITER}Mine-1" -f $dimfile \
+  $infile $infile > "$outfile"
+
+if [ $? -ne 0 ] ||
+   [ "`diff -q $outfile $expected`" ]; then
+  test_status $test_number $subtest "$description (several files)" FAIL
+else
+  test_status $test_number $subtest "$description (several files)" PASS
+  rm "$outfile" "$expected"
+fi
@@ -0,0 +1,33 @@
+test_number=12
+description="two-key join with a dimension index"
+
+infile="$test_dir/input_header.log"
+dimfile="$test_dir/dimension_header.log"
+indexfile="$test_dir/test_$test_number.idx"
+expected="$test_dir/test_01.expected"
+
+subtest=1
+outfile="$test_dir/test_$test_number.$subtest.actual"
+
+$bin -k 1,2 -l 1,2 -j 3,4 -f $dimfile -B $indexfile &&
+  $bin -k 1,2 -l 1,2 -j 3,4 -f $dimfile -I $indexfile $infile > "$outfile"
+
+if [ $? -ne 0 ] ||
+   [ "`diff -q $outfile $expected`" ]; then
+  test_status $test_number $subtest "$description" FAIL
+else
+  test_status $test_number $subtest "$description" PASS
+  rm "$outfile"
+fi
+
+subtest=2
+$bin -k 1,2 -l 1,3 -j 3,4 -f $dimfile -I $indexfile $infile \
+  > /dev/null 2>&1
+
+if [ $? -eq 0 ]; then
+  test_status $test_number $subtest "$description (other arguments)" FAIL
+else
+  test_status $test_number $subtest "$description (other arguments)" PASS
+fi
+
+rm -f "$indexfile"
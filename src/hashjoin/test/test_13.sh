@@ -0,0 +1,21 @@
+test_number=13
+description="two-key join with verbose filter statistics"
+
+infile="$test_dir/input_header.log"
+dimfile="$test_dir/dimension_header.log"
+outfile="$test_dir/test_$test_number.actual"
+errfile="$test_dir/test_$test_number.err"
+expected="$test_dir/test_01.expected"
+
+$bin -v -k 1,2 -l 1,2 -j 3,4 -f $dimfile $infile \
+  > "$outfile" 2> "$errfile"
+
+if [ $? -ne 0 ] ||
+   [ "`diff -q $outfile $expected`" ] ||
+   ! grep -q "4 data lines, 3 matched" "$errfile" ||
+   ! grep -q "rejected 1 lines; 0 false positives" "$errfile"; then
+  test_status $test_number 1 "$description" FAIL
+else
+  test_status $test_number 1 "$description" PASS
+  rm "$outfile" "$errfile"
+fi
@@ -0,0 +1,47 @@
+test_number=14
+description="join in partitions"
+
+dimfile="$test_dir/test_$test_number.dim"
+infile="$test_dir/test_$test_number.in"
+
+# enough dimension rows to need many partitions under a 1K limit.
+awk -v d="$DELIMITER" 'BEGIN {
+  print "Key" d "Value-0" d "Value-1";
+  for (i = 0; i < 2000; i++) print "k" i d "v" i d i * 7 }' > "$dimfile"
+awk -v d="$DELIMITER" 'BEGIN {
+  print "Line" d "Key";
+  for (i = 0; i < 3000; i++) print i d "k" (i * 37) % 2500 }' > "$infile"
+
+subtest=1
+outfile="$test_dir/test_$test_number.$subtest.actual"
+expected="$test_dir/test_$test_number.$subtest.expected"
+
+$bin -k 2 -l 1 -j 2,3 -m x,y -f $dimfile $infile > "$expected" &&
+  $bin -M 1K -k 2 -l 1 -j 2,3 -m x,y -f $dimfile $infile > "$outfile"
+
+if [ $? -ne 0 ] ||
+   [ "`diff -q $outfile $expected`" ]; then
+  test_status $test_number $subtest "$description" FAIL
+else
+  test_status $test_number $subtest "$description" PASS
+  rm "$outfile" "$expected"
+fi
+
+subtest=2
+outfile="$test_dir/test_$test_number.$subtest.actual"
+expected="$test_dir/test_$test_number.$subtest.expected"
+
+$bin -k 2 -l 1 -j 2,3 -L "V0${DELIMITER}V1" -f $dimfile \
+  $infile $infile > "$expected" &&
+  $bin -M 1K -k 2 -l 1 -j 2,3 -L "V0${DELIMITER}V1" -f $dimfile \
+  $infile $infile > "$outfile"
+
+if [ $? -ne 0 ] ||
+   [ "`diff -q $outfile $expected`" ]; then
+  test_status $test_number $subtest "$description (several files)" FAIL
+else
+  test_status $test_number $subtest "$description (several files)" PASS
+  rm "$outfile" "$expected"
+fi
+
+rm -f "$dimfile" "$infile"
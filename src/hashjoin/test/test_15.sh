@@ -0,0 +1,39 @@
+test_number=15
+description="two dimension files joined in one pass"
+
+dimfile="$test_dir/dimension_no_header.log"
+
+subtest=1
+infile="$test_dir/input_no_header.log"
+outfile="$test_dir/test_$test_number.$subtest.actual"
+expected="$test_dir/test_$test_number.$subtest.expected"
+
+printf '1,2,wee,3,5\n5,6,w00t,7,8\n7,8,nope,,none\n' > "$expected"
+$bin -k 1,2 -l 1,2 -j 3 -f $dimfile -f $dimfile -k 1 -l 1 -j 4 -m none \
+  $infile > "$outfile"
+
+if [ $? -ne 0 ] ||
+   [ "`diff -q $outfile $expected`" ]; then
+  test_status $test_number $subtest "$description" FAIL
+else
+  test_status $test_number $subtest "$description" PASS
+  rm "$outfile" "$expected"
+fi
+
+subtest=2
+infile="$test_dir/input_header.log"
+outfile="$test_dir/test_$test_number.$subtest.actual"
+expected="$test_dir/test_$test_number.$subtest.expected"
+
+printf 'Field-0,Field-1,Something-Else,Mine-0,Mine-1\n' > "$expected"
+printf '1,2,wee,3,5\n5,6,w00t,7,8\n7,8,nope,,none\n' >> "$expected"
+$bin -T 2 -L Mine-0 -k 1,2 -l 1,2 -j 3 -f $dimfile \
+  -f $dimfile -k 1 -l 1 -j 4 -m none -L Mine-1 $infile > "$outfile"
+
+if [ $? -ne 0 ] ||
+   [ "`diff -q $outfile $expected`" ]; then
+  test_status $test_number $subtest "$description (labels, threads)" FAIL
+else
+  test_status $test_number $subtest "$description (labels, threads)" PASS
+  rm "$outfile" "$expected"
+fi
@@ -0,0 +1,20 @@
+test_number=16
+description="two-key join with interned values and load statistics"
+
+infile="$test_dir/input_header.log"
+dimfile="$test_dir/dimension_header.log"
+outfile="$test_dir/test_$test_number.actual"
+errfile="$test_dir/test_$test_number.err"
+expected="$test_dir/test_01.expected"
+
+$bin -i -v -k 1,2 -l 1,2 -j 3,4 -f $dimfile $infile \
+  > "$outfile" 2> "$errfile"
+
+if [ $? -ne 0 ] ||
+   [ "`diff -q $outfile $expected`" ] ||
+   ! grep -q "loaded 5 keys in .* 5 values stored in 5 copies" "$errfile"; then
+  test_status $test_number 1 "$description" FAIL
+else
+  test_status $test_number 1 "$description" PASS
+  rm "$outfile" "$errfile"
+fi
@@ -0,0 +1,30 @@
+test_number=17
+description="two-key join through a join server"
+
+infile="$test_dir/input_header.log"
+dimfile="$test_dir/dimension_header.log"
+outfile="$test_dir/test_$test_number.actual"
+expected="$test_dir/test_01.expected"
+# socket paths are limited to about 100 characters.
+socket="${TMPDIR:-/tmp}/hashjoin_test_$$.sock"
+
+$bin -S "$socket" -k 1,2 -l 1,2 -j 3,4 -f $dimfile &
+server=$!
+for i in 1 2 3 4 5 6 7 8 9 10; do
+  [ -S "$socket" ] && break
+  sleep 1
+done
+
+$bin -C "$socket" $infile > "$outfile"
+status=$?
+kill $server
+wait $server
+server_status=$?
+
+if [ $status -ne 0 ] || [ $server_status -ne 0 ] || [ -e "$socket" ] ||
+   [ "`diff -q $outfile $expected`" ]; then
+  test_status $test_number 1 "$description" FAIL
+else
+  test_status $test_number 1 "$description" PASS
+  rm "$outfile"
+fi
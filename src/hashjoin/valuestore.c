@@ -0,0 +1,128 @@
+/********************************
+   Copyright 2010 Google Inc.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ ********************************/
+
+/* Storage for the joined values of a dimension table.
+
+   Values are copied one after another into the pages of a mempool, which
+   costs no allocator overhead per value and is released all at once.  A
+   value longer than a page gets an allocation of its own.
+
+   With interning, an open-addressed table of the values stored so far, at
+   most half full, finds an earlier copy of a value before it is copied
+   again.  Dimension files often repeat a few values, such as country
+   names, across millions of keys. */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <string.h>
+
+#include <crush/bloom.h>
+#include <crush/ffutils.h>
+#include <crush/general.h>
+
+#include "hashjoin.h"
+
+#define VALUE_PAGE_SZ (1 << 20)
+
+struct value_slot {
+  uint64_t hash;
+  char *value;              /* NULL if the slot is empty */
+};
+
+/* stores a value in the slot for its hash, which must not be full. */
+static void value_slot_put(struct value_slot *slots, size_t n_slots,
+                           uint64_t hash, char *value) {
+  size_t i;
+  for (i = hash & (n_slots - 1); slots[i].value; i = (i + 1) & (n_slots - 1))
+    ;
+  slots[i].hash = hash;
+  slots[i].value = value;
+}
+
+/* doubles the table of interned values. */
+static void value_slots_grow(value_store_t *store) {
+  struct value_slot *old = store->slots;
+  size_t n_old = store->n_slots, i;
+
+  store->n_slots *= 2;
+  store->slots = xcalloc(store->n_slots, sizeof(struct value_slot));
+  for (i = 0; i < n_old; i++) {
+    if (old[i].value)
+      value_slot_put(store->slots, store->n_slots, old[i].hash, old[i].value);
+  }
+  free(old);
+}
+
+
+void value_store_init(value_store_t *store, int intern) {
+  memset(store, 0, sizeof(value_store_t));
+  store->pool = mempool_create(VALUE_PAGE_SZ);
+  if (intern) {
+    store->n_slots = 1024;
+    store->slots = xcalloc(store->n_slots, sizeof(struct value_slot));
+  }
+}
+
+
+char *value_store_add(value_store_t *store, const char *value) {
+  size_t len = strlen(value) + 1, i;
+  uint64_t hash = 0;
+  char *copy;
+
+  store->n_values++;
+  if (store->slots) {
+    hash = bloom_hash(BLOOM_HASH_INIT, value, len);
+    for (i = hash & (store->n_slots - 1); store->slots[i].value;
+         i = (i + 1) & (store->n_slots - 1)) {
+      if (store->slots[i].hash == hash && str_eq(store->slots[i].value, value))
+        return store->slots[i].value;
+    }
+  }
+
+  if (len > VALUE_PAGE_SZ) {
+    copy = xstrdup(value);
+    store->oversize = xrealloc(store->oversize,
+                               sizeof(char *) * (store->n_oversize + 1));
+    store->oversize[store->n_oversize++] = copy;
+  } else {
+    copy = mempool_add(store->pool, value, len);
+  }
+  store->n_copies++;
+  store->bytes += len;
+
+  if (store->slots) {
+    if (2 * (store->n_copies + 1) > store->n_slots)
+      value_slots_grow(store);
+    value_slot_put(store->slots, store->n_slots, hash, copy);
+  }
+  return copy;
+}
+
+
+void value_store_destroy(value_store_t *store) {
+  size_t i;
+
+  mempool_destroy(store->pool);
+  for (i = 0; i < store->n_oversize; i++)
+    free(store->oversize[i]);
+  if (store->oversize)
+    free(store->oversize);
+  if (store->slots)
+    free(store->slots);
+  memset(store, 0, sizeof(value_store_t));
+}
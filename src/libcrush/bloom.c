@@ -0,0 +1,88 @@
+/*****************************************
+   Copyright 2010 Google Inc.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *****************************************/
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <string.h>
+#include <crush/bloom.h>
+#include <crush/general.h>
+
+#define BLOOM_BLOCK_WORDS 8     /* 512 bits, one cache line */
+
+/* the MurmurHash3 finalizer, which spreads the FNV-1a bits of short keys
+ * over the whole word. */
+static uint64_t bloom_mix(uint64_t h) {
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+
+void bloom_init(bloom_t *bf, size_t n_keys) {
+  size_t n_bits = n_keys * BLOOM_BITS_PER_KEY;
+  bf->n_blocks = 1;
+  while (bf->n_blocks * BLOOM_BLOCK_WORDS * 64 < n_bits)
+    bf->n_blocks *= 2;
+  bf->bits = xcalloc(bf->n_blocks * BLOOM_BLOCK_WORDS, sizeof(uint64_t));
+}
+
+
+void bloom_destroy(bloom_t *bf) {
+  if (bf->bits)
+    free(bf->bits);
+  memset(bf, 0, sizeof(bloom_t));
+}
+
+
+uint64_t bloom_hash(uint64_t h, const char *data, size_t len) {
+  size_t i;
+  for (i = 0; i < len; i++) {
+    h ^= (unsigned char) data[i];
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+
+/* the low bits of the mixed hash pick the block, and 9 bits of a second
+ * mix pick each bit within it. */
+void bloom_add(bloom_t *bf, uint64_t h) {
+  uint64_t m = bloom_mix(h), bits = bloom_mix(m ^ 0x9e3779b97f4a7c15ULL);
+  uint64_t *block = bf->bits + (m & (bf->n_blocks - 1)) * BLOOM_BLOCK_WORDS;
+  int i;
+
+  for (i = 0; i < BLOOM_N_HASHES; i++, bits >>= 9)
+    block[(bits & 511) >> 6] |= 1ULL << (bits & 63);
+}
+
+
+int bloom_check(const bloom_t *bf, uint64_t h) {
+  uint64_t m = bloom_mix(h), bits = bloom_mix(m ^ 0x9e3779b97f4a7c15ULL);
+  const uint64_t *block = bf->bits +
+                          (m & (bf->n_blocks - 1)) * BLOOM_BLOCK_WORDS;
+  int i;
+
+  for (i = 0; i < BLOOM_N_HASHES; i++, bits >>= 9) {
+    if (! (block[(bits & 511) >> 6] & (1ULL << (bits & 63))))
+      return 0;
+  }
+  return 1;
+}
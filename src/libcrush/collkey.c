@@ -0,0 +1,147 @@
+/*****************************************
+   Copyright 2010 Google Inc.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *****************************************/
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <string.h>
+#include <crush/collkey.h>
+#include <crush/ffutils.h>
+#include <crush/general.h>
+
+
+void collkey_init(collkey_t *k) {
+  memset(k, 0, sizeof(collkey_t));
+}
+
+
+/* appends the strxfrm(3) form of a field and its NUL to a key. */
+static void append_field(collkey_t *k, const char *field) {
+  size_t len;
+
+  for (;;) {
+    if (k->sz > k->len)
+      len = strxfrm(k->key + k->len, field, k->sz - k->len);
+    else
+      len = strxfrm(NULL, field, 0);
+    if (k->len + len < k->sz)
+      break;
+    /* too small: the contents are unspecified, so transform it again. */
+    k->sz = (k->len + len + 1) * 2;
+    k->key = xrealloc(k->key, k->sz);
+  }
+  k->len += len + 1;
+}
+
+
+void collkey_set(collkey_t *k, const char *line, const int *fields,
+                 size_t n_fields, const char *delim) {
+  int start, end, len;
+  size_t i;
+
+  k->len = 0;
+  for (i = 0; i < n_fields; i++) {
+    len = get_line_pos(line, fields[i], delim, &start, &end);
+    if (len < 0)
+      len = 0;
+    if (k->field_sz < (size_t) len + 1) {
+      k->field_sz = len + 1;
+      k->field = xrealloc(k->field, k->field_sz);
+    }
+    if (len > 0)
+      memcpy(k->field, line + start, len);
+    k->field[len] = '\0';
+    append_field(k, k->field);
+  }
+}
+
+
+void collkey_copy(collkey_t *dest, const collkey_t *src) {
+  if (dest->sz < src->len) {
+    dest->sz = src->len;
+    dest->key = xrealloc(dest->key, dest->sz);
+  }
+  if (src->len > 0)
+    memcpy(dest->key, src->key, src->len);
+  dest->len = src->len;
+}
+
+
+int collkey_cmp(const collkey_t *a, const collkey_t *b) {
+  /* strxfrm(3) output holds no NULs, so one field cannot run into the next:
+     where two keys first differ, either both are within a field, or one
+     field has ended and the shorter one sorts first, as with strcmp(3). */
+  int cmp = memcmp(a->key, b->key, a->len < b->len ? a->len : b->len);
+  if (cmp != 0)
+    return cmp;
+  return a->len < b->len ? -1 : a->len > b->len;
+}
+
+
+void collkey_destroy(collkey_t *k) {
+  if (k->key)
+    free(k->key);
+  if (k->field)
+    free(k->field);
+  memset(k, 0, sizeof(collkey_t));
+}
+
+
+void collkey_cache_init(collkey_cache_t *cache, const dbfr_t *reader,
+                        const int *fields, size_t n_fields,
+                        const char *delim) {
+  collkey_init(&cache->current);
+  collkey_init(&cache->next);
+  cache->fields = fields;
+  cache->n_fields = n_fields;
+  cache->delim = delim;
+  if (reader->next_line)
+    collkey_set(&cache->next, reader->next_line, fields, n_fields, delim);
+}
+
+
+ssize_t collkey_getline(collkey_cache_t *cache, dbfr_t *reader) {
+  collkey_t tmp;
+  ssize_t len = dbfr_getline(reader);
+
+  /* dbfr_getline() leaves the lines alone at eof. */
+  if (len <= 0)
+    return len;
+  tmp = cache->current;
+  cache->current = cache->next;
+  cache->next = tmp;
+  if (reader->next_line)
+    collkey_set(&cache->next, reader->next_line, cache->fields,
+                cache->n_fields, cache->delim);
+  return len;
+}
+
+
+int collkey_seek(collkey_cache_t *cache, dbfr_t *reader, off_t offset) {
+  if (dbfr_seek(reader, offset) != 0)
+    return -1;
+  if (reader->next_line)
+    collkey_set(&cache->next, reader->next_line, cache->fields,
+                cache->n_fields, cache->delim);
+  return 0;
+}
+
+
+void collkey_cache_destroy(collkey_cache_t *cache) {
+  collkey_destroy(&cache->current);
+  collkey_destroy(&cache->next);
+}
@@ -0,0 +1,90 @@
+/*****************************************
+   Copyright 2010 Google Inc.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *****************************************/
+
+/** @file bloom.h
+  * @brief blocked Bloom filters for cheap negative lookups.
+  *
+  * All of the bits for a key are set within a single 64-byte block, so a
+  * lookup touches one cache line.  Keys are added and checked by hash, and
+  * the hash can be computed over a key in several pieces, so a caller need
+  * not copy the pieces of a key together just to check it.
+  */
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifndef BLOOM_H
+#define BLOOM_H
+
+/** @brief the number of filter bits allotted to each expected key, for a
+  * false positive rate of about 1%. */
+#define BLOOM_BITS_PER_KEY 10
+
+/** @brief the number of bits set for each key. */
+#define BLOOM_N_HASHES 7
+
+/** @brief the starting value of bloom_hash(). */
+#define BLOOM_HASH_INIT 14695981039346656037ULL
+
+/** @brief a blocked Bloom filter.  Members of this struct should not be
+  * modified by user code. */
+typedef struct _bloom {
+  uint64_t *bits;       /**< n_blocks blocks of 8 words. */
+  size_t n_blocks;      /**< a power of 2. */
+} bloom_t;
+
+/** @brief initializes an empty filter.
+  *
+  * @param bf the filter to be initialized.
+  * @param n_keys the number of keys to be added.
+  */
+void bloom_init(bloom_t *bf, size_t n_keys);
+
+/** @brief releases the memory used by a filter.
+  *
+  * @param bf the filter to be destroyed.
+  */
+void bloom_destroy(bloom_t *bf);
+
+/** @brief hashes the next piece of a key.
+  *
+  * @param h BLOOM_HASH_INIT for the first piece, or the hash of the pieces
+  *          before this one.
+  * @param data the piece, which need not be NUL-terminated.
+  * @param len the length of data.
+  *
+  * @return the hash of the key so far.
+  */
+uint64_t bloom_hash(uint64_t h, const char *data, size_t len);
+
+/** @brief adds a key to a filter.
+  *
+  * @param bf the filter.
+  * @param h the key's bloom_hash().
+  */
+void bloom_add(bloom_t *bf, uint64_t h);
+
+/** @brief checks whether a key may have been added to a filter.
+  *
+  * @param bf the filter.
+  * @param h the key's bloom_hash().
+  *
+  * @return 0 if the key was certainly not added, non-zero if it may have
+  *         been.
+  */
+int bloom_check(const bloom_t *bf, uint64_t h);
+
+#endif /* BLOOM_H */
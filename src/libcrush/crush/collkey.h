@@ -0,0 +1,138 @@
+/*****************************************
+   Copyright 2010 Google Inc.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *****************************************/
+
+/** @file collkey.h
+  * @brief byte-comparable keys for the collation order of the locale.
+  *
+  * Comparing key fields with strcoll(3) means extracting them from both
+  * lines on every comparison, and a sort-merge compares each line several
+  * times.  A collkey holds the strxfrm(3) form of a line's key fields,
+  * built once, so that a comparison is a single memcmp(3) which orders
+  * keys as strcoll(3) would, field by field.
+  */
+
+#include <stdlib.h>
+
+#include <crush/dbfr.h>
+
+#ifndef COLLKEY_H
+#define COLLKEY_H
+
+/** @brief the collation key of a line.  Members of this struct should not
+  * be modified by user code. */
+typedef struct _collkey {
+  char *key;                 /**< the transformed fields, each followed by
+                                  a NUL. */
+  size_t len;                /**< the length of key. */
+  size_t sz;                 /**< the size of the key buffer. */
+  char *field;               /**< scratch space for one field. */
+  size_t field_sz;
+} collkey_t;
+
+/** @brief the collation keys of the current and next lines of a
+  * double-buffered reader. */
+typedef struct _collkey_cache {
+  collkey_t current;         /**< the key of the reader's current_line. */
+  collkey_t next;            /**< the key of the reader's next_line. */
+  const int *fields;         /**< the 0-based indexes of the key fields. */
+  size_t n_fields;
+  const char *delim;
+} collkey_cache_t;
+
+/** @brief initializes an empty key.
+  *
+  * @param k the key to be initialized.
+  */
+void collkey_init(collkey_t *k);
+
+/** @brief builds the key of a line.
+  *
+  * Fields which are not in the line are taken to be empty.
+  *
+  * @param k the key.
+  * @param line the line, whose trailing newline is ignored.
+  * @param fields the 0-based indexes of the key fields.
+  * @param n_fields the number of elements in fields.
+  * @param delim the field separator.
+  */
+void collkey_set(collkey_t *k, const char *line, const int *fields,
+                 size_t n_fields, const char *delim);
+
+/** @brief copies a key.
+  *
+  * @param dest the key to be overwritten.
+  * @param src the key to copy.
+  */
+void collkey_copy(collkey_t *dest, const collkey_t *src);
+
+/** @brief compares two keys built from the same number of fields.
+  *
+  * @param a a key.
+  * @param b another key.
+  *
+  * @return less than, equal to or greater than zero as a's fields collate
+  *         before, the same as or after b's.
+  */
+int collkey_cmp(const collkey_t *a, const collkey_t *b);
+
+/** @brief releases the memory used by a key.
+  *
+  * @param k the key to be destroyed.
+  */
+void collkey_destroy(collkey_t *k);
+
+/** @brief starts caching the keys of a reader's lines, building the key of
+  * its next_line.
+  *
+  * @param cache the cache to be initialized.
+  * @param reader the reader.
+  * @param fields the 0-based indexes of the key fields, which must last as
+  *               long as the cache.
+  * @param n_fields the number of elements in fields.
+  * @param delim the field separator.
+  */
+void collkey_cache_init(collkey_cache_t *cache, const dbfr_t *reader,
+                        const int *fields, size_t n_fields,
+                        const char *delim);
+
+/** @brief reads a line with dbfr_getline(), keeping the cached keys in step
+  * with the reader's lines.
+  *
+  * @param cache the reader's cache.
+  * @param reader the reader.
+  *
+  * @return the return value of dbfr_getline().
+  */
+ssize_t collkey_getline(collkey_cache_t *cache, dbfr_t *reader);
+
+/** @brief moves a reader with dbfr_seek(), keeping the cached key of its
+  * next line in step.
+  *
+  * @param cache the reader's cache.
+  * @param reader the reader.
+  * @param offset the start of a line, counted from where the reader started.
+  *
+  * @return the return value of dbfr_seek().
+  */
+int collkey_seek(collkey_cache_t *cache, dbfr_t *reader, off_t offset);
+
+/** @brief releases the memory used by a cache.
+  *
+  * @param cache the cache to be destroyed.
+  */
+void collkey_cache_destroy(collkey_cache_t *cache);
+
+#endif /* COLLKEY_H */
@@ -49,6 +49,14 @@ typedef struct {
   char *next_line;          /**< \brief holds the next line to be read. */
   ssize_t next_line_len;    /**< \brief the length of the next line. */
   size_t next_line_sz;      /**< \brief the size of the next_line buffer. */
+  off_t next_line_offset;   /**< \brief the number of bytes before next_line,
+                                        counted from where the reader
+                                        started. */
+  off_t end;                /**< \brief the offset at which the reader stops,
+                                        or -1.  see dbfr_set_end(). */
+  off_t base;               /**< \brief the offset in the file at which the
+                                        reader started, or -1 if the file
+                                        cannot seek. */
   FILE *file;               /**< \brief the file being read. */
   int eof;                  /**< \brief non-zero when EOF is reached in the
                                         current line. */
@@ -90,6 +98,29 @@ dbfr_t * dbfr_init(FILE *fp);
   */
 ssize_t dbfr_getline(dbfr_t *reader);
 
+/** \brief makes a reader stop short of the end of its file.
+  *
+  * This allows a part of a file to be read, e.g. by fseeko(3)ing its FILE to
+  * the start of the part before calling dbfr_init().
+  *
+  * \param reader a valid double-buffered reader object.
+  * \param end a number of bytes, counted from where the reader started.  The
+  *            reader reaches EOF at the first line which starts at or after
+  *            this offset.
+  */
+void dbfr_set_end(dbfr_t *reader, off_t end);
+
+/** \brief moves a reader so that its next line is the one starting at an
+  * offset.  The current line is kept, but line_no no longer counts the
+  * lines before it.
+  *
+  * \param reader a valid double-buffered reader object, whose file can seek.
+  * \param offset the start of a line, counted from where the reader started.
+  *
+  * \return 0 on success, or -1 with errno set.
+  */
+int dbfr_seek(dbfr_t *reader, off_t offset);
+
 /** \brief closes a double-buffered reader's file and releases its resources.
   *
   * \param reader a double-buffered reader object.
@@ -0,0 +1,100 @@
+/*****************************************
+   Copyright 2010 Google Inc.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *****************************************/
+
+/** @file heap.h
+  * @brief A binary min-heap of pointers.
+  *
+  * The element at the top of the heap is the one which compares lowest
+  * according to the heap's comparison function.  Keeping the N largest
+  * items of a stream is done by replacing the top whenever a larger item
+  * arrives; merging sorted streams is done by popping the top.
+  */
+
+#include <stdlib.h>
+
+#ifndef HEAP_H
+#define HEAP_H
+
+/** @brief compares two heap elements, returning a negative number, zero,
+  * or a positive number like strcmp(). */
+typedef int (*heap_cmp_func_t) (const void *, const void *);
+
+/** @brief a binary heap.  Members of this struct should not be modified by
+  * user code. */
+typedef struct _heap {
+  void **elems;          /**< the elements, in heap order. */
+  size_t n_elems;        /**< number of elements in the heap. */
+  size_t capacity;       /**< allocated size of elems. */
+  heap_cmp_func_t cmp;   /**< element comparison function. */
+} heap_t;
+
+/** @brief returns whether or not a heap is empty.
+  * @param h a heap_t pointer
+  */
+#define heap_empty( h ) \
+  ((h)->n_elems == 0)
+
+/** @brief returns the top element of a heap without removing it.
+  * @param h a non-empty heap_t pointer
+  */
+#define heap_peek( h ) \
+  ((h)->elems[0])
+
+/** @brief initializes a heap.
+  *
+  * @param h the heap to be initialized.
+  * @param capacity the number of elements to allocate space for.  The heap
+  *                 grows as needed.
+  * @param cmp the element comparison function.
+  *
+  * @return 0 on success, 1 if h or cmp is NULL.
+  */
+int heap_init(heap_t *h, size_t capacity, heap_cmp_func_t cmp);
+
+/** @brief releases the memory used by a heap.  The elements themselves are
+  * not freed.
+  *
+  * @param h the heap to be destroyed.
+  */
+void heap_destroy(heap_t *h);
+
+/** @brief adds an element to a heap.
+  *
+  * @param h the heap.
+  * @param elem the element to be added.
+  */
+void heap_push(heap_t *h, void *elem);
+
+/** @brief removes the top element of a heap.
+  *
+  * @param h the heap.
+  *
+  * @return the lowest element, or NULL if the heap is empty.
+  */
+void *heap_pop(heap_t *h);
+
+/** @brief replaces the top element of a heap with a new element.
+  *
+  * This is cheaper than a heap_pop() followed by a heap_push().
+  *
+  * @param h a non-empty heap.
+  * @param elem the new element.
+  *
+  * @return the element which was removed.
+  */
+void *heap_replace_top(heap_t *h, void *elem);
+
+#endif /* HEAP_H */
@@ -0,0 +1,121 @@
+/*****************************************
+   Copyright 2010 Google Inc.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *****************************************/
+
+/** @file hll.h
+  * @brief HyperLogLog estimates of the number of distinct strings.
+  *
+  * A sketch of 2^precision one-byte registers estimates the number of
+  * distinct strings added to it with a standard error of about
+  * 1.04 / sqrt(2^precision), however many strings there are.  This is
+  * used to size hash tables once instead of letting them rehash as they
+  * grow.
+  */
+
+#include <stdlib.h>
+
+#ifndef HLL_H
+#define HLL_H
+
+/** @brief the default sketch precision: 4096 registers, or ~1.6% error. */
+#define HLL_DEFAULT_PRECISION 12
+
+/** @brief the number of evenly-spaced blocks read by hll_sample_file(). */
+#define HLL_SAMPLE_BLOCKS 16
+
+/** @brief a HyperLogLog sketch.  Members of this struct should not be
+  * modified by user code. */
+typedef struct _hll {
+  unsigned char *registers;  /**< the highest rank seen for each bucket. */
+  size_t n_registers;        /**< 2^precision. */
+  int precision;             /**< bits of the hash used to pick a register. */
+} hll_t;
+
+/** @brief initializes a sketch.
+  *
+  * @param hll the sketch to be initialized.
+  * @param precision the number of registers as a power of 2, from 4 to 16.
+  *
+  * @return 0 on success, 1 if the precision is out of range.
+  */
+int hll_init(hll_t *hll, int precision);
+
+/** @brief releases the memory used by a sketch.
+  *
+  * @param hll the sketch to be destroyed.
+  */
+void hll_destroy(hll_t *hll);
+
+/** @brief adds a string to a sketch.
+  *
+  * @param hll the sketch.
+  * @param data the string, which need not be NUL-terminated.
+  * @param len the length of data.
+  */
+void hll_add(hll_t *hll, const char *data, size_t len);
+
+/** @brief estimates the number of distinct strings added to a sketch.
+  *
+  * @param hll the sketch.
+  *
+  * @return the estimated count.
+  */
+double hll_estimate(const hll_t *hll);
+
+/** @brief estimates the number of distinct keys in a delimited file.
+  *
+  * If the file is larger than sample_sz, HLL_SAMPLE_BLOCKS evenly-spaced
+  * blocks totalling sample_sz bytes are read, and the number of keys is
+  * extrapolated by treating the lines as random draws from the file's keys.
+  * Keys which are clustered together in the file are under-counted.
+  *
+  * @param path the file, which must be a regular file.
+  * @param sample_sz the number of bytes to read.
+  * @param skip_header whether the first line of the file is a header.
+  * @param fields the 0-based indexes of the key fields.
+  * @param n_fields the number of elements in fields.
+  * @param delim the field separator.
+  *
+  * @return the estimated number of keys, or 0 if the file could not be
+  *         sampled.
+  */
+size_t hll_sample_file(const char *path, size_t sample_sz, int skip_header,
+                       const int *fields, size_t n_fields, const char *delim);
+
+/** @brief chooses the initial size of a hash table from a tool's
+  * --expected-keys and --sample-size arguments.
+  *
+  * @param expected_keys the expected number of keys, or NULL.  This
+  *                      overrides sample_mb.
+  * @param sample_mb the number of megabytes of path to sample with
+  *                  hll_sample_file(), or NULL.
+  * @param path the file to be sampled, or NULL.  A file which cannot be
+  *             sampled, such as a pipe, leaves the default size.
+  * @param skip_header whether the first line of path is a header.
+  * @param fields the 0-based indexes of the key fields.
+  * @param n_fields the number of elements in fields.
+  * @param delim the field separator.
+  * @param default_sz the size to use without either argument, and the
+  *                   smallest size a sample can choose.
+  *
+  * @return the table size, or 0 if either argument is not a positive
+  *         number.
+  */
+size_t hll_presize(const char *expected_keys, const char *sample_mb,
+                   const char *path, int skip_header,
+                   const int *fields, size_t n_fields, const char *delim,
+                   size_t default_sz);
+
+#endif /* HLL_H */
@@ -24,6 +24,10 @@
   * the page size can be stored in the pool.  But ideally the page size will be
   * enough to hold several items.  And optimally, the page size should be a
   * multiple of the size of the things to be stored.
+  *
+  * Things are placed one after another.  One which does not fit in the rest
+  * of the last page starts a new page, so allocation takes constant time and
+  * the end of each page may go unused.
   */
 #include <stdlib.h>
 
@@ -41,7 +45,6 @@ struct _mempool_page {
 typedef struct _mempool {
   size_t page_size;  /**< @brief the capacity of each "page" of memory. */
   size_t n_pages;    /**< @brief the number of pages currently allocated. */
-  size_t next_unfull;/**< @brief the index of the first page with free space. */
   struct _mempool_page *pages; /**< @brief list of pages */
 } mempool_t;
 
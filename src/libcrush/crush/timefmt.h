@@ -0,0 +1,100 @@
+/*****************************************
+   Copyright 2010 Google Inc.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *****************************************/
+
+/** @file timefmt.h
+  * @brief Date formats compiled for fast parsing and printing.
+  *
+  * A format uses the strptime() conversions %Y, %y, %m, %d, %H, %M, %S,
+  * and %s, the shorthands %T, %F, %D, and %R, and %% for a literal percent
+  * sign.  Any other character must match itself.  Times are treated as
+  * UTC, so that no time zone lookups are needed for each line.
+  */
+
+#include <stdlib.h>
+#include <time.h>
+
+#ifndef TIMEFMT_H
+#define TIMEFMT_H
+
+/** @brief one element of a compiled format. */
+typedef struct _timefmt_elem {
+  char conv;      /**< conversion character, or 0 for a literal. */
+  char literal;   /**< the character to match if conv is 0. */
+} timefmt_elem_t;
+
+/** @brief a compiled date format.  Members of this struct should not be
+  * modified by user code. */
+typedef struct _timefmt {
+  timefmt_elem_t *elems;
+  size_t n_elems;
+} timefmt_t;
+
+/** @brief rounds a time down to the start of its bucket.
+  * @param t the time.
+  * @param width the bucket width in seconds.
+  */
+#define timefmt_floor( t, width ) \
+  ((t) - ((((t) % (width)) + (width)) % (width)))
+
+/** @brief compiles a date format.
+  *
+  * @param tf the format to be initialized.
+  * @param format the format string.
+  *
+  * @return 0 on success, 1 if the format uses an unsupported conversion.
+  */
+int timefmt_compile(timefmt_t *tf, const char *format);
+
+/** @brief releases the memory used by a compiled format.
+  *
+  * @param tf the format to be destroyed.
+  */
+void timefmt_destroy(timefmt_t *tf);
+
+/** @brief parses a date.  As with strptime(), anything following the
+  * matched date is ignored.
+  *
+  * @param tf the compiled format.
+  * @param s the string to be parsed.
+  * @param t set to the time in seconds since the epoch.
+  *
+  * @return 0 on success, 1 if the string does not match the format.
+  */
+int timefmt_parse(const timefmt_t *tf, const char *s, time_t *t);
+
+/** @brief prints a time using a compiled format.
+  *
+  * @param tf the compiled format.
+  * @param t the time in seconds since the epoch.
+  * @param buf the output buffer.
+  * @param buf_sz the size of buf.
+  *
+  * @return the length of the output, or 0 if buf is too small.
+  */
+size_t timefmt_format(const timefmt_t *tf, time_t t, char *buf,
+                      size_t buf_sz);
+
+/** @brief parses a duration such as "30s", "5m", "1h", "1d", or "1w".  A
+  * number with no unit is a number of seconds.
+  *
+  * @param s the duration.
+  *
+  * @return the number of seconds, or -1 if the duration is invalid or not
+  *         positive.
+  */
+long timefmt_duration(const char *s);
+
+#endif /* TIMEFMT_H */
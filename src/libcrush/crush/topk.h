@@ -0,0 +1,116 @@
+/*****************************************
+   Copyright 2010 Google Inc.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *****************************************/
+
+/** @file topk.h
+  * @brief Approximate heavy-hitter tracking using the Space-Saving algorithm
+  * (Metwally, Agrawal & El Abbadi, 2005).
+  *
+  * A summary holds at most K counters, no matter how many distinct keys are
+  * seen.  When a key which is not being tracked arrives and all counters are
+  * in use, the counter with the smallest weight is taken over by the new key,
+  * which inherits that weight as its potential over-estimation.  For every
+  * tracked key:
+  *
+  *   weight - error <= true weight <= weight
+  *
+  * and any key whose true weight is greater than the smallest tracked weight
+  * is guaranteed to be in the summary.
+  */
+
+#include <stdlib.h>
+
+#ifndef TOPK_H
+#define TOPK_H
+
+/** @brief a single Space-Saving counter. */
+typedef struct _topk_counter {
+  char *key;          /**< the key being counted. */
+  size_t key_sz;      /**< allocated size of the key buffer. */
+  double weight;      /**< estimated total weight of the key. */
+  double error;       /**< maximum over-estimation of weight. */
+  unsigned int hash;  /**< for internal use only. */
+  size_t heap_pos;    /**< for internal use only. */
+} topk_counter_t;
+
+/** @brief a Space-Saving summary.  Members of this struct should not be
+  * modified by user code. */
+typedef struct _topk {
+  size_t capacity;           /**< maximum number of counters (K). */
+  size_t n_counters;         /**< number of counters currently in use. */
+  topk_counter_t *counters;  /**< storage for the counters. */
+  topk_counter_t **heap;     /**< min-heap of counters ordered by weight. */
+  topk_counter_t **slots;    /**< open-addressed key index. */
+  size_t n_slots;            /**< size of the slots array (a power of 2). */
+  double total_weight;       /**< sum of all weights added. */
+} topk_t;
+
+/** @brief initializes a summary which will track at most K keys.
+  *
+  * @param tk the summary to be initialized.
+  * @param k the number of counters.
+  *
+  * @return 0 on success, 1 if tk is NULL or k is 0.
+  */
+int topk_init(topk_t *tk, size_t k);
+
+/** @brief releases the resources held by a summary.
+  *
+  * @param tk the summary to be destroyed.
+  */
+void topk_destroy(topk_t *tk);
+
+/** @brief adds weight to a key's counter, evicting the smallest counter if
+  * the key is not tracked and the summary is full.
+  *
+  * @param tk the summary.
+  * @param key the key to be counted.
+  * @param weight a non-negative amount to add to the key's weight.
+  *
+  * @return the counter now tracking key.
+  */
+topk_counter_t *topk_add(topk_t *tk, const char *key, double weight);
+
+/** @brief looks up the counter for a key.
+  *
+  * @param tk the summary.
+  * @param key the key to look up.
+  *
+  * @return the key's counter, or NULL if the key is not being tracked.
+  */
+topk_counter_t *topk_get(topk_t *tk, const char *key);
+
+/** @brief gets the smallest weight being tracked.
+  *
+  * Any key which is not in the summary has a true weight no greater than
+  * this value.
+  *
+  * @param tk the summary.
+  *
+  * @return the minimum counter weight, or 0 if the summary is not full.
+  */
+double topk_min_weight(topk_t *tk);
+
+/** @brief populates a list with the summary's counters in order of
+  * descending weight.
+  *
+  * @param tk the summary.
+  * @param array a list large enough to hold tk->n_counters pointers.
+  *
+  * @return the number of counters stored in array.
+  */
+size_t topk_sorted(topk_t *tk, topk_counter_t **array);
+
+#endif /* TOPK_H */
@@ -101,6 +101,8 @@ dbfr_t * dbfr_init(FILE *fp) {
   reader = xmalloc(sizeof(dbfr_t));
   memset(reader, 0, sizeof(*reader));
   reader->file = fp;
+  reader->end = -1;
+  reader->base = ftello(fp);
 
   if ((reader->next_line_len = getline(&(reader->next_line),
                                       &(reader->next_line_sz),
@@ -131,9 +133,13 @@ ssize_t dbfr_getline(dbfr_t *reader) {
   reader->next_line_len = cur_len;
 
   /* read in the new "next" line */
-  reader->next_line_len = getline(&(reader->next_line),
-                                  &(reader->next_line_sz),
-                                  reader->file);
+  reader->next_line_offset += reader->current_line_len;
+  if (reader->end >= 0 && reader->next_line_offset >= reader->end)
+    reader->next_line_len = 0;
+  else
+    reader->next_line_len = getline(&(reader->next_line),
+                                    &(reader->next_line_sz),
+                                    reader->file);
   if (reader->next_line_len < 1) {
     free(reader->next_line);
     reader->next_line = NULL;
@@ -143,6 +149,36 @@ ssize_t dbfr_getline(dbfr_t *reader) {
   return reader->current_line_len;
 }
 
+void dbfr_set_end(dbfr_t *reader, off_t end) {
+  reader->end = end;
+  if (reader->next_line_len > 0 && reader->next_line_offset >= end) {
+    free(reader->next_line);
+    reader->next_line = NULL;
+    reader->next_line_sz = 0;
+    reader->next_line_len = 0;
+  }
+}
+
+int dbfr_seek(dbfr_t *reader, off_t offset) {
+  if (reader->base < 0 ||
+      fseeko(reader->file, reader->base + offset, SEEK_SET) != 0)
+    return -1;
+  reader->next_line_offset = offset;
+  reader->eof = 0;
+  if (reader->end >= 0 && offset >= reader->end)
+    reader->next_line_len = 0;
+  else
+    reader->next_line_len = getline(&(reader->next_line),
+                                    &(reader->next_line_sz),
+                                    reader->file);
+  if (reader->next_line_len < 1) {
+    free(reader->next_line);
+    reader->next_line = NULL;
+    reader->next_line_sz = 0;
+  }
+  return 0;
+}
+
 void dbfr_close(dbfr_t *reader) {
   if (! reader)
     return;
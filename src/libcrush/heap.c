@@ -0,0 +1,100 @@
+/*****************************************
+   Copyright 2010 Google Inc.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *****************************************/
+
+#include <string.h>
+#include <crush/general.h>
+#include <crush/heap.h>
+
+
+static void heap_sift_up(heap_t *h, size_t pos) {
+  void *elem = h->elems[pos];
+  while (pos > 0) {
+    size_t parent = (pos - 1) / 2;
+    if (h->cmp(h->elems[parent], elem) <= 0)
+      break;
+    h->elems[pos] = h->elems[parent];
+    pos = parent;
+  }
+  h->elems[pos] = elem;
+}
+
+static void heap_sift_down(heap_t *h, size_t pos) {
+  void *elem = h->elems[pos];
+  for (;;) {
+    size_t child = 2 * pos + 1;
+    if (child >= h->n_elems)
+      break;
+    if (child + 1 < h->n_elems &&
+        h->cmp(h->elems[child + 1], h->elems[child]) < 0)
+      child++;
+    if (h->cmp(elem, h->elems[child]) <= 0)
+      break;
+    h->elems[pos] = h->elems[child];
+    pos = child;
+  }
+  h->elems[pos] = elem;
+}
+
+
+int heap_init(heap_t *h, size_t capacity, heap_cmp_func_t cmp) {
+  if (h == NULL || cmp == NULL)
+    return 1;
+  if (capacity == 0)
+    capacity = 16;
+  h->elems = xmalloc(sizeof(void *) * capacity);
+  h->n_elems = 0;
+  h->capacity = capacity;
+  h->cmp = cmp;
+  return 0;
+}
+
+
+void heap_destroy(heap_t *h) {
+  free(h->elems);
+  memset(h, 0, sizeof(heap_t));
+}
+
+
+void heap_push(heap_t *h, void *elem) {
+  if (h->n_elems == h->capacity) {
+    h->capacity *= 2;
+    h->elems = xrealloc(h->elems, sizeof(void *) * h->capacity);
+  }
+  h->elems[h->n_elems] = elem;
+  heap_sift_up(h, h->n_elems++);
+}
+
+
+void *heap_pop(heap_t *h) {
+  void *top;
+  if (h->n_elems == 0)
+    return NULL;
+  top = h->elems[0];
+  h->n_elems--;
+  if (h->n_elems > 0) {
+    h->elems[0] = h->elems[h->n_elems];
+    heap_sift_down(h, 0);
+  }
+  return top;
+}
+
+
+void *heap_replace_top(heap_t *h, void *elem) {
+  void *top = h->elems[0];
+  h->elems[0] = elem;
+  heap_sift_down(h, 0);
+  return top;
+}
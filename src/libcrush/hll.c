@@ -0,0 +1,297 @@
+/*****************************************
+   Copyright 2010 Google Inc.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *****************************************/
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <crush/ffutils.h>
+#include <crush/general.h>
+#include <crush/hll.h>
+
+#define HLL_LN2 0.69314718055994530942
+
+
+/* 64-bit FNV-1a, followed by the MurmurHash3 finalizer so that the high
+ * bits used to pick a register are well mixed for short keys. */
+static uint64_t hll_hash(const char *data, size_t len) {
+  uint64_t h = 14695981039346656037ULL;
+  size_t i;
+  for (i = 0; i < len; i++) {
+    h ^= (unsigned char) data[i];
+    h *= 1099511628211ULL;
+  }
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+/* natural log of x >= 1, so that libcrush does not need libm. */
+static double hll_ln(double x) {
+  double y, y2, term, sum = 0;
+  int k = 0, i;
+  while (x >= 2) {
+    x /= 2;
+    k++;
+  }
+  /* ln(x) = 2 * atanh((x - 1) / (x + 1)), which converges fast on [1, 2). */
+  y = (x - 1) / (x + 1);
+  y2 = y * y;
+  term = y;
+  for (i = 1; i < 40; i += 2) {
+    sum += term / i;
+    term *= y2;
+  }
+  return 2 * sum + k * HLL_LN2;
+}
+
+/* e^-x for x >= 0, also without libm. */
+static double hll_exp_neg(double x) {
+  double term = 1, sum = 1;
+  int k = 0, i;
+  while (x >= HLL_LN2) {
+    x -= HLL_LN2;
+    k++;
+  }
+  if (k > 1000)
+    return 0;
+  for (i = 1; i < 20; i++) {
+    term *= -x / i;
+    sum += term;
+  }
+  while (k-- > 0)
+    sum /= 2;
+  return sum;
+}
+
+/* the number of keys which, drawn n_lines times at random, would be expected
+ * to show n_keys distinct ones: the D for which D * (1 - e^(-n/D)) = n_keys,
+ * up to max_keys. */
+static double occupancy_keys(double n_keys, double n_lines, double max_keys) {
+  double lo = n_keys, hi = max_keys, mid;
+  int i;
+  if (hi <= lo || hi * (1 - hll_exp_neg(n_lines / hi)) <= n_keys)
+    return hi > lo ? hi : lo;
+  for (i = 0; i < 60; i++) {
+    mid = (lo + hi) / 2;
+    if (mid * (1 - hll_exp_neg(n_lines / mid)) < n_keys)
+      lo = mid;
+    else
+      hi = mid;
+  }
+  return (lo + hi) / 2;
+}
+
+
+int hll_init(hll_t *hll, int precision) {
+  if (precision < 4 || precision > 16)
+    return 1;
+  hll->precision = precision;
+  hll->n_registers = (size_t) 1 << precision;
+  hll->registers = xcalloc(hll->n_registers, 1);
+  return 0;
+}
+
+
+void hll_destroy(hll_t *hll) {
+  if (hll->registers)
+    free(hll->registers);
+  memset(hll, 0, sizeof(hll_t));
+}
+
+
+void hll_add(hll_t *hll, const char *data, size_t len) {
+  uint64_t h = hll_hash(data, len);
+  size_t index = h >> (64 - hll->precision);
+  uint64_t rest = h << hll->precision;
+  unsigned char rank = 1;
+
+  while (rank <= 64 - hll->precision && ! (rest & (1ULL << 63))) {
+    rest <<= 1;
+    rank++;
+  }
+  if (hll->registers[index] < rank)
+    hll->registers[index] = rank;
+}
+
+
+double hll_estimate(const hll_t *hll) {
+  double m = hll->n_registers, alpha, sum = 0, estimate;
+  size_t i, zeros = 0;
+
+  for (i = 0; i < hll->n_registers; i++) {
+    sum += 1.0 / (double) (1ULL << hll->registers[i]);
+    if (hll->registers[i] == 0)
+      zeros++;
+  }
+  if (hll->n_registers == 16)
+    alpha = 0.673;
+  else if (hll->n_registers == 32)
+    alpha = 0.697;
+  else if (hll->n_registers == 64)
+    alpha = 0.709;
+  else
+    alpha = 0.7213 / (1 + 1.079 / m);
+
+  estimate = alpha * m * m / sum;
+  /* linear counting is more accurate while many registers are unused.  A
+   * 64-bit hash needs no correction for large counts. */
+  if (estimate <= 2.5 * m && zeros > 0)
+    estimate = m * hll_ln(m / zeros);
+  return estimate;
+}
+
+
+/* adds the key of each line starting in [start, end) of a file to a sketch,
+ * returning the number of lines read. */
+static size_t sample_block(hll_t *hll, FILE *fp, off_t start, off_t end,
+                           int skip_header, const int *fields,
+                           size_t n_fields, const char *delim,
+                           char **line, size_t *line_sz,
+                           char **key, size_t *key_sz, size_t *bytes) {
+  ssize_t line_len;
+  size_t key_len, i, n_lines = 0;
+  int field_start, field_end;
+
+  if (fseeko(fp, start, SEEK_SET) != 0)
+    return 0;
+  /* a block usually begins inside a line which belongs to the one before. */
+  if (start > 0 || skip_header) {
+    if (getline(line, line_sz, fp) < 0)
+      return 0;
+  }
+
+  while (ftello(fp) < end && (line_len = getline(line, line_sz, fp)) > 0) {
+    if (*key_sz < (size_t) line_len + n_fields) {
+      *key_sz = line_len + n_fields;
+      *key = xrealloc(*key, *key_sz);
+    }
+    chomp(*line);
+    /* a newline cannot occur in a field, so it separates the key fields. */
+    for (key_len = 0, i = 0; i < n_fields; i++) {
+      if (get_line_pos(*line, fields[i], delim,
+                       &field_start, &field_end) > 0) {
+        memcpy(*key + key_len, *line + field_start,
+               field_end - field_start + 1);
+        key_len += field_end - field_start + 1;
+      }
+      (*key)[key_len++] = '\n';
+    }
+    hll_add(hll, *key, key_len);
+    *bytes += line_len;
+    n_lines++;
+  }
+  return n_lines;
+}
+
+
+size_t hll_sample_file(const char *path, size_t sample_sz, int skip_header,
+                       const int *fields, size_t n_fields, const char *delim) {
+  struct stat st;
+  FILE *fp;
+  hll_t hll;
+  char *line = NULL, *key = NULL;
+  size_t line_sz = 0, key_sz = 0, bytes = 0;
+  size_t n_lines = 0;
+  double n_keys, total_lines;
+  off_t stride, block_sz;
+  int i, n_blocks;
+
+  if (stat(path, &st) != 0 || ! S_ISREG(st.st_mode) || st.st_size == 0)
+    return 0;
+  if ((fp = fopen(path, "r")) == NULL)
+    return 0;
+  hll_init(&hll, HLL_DEFAULT_PRECISION);
+
+  if ((off_t) sample_sz >= st.st_size) {
+    n_blocks = 1;
+    stride = block_sz = st.st_size;
+  } else {
+    n_blocks = HLL_SAMPLE_BLOCKS;
+    stride = st.st_size / n_blocks;
+    block_sz = sample_sz / n_blocks;
+    if (block_sz < 1)
+      block_sz = 1;
+  }
+
+  for (i = 0; i < n_blocks; i++) {
+    n_lines += sample_block(&hll, fp, i * stride, i * stride + block_sz,
+                            i == 0 && skip_header, fields, n_fields, delim,
+                            &line, &line_sz, &key, &key_sz, &bytes);
+  }
+  n_keys = hll_estimate(&hll);
+
+  fclose(fp);
+  hll_destroy(&hll);
+  if (line)
+    free(line);
+  if (key)
+    free(key);
+
+  if (n_lines == 0)
+    return 0;
+  if (n_blocks > 1) {
+    /* the unread lines hold keys the sample has not seen.  treating the
+     * lines as random draws from the file's keys, the sample's distinct
+     * count says how many keys there are to draw from. */
+    total_lines = (double) n_lines * st.st_size / bytes;
+    n_keys = occupancy_keys(n_keys, n_lines, total_lines);
+  }
+  return n_keys < 1 ? 1 : (size_t) (n_keys + 0.5);
+}
+
+
+/* parses a positive decimal number, returning 0 if s is anything else. */
+static unsigned long parse_count(const char *s) {
+  char *end;
+  unsigned long n;
+  if (! isdigit((unsigned char) *s))
+    return 0;
+  n = strtoul(s, &end, 10);
+  return *end == '\0' ? n : 0;
+}
+
+
+size_t hll_presize(const char *expected_keys, const char *sample_mb,
+                   const char *path, int skip_header,
+                   const int *fields, size_t n_fields, const char *delim,
+                   size_t default_sz) {
+  unsigned long n;
+  size_t estimate;
+
+  if (expected_keys)
+    return parse_count(expected_keys);
+  if (sample_mb) {
+    if ((n = parse_count(sample_mb)) == 0)
+      return 0;
+    /* a low estimate may just be clustered keys, which cost nothing to
+     * leave at the default size. */
+    if (path && (estimate = hll_sample_file(path, (size_t) n << 20,
+                                            skip_header, fields, n_fields,
+                                            delim)) > default_sz)
+      return estimate;
+  }
+  return default_sz;
+}
@@ -52,7 +52,6 @@ mempool_t *mempool_create(size_t page_size) {
     free(pool);
     return NULL;
   }
-  pool->next_unfull = 0;
   return pool;
 }
 
@@ -74,27 +73,18 @@ void * mempool_alloc(mempool_t * pool, size_t n_bytes) {
   if (!pool || n_bytes == 0 || n_bytes > pool->page_size)
     return NULL;
 
-  /* find a page with enough room, or make a new page. */
-  for (i = pool->next_unfull; i < pool->n_pages; i++) {
-    if (bytes_available_in_page(pool, i) >= n_bytes)
-      break;
-  }
-
-  if (i == pool->n_pages) {
+  /* only the last page is tried, so that allocation takes constant time
+   * however many pages have a few bytes left over.  those bytes are lost. */
+  i = pool->n_pages - 1;
+  if (bytes_available_in_page(pool, i) < n_bytes) {
     if (! _mempool_add_page(pool))
       return NULL;
+    i++;
   }
 
   location = pool->pages[i].buffer + pool->pages[i].next;
   pool->pages[i].next += n_bytes;
 
-  /* reduce search time for subsequent allocations */
-  for (i = pool->next_unfull;
-       i < pool->n_pages && bytes_available_in_page(pool, i) == 0;
-       i++) {
-    pool->next_unfull++;
-  }
-
   return location;
 }
 
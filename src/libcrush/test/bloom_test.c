@@ -0,0 +1,62 @@
+/*****************************************
+   Copyright 2010 Google Inc.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *****************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <crush/bloom.h>
+#include "unittest.h"
+
+
+static uint64_t key_hash(const char *prefix, int i) {
+  char buf[32];
+  sprintf(buf, "%s-%d", prefix, i);
+  return bloom_hash(BLOOM_HASH_INIT, buf, strlen(buf));
+}
+
+int main(int argc, char *argv[]) {
+  bloom_t bf;
+  int i, missing = 0, false_positives = 0;
+
+  bloom_init(&bf, 10000);
+  for (i = 0; i < 10000; i++)
+    bloom_add(&bf, key_hash("key", i));
+
+  for (i = 0; i < 10000; i++) {
+    if (! bloom_check(&bf, key_hash("key", i)))
+      missing++;
+  }
+  ASSERT_INT_EQ(0, missing, "bloom_check: finds every key added");
+
+  for (i = 0; i < 10000; i++) {
+    if (bloom_check(&bf, key_hash("other", i)))
+      false_positives++;
+  }
+  ASSERT_TRUE(false_positives < 300,
+              "bloom_check: false positive rate under 3%");
+
+  ASSERT_TRUE(bloom_hash(bloom_hash(BLOOM_HASH_INIT, "ab", 2), "cd", 2) ==
+              bloom_hash(BLOOM_HASH_INIT, "abcd", 4),
+              "bloom_hash: a key can be hashed in pieces");
+  bloom_destroy(&bf);
+
+  bloom_init(&bf, 0);
+  ASSERT_INT_EQ(0, bloom_check(&bf, key_hash("key", 1)),
+                "bloom_check: empty filter");
+  bloom_destroy(&bf);
+
+  return unittest_has_error;
+}
@@ -0,0 +1,110 @@
+/*****************************************
+   Copyright 2010 Google Inc.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *****************************************/
+
+
+#include <locale.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <crush/collkey.h>
+#include "unittest.h"
+
+
+/* the sign of a comparison, for checking it against strcoll(3). */
+static int sign(int n) {
+  return n < 0 ? -1 : n > 0;
+}
+
+int main(int argc, char *argv[]) {
+  collkey_t a, b;
+  collkey_cache_t cache;
+  dbfr_t *reader;
+  char path[] = "/tmp/collkey_test.XXXXXX";
+  const char *words[] = { "", "a", "B", "ab", "b", "apple", "Apple", "a b" };
+  int fields[] = { 2, 0 };
+  int i, j, agrees;
+  FILE *fp;
+
+  setlocale(LC_COLLATE, "");
+  collkey_init(&a);
+  collkey_init(&b);
+
+  agrees = 1;
+  for (i = 0; i < sizeof(words) / sizeof(words[0]); i++) {
+    for (j = 0; j < sizeof(words) / sizeof(words[0]); j++) {
+      collkey_set(&a, words[i], fields + 1, 1, "\t");
+      collkey_set(&b, words[j], fields + 1, 1, "\t");
+      if (sign(collkey_cmp(&a, &b)) != sign(strcoll(words[i], words[j])))
+        agrees = 0;
+    }
+  }
+  ASSERT_TRUE(agrees, "collkey_cmp: orders single fields as strcoll");
+
+  collkey_set(&a, "a\tx\tb\n", fields, 2, "\t");
+  collkey_set(&b, "a\ty\tab\n", fields, 2, "\t");
+  ASSERT_TRUE(sign(collkey_cmp(&a, &b)) == sign(strcoll("b", "ab")),
+              "collkey_cmp: the first key field decides");
+
+  collkey_set(&a, "ab\tx\tb\n", fields, 2, "\t");
+  collkey_set(&b, "a\tx\tb", fields, 2, "\t");
+  ASSERT_TRUE(sign(collkey_cmp(&a, &b)) == sign(strcoll("ab", "a")),
+              "collkey_cmp: a shorter field is not extended by the next");
+
+  collkey_set(&a, "a\tx\tb\n", fields, 2, "\t");
+  collkey_set(&b, "a\ty\tb", fields, 2, "\t");
+  ASSERT_INT_EQ(0, collkey_cmp(&a, &b),
+                "collkey_cmp: equal keys, ignoring the newline");
+
+  collkey_copy(&b, &a);
+  ASSERT_INT_EQ(0, collkey_cmp(&a, &b), "collkey_copy: copies the key");
+
+  collkey_set(&a, "a\tx", fields, 2, "\t");
+  collkey_set(&b, "a\tx\t", fields, 2, "\t");
+  ASSERT_INT_EQ(0, collkey_cmp(&a, &b),
+                "collkey_set: missing fields are empty");
+
+  collkey_destroy(&a);
+  collkey_destroy(&b);
+
+  close(mkstemp(path));
+  fp = fopen(path, "w");
+  fprintf(fp, "a\t1\tz\nb\t2\tz\nb\t3\ty\n");
+  fclose(fp);
+
+  reader = dbfr_open(path);
+  collkey_cache_init(&cache, reader, fields, 2, "\t");
+  collkey_getline(&cache, reader);
+  collkey_getline(&cache, reader);
+  ASSERT_TRUE(collkey_cmp(&cache.current, &cache.next) != 0,
+              "collkey_getline: keys follow the lines");
+  collkey_getline(&cache, reader);
+  ASSERT_TRUE(reader->next_line == NULL, "collkey_getline: last line");
+  ASSERT_TRUE(collkey_getline(&cache, reader) <= 0, "collkey_getline: eof");
+  collkey_set(&a, "b\t3\ty\n", fields, 2, "\t");
+  ASSERT_INT_EQ(0, collkey_cmp(&a, &cache.current),
+                "collkey_getline: the current key is kept at eof");
+  collkey_seek(&cache, reader, strlen("a\t1\tz\n"));
+  collkey_set(&a, "b\t2\tz\n", fields, 2, "\t");
+  ASSERT_INT_EQ(0, collkey_cmp(&a, &cache.next),
+                "collkey_seek: the next key follows the seek");
+  collkey_destroy(&a);
+  collkey_cache_destroy(&cache);
+  dbfr_close(reader);
+  unlink(path);
+
+  return unittest_has_error;
+}
@@ -120,6 +120,62 @@ int test_dbfr_getline_2() {
   return 0;
 }
 
+/* tests reading part of a file. */
+int test_dbfr_set_end() {
+  FILE *f = fopen(TEST_FILENAME, "r");
+  dbfr_t *reader;
+  off_t line_len = strlen("this is line 1\n");
+  int n_lines = 0;
+
+  unittest_has_error = 0;
+  /* start at line 2 and stop before line 5. */
+  fseeko(f, line_len, SEEK_SET);
+  reader = dbfr_init(f);
+  dbfr_set_end(reader, line_len * 3);
+  while (dbfr_getline(reader) > 0)
+    n_lines++;
+  ASSERT_INT_EQ(3, n_lines, "dbfr_set_end: stop at the end offset");
+  ASSERT_STR_EQ("this is line 4\n", reader->current_line,
+                "dbfr_set_end: last line read");
+  ASSERT_TRUE(reader->eof, "dbfr_set_end: eof at the end offset");
+  ASSERT_LONG_EQ((long) line_len * 3, (long) reader->next_line_offset,
+                 "dbfr_set_end: next_line_offset counts bytes read");
+  dbfr_close(reader);
+
+  reader = dbfr_open(TEST_FILENAME);
+  dbfr_set_end(reader, 0);
+  ASSERT_TRUE(reader->next_line == NULL, "dbfr_set_end: an empty part");
+  ASSERT_TRUE(dbfr_getline(reader) <= 0 && reader->eof,
+              "dbfr_set_end: eof in an empty part");
+  dbfr_close(reader);
+  return unittest_has_error;
+}
+
+/* tests moving a reader to another line. */
+int test_dbfr_seek() {
+  dbfr_t *reader = dbfr_open(TEST_FILENAME);
+  off_t line_len = strlen("this is line 1\n");
+
+  unittest_has_error = 0;
+  dbfr_getline(reader);
+  ASSERT_INT_EQ(0, dbfr_seek(reader, line_len * 5),
+                "dbfr_seek: regular file");
+  ASSERT_STR_EQ("this is line 1\n", reader->current_line,
+                "dbfr_seek: current_line kept");
+  ASSERT_STR_EQ("this is line 6\n", reader->next_line,
+                "dbfr_seek: next_line read from the offset");
+  dbfr_getline(reader);
+  ASSERT_STR_EQ("this is line 6\n", reader->current_line,
+                "dbfr_seek: reading continues from the offset");
+  ASSERT_LONG_EQ((long) line_len * 6, (long) reader->next_line_offset,
+                 "dbfr_seek: next_line_offset follows the seek");
+  dbfr_seek(reader, line_len * (LINES_IN_TEST_FILE - 1));
+  ASSERT_TRUE(dbfr_getline(reader) > 0 && dbfr_getline(reader) <= 0 &&
+              reader->eof, "dbfr_seek: to the last line of the file");
+  dbfr_close(reader);
+  return unittest_has_error;
+}
+
 int main (int argc, char *argv[]) {
   int has_failures = 0;
 
@@ -133,6 +189,8 @@ int main (int argc, char *argv[]) {
   has_failures += test_dbfr_init();
   has_failures += test_dbfr_getline_1();
   has_failures += test_dbfr_getline_2();
+  has_failures += test_dbfr_set_end();
+  has_failures += test_dbfr_seek();
 
   teardown();
   if (has_failures)
@@ -0,0 +1,69 @@
+/*****************************************
+   Copyright 2010 Google Inc.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *****************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <crush/heap.h>
+#include "unittest.h"
+
+
+static int intptr_cmp(const void *a, const void *b) {
+  return *((const int *) a) - *((const int *) b);
+}
+
+int main(int argc, char *argv[]) {
+  heap_t h;
+  int values[] = { 5, 3, 8, 1, 9, 2, 7, 4, 6, 0 };
+  int expected[] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9 };
+  int largest[] = { 7, 8, 9 };
+  int popped[10];
+  int i, n, retval;
+
+  retval = heap_init(&h, 0, NULL);
+  ASSERT_INT_EQ(1, retval, "heap_init: rejects missing comparison function");
+
+  /* start small so that the heap has to grow. */
+  retval = heap_init(&h, 2, intptr_cmp);
+  ASSERT_INT_EQ(0, retval, "heap_init: clean initialization");
+  ASSERT_TRUE(heap_empty(&h), "heap_empty: new heap is empty");
+  ASSERT_TRUE(heap_pop(&h) == NULL, "heap_pop: NULL from an empty heap");
+
+  for (i = 0; i < 10; i++)
+    heap_push(&h, &values[i]);
+  ASSERT_LONG_EQ(10L, h.n_elems, "heap_push: all elements added");
+  ASSERT_INT_EQ(0, *((int *) heap_peek(&h)), "heap_peek: lowest on top");
+
+  n = 0;
+  while (! heap_empty(&h))
+    popped[n++] = *((int *) heap_pop(&h));
+  ASSERT_INT_EQ(10, n, "heap_pop: all elements removed");
+  ASSERT_INT_ARRAY_EQ(expected, popped, 10, "heap_pop: ascending order");
+
+  /* keep the 3 largest values. */
+  for (i = 0; i < 10; i++) {
+    if (h.n_elems < 3)
+      heap_push(&h, &values[i]);
+    else if (values[i] > *((int *) heap_peek(&h)))
+      heap_replace_top(&h, &values[i]);
+  }
+  n = 0;
+  while (! heap_empty(&h))
+    popped[n++] = *((int *) heap_pop(&h));
+  ASSERT_INT_ARRAY_EQ(largest, popped, 3, "heap_replace_top: bounded heap");
+
+  heap_destroy(&h);
+  return unittest_has_error;
+}
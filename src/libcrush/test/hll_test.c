@@ -0,0 +1,104 @@
+/*****************************************
+   Copyright 2010 Google Inc.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *****************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <crush/hll.h>
+#include "unittest.h"
+
+
+/* writes n_lines lines whose first field takes n_keys distinct values. */
+static void write_sample(const char *path, int n_lines, int n_keys) {
+  FILE *fp = fopen(path, "w");
+  int i;
+  fprintf(fp, "Key\tValue\n");
+  for (i = 0; i < n_lines; i++)
+    fprintf(fp, "key-%d\t%d\n", i % n_keys, i);
+  fclose(fp);
+}
+
+int main(int argc, char *argv[]) {
+  hll_t hll;
+  char buf[32], path[] = "/tmp/hll_test.XXXXXX";
+  int fields[] = { 0 };
+  int i, retval;
+  double estimate;
+  size_t n_keys;
+
+  retval = hll_init(&hll, 3);
+  ASSERT_INT_EQ(1, retval, "hll_init: rejects a precision below 4");
+
+  retval = hll_init(&hll, HLL_DEFAULT_PRECISION);
+  ASSERT_INT_EQ(0, retval, "hll_init: clean initialization");
+  ASSERT_TRUE(hll_estimate(&hll) == 0, "hll_estimate: empty sketch");
+
+  for (i = 0; i < 100; i++) {
+    sprintf(buf, "%d", i % 10);
+    hll_add(&hll, buf, strlen(buf));
+  }
+  estimate = hll_estimate(&hll);
+  ASSERT_TRUE(estimate > 9.5 && estimate < 10.5,
+              "hll_estimate: small counts are exact");
+
+  for (i = 0; i < 100000; i++) {
+    sprintf(buf, "%d", i);
+    hll_add(&hll, buf, strlen(buf));
+  }
+  estimate = hll_estimate(&hll);
+  ASSERT_TRUE(estimate > 95000 && estimate < 105000,
+              "hll_estimate: large counts are within 5%");
+  hll_destroy(&hll);
+
+  close(mkstemp(path));
+
+  write_sample(path, 20000, 500);
+  n_keys = hll_sample_file(path, 1 << 20, 1, fields, 1, "\t");
+  ASSERT_TRUE(n_keys >= 490 && n_keys <= 510,
+              "hll_sample_file: reads a small file entirely");
+
+  n_keys = hll_sample_file(path, 65536, 1, fields, 1, "\t");
+  ASSERT_TRUE(n_keys >= 450 && n_keys <= 600,
+              "hll_sample_file: low-cardinality keys are not extrapolated");
+
+  write_sample(path, 50000, 50000);
+  n_keys = hll_sample_file(path, 65536, 1, fields, 1, "\t");
+  ASSERT_TRUE(n_keys >= 40000 && n_keys <= 60000,
+              "hll_sample_file: extrapolates unique keys");
+
+  n_keys = hll_presize("1000", "1", path, 1, fields, 1, "\t", 1024);
+  ASSERT_LONG_EQ(1000L, (long) n_keys, "hll_presize: expected keys override");
+  n_keys = hll_presize(NULL, "1", path, 1, fields, 1, "\t", 1024);
+  ASSERT_TRUE(n_keys >= 40000 && n_keys <= 60000,
+              "hll_presize: samples the file");
+  n_keys = hll_presize(NULL, NULL, path, 1, fields, 1, "\t", 1024);
+  ASSERT_LONG_EQ(1024L, (long) n_keys, "hll_presize: default size");
+  n_keys = hll_presize(NULL, "1", NULL, 1, fields, 1, "\t", 1024);
+  ASSERT_LONG_EQ(1024L, (long) n_keys, "hll_presize: unsampled input");
+  n_keys = hll_presize("-5", NULL, path, 1, fields, 1, "\t", 1024);
+  ASSERT_LONG_EQ(0L, (long) n_keys, "hll_presize: rejects a bad count");
+  n_keys = hll_presize(NULL, "2x", path, 1, fields, 1, "\t", 1024);
+  ASSERT_LONG_EQ(0L, (long) n_keys, "hll_presize: rejects a bad size");
+
+  unlink(path);
+  n_keys = hll_sample_file(path, 65536, 1, fields, 1, "\t");
+  ASSERT_LONG_EQ(0L, (long) n_keys, "hll_sample_file: missing file");
+  n_keys = hll_sample_file("/dev/null", 65536, 0, fields, 1, "\t");
+  ASSERT_LONG_EQ(0L, (long) n_keys, "hll_sample_file: not a regular file");
+
+  return unittest_has_error;
+}
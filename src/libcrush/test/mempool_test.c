@@ -48,8 +48,8 @@ int main(int argc, char *argv[]) {
                 "mempool_add doesn't clobber pool data");
   ASSERT_TRUE(ptr_b == ptr_a + sizeof(test_int),
               "mempool_add puts new data in correct place");
-  ASSERT_LONG_EQ(1, pool->next_unfull,
-                 "mempool_alloc detects full buffer");
+  ASSERT_LONG_EQ(16, pool->pages[0].next,
+                 "mempool_add fills the page");
   ASSERT_LONG_EQ(1, pool->n_pages,
                  "mempool_alloc doesn't allocate new pages needlessly");
   mempool_add(pool, "goodbye world", strlen("goodbye world") + 1);
@@ -0,0 +1,73 @@
+/*****************************************
+   Copyright 2010 Google Inc.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *****************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <crush/timefmt.h>
+#include "unittest.h"
+
+
+int main(int argc, char *argv[]) {
+  timefmt_t tf;
+  time_t t;
+  char buf[64];
+  int retval;
+
+  retval = timefmt_compile(&tf, "%Y-%m-%d %Q");
+  ASSERT_INT_EQ(1, retval, "timefmt_compile: rejects unknown conversions");
+
+  retval = timefmt_compile(&tf, "%m-%d-%Y-%T");
+  ASSERT_INT_EQ(0, retval, "timefmt_compile: clean compilation");
+
+  retval = timefmt_parse(&tf, "03-15-2010-13:47:09", &t);
+  ASSERT_INT_EQ(0, retval, "timefmt_parse: accepts a matching date");
+  ASSERT_LONG_EQ(1268660829L, (long) t, "timefmt_parse: correct time");
+
+  retval = timefmt_parse(&tf, "03-15-2010 13:47:09", &t);
+  ASSERT_INT_EQ(1, retval, "timefmt_parse: rejects a mismatched literal");
+  retval = timefmt_parse(&tf, "13-15-2010-13:47:09", &t);
+  ASSERT_INT_EQ(1, retval, "timefmt_parse: rejects an invalid month");
+
+  t = timefmt_floor(t, 300);
+  ASSERT_TRUE(timefmt_format(&tf, t, buf, sizeof(buf)) > 0,
+              "timefmt_format: fits in the buffer");
+  ASSERT_STR_EQ("03-15-2010-13:45:00", buf, "timefmt_floor: 5-minute bucket");
+  ASSERT_LONG_EQ(0L, (long) timefmt_format(&tf, t, buf, 8),
+                 "timefmt_format: detects a short buffer");
+  timefmt_destroy(&tf);
+
+  timefmt_compile(&tf, "%s");
+  timefmt_parse(&tf, "-90", &t);
+  ASSERT_LONG_EQ(-120L, (long) timefmt_floor(t, 60),
+                 "timefmt_floor: rounds negative times down");
+  timefmt_destroy(&tf);
+
+  timefmt_compile(&tf, "%F");
+  timefmt_parse(&tf, "1969-12-31", &t);
+  ASSERT_LONG_EQ(-86400L, (long) t, "timefmt_parse: dates before the epoch");
+  timefmt_format(&tf, 951782400, buf, sizeof(buf));
+  ASSERT_STR_EQ("2000-02-29", buf, "timefmt_format: leap day");
+  timefmt_destroy(&tf);
+
+  ASSERT_LONG_EQ(300L, timefmt_duration("5m"), "timefmt_duration: minutes");
+  ASSERT_LONG_EQ(3600L, timefmt_duration("1h"), "timefmt_duration: hours");
+  ASSERT_LONG_EQ(45L, timefmt_duration("45"), "timefmt_duration: seconds");
+  ASSERT_LONG_EQ(-1L, timefmt_duration("5x"), "timefmt_duration: bad unit");
+  ASSERT_LONG_EQ(-1L, timefmt_duration("0m"), "timefmt_duration: zero");
+
+  return unittest_has_error;
+}
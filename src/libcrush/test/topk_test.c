@@ -0,0 +1,76 @@
+/*****************************************
+   Copyright 2010 Google Inc.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *****************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <crush/topk.h>
+#include "unittest.h"
+
+
+int main(int argc, char *argv[]) {
+  topk_t tk;
+  topk_counter_t *counter, *sorted[4];
+  char key[16];
+  int i, retval;
+
+  retval = topk_init(&tk, 0);
+  ASSERT_INT_EQ(1, retval, "topk_init: rejects zero capacity");
+
+  retval = topk_init(&tk, 3);
+  ASSERT_INT_EQ(0, retval, "topk_init: clean initialization");
+
+  topk_add(&tk, "a", 5);
+  topk_add(&tk, "b", 2);
+  counter = topk_add(&tk, "a", 1);
+  ASSERT_STR_EQ("a", counter->key, "topk_add: returns the key's counter");
+  ASSERT_TRUE(counter->weight == 6, "topk_add: accumulates weight");
+  ASSERT_TRUE(counter->error == 0, "topk_add: no error before eviction");
+  ASSERT_TRUE(topk_min_weight(&tk) == 0,
+              "topk_min_weight: zero while not full");
+
+  topk_add(&tk, "c", 3);
+  ASSERT_TRUE(topk_min_weight(&tk) == 2,
+              "topk_min_weight: smallest counter once full");
+
+  /* "d" takes over the counter for "b" */
+  counter = topk_add(&tk, "d", 1);
+  ASSERT_TRUE(topk_get(&tk, "b") == NULL, "topk_add: evicts smallest key");
+  ASSERT_TRUE(counter->weight == 3, "topk_add: evicted weight is inherited");
+  ASSERT_TRUE(counter->error == 2, "topk_add: error is the evicted weight");
+  ASSERT_LONG_EQ(3L, tk.n_counters, "topk_add: capacity is respected");
+
+  ASSERT_LONG_EQ(3L, topk_sorted(&tk, sorted),
+                 "topk_sorted: returns the number of counters");
+  ASSERT_STR_EQ("a", sorted[0]->key, "topk_sorted: heaviest key first");
+  ASSERT_STR_EQ("c", sorted[1]->key, "topk_sorted: ties ordered by key");
+  ASSERT_STR_EQ("d", sorted[2]->key, "topk_sorted: ties ordered by key");
+  ASSERT_TRUE(tk.total_weight == 12, "topk_add: tracks total weight");
+
+  /* churn through many keys to exercise index deletion. */
+  for (i = 0; i < 1000; i++) {
+    sprintf(key, "k%d", i % 97);
+    topk_add(&tk, key, 1);
+    topk_add(&tk, "a", 1);
+  }
+  ASSERT_TRUE(topk_get(&tk, "a") != NULL, "topk_add: heavy hitter retained");
+  ASSERT_TRUE(topk_get(&tk, "a")->weight - topk_get(&tk, "a")->error <= 1006 &&
+              topk_get(&tk, "a")->weight >= 1006,
+              "topk_add: estimate brackets true weight");
+  topk_destroy(&tk);
+
+  return unittest_has_error;
+}
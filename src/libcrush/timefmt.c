@@ -0,0 +1,282 @@
+/*****************************************
+   Copyright 2010 Google Inc.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *****************************************/
+
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+#include <crush/general.h>
+#include <crush/timefmt.h>
+
+
+/* days between 1970-01-01 and a date in the proleptic Gregorian calendar. */
+static long days_from_civil(long y, int m, int d) {
+  long era, yoe, doy, doe;
+  y -= m <= 2;
+  era = (y >= 0 ? y : y - 399) / 400;
+  yoe = y - era * 400;
+  doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+  doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + doe - 719468;
+}
+
+/* the date of a number of days since 1970-01-01. */
+static void civil_from_days(long z, long *y, int *m, int *d) {
+  long era, doe, yoe, doy, mp;
+  z += 719468;
+  era = (z >= 0 ? z : z - 146096) / 146097;
+  doe = z - era * 146097;
+  yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  mp = (5 * doy + 2) / 153;
+  *d = doy - (153 * mp + 2) / 5 + 1;
+  *m = mp < 10 ? mp + 3 : mp - 9;
+  *y = yoe + era * 400 + (*m <= 2);
+}
+
+static void timefmt_add(timefmt_t *tf, size_t *sz, char conv, char literal) {
+  if (tf->n_elems == *sz) {
+    *sz *= 2;
+    tf->elems = xrealloc(tf->elems, sizeof(timefmt_elem_t) * *sz);
+  }
+  tf->elems[tf->n_elems].conv = conv;
+  tf->elems[tf->n_elems].literal = literal;
+  tf->n_elems++;
+}
+
+
+int timefmt_compile(timefmt_t *tf, const char *format) {
+  size_t sz = 16;
+  const char *expansion, *p;
+
+  tf->elems = xmalloc(sizeof(timefmt_elem_t) * sz);
+  tf->n_elems = 0;
+
+  for (; *format; format++) {
+    if (*format != '%') {
+      timefmt_add(tf, &sz, 0, *format);
+      continue;
+    }
+    format++;
+    expansion = NULL;
+    switch (*format) {
+      case 'Y': case 'y': case 'm': case 'd':
+      case 'H': case 'M': case 'S': case 's':
+        timefmt_add(tf, &sz, *format, 0);
+        break;
+      case '%':
+        timefmt_add(tf, &sz, 0, '%');
+        break;
+      case 'T':
+        expansion = "H:M:S";
+        break;
+      case 'F':
+        expansion = "Y-m-d";
+        break;
+      case 'D':
+        expansion = "m/d/y";
+        break;
+      case 'R':
+        expansion = "H:M";
+        break;
+      default:
+        timefmt_destroy(tf);
+        return 1;
+    }
+    /* in an expansion, letters are conversions and the rest literals. */
+    for (p = expansion; p && *p; p++) {
+      if (isalpha(*p))
+        timefmt_add(tf, &sz, *p, 0);
+      else
+        timefmt_add(tf, &sz, 0, *p);
+    }
+  }
+  return 0;
+}
+
+
+void timefmt_destroy(timefmt_t *tf) {
+  if (tf->elems)
+    free(tf->elems);
+  memset(tf, 0, sizeof(timefmt_t));
+}
+
+
+/* parses up to max_digits digits, requiring at least one. */
+static const char *parse_digits(const char *s, int max_digits, long *value) {
+  int n = 0;
+  *value = 0;
+  while (n < max_digits && isdigit((unsigned char) s[n])) {
+    *value = *value * 10 + (s[n] - '0');
+    n++;
+  }
+  return n ? s + n : NULL;
+}
+
+
+int timefmt_parse(const timefmt_t *tf, const char *s, time_t *t) {
+  long year = 1970, month = 1, day = 1, hour = 0, minute = 0, second = 0;
+  long value;
+  int negative, have_epoch = 0;
+  time_t epoch = 0;
+  size_t i;
+
+  for (i = 0; i < tf->n_elems; i++) {
+    const timefmt_elem_t *e = &(tf->elems[i]);
+    if (! e->conv) {
+      if (*s != e->literal)
+        return 1;
+      s++;
+      continue;
+    }
+    switch (e->conv) {
+      case 'Y':
+        s = parse_digits(s, 4, &year);
+        break;
+      case 'y':
+        /* as with strptime(), 69-99 are in the 20th century. */
+        if ((s = parse_digits(s, 2, &value)) != NULL)
+          year = value < 69 ? 2000 + value : 1900 + value;
+        break;
+      case 'm':
+        s = parse_digits(s, 2, &month);
+        break;
+      case 'd':
+        s = parse_digits(s, 2, &day);
+        break;
+      case 'H':
+        s = parse_digits(s, 2, &hour);
+        break;
+      case 'M':
+        s = parse_digits(s, 2, &minute);
+        break;
+      case 'S':
+        s = parse_digits(s, 2, &second);
+        break;
+      case 's':
+        negative = (*s == '-');
+        if (negative)
+          s++;
+        epoch = 0;
+        if (! isdigit((unsigned char) *s))
+          return 1;
+        while (isdigit((unsigned char) *s))
+          epoch = epoch * 10 + (*s++ - '0');
+        if (negative)
+          epoch = -epoch;
+        have_epoch = 1;
+        break;
+    }
+    if (s == NULL)
+      return 1;
+  }
+
+  if (have_epoch) {
+    *t = epoch;
+    return 0;
+  }
+  if (month < 1 || month > 12 || day < 1 || day > 31 || hour > 23 ||
+      minute > 59 || second > 60)
+    return 1;
+  *t = (time_t) days_from_civil(year, month, day) * 86400 +
+       hour * 3600 + minute * 60 + second;
+  return 0;
+}
+
+
+size_t timefmt_format(const timefmt_t *tf, time_t t, char *buf,
+                      size_t buf_sz) {
+  long days = (long) (t / 86400), secs = (long) (t % 86400), year;
+  int month, day, n;
+  size_t i, len = 0;
+
+  if (secs < 0) {
+    secs += 86400;
+    days--;
+  }
+  civil_from_days(days, &year, &month, &day);
+
+  for (i = 0; i < tf->n_elems; i++) {
+    const timefmt_elem_t *e = &(tf->elems[i]);
+    char *p = buf + len;
+    size_t room = buf_sz - len;
+    switch (e->conv) {
+      case 0:
+        n = snprintf(p, room, "%c", e->literal);
+        break;
+      case 'Y':
+        n = snprintf(p, room, "%04ld", year);
+        break;
+      case 'y':
+        n = snprintf(p, room, "%02ld", year % 100);
+        break;
+      case 'm':
+        n = snprintf(p, room, "%02d", month);
+        break;
+      case 'd':
+        n = snprintf(p, room, "%02d", day);
+        break;
+      case 'H':
+        n = snprintf(p, room, "%02ld", secs / 3600);
+        break;
+      case 'M':
+        n = snprintf(p, room, "%02ld", secs / 60 % 60);
+        break;
+      case 'S':
+        n = snprintf(p, room, "%02ld", secs % 60);
+        break;
+      case 's':
+        n = snprintf(p, room, "%lld", (long long) t);
+        break;
+      default:
+        n = 0;
+    }
+    if (n < 0 || (size_t) n >= room)
+      return 0;
+    len += n;
+  }
+  return len;
+}
+
+
+long timefmt_duration(const char *s) {
+  char *end;
+  long n = strtol(s, &end, 10);
+
+  if (end == s || n <= 0)
+    return -1;
+  switch (*end) {
+    case '\0':
+    case 's':
+      break;
+    case 'm':
+      n *= 60;
+      break;
+    case 'h':
+      n *= 3600;
+      break;
+    case 'd':
+      n *= 86400;
+      break;
+    case 'w':
+      n *= 7 * 86400;
+      break;
+    default:
+      return -1;
+  }
+  if (*end != '\0' && end[1] != '\0')
+    return -1;
+  return n;
+}
@@ -0,0 +1,208 @@
+/*****************************************
+   Copyright 2010 Google Inc.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *****************************************/
+
+#include <string.h>
+#include <crush/general.h>
+#include <crush/hashfuncs.h>
+#include <crush/topk.h>
+
+
+static void topk_heap_swap(topk_t *tk, size_t a, size_t b) {
+  topk_counter_t *tmp = tk->heap[a];
+  tk->heap[a] = tk->heap[b];
+  tk->heap[b] = tmp;
+  tk->heap[a]->heap_pos = a;
+  tk->heap[b]->heap_pos = b;
+}
+
+static void topk_sift_up(topk_t *tk, size_t pos) {
+  while (pos > 0) {
+    size_t parent = (pos - 1) / 2;
+    if (tk->heap[parent]->weight <= tk->heap[pos]->weight)
+      break;
+    topk_heap_swap(tk, parent, pos);
+    pos = parent;
+  }
+}
+
+/* a counter's weight only ever grows, so after an update it can only need
+   to move away from the root. */
+static void topk_sift_down(topk_t *tk, size_t pos) {
+  for (;;) {
+    size_t smallest = pos,
+           l = 2 * pos + 1,
+           r = 2 * pos + 2;
+    if (l < tk->n_counters &&
+        tk->heap[l]->weight < tk->heap[smallest]->weight)
+      smallest = l;
+    if (r < tk->n_counters &&
+        tk->heap[r]->weight < tk->heap[smallest]->weight)
+      smallest = r;
+    if (smallest == pos)
+      break;
+    topk_heap_swap(tk, pos, smallest);
+    pos = smallest;
+  }
+}
+
+/* returns the slot holding key, or the empty slot where it belongs. */
+static size_t topk_find_slot(topk_t *tk, const char *key, unsigned int hash) {
+  size_t mask = tk->n_slots - 1;
+  size_t i = hash & mask;
+  while (tk->slots[i]) {
+    if (tk->slots[i]->hash == hash && strcmp(tk->slots[i]->key, key) == 0)
+      break;
+    i = (i + 1) & mask;
+  }
+  return i;
+}
+
+/* removes a counter from the key index, shifting back any entries in the
+   same probe sequence so that lookups never stop at a false gap. */
+static void topk_remove_slot(topk_t *tk, topk_counter_t *counter) {
+  size_t mask = tk->n_slots - 1;
+  size_t i = topk_find_slot(tk, counter->key, counter->hash);
+  size_t j = i;
+
+  tk->slots[i] = NULL;
+  for (;;) {
+    size_t home;
+    j = (j + 1) & mask;
+    if (! tk->slots[j])
+      break;
+    home = tk->slots[j]->hash & mask;
+    /* leave the entry alone if its home slot lies cyclically in (i, j]. */
+    if ((i <= j) ? (i < home && home <= j) : (i < home || home <= j))
+      continue;
+    tk->slots[i] = tk->slots[j];
+    tk->slots[j] = NULL;
+    i = j;
+  }
+}
+
+static void topk_set_key(topk_counter_t *counter, const char *key,
+                         unsigned int hash) {
+  size_t len = strlen(key) + 1;
+  if (len > counter->key_sz) {
+    counter->key = xrealloc(counter->key, len);
+    counter->key_sz = len;
+  }
+  memcpy(counter->key, key, len);
+  counter->hash = hash;
+}
+
+
+int topk_init(topk_t *tk, size_t k) {
+  if (tk == NULL || k == 0)
+    return 1;
+
+  memset(tk, 0, sizeof(topk_t));
+  tk->capacity = k;
+  tk->counters = xcalloc(k, sizeof(topk_counter_t));
+  tk->heap = xmalloc(sizeof(topk_counter_t *) * k);
+
+  /* keep the index at most half full so probe sequences stay short. */
+  tk->n_slots = 2;
+  while (tk->n_slots < k * 2)
+    tk->n_slots <<= 1;
+  tk->slots = xcalloc(tk->n_slots, sizeof(topk_counter_t *));
+  return 0;
+}
+
+
+void topk_destroy(topk_t *tk) {
+  size_t i;
+  for (i = 0; i < tk->capacity; i++) {
+    if (tk->counters[i].key)
+      free(tk->counters[i].key);
+  }
+  free(tk->counters);
+  free(tk->heap);
+  free(tk->slots);
+  memset(tk, 0, sizeof(topk_t));
+}
+
+
+topk_counter_t *topk_get(topk_t *tk, const char *key) {
+  unsigned int hash = BKDRHash((unsigned char *) key);
+  return tk->slots[topk_find_slot(tk, key, hash)];
+}
+
+
+topk_counter_t *topk_add(topk_t *tk, const char *key, double weight) {
+  unsigned int hash = BKDRHash((unsigned char *) key);
+  size_t slot = topk_find_slot(tk, key, hash);
+  topk_counter_t *counter = tk->slots[slot];
+
+  tk->total_weight += weight;
+
+  if (counter) {
+    counter->weight += weight;
+    topk_sift_down(tk, counter->heap_pos);
+    return counter;
+  }
+
+  if (tk->n_counters < tk->capacity) {
+    counter = &(tk->counters[tk->n_counters]);
+    topk_set_key(counter, key, hash);
+    counter->weight = weight;
+    counter->error = 0;
+    counter->heap_pos = tk->n_counters;
+    tk->heap[tk->n_counters] = counter;
+    tk->n_counters++;
+    tk->slots[slot] = counter;
+    topk_sift_up(tk, counter->heap_pos);
+    return counter;
+  }
+
+  /* take over the smallest counter.  the new key might have been seen up to
+     that many times before while it was not being tracked. */
+  counter = tk->heap[0];
+  topk_remove_slot(tk, counter);
+  topk_set_key(counter, key, hash);
+  counter->error = counter->weight;
+  counter->weight += weight;
+  tk->slots[topk_find_slot(tk, key, hash)] = counter;
+  topk_sift_down(tk, 0);
+  return counter;
+}
+
+
+double topk_min_weight(topk_t *tk) {
+  if (tk->n_counters < tk->capacity)
+    return 0;
+  return tk->heap[0]->weight;
+}
+
+
+static int topk_counter_cmp(const void *a, const void *b) {
+  const topk_counter_t *ca = *((topk_counter_t **) a),
+                       *cb = *((topk_counter_t **) b);
+  if (ca->weight > cb->weight)
+    return -1;
+  if (ca->weight < cb->weight)
+    return 1;
+  return strcmp(ca->key, cb->key);
+}
+
+
+size_t topk_sorted(topk_t *tk, topk_counter_t **array) {
+  size_t i;
+  for (i = 0; i < tk->n_counters; i++)
+    array[i] = &(tk->counters[i]);
+  qsort(array, tk->n_counters, sizeof(topk_counter_t *), topk_counter_cmp);
+  return tk->n_counters;
+}
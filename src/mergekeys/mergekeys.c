@@ -14,15 +14,26 @@
    limitations under the License.
  ********************************/
 
+#include <crush/collkey.h>
 #include <crush/general.h>
+#include <crush/heap.h>
 
 #include "mergekeys_main.h"
 #include "mergekeys.h"
 
+#ifdef HAVE_PTHREAD_H
+# include <pthread.h>
+#endif
+
 #ifndef HAVE_OPEN64
 # define open64 open
 #endif
 
+/* extract each element of fields from line and print them, separated by delim.
+   the delimiter will not be printed after the last field. */
+static void extract_and_print_fields(char *line, int *fields, size_t nfields,
+                                     char *delim, FILE *out);
+
 char *delim;
 size_t nfields_left;
 size_t nfields_right;
@@ -40,7 +51,7 @@ size_t left_ntomerge, right_ntomerge;
 
 /** @brief opens all the files necessary, sets a default
   * delimiter if none was specified, and calls the
-  * merge_files() function.
+  * merge_files() function, or merge_many() for more than two files.
   *
   * @param args contains the parsed cmd-line options & arguments.
   * @param argc number of cmd-line arguments.
@@ -52,8 +63,9 @@ size_t left_ntomerge, right_ntomerge;
 int mergekeys(struct cmdargs *args, int argc, char *argv[], int optind) {
   char default_delimiter[] = { 0xfe, 0x00 };
   FILE *out; /* the output file ptrs */
-  dbfr_t *left_reader, *right_reader;
+  dbfr_t **readers;
   int fd_tmp, retval; /* file descriptor and return value */
+  int n_files, i, j;
 
   enum join_type_t join_type;
 
@@ -66,32 +78,58 @@ int mergekeys(struct cmdargs *args, int argc, char *argv[], int optind) {
     return EXIT_HELP;
   }
 
-  if (argc - optind != 2) {
+  if (argc - optind < 2) {
     fprintf(stderr,
             "%s: missing file arguments.  see %s -h for usage information.\n",
             argv[0], argv[0]);
     return EXIT_HELP;
-  } else if (str_eq(argv[optind], argv[optind + 1])) {
-    /* TODO: it would be safer to convert these to absolute
-       paths first.  "mergekeys file ./file" would still
-       go through.
-     */
-    fprintf(stderr,
-            "%s: both input files are the same. see %s -h for usage information.\n",
-            argv[0], argv[0]);
-    return EXIT_HELP;
   }
-
-  left_reader = dbfr_open(argv[optind]);
-  if (! left_reader) {
-    perror(argv[optind]);
-    return EXIT_FILE_ERR;
+  for (i = optind; i < argc; i++) {
+    for (j = i + 1; j < argc; j++) {
+      if (str_eq(argv[i], argv[j])) {
+        /* TODO: it would be safer to convert these to absolute
+           paths first.  "mergekeys file ./file" would still
+           go through.
+         */
+        fprintf(stderr,
+                "%s: %s is given more than once. see %s -h for usage information.\n",
+                argv[0], argv[i], argv[0]);
+        return EXIT_HELP;
+      }
+    }
   }
 
-  right_reader = dbfr_open(argv[optind + 1]);
-  if (! right_reader) {
-    perror(argv[optind + 1]);
-    return EXIT_FILE_ERR;
+  n_files = argc - optind;
+  if (args->threads) {
+    struct stat st;
+    if (atoi(args->threads) < 1) {
+      fprintf(stderr, "%s: -T must be a positive integer.\n", argv[0]);
+      return EXIT_HELP;
+    }
+#ifndef HAVE_PTHREAD_H
+    fprintf(stderr, "%s was compiled without thread support.\n", argv[0]);
+    return EXIT_HELP;
+#endif
+    /* the files are split by byte offset, so each must be a file which
+       can be read from several places at once. */
+    for (i = optind; i < argc; i++) {
+      if (n_files != 2 || str_eq(argv[i], "-") ||
+          stat(argv[i], &st) != 0 || ! S_ISREG(st.st_mode)) {
+        fprintf(stderr, "%s: -T requires two regular input files.\n",
+                argv[0]);
+        return EXIT_HELP;
+      }
+    }
+    if (atoi(args->threads) == 1)
+      args->threads = NULL;
+  }
+  readers = xmalloc(sizeof(dbfr_t *) * n_files);
+  for (i = 0; i < n_files; i++) {
+    readers[i] = dbfr_open(argv[optind + i]);
+    if (! readers[i]) {
+      perror(argv[optind + i]);
+      return EXIT_FILE_ERR;
+    }
   }
 
   if (!args->outfile) {
@@ -134,85 +172,39 @@ int mergekeys(struct cmdargs *args, int argc, char *argv[], int optind) {
   setlocale(LC_ALL, "");
   setlocale(LC_COLLATE, "");
 
-  retval = merge_files(left_reader, right_reader, join_type, out, args);
+  if (n_files == 2)
+    retval = merge_files(readers[0], readers[1],
+                         args->threads ? argv + optind : NULL,
+                         join_type, out, args);
+  else
+    retval = merge_many(readers, argv + optind, n_files, join_type, out, args);
 
-  dbfr_close(left_reader);
-  dbfr_close(right_reader);
+  for (i = 0; i < n_files; i++)
+    dbfr_close(readers[i]);
+  free(readers);
   fclose(out);
 
   return retval;
 }
 
 
-int merge_files(dbfr_t *left, dbfr_t *right, enum join_type_t join_type,
-                FILE * out, struct cmdargs *args) {
-
-  int retval = EXIT_OKAY;
-  int keycmp = 0;
-
-  if (dbfr_getline(left) <= 0) {
-    fprintf(stderr, "%s: no header found in left-hand file\n", getenv("_"));
-    exit(EXIT_FAILURE);
-  }
-  if (dbfr_getline(right) <= 0) {
-    fprintf(stderr, "%s: no header found in right-hand file\n", getenv("_"));
-    exit(EXIT_FAILURE);
-  }
-
-  chomp(left->current_line);
-  chomp(right->current_line);
-
-  nfields_left = fields_in_line(left->current_line, delim);
-  nfields_right = fields_in_line(right->current_line, delim);
-
-  if (args->verbose) {
-    fprintf(stderr,
-            "VERBOSE: fields in left: %s\nVERBOSE: fields in right: %s\n",
-            left->current_line, right->current_line);
-  }
-
-  left_keyfields = xmalloc(sizeof(int) * nfields_left);
-  right_keyfields = xmalloc(sizeof(int) * nfields_right);
-  left_mergefields = xmalloc(sizeof(int) * nfields_left);
-  right_mergefields = xmalloc(sizeof(int) * nfields_right);
-
-  if ((args->left_keys || args->left_key_labels) &&
-      (args->right_keys ||args->right_key_labels)) {
-    int has_error = set_key_lists(args, left->current_line,
-                                  right->current_line, delim);
-    if (has_error) {
-      exit(EXIT_FAILURE);
-    }
-  } else {
-    /* use headers to figure out which fields are keys or need to be merged */
-    classify_fields(left->current_line, right->current_line);
-  }
-
-  if (nkeys == 0) {
-    fprintf(stderr, "%s: no common fields found\n", getenv("_"));
-    exit(EXIT_FAILURE);
-  }
+/* the key of a reader's current line, or NULL if it has none. */
+static const collkey_t *current_key(const dbfr_t *reader,
+                                    const collkey_cache_t *keys) {
+  return reader->current_line ? &keys->current : NULL;
+}
 
-  if (args->verbose) {
-    fprintf(stderr, "VERBOSE: # key fields:       %lu\n", nkeys);
-    fprintf(stderr, "VERBOSE: left merge fields:  %lu\n", left_ntomerge);
-    fprintf(stderr, "VERBOSE: right merge fields: %lu\n", right_ntomerge);
-  }
 
-  /* print the headers which were already read in above */
-  extract_and_print_fields(left->current_line, left_keyfields, nkeys,
-                           delim, out);
-  if (left_ntomerge > 0) {
-    fputs(delim, out);
-    extract_and_print_fields(left->current_line, left_mergefields,
-                             left_ntomerge, delim, out);
-  }
-  if (right_ntomerge > 0) {
-    fputs(delim, out);
-    extract_and_print_fields(right->current_line, right_mergefields,
-                             right_ntomerge, delim, out);
-  }
-  fputc('\n', out);
+/* merges the lines of two files, or of the parts of them which the readers
+   have been limited to, after their headers. */
+static int merge_lines(dbfr_t *left, dbfr_t *right,
+                       enum join_type_t join_type, FILE *out,
+                       struct cmdargs *args) {
+  int keycmp = 0;
+  int left_line_printed = 0;
+  int retval = EXIT_OKAY;
+  collkey_cache_t left_keys, right_keys;
+  struct gallop left_gallop, right_gallop;
 
   /* force a line-read from LEFT the first time around.
      if eof is reached here, we still need to process
@@ -220,32 +212,53 @@ int merge_files(dbfr_t *left, dbfr_t *right, enum join_type_t join_type,
    */
   keycmp = LEFT_RIGHT_EQUAL;
 
-  if (dbfr_getline(right) <= 0) {
+  /* each line's key is built once, as it is read. */
+  collkey_cache_init(&left_keys, left, left_keyfields, nkeys, delim);
+  collkey_cache_init(&right_keys, right, right_keyfields, nkeys, delim);
+
+  /* unmatched lines which are not printed can be skipped over wholesale. */
+  gallop_init(&left_gallop, left, left_keyfields, nkeys, delim);
+  gallop_init(&right_gallop, right, right_keyfields, nkeys, delim);
+
+  if (collkey_getline(&right_keys, right) <= 0) {
     free(right->current_line);
     right->current_line = NULL;
   }
 
+  /* a range of a file may hold no lines, leaving LEFT at eof already. */
+  if (left->eof && (join_type == join_type_outer ||
+                    join_type == join_type_right_outer)) {
+    keycmp = compare_keys(NULL, current_key(right, &right_keys));
+    goto right_file_loop;
+  }
+
 left_file_loop:
 
   while (!left->eof) {
-    int left_line_printed = 0;
+    left_line_printed = 0;
 
     if (LEFT_LE_RIGHT(keycmp)) {
-      if (dbfr_getline(left) <= 0) {
+      if (collkey_getline(&left_keys, left) <= 0) {
         if (join_type == join_type_inner || join_type == join_type_left_outer)
           break;
         free(left->current_line);
         left->current_line = NULL;
-        keycmp = compare_keys(left->current_line, right->current_line);
+        keycmp = compare_keys(current_key(left, &left_keys),
+                              current_key(right, &right_keys));
         goto right_file_loop;
       }
     }
 
-    keycmp = compare_keys(left->current_line, right->current_line);
+    keycmp = compare_keys(current_key(left, &left_keys),
+                          current_key(right, &right_keys));
 
     if (LEFT_LT_RIGHT(keycmp)) {
       if (join_type == join_type_outer || join_type == join_type_left_outer)
         join_lines(left->current_line, NULL, args->merge_default, out);
+      else if (right->current_line &&
+               gallop_to(&left_gallop, left, &left_keys,
+                         &right_keys.current) != 0)
+        goto seek_error;
       goto left_file_loop;
     }
 
@@ -253,8 +266,9 @@ left_file_loop:
       /* everybody likes an inner join */
       join_lines(left->current_line, right->current_line,
                  args->merge_default, out);
+      left_gallop.run = right_gallop.run = 0;
 
-      if (peek_keys(left->next_line, left->current_line, left_keyfields) == 0) {
+      if (peek_keys(left, &left_keys) == 0) {
         /* the keys in the next line of LEFT are the same.
            handle "many:1"
          */
@@ -270,21 +284,28 @@ left_file_loop:
       if (LEFT_GT_RIGHT(keycmp)) {
         if (join_type == join_type_outer || join_type == join_type_right_outer)
           join_lines(NULL, right->current_line, args->merge_default, out);
+        else if (gallop_to(&right_gallop, right, &right_keys,
+                           &left_keys.current) != 0)
+          goto seek_error;
       }
 
-      if(dbfr_getline(right) <= 0) {
+      if(collkey_getline(&right_keys, right) <= 0) {
         free(right->current_line);
         right->current_line = NULL;
       }
-      keycmp = compare_keys(left->current_line, right->current_line);
+      keycmp = compare_keys(current_key(left, &left_keys),
+                            current_key(right, &right_keys));
 
       if (LEFT_LT_RIGHT(keycmp)) {
 
-        if ((!left_line_printed) &&
-            (join_type == join_type_outer
-             || join_type == join_type_left_outer)) {
-
-          join_lines(left->current_line, NULL, args->merge_default, out);
+        if (join_type == join_type_outer
+            || join_type == join_type_left_outer) {
+          if (!left_line_printed)
+            join_lines(left->current_line, NULL, args->merge_default, out);
+        } else if (right->current_line &&
+                   gallop_to(&left_gallop, left, &left_keys,
+                             &right_keys.current) != 0) {
+          goto seek_error;
         }
 
         goto left_file_loop;
@@ -295,12 +316,12 @@ left_file_loop:
         join_lines(left->current_line, right->current_line,
                    args->merge_default, out);
         left_line_printed = 1;
+        left_gallop.run = right_gallop.run = 0;
 
         /* if the keys in the next line of LEFT are the same,
            handle "many:1". */
-        peek_cmp = peek_keys(left->next_line, left->current_line,
-                             left_keyfields);
-        if ((args->inner && peek_cmp <= 0) || peek_cmp == 0) {
+        peek_cmp = peek_keys(left, &left_keys);
+        if (peek_cmp == 0) {
           goto left_file_loop;
         }
 
@@ -308,10 +329,9 @@ left_file_loop:
            handle "1:many" by staying in this inner loop.  otherwise,
            go back to the outer loop. */
 
-        if (peek_keys(right->next_line, right->current_line, right_keyfields)
-            != 0) {
+        if (peek_keys(right, &right_keys) != 0) {
           /* need a new line from RIGHT */
-          if (dbfr_getline(right) <= 0) {
+          if (collkey_getline(&right_keys, right) <= 0) {
             free(right->current_line);
             right->current_line = NULL;
           }
@@ -320,6 +340,280 @@ left_file_loop:
       }
     } /* feof( right ) */
   } /* feof( left ) */
+  goto done;
+
+seek_error:
+  warn("error searching input");
+  retval = EXIT_FILE_ERR;
+
+done:
+  collkey_cache_destroy(&left_keys);
+  collkey_cache_destroy(&right_keys);
+  gallop_destroy(&left_gallop);
+  gallop_destroy(&right_gallop);
+  return retval;
+}
+
+
+#ifdef HAVE_PTHREAD_H
+
+/* one worker of a multi-threaded merge. */
+struct merge_worker {
+  pthread_t thread;
+  char **paths;
+  off_t start[2];     /**< offsets of the first lines of the ranges. */
+  off_t end[2];       /**< offsets just past the last lines of the ranges. */
+  enum join_type_t join_type;
+  struct cmdargs *args;
+  FILE *out;          /**< temporary file holding the worker's output. */
+  int status;         /**< nonzero if a file could not be read. */
+};
+
+static void *merge_range(void *arg) {
+  struct merge_worker *w = arg;
+  dbfr_t *readers[2] = { NULL, NULL };
+  FILE *in;
+  int i;
+
+  for (i = 0; i < 2; i++) {
+    if ((in = fopen(w->paths[i], "r")) == NULL ||
+        fseeko(in, w->start[i], SEEK_SET) != 0 ||
+        (readers[i] = dbfr_init(in)) == NULL) {
+      w->status = 1;
+      if (in)
+        fclose(in);
+      break;
+    }
+    dbfr_set_end(readers[i], w->end[i] - w->start[i]);
+  }
+  if (w->status == 0)
+    w->status = merge_lines(readers[0], readers[1], w->join_type, w->out,
+                            w->args) != EXIT_OKAY;
+  for (i = 0; i < 2; i++)
+    dbfr_close(readers[i]);
+  return NULL;
+}
+
+/** @brief merges two sorted regular files using several threads.
+  *
+  * Split keys are taken from evenly-spaced lines of the larger file, and
+  * each file is binary-searched for the first line having each split key.
+  * The ranges between them hold the same keys in both files, so they are
+  * merged independently and their outputs concatenated in order.
+  *
+  * @param left the left-hand file, after its header.
+  * @param right the right-hand file, after its header.
+  * @param paths the names of the files.
+  * @param join_type the kind of join.
+  * @param out the output.
+  * @param args commandline options.
+  *
+  * @return exit status for main() to return.
+  */
+static int merge_threaded(dbfr_t *left, dbfr_t *right, char **paths,
+                          enum join_type_t join_type, FILE *out,
+                          struct cmdargs *args) {
+  struct merge_worker *workers;
+  struct key_search search[2];
+  const int *keyfields[2] = { left_keyfields, right_keyfields };
+  off_t data_start[2], size[2], pos;
+  collkey_t split;
+  struct stat st;
+  FILE *in[2] = { NULL, NULL };
+  char buf[65536];
+  size_t n;
+  int nthreads, sampled, i, f, retval = EXIT_OKAY;
+
+  data_start[0] = left->next_line_offset;
+  data_start[1] = right->next_line_offset;
+  for (f = 0; f < 2; f++) {
+    if ((in[f] = fopen(paths[f], "r")) == NULL ||
+        fstat(fileno(in[f]), &st) != 0) {
+      warn("%s", paths[f]);
+      if (in[f])
+        fclose(in[f]);
+      if (f == 1)
+        fclose(in[0]);
+      return EXIT_FILE_ERR;
+    }
+    size[f] = st.st_size;
+    key_search_init(&search[f], in[f], keyfields[f], nkeys, delim);
+  }
+  sampled = size[1] > size[0];
+
+  nthreads = atoi(args->threads);
+  workers = xcalloc(nthreads, sizeof(struct merge_worker));
+  collkey_init(&split);
+
+  for (i = 0; i < nthreads; i++) {
+    struct merge_worker *w = &(workers[i]);
+    w->paths = paths;
+    w->join_type = join_type;
+    w->args = args;
+    for (f = 0; f < 2; f++)
+      w->start[f] = (i == 0) ? data_start[f] : workers[i - 1].end[f];
+
+    if (i == nthreads - 1) {
+      w->end[0] = size[0];
+      w->end[1] = size[1];
+    } else {
+      pos = data_start[sampled] +
+            (size[sampled] - data_start[sampled]) / nthreads * (i + 1);
+      if (pos < w->start[sampled])
+        pos = w->start[sampled];
+      if ((pos = key_search_line(&search[sampled], pos)) < 0) {
+        warn("%s", paths[sampled]);
+        retval = EXIT_FILE_ERR;
+        break;
+      }
+      if (search[sampled].line_len == 0) {
+        /* past the last line: the rest is empty. */
+        w->end[0] = w->start[0];
+        w->end[1] = w->start[1];
+      } else {
+        collkey_copy(&split, &search[sampled].key);
+        for (f = 0; f < 2; f++) {
+          if ((w->end[f] = key_search_lower_bound(&search[f], w->start[f],
+                                                  size[f], &split)) < 0) {
+            warn("%s", paths[f]);
+            retval = EXIT_FILE_ERR;
+            break;
+          }
+        }
+        if (retval != EXIT_OKAY)
+          break;
+      }
+    }
+
+    if ((w->out = tmpfile()) == NULL) {
+      warn("tmpfile");
+      retval = EXIT_FILE_ERR;
+      break;
+    }
+    if (args->verbose)
+      fprintf(stderr,
+              "VERBOSE: thread %d: left bytes %lld to %lld, "
+              "right bytes %lld to %lld\n", i,
+              (long long) w->start[0], (long long) w->end[0],
+              (long long) w->start[1], (long long) w->end[1]);
+    if (pthread_create(&(w->thread), NULL, merge_range, w) != 0) {
+      fprintf(stderr, "%s: failed to start a thread.\n", getenv("_"));
+      fclose(w->out);
+      w->out = NULL;
+      retval = EXIT_HELP;
+      break;
+    }
+  }
+
+  for (i = 0; i < nthreads && workers[i].out; i++) {
+    struct merge_worker *w = &(workers[i]);
+    pthread_join(w->thread, NULL);
+    if (w->status != 0 && retval == EXIT_OKAY) {
+      fprintf(stderr, "%s: error reading input files\n", getenv("_"));
+      retval = EXIT_FILE_ERR;
+    }
+    if (retval == EXIT_OKAY) {
+      rewind(w->out);
+      while ((n = fread(buf, 1, sizeof(buf), w->out)) > 0)
+        fwrite(buf, 1, n, out);
+    }
+    fclose(w->out);
+  }
+
+  collkey_destroy(&split);
+  for (f = 0; f < 2; f++) {
+    key_search_destroy(&search[f]);
+    fclose(in[f]);
+  }
+  free(workers);
+  return retval;
+}
+
+#else
+
+static int merge_threaded(dbfr_t *left, dbfr_t *right, char **paths,
+                          enum join_type_t join_type, FILE *out,
+                          struct cmdargs *args) {
+  return EXIT_HELP;
+}
+
+#endif /* HAVE_PTHREAD_H */
+
+
+int merge_files(dbfr_t *left, dbfr_t *right, char **paths,
+                enum join_type_t join_type, FILE * out,
+                struct cmdargs *args) {
+
+  int retval = EXIT_OKAY;
+
+  if (dbfr_getline(left) <= 0) {
+    fprintf(stderr, "%s: no header found in left-hand file\n", getenv("_"));
+    exit(EXIT_FAILURE);
+  }
+  if (dbfr_getline(right) <= 0) {
+    fprintf(stderr, "%s: no header found in right-hand file\n", getenv("_"));
+    exit(EXIT_FAILURE);
+  }
+
+  chomp(left->current_line);
+  chomp(right->current_line);
+
+  nfields_left = fields_in_line(left->current_line, delim);
+  nfields_right = fields_in_line(right->current_line, delim);
+
+  if (args->verbose) {
+    fprintf(stderr,
+            "VERBOSE: fields in left: %s\nVERBOSE: fields in right: %s\n",
+            left->current_line, right->current_line);
+  }
+
+  left_keyfields = xmalloc(sizeof(int) * nfields_left);
+  right_keyfields = xmalloc(sizeof(int) * nfields_right);
+  left_mergefields = xmalloc(sizeof(int) * nfields_left);
+  right_mergefields = xmalloc(sizeof(int) * nfields_right);
+
+  if ((args->left_keys || args->left_key_labels) &&
+      (args->right_keys ||args->right_key_labels)) {
+    int has_error = set_key_lists(args, left->current_line,
+                                  right->current_line, delim);
+    if (has_error) {
+      exit(EXIT_FAILURE);
+    }
+  } else {
+    /* use headers to figure out which fields are keys or need to be merged */
+    classify_fields(left->current_line, right->current_line);
+  }
+
+  if (nkeys == 0) {
+    fprintf(stderr, "%s: no common fields found\n", getenv("_"));
+    exit(EXIT_FAILURE);
+  }
+
+  if (args->verbose) {
+    fprintf(stderr, "VERBOSE: # key fields:       %lu\n", nkeys);
+    fprintf(stderr, "VERBOSE: left merge fields:  %lu\n", left_ntomerge);
+    fprintf(stderr, "VERBOSE: right merge fields: %lu\n", right_ntomerge);
+  }
+
+  /* print the headers which were already read in above */
+  extract_and_print_fields(left->current_line, left_keyfields, nkeys,
+                           delim, out);
+  if (left_ntomerge > 0) {
+    fputs(delim, out);
+    extract_and_print_fields(left->current_line, left_mergefields,
+                             left_ntomerge, delim, out);
+  }
+  if (right_ntomerge > 0) {
+    fputs(delim, out);
+    extract_and_print_fields(right->current_line, right_mergefields,
+                             right_ntomerge, delim, out);
+  }
+  fputc('\n', out);
+
+  if (paths)
+    retval = merge_threaded(left, right, paths, join_type, out, args);
+  else
+    retval = merge_lines(left, right, join_type, out, args);
 
   if (left_keyfields)
     free(left_keyfields);
@@ -526,58 +820,354 @@ void classify_fields(char *left_header, char *right_header) {
 }
 
 
-int compare_keys(char *buffer_left, char *buffer_right) {
-  int keycmp = 0;
-  int i;
-  char *field_left = NULL, *field_right = NULL;
-  size_t field_left_sz = 0, field_right_sz = 0;
-
-  if (buffer_left == NULL && buffer_right == NULL)
+int compare_keys(const collkey_t *key_left, const collkey_t *key_right) {
+  if (key_left == NULL && key_right == NULL)
     return LEFT_RIGHT_EQUAL;
 
   /* these special cases may seem counter-intuitive, but saying that
      a NULL line is greater than a non-NULL line results in
      the non-NULL line getting printed and a new line read in.
    */
-  if (buffer_left == NULL)
+  if (key_left == NULL)
     return LEFT_GREATER;
 
-  if (buffer_right == NULL)
+  if (key_right == NULL)
     return RIGHT_GREATER;
 
-  for (i = 0; i < nkeys; i++) {
-    copy_field(buffer_left, &field_left, &field_left_sz,
-               left_keyfields[i], delim);
-    copy_field(buffer_right, &field_right, &field_right_sz,
-               right_keyfields[i], delim);
-    if ((keycmp = strcoll(field_left, field_right)) != 0)
-      break;
-  }
-  free(field_left);
-  free(field_right);
-  return keycmp;
+  return collkey_cmp(key_left, key_right);
 }
 
 
 /* compares keys of the current and the next line.  Basically the same
- * as compare_keys(), but using the same keyfield list for both lines. */
-int peek_keys(char *peek_line, char *current_line, const int *keyfields) {
-  int keycmp = 0;
-  int i;
-  char *field_cur = NULL, *field_next = NULL;
-  size_t field_cur_sz = 0, field_next_sz = 0;
-
+ * as compare_keys(), but for two lines of the same file. */
+int peek_keys(const dbfr_t *reader, const collkey_cache_t *keys) {
   /* no next line, so current line's fields are greater. */
-  if (peek_line == NULL)
+  if (reader->next_line == NULL)
     return 1;
+  return collkey_cmp(&keys->current, &keys->next);
+}
 
-  for (i = 0; i < nkeys; i++) {
-    copy_field(current_line, &field_cur, &field_cur_sz, keyfields[i], delim);
-    copy_field(peek_line, &field_next, &field_next_sz, keyfields[i], delim);
-    if ((keycmp = strcoll(field_cur, field_next)) != 0)
-      break;
+
+/* One of the files in a merge of more than two. */
+struct merge_input {
+  dbfr_t *reader;
+  const char *name;
+  int index;                    /* position on the commandline */
+  int *keyfields;
+  int *mergefields;
+  size_t nfields, n_merge;
+  collkey_t key;                /* the key of the current line */
+  char **group;                 /* the lines having the key being merged */
+  size_t *group_sz;
+  size_t n_group, group_cap;
+};
+
+
+/* orders inputs by the key of their current line, then by their position
+   on the commandline. */
+static int compare_merge_inputs(const void *a, const void *b) {
+  const struct merge_input *left = a, *right = b;
+  int keycmp = collkey_cmp(&left->key, &right->key);
+  return keycmp ? keycmp : left->index - right->index;
+}
+
+
+/* reads the next line of an input and its key, returning 0 at eof. */
+static int read_merge_input(struct merge_input *in) {
+  if (dbfr_getline(in->reader) <= 0)
+    return 0;
+  chomp(in->reader->current_line);
+  collkey_set(&in->key, in->reader->current_line, in->keyfields, nkeys,
+              delim);
+  return 1;
+}
+
+
+/* saves the current line of an input in its group. */
+static void add_to_group(struct merge_input *in) {
+  size_t len = strlen(in->reader->current_line) + 1;
+  if (in->n_group == in->group_cap) {
+    in->group_cap = in->group_cap ? in->group_cap * 2 : 4;
+    in->group = xrealloc(in->group, sizeof(char *) * in->group_cap);
+    in->group_sz = xrealloc(in->group_sz, sizeof(size_t) * in->group_cap);
+    memset(in->group + in->n_group, 0,
+           sizeof(char *) * (in->group_cap - in->n_group));
+    memset(in->group_sz + in->n_group, 0,
+           sizeof(size_t) * (in->group_cap - in->n_group));
+  }
+  if (len > in->group_sz[in->n_group]) {
+    in->group_sz[in->n_group] = len;
+    in->group[in->n_group] = xrealloc(in->group[in->n_group], len);
+  }
+  memcpy(in->group[in->n_group++], in->reader->current_line, len);
+}
+
+
+/* prints one merged line: the keys of the first line present, then the
+   merge fields of each input, or defaults for inputs without a line. */
+static void print_merged_line(struct merge_input *inputs, size_t n,
+                              char **lines, char *merge_default, FILE *out) {
+  size_t i, j;
+
+  for (i = 0; ! lines[i]; i++)
+    ;
+  extract_and_print_fields(lines[i], inputs[i].keyfields, nkeys, delim, out);
+  for (i = 0; i < n; i++) {
+    if (! lines[i]) {
+      for (j = 0; j < inputs[i].n_merge; j++)
+        fprintf(out, "%s%s", delim, merge_default);
+    } else if (inputs[i].n_merge > 0) {
+      fputs(delim, out);
+      extract_and_print_fields(lines[i], inputs[i].mergefields,
+                               inputs[i].n_merge, delim, out);
+    }
+  }
+  fputc('\n', out);
+}
+
+
+/* prints the grouped lines of the inputs, pairing them as merge_files()
+   does for two files: the first line of each group, then each further line
+   of the first input's group with the last line of each other group, then
+   each further line of the second input's group, and so on.  this is one
+   line unless a key is repeated within a file. */
+static void print_merged_group(struct merge_input *inputs, size_t n,
+                               char **lines, char *merge_default, FILE *out) {
+  size_t i, j;
+
+  for (i = 0; i < n; i++)
+    lines[i] = inputs[i].n_group ? inputs[i].group[0] : NULL;
+  print_merged_line(inputs, n, lines, merge_default, out);
+  for (i = 0; i < n; i++) {
+    for (j = 1; j < inputs[i].n_group; j++) {
+      lines[i] = inputs[i].group[j];
+      print_merged_line(inputs, n, lines, merge_default, out);
+    }
+  }
+}
+
+
+/* finds the key and merge fields of each input from the -a/-A and -b/-B
+   options, which give the keys of the first file and of all the others. */
+static int set_merge_key_lists(struct merge_input *inputs, size_t n,
+                               struct cmdargs *args) {
+  char *keys, *labels;
+  ssize_t n_in_keys;
+  size_t i, list_sz;
+
+  for (i = 0; i < n; i++) {
+    keys = i == 0 ? args->left_keys : args->right_keys;
+    labels = i == 0 ? args->left_key_labels : args->right_key_labels;
+    list_sz = 0;
+    if (labels) {
+      n_in_keys = expand_label_list(labels, inputs[i].reader->current_line,
+                                    delim, &inputs[i].keyfields, &list_sz);
+    } else {
+      /* expand_nums() consumes its argument, which the other files need. */
+      keys = xstrdup(keys);
+      n_in_keys = expand_nums(keys, &inputs[i].keyfields, &list_sz);
+      free(keys);
+    }
+    if (n_in_keys <= 0) {
+      fprintf(stderr, "%s: error parsing keys of %s\n", getenv("_"),
+              inputs[i].name);
+      return -1;
+    }
+    if (i > 0 && n_in_keys != nkeys) {
+      fprintf(stderr, "%s: all files must have the same number of keys.\n",
+              getenv("_"));
+      return -1;
+    }
+    nkeys = n_in_keys;
+    decrement_each(inputs[i].keyfields, nkeys);
+  }
+  return 0;
+}
+
+
+/* finds the fields whose labels are in every header, which are the keys. */
+static void classify_merge_fields(struct merge_input *inputs, size_t n) {
+  char *label = NULL, *other = NULL;
+  size_t label_sz = 0, other_sz = 0, field, i, j;
+  int *positions = xmalloc(sizeof(int) * n);
+
+  for (i = 0; i < n; i++)
+    inputs[i].keyfields = xmalloc(sizeof(int) * inputs[i].nfields);
+
+  nkeys = 0;
+  for (field = 0; field < inputs[0].nfields; field++) {
+    copy_field(inputs[0].reader->current_line, &label, &label_sz, field,
+               delim);
+    positions[0] = field;
+    for (i = 1; i < n; i++) {
+      for (j = 0; j < inputs[i].nfields; j++) {
+        copy_field(inputs[i].reader->current_line, &other, &other_sz, j,
+                   delim);
+        if (str_eq(label, other))
+          break;
+      }
+      if (j == inputs[i].nfields)
+        break;
+      positions[i] = j;
+    }
+    if (i == n) {
+      for (i = 0; i < n; i++)
+        inputs[i].keyfields[nkeys] = positions[i];
+      nkeys++;
+    }
+  }
+  free(positions);
+  if (label)
+    free(label);
+  if (other)
+    free(other);
+}
+
+
+/** @brief merges more than two files in one pass.
+  *
+  * Each file contributes its non-key fields.  A heap orders the files by
+  * the key of their current line; each key is merged by reading the lines
+  * with that key from every file which has it.  An inner join keeps the
+  * keys found in every file, a left join those in the first file, a right
+  * join those in the last file, and an outer join every key.
+  *
+  * @param readers the files, positioned at their headers.
+  * @param names the names of the files.
+  * @param n the number of files.
+  * @param join_type the kind of join.
+  * @param out the output.
+  * @param args commandline options.
+  *
+  * @return exit status for main() to return.
+  */
+int merge_many(dbfr_t **readers, char **names, size_t n,
+               enum join_type_t join_type, FILE *out, struct cmdargs *args) {
+  struct merge_input *inputs = xcalloc(n, sizeof(struct merge_input)), *in;
+  char **lines = xmalloc(sizeof(char *) * n);
+  collkey_t min_key;
+  size_t i, j, n_present;
+  heap_t heap;
+  int keep;
+
+  for (i = 0; i < n; i++) {
+    in = &inputs[i];
+    in->reader = readers[i];
+    in->name = names[i];
+    in->index = i;
+    if (dbfr_getline(in->reader) <= 0) {
+      fprintf(stderr, "%s: no header found in %s\n", getenv("_"), in->name);
+      exit(EXIT_FAILURE);
+    }
+    chomp(in->reader->current_line);
+    in->nfields = fields_in_line(in->reader->current_line, delim);
+    if (args->verbose)
+      fprintf(stderr, "VERBOSE: fields in %s: %s\n", in->name,
+              in->reader->current_line);
+  }
+
+  if ((args->left_keys || args->left_key_labels) &&
+      (args->right_keys || args->right_key_labels)) {
+    if (set_merge_key_lists(inputs, n, args) != 0)
+      exit(EXIT_FAILURE);
+  } else {
+    /* use headers to figure out which fields are keys or need to be merged */
+    classify_merge_fields(inputs, n);
+  }
+
+  if (nkeys == 0) {
+    fprintf(stderr, "%s: no common fields found\n", getenv("_"));
+    exit(EXIT_FAILURE);
+  }
+
+  for (i = 0; i < n; i++) {
+    in = &inputs[i];
+    in->mergefields = xmalloc(sizeof(int) * in->nfields);
+    for (j = 0; j < in->nfields; j++) {
+      size_t k;
+      for (k = 0; k < nkeys && in->keyfields[k] != (int) j; k++)
+        ;
+      if (k == nkeys)
+        in->mergefields[in->n_merge++] = j;
+    }
+  }
+
+  if (args->verbose) {
+    fprintf(stderr, "VERBOSE: # key fields:       %lu\n", nkeys);
+    for (i = 0; i < n; i++)
+      fprintf(stderr, "VERBOSE: merge fields in %s: %lu\n", inputs[i].name,
+              inputs[i].n_merge);
+  }
+
+  /* the header is merged like any other line. */
+  for (i = 0; i < n; i++)
+    lines[i] = inputs[i].reader->current_line;
+  print_merged_line(inputs, n, lines, args->merge_default, out);
+
+  collkey_init(&min_key);
+  heap_init(&heap, n, compare_merge_inputs);
+  for (i = 0; i < n; i++) {
+    if (read_merge_input(&inputs[i]))
+      heap_push(&heap, &inputs[i]);
+  }
+
+  while (! heap_empty(&heap)) {
+    in = heap_peek(&heap);
+    collkey_copy(&min_key, &in->key);
+
+    for (i = 0; i < n; i++)
+      inputs[i].n_group = 0;
+    n_present = 0;
+    while (! heap_empty(&heap) &&
+           collkey_cmp(&((struct merge_input *) heap_peek(&heap))->key,
+                       &min_key) == 0) {
+      in = heap_pop(&heap);
+      n_present++;
+      do {
+        add_to_group(in);
+        if (! read_merge_input(in)) {
+          in = NULL;
+          break;
+        }
+      } while (collkey_cmp(&in->key, &min_key) == 0);
+      if (in)
+        heap_push(&heap, in);
+    }
+
+    switch (join_type) {
+      case join_type_inner:
+        keep = n_present == n;
+        break;
+      case join_type_left_outer:
+        keep = inputs[0].n_group > 0;
+        break;
+      case join_type_right_outer:
+        keep = inputs[n - 1].n_group > 0;
+        break;
+      default:
+        keep = 1;
+    }
+    if (keep)
+      print_merged_group(inputs, n, lines, args->merge_default, out);
+  }
+
+  heap_destroy(&heap);
+  for (i = 0; i < n; i++) {
+    in = &inputs[i];
+    for (j = 0; j < in->group_cap; j++) {
+      if (in->group[j])
+        free(in->group[j]);
+    }
+    if (in->group) {
+      free(in->group);
+      free(in->group_sz);
+    }
+    collkey_destroy(&in->key);
+    free(in->keyfields);
+    free(in->mergefields);
   }
-  free(field_cur);
-  free(field_next);
-  return keycmp;
+  free(inputs);
+  free(lines);
+  collkey_destroy(&min_key);
+  return EXIT_OKAY;
 }
@@ -19,6 +19,7 @@
 #endif
 
 #include <crush/ffutils.h>
+#include <crush/collkey.h>
 #include <crush/dbfr.h>
 
 #ifdef HAVE_FCNTL_H
@@ -72,22 +73,119 @@ enum join_type_t {
   join_type_right_outer,
 };
 
-int merge_files(dbfr_t *a, dbfr_t *b, enum join_type_t join_type, FILE * out,
-                struct cmdargs *args);
+int merge_files(dbfr_t *a, dbfr_t *b, char **paths,
+                enum join_type_t join_type, FILE * out, struct cmdargs *args);
+int merge_many(dbfr_t **readers, char **names, size_t n,
+               enum join_type_t join_type, FILE *out, struct cmdargs *args);
+
+/** @brief a sorted regular file which is searched by byte offset. */
+struct key_search {
+  FILE *file;
+  const int *fields;        /**< the key fields. */
+  size_t n_fields;
+  const char *delim;
+  char *line;               /**< the line found by the last search. */
+  size_t line_sz;
+  ssize_t line_len;         /**< its length, or 0 at the end of the file. */
+  collkey_t key;            /**< its key. */
+};
+
+/** @brief prepares to search a file.
+  *
+  * @param ks the search to be initialized.
+  * @param file the file, which must be seekable.
+  * @param fields the 0-based indexes of the key fields.
+  * @param n_fields the number of elements in fields.
+  * @param delim the field separator.
+  */
+void key_search_init(struct key_search *ks, FILE *file, const int *fields,
+                     size_t n_fields, const char *delim);
+
+/** @brief releases the memory used by a search.
+  *
+  * @param ks the search to be destroyed.
+  */
+void key_search_destroy(struct key_search *ks);
+
+/** @brief reads the first line which starts at or after an offset, along
+  * with its key.
+  *
+  * @param ks the search.
+  * @param pos an offset in the file.
+  *
+  * @return the offset of the line, or of the end of the file if there is
+  *         none, or -1 on error.
+  */
+off_t key_search_line(struct key_search *ks, off_t pos);
+
+/** @brief finds the first line whose key does not sort before a key.
+  *
+  * @param ks the search.
+  * @param lo the start of a line, before which every line sorts before key.
+  * @param hi the start of a line which does not sort before key, or the
+  *           end of the file.
+  * @param key the key to look for.
+  *
+  * @return the offset of the line, or -1 on error.
+  */
+off_t key_search_lower_bound(struct key_search *ks, off_t lo, off_t hi,
+                             const collkey_t *key);
+
+/** @brief inner joins skip runs of at least this many unmatched lines by
+  * searching the file. */
+#define GALLOP_MIN_RUN 32
+
+/** @brief the distance in bytes of the first probe of a skip. */
+#define GALLOP_STEP 4096
+
+/** @brief skips ahead in a sorted regular file, for selective joins. */
+struct gallop {
+  struct key_search search;
+  off_t end;                /**< where the reader stops in the file. */
+  size_t run;               /**< lines passed over since the last skip. */
+  int enabled;              /**< whether the file can be searched. */
+};
+
+/** @brief prepares to skip ahead in a reader's file, if it is a regular
+  * file.
+  *
+  * @param g the gallop to be initialized.
+  * @param reader the reader.
+  * @param fields the 0-based indexes of the key fields.
+  * @param n_fields the number of elements in fields.
+  * @param delim the field separator.
+  */
+void gallop_init(struct gallop *g, dbfr_t *reader, const int *fields,
+                 size_t n_fields, const char *delim);
+
+/** @brief releases the memory used by a gallop.
+  *
+  * @param g the gallop to be destroyed.
+  */
+void gallop_destroy(struct gallop *g);
+
+/** @brief counts a line which was passed over, and once GALLOP_MIN_RUN
+  * have been, moves the reader to the first line which does not sort before
+  * a key.  The file is probed at exponentially growing distances, then
+  * binary-searched.
+  *
+  * @param g the reader's gallop.
+  * @param reader the reader.
+  * @param keys the reader's key cache.
+  * @param key the key to skip to.
+  *
+  * @return 0 on success, or -1 with errno set.
+  */
+int gallop_to(struct gallop *g, dbfr_t *reader, collkey_cache_t *keys,
+              const collkey_t *key);
 
 void classify_fields(char *left_header, char *right_header);
 int set_key_lists(struct cmdargs *args, const char *left_line,
                   const char *right_line, const char *delim);
 int set_field_types();
-int compare_keys(char *buffer_left, char *buffer_right);
+int compare_keys(const collkey_t *key_left, const collkey_t *key_right);
 void join_lines(char *left_line, char *right_line, char *merge_default,
                 FILE * out);
-int peek_keys(char *peek_line, char *current_line, const int *keyfields);
-
-/* extract each element of fields from line and print them, separated by delim.
-   the delimiter will not be printed after the last field. */
-static void extract_and_print_fields(char *line, int *fields, size_t nfields,
-                                     char *delim, FILE *out);
-
+int peek_keys(const dbfr_t *reader, const collkey_cache_t *keys);
 
 #endif /* MERGEKEYS_H */
@@ -0,0 +1,141 @@
+/********************************
+   Copyright 2010 Google Inc.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ ********************************/
+
+/* Searching sorted regular files by key.
+
+   A sorted file can be split or skipped through without reading it line
+   by line: a byte offset is moved forward to the start of the next line,
+   and the key of that line says which side of it a key lies on. */
+
+#include <crush/general.h>
+
+#include "mergekeys_main.h"
+#include "mergekeys.h"
+
+
+void key_search_init(struct key_search *ks, FILE *file, const int *fields,
+                     size_t n_fields, const char *delim) {
+  memset(ks, 0, sizeof(struct key_search));
+  ks->file = file;
+  ks->fields = fields;
+  ks->n_fields = n_fields;
+  ks->delim = delim;
+  collkey_init(&ks->key);
+}
+
+
+void key_search_destroy(struct key_search *ks) {
+  if (ks->line)
+    free(ks->line);
+  collkey_destroy(&ks->key);
+}
+
+
+off_t key_search_line(struct key_search *ks, off_t pos) {
+  ssize_t len;
+
+  /* the line holding pos - 1 ends at or after pos. */
+  if (pos > 0) {
+    if (fseeko(ks->file, pos - 1, SEEK_SET) != 0)
+      return -1;
+    if ((len = getline(&ks->line, &ks->line_sz, ks->file)) > 0)
+      pos += len - 1;
+  } else if (fseeko(ks->file, 0, SEEK_SET) != 0) {
+    return -1;
+  }
+
+  if ((len = getline(&ks->line, &ks->line_sz, ks->file)) > 0) {
+    ks->line_len = len;
+    collkey_set(&ks->key, ks->line, ks->fields, ks->n_fields, ks->delim);
+  } else {
+    ks->line_len = 0;
+  }
+  return pos;
+}
+
+
+off_t key_search_lower_bound(struct key_search *ks, off_t lo, off_t hi,
+                             const collkey_t *key) {
+  off_t limit = hi, mid, start;
+
+  /* every line before lo sorts before key, hi is the start of a line which
+     does not (or the end of the file), and no line starts in [limit, hi). */
+  while (lo < limit) {
+    mid = lo + (limit - lo) / 2;
+    if ((start = key_search_line(ks, mid)) < 0)
+      return -1;
+    if (start >= limit) {
+      limit = mid;
+    } else if (collkey_cmp(&ks->key, key) >= 0) {
+      hi = start;
+      limit = mid;
+    } else {
+      lo = start + ks->line_len;
+    }
+  }
+  return hi;
+}
+
+
+void gallop_init(struct gallop *g, dbfr_t *reader, const int *fields,
+                 size_t n_fields, const char *delim) {
+  struct stat st;
+
+  memset(g, 0, sizeof(struct gallop));
+  if (reader->base < 0 || fstat(fileno(reader->file), &st) != 0 ||
+      ! S_ISREG(st.st_mode))
+    return;
+  g->enabled = 1;
+  g->end = reader->end >= 0 ? reader->base + reader->end : st.st_size;
+  key_search_init(&g->search, reader->file, fields, n_fields, delim);
+}
+
+
+void gallop_destroy(struct gallop *g) {
+  if (g->enabled)
+    key_search_destroy(&g->search);
+}
+
+
+int gallop_to(struct gallop *g, dbfr_t *reader, collkey_cache_t *keys,
+              const collkey_t *key) {
+  off_t lo, hi, step, start;
+
+  if (! g->enabled || ++g->run < GALLOP_MIN_RUN)
+    return 0;
+  if (reader->next_line == NULL || collkey_cmp(&keys->next, key) >= 0)
+    return 0;
+
+  /* the next line sorts before key.  probe ever further past it until a
+     line does not, then search between the last two probes. */
+  lo = reader->base + reader->next_line_offset + reader->next_line_len;
+  hi = g->end;
+  for (step = GALLOP_STEP; lo + step < hi; step *= 2) {
+    if ((start = key_search_line(&g->search, lo + step)) < 0)
+      return -1;
+    if (start >= hi)
+      break;
+    if (collkey_cmp(&g->search.key, key) >= 0) {
+      hi = start;
+      break;
+    }
+    lo = start + g->search.line_len;
+  }
+  if ((start = key_search_lower_bound(&g->search, lo, hi, key)) < 0)
+    return -1;
+  g->run = 0;
+  return collkey_seek(keys, reader, start - reader->base);
+}
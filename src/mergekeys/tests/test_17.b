@@ -0,0 +1,5 @@
+Key	B-Value
+k1	b1
+k3	b3
+k4	b4
+k5	b5
@@ -0,0 +1,6 @@
+Key	C-One	C-Two
+k1	c1	C1
+k2	c2	C2
+k3	c3	C3
+k4	c4	C4
+k6	c6	C6
@@ -0,0 +1,13 @@
+Key	B-Value
+k00	b0
+k02	b2
+k03	b3
+k03	b3b
+k04	b4
+k06	b6
+k07	b7
+k09	b9
+k10	b10
+k10	b10b
+k12	b12
+k13	b13
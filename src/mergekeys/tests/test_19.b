@@ -0,0 +1,9 @@
+Key	B-Value
+k0000	b0
+k0003	b3
+k0003	b3
+k0700	b700
+k0701	b701
+k1200	b1200
+k1499	b1499
+k2000	b2000
@@ -0,0 +1,6 @@
+Key	B-Value
+k2	b2
+k2	b2b
+k2	b2c
+k3	b3
+k4	b4
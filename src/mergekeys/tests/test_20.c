@@ -0,0 +1,4 @@
+Key	C-Value
+k1	c1
+k2	c2
+k4	c4
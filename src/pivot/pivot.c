@@ -14,14 +14,22 @@
    limitations under the License.
  ********************************/
 
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+#include <err.h>
 #include <locale.h>
 #include <assert.h>
+#ifdef HAVE_PTHREAD_H
+# include <pthread.h>
+#endif
 
 #include <crush/dbfr.h>
 #include <crush/ffutils.h>
 #include <crush/general.h>
+#include <crush/hashfuncs.h>
 #include <crush/hashtbl.h>
-#include <crush/linklist.h>
+#include <crush/hll.h>
 
 #include "pivot_main.h"
 
@@ -55,11 +63,700 @@ int float_str_precision(char *d);
 
 char *delim;
 
-void free_hash(void *t) {
-  ht_destroy((hashtbl_t *) t);
-  free(t);
+/* the distinct pivot strings seen so far, each interned to a dense column
+ * id in the order of first appearance. */
+struct pivot_columns {
+  hashtbl_t ids;                /* pivot string -> column id + 1 */
+  char **strings;               /* column id -> pivot string */
+  size_t n;                     /* number of columns */
+  size_t sz;                    /* allocated size of strings */
+};
+
+/* the accumulators of one output row: n_values sums for each of n_cols
+ * columns, indexed by column id.  the array grows in place as new pivot
+ * values appear. */
+struct pivot_row {
+  double *cells;
+  size_t n_cols;
+};
+
+void free_row(void *r) {
+  free(((struct pivot_row *) r)->cells);
+  free(r);
+}
+
+/* returns the column id of a pivot string, assigning the next one if the
+ * string is new. */
+static size_t intern_pivot(struct pivot_columns *cols, const char *pivstr) {
+  void *id = ht_get(&cols->ids, (char *) pivstr);
+  if (id)
+    return (size_t) id - 1;
+
+  if (cols->n == cols->sz) {
+    cols->sz = cols->sz ? cols->sz * 2 : PIVOT_HASH_SZ;
+    cols->strings = xrealloc(cols->strings, sizeof(char *) * cols->sz);
+  }
+  cols->strings[cols->n] = xstrdup(pivstr);
+  ht_put(&cols->ids, (char *) pivstr, (void *) (cols->n + 1));
+  return cols->n++;
+}
+
+/* returns the accumulators of a column in a row, growing the row to hold
+ * every column known so far if it is too short. */
+static double *row_cells(struct pivot_row *row, size_t col, size_t n_cols,
+                         size_t n_values) {
+  if (col >= row->n_cols) {
+    row->cells = xrealloc(row->cells, sizeof(double) * n_cols * n_values);
+    memset(row->cells + row->n_cols * n_values, 0,
+           sizeof(double) * (n_cols - row->n_cols) * n_values);
+    row->n_cols = n_cols;
+  }
+  return row->cells + col * n_values;
+}
+
+/* column ids sorted by their pivot strings, for output. */
+static size_t *column_order(struct pivot_columns *cols) {
+  char **sorted = xmalloc(sizeof(char *) * cols->n);
+  size_t *order = xmalloc(sizeof(size_t) * cols->n);
+  size_t i;
+
+  memcpy(sorted, cols->strings, sizeof(char *) * cols->n);
+  qsort(sorted, cols->n, sizeof(char *),
+        (int (*)(const void *, const void *)) key_strcmp);
+  for (i = 0; i < cols->n; i++)
+    order[i] = (size_t) ht_get(&cols->ids, sorted[i]) - 1;
+  free(sorted);
+  return order;
+}
+
+/* extracts the key and pivot strings of a line into their buffers, which are
+ * grown to hold the whole line.  without key fields, *keystr is left alone.
+ * returns non-zero if memory runs out. */
+static int line_strings(struct pivot_conf *conf, dbfr_t *reader,
+                        char **keystr, size_t *keystr_sz,
+                        char **pivstr, size_t *pivstr_sz) {
+  if (conf->n_keys) {
+    if (realloc_if_needed(keystr, keystr_sz,
+                          reader->current_line_sz) == NULL)
+      return 1;
+    extract_fields_to_string(reader->current_line, *keystr, *keystr_sz,
+                             conf->keys, conf->n_keys, delim);
+  }
+  if (realloc_if_needed(pivstr, pivstr_sz, reader->current_line_sz) == NULL)
+    return 1;
+  extract_fields_to_string(reader->current_line, *pivstr, *pivstr_sz,
+                           conf->pivots, conf->n_pivots, delim);
+
+#ifdef CRUSH_DEBUG
+  if (conf->n_keys)
+    fprintf(stderr, "key string: %s\n", *keystr);
+  fprintf(stderr, "pivot string: %s\n", *pivstr);
+#endif
+  return 0;
+}
+
+/* adds the value fields of a line into its accumulators, remembering the
+ * greatest input floating-point precision for each field. */
+static void add_values(struct pivot_conf *conf, const char *line,
+                       double *line_values, char *fieldbuf,
+                       size_t fieldbuf_sz) {
+  int i, tmplen;
+
+  for (i = 0; i < conf->n_values; i++) {
+    tmplen = get_line_field(fieldbuf, line, fieldbuf_sz - 1,
+                            conf->values[i], delim);
+    if (tmplen > 0) {
+      line_values[i] += atof(fieldbuf);
+
+      tmplen = float_str_precision(fieldbuf);
+      if (conf->value_precisions[i] < tmplen) {
+#ifdef CRUSH_DEBUG
+        fprintf(stderr, "setting precision to %d for field %d\n", tmplen, i);
+#endif
+        conf->value_precisions[i] = tmplen;
+      }
+    }
+  }
+}
+
+/* prints the header line: the key labels, then a label for each value of
+ * each column. */
+static void print_pivot_header(struct pivot_conf *conf, char **headers,
+                               struct pivot_columns *cols, size_t *col_order,
+                               char *fieldbuf, size_t fieldbuf_sz) {
+  char *pivot_label;
+  size_t i, label_sz;
+  int j;
+
+  for (i = 0; i < conf->n_keys; i++)
+    printf("%s%s", headers[conf->keys[i]], delim);
+
+  for (i = 0; i < cols->n; i++) {
+    const char *pivstr = cols->strings[col_order[i]];
+
+    /* the label has the pivot field values separated by " - ". */
+    label_sz = strlen(pivstr) + 3 * conf->n_pivots + 1;
+    pivot_label = xmalloc(label_sz);
+    pivot_label[0] = 0x00;
+    for (j = 0; j < conf->n_pivots; j++) {
+      get_line_field(fieldbuf, pivstr, fieldbuf_sz - 1, j, delim);
+      strcat(pivot_label, fieldbuf);
+      if (j != conf->n_pivots - 1)
+        strcat(pivot_label, " - ");
+    }
+
+    /* get the value field labels & print them with the pivot label */
+    for (j = 0; j < conf->n_values; j++) {
+      printf("%s: %s", pivot_label, headers[conf->values[j]]);
+      if (j != conf->n_values - 1)
+        fputs(delim, stdout);
+    }
+    if (i != cols->n - 1)
+      fputs(delim, stdout);
+    free(pivot_label);
+  }
+  fputs("\n", stdout);
+}
+
+/* prints one output row, with the columns in output order.  columns which
+ * appeared after the row's last value was added print as zeros. */
+static void print_row(struct pivot_conf *conf, const char *key,
+                      struct pivot_row *row, size_t n_cols,
+                      size_t *col_order) {
+  size_t k, col;
+  int j;
+
+  printf("%s%s", key, delim);
+  for (k = 0; k < n_cols; k++) {
+    col = col_order[k];
+    for (j = 0; j < conf->n_values; j++) {
+      printf("%.*f%s", conf->value_precisions[j],
+             col < row->n_cols ? row->cells[col * conf->n_values + j] : 0.0,
+             j != conf->n_values - 1 ? delim : "");
+    }
+    if (k != n_cols - 1)
+      fputs(delim, stdout);
+  }
+  fputs("\n", stdout);
+}
+
+/* interns the columns given with --columns or --columns-file.  returns
+ * non-zero if the file cannot be read. */
+static int load_columns(struct cmdargs *args, struct pivot_columns *cols) {
+  char *list, *column, *saveptr;
+  dbfr_t *reader;
+
+  if (args->columns) {
+    list = xstrdup(args->columns);
+    for (column = strtok_r(list, ",", &saveptr); column;
+         column = strtok_r(NULL, ",", &saveptr))
+      intern_pivot(cols, column);
+    free(list);
+    return 0;
+  }
+
+  if ((reader = dbfr_open(args->columns_file)) == NULL) {
+    warn("%s", args->columns_file);
+    return 1;
+  }
+  while (dbfr_getline(reader) > 0) {
+    chomp(reader->current_line);
+    intern_pivot(cols, reader->current_line);
+  }
+  dbfr_close(reader);
+  return 0;
+}
+
+/* reads the input files once to find every column, and the precision of
+ * each value field, before --sorted streams them.  returns non-zero if the
+ * inputs cannot be read twice or their fields cannot be configured. */
+static int scan_columns(struct cmdargs *args, int argc, char *argv[],
+                        int optind, struct pivot_conf *conf,
+                        struct pivot_columns *cols,
+                        char *fieldbuf, size_t fieldbuf_sz) {
+  char *keystr = NULL, *pivstr = NULL;
+  size_t keystr_sz = 0, pivstr_sz = 0;
+  double *scratch = xcalloc(conf->n_values, sizeof(double));
+  dbfr_t *reader;
+  FILE *fin;
+  int i;
+
+  for (i = optind; i < argc; i++) {
+    if (str_eq(argv[i], "-")) {
+      fprintf(stderr, "%s: --sorted cannot find the columns of stdin; use "
+              "--columns or --columns-file.\n", argv[0]);
+      return 1;
+    }
+  }
+  if (optind == argc) {
+    fprintf(stderr, "%s: --sorted cannot find the columns of stdin; use "
+            "--columns or --columns-file.\n", argv[0]);
+    return 1;
+  }
+
+  while ((fin = nextfile(argc, argv, &optind, "r")) != NULL) {
+    reader = dbfr_init(fin);
+    if (configure_pivot(conf, args, reader->next_line, delim) != 0) {
+      fprintf(stderr, "%s: error parsing input field arguments.\n", argv[0]);
+      return 1;
+    }
+    if (args->keep_header)
+      dbfr_getline(reader);
+    while (dbfr_getline(reader) > 0) {
+      chomp(reader->current_line);
+      if (line_strings(conf, reader, &keystr, &keystr_sz,
+                       &pivstr, &pivstr_sz) != 0) {
+        fprintf(stderr, "%s: out of memory.\n", getenv("_"));
+        return 1;
+      }
+      intern_pivot(cols, pivstr);
+      add_values(conf, reader->current_line, scratch, fieldbuf, fieldbuf_sz);
+    }
+    dbfr_close(reader);
+  }
+
+  if (keystr)
+    free(keystr);
+  if (pivstr)
+    free(pivstr);
+  free(scratch);
+  return 0;
 }
 
+/* with --sorted, prints each row as soon as its key changes, so that only
+ * one row is held in memory.  the columns must already be known; lines of
+ * any other column are skipped.  returns the exit status for main(). */
+static int pivot_sorted(struct cmdargs *args, int argc, char *argv[],
+                        int optind, dbfr_t *in_reader,
+                        struct pivot_conf *conf, struct pivot_columns *cols,
+                        char *keystr, char *fieldbuf, size_t fieldbuf_sz) {
+  struct pivot_row row;
+  size_t *col_order = column_order(cols);
+  char *group_key = NULL, *pivstr = NULL, *tmp;
+  size_t keystr_sz = 0, group_key_sz = 0, pivstr_sz = 0, tmp_sz;
+  int have_row = 0, retval = EXIT_OKAY;
+  void *id;
+  FILE *fin;
+
+  row.n_cols = cols->n;
+  row.cells = xcalloc(cols->n * conf->n_values, sizeof(double));
+
+  while (in_reader != NULL) {
+    while (dbfr_getline(in_reader) > 0) {
+      chomp(in_reader->current_line);
+      if (line_strings(conf, in_reader, &keystr, &keystr_sz,
+                       &pivstr, &pivstr_sz) != 0) {
+        fprintf(stderr, "%s: out of memory.\n", getenv("_"));
+        retval = EXIT_MEM_ERR;
+        break;
+      }
+      if ((id = ht_get(&cols->ids, pivstr)) == NULL)
+        continue;
+
+      if (have_row && ! str_eq(keystr, group_key)) {
+        if (key_strcmp(&group_key, &keystr) > 0) {
+          fprintf(stderr, "%s: input is not sorted by key: \"%s\" follows "
+                  "\"%s\".\n", argv[0], keystr, group_key);
+          retval = EXIT_FILE_ERR;
+          break;
+        }
+        print_row(conf, group_key, &row, cols->n, col_order);
+        memset(row.cells, 0, sizeof(double) * cols->n * conf->n_values);
+        have_row = 0;
+      }
+
+      if (! have_row && conf->n_keys) {
+        /* hold on to this row's key, and read the next one into the
+           other buffer. */
+        tmp = group_key;
+        tmp_sz = group_key_sz;
+        group_key = keystr;
+        group_key_sz = keystr_sz;
+        keystr = tmp;
+        keystr_sz = tmp_sz;
+      } else if (! have_row) {
+        group_key = keystr;
+      }
+      have_row = 1;
+      add_values(conf, in_reader->current_line,
+                 row.cells + ((size_t) id - 1) * conf->n_values,
+                 fieldbuf, fieldbuf_sz);
+    }
+    dbfr_close(in_reader);
+    if (retval != EXIT_OKAY)
+      break;
+
+    in_reader = NULL;
+    if ((fin = nextfile(argc, argv, &optind, "r")) != NULL) {
+      in_reader = dbfr_init(fin);
+      /* reconfigure in case the fields are rearranged in the new file */
+      if (configure_pivot(conf, args, in_reader->next_line, delim) != 0) {
+        fprintf(stderr, "%s: error parsing input field arguments.\n", argv[0]);
+        retval = EXIT_HELP;
+        break;
+      }
+      /* throw out headers from all files after the first. */
+      if (args->keep_header)
+        dbfr_getline(in_reader);
+    }
+  }
+
+  if (have_row && retval == EXIT_OKAY)
+    print_row(conf, group_key, &row, cols->n, col_order);
+
+  if (conf->n_keys) {
+    if (keystr)
+      free(keystr);
+    if (group_key)
+      free(group_key);
+  }
+  if (pivstr)
+    free(pivstr);
+  free(row.cells);
+  free(col_order);
+  return retval;
+}
+
+#ifdef HAVE_PTHREAD_H
+
+#define PIVOT_BATCH_SZ 65536    /* bytes of lines handed to a worker at once */
+#define PIVOT_QUEUE_LEN 4       /* batches queued for a worker before the
+                                   reader waits for it */
+
+/* lines handed to a worker, each stored as its key string and then the
+ * line, both NUL-terminated. */
+struct pivot_batch {
+  char *buf;
+  size_t len;
+  struct pivot_batch *next;
+};
+
+/* one worker of a multi-threaded pivot, owning the rows of the keys which
+ * hash to it. */
+struct pivot_worker {
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;          /* signalled whenever the queue changes */
+  struct pivot_batch *head, *tail;
+  size_t queued;                /* number of batches in the queue */
+  int busy;                     /* a batch is being added outside the lock */
+  int done;                     /* no more batches will be queued */
+  struct pivot_batch *filling;  /* the batch the reader is filling */
+  struct pivot_conf conf;       /* a copy of the config with its own
+                                   precisions */
+  hashtbl_t rows;               /* key string -> pivot_row */
+  struct pivot_columns cols;    /* the pivot strings of the worker's rows */
+};
+
+/* an output row, and the worker holding it. */
+struct pivot_entry {
+  char *key;
+  size_t worker;
+};
+
+/* adds a batch of lines to the worker's rows. */
+static void pivot_batch_lines(struct pivot_worker *w, struct pivot_batch *b,
+                              char **pivstr, size_t *pivstr_sz,
+                              char *fieldbuf, size_t fieldbuf_sz) {
+  struct pivot_row *row;
+  char *key, *line, *end = b->buf + b->len;
+  size_t line_len, col;
+
+  for (key = b->buf; key < end; key = line + line_len + 1) {
+    line = key + strlen(key) + 1;
+    line_len = strlen(line);
+    if (*pivstr_sz < line_len + 1) {
+      *pivstr_sz = line_len + 1;
+      *pivstr = xrealloc(*pivstr, *pivstr_sz);
+    }
+    extract_fields_to_string(line, *pivstr, *pivstr_sz, w->conf.pivots,
+                             w->conf.n_pivots, delim);
+
+    row = (struct pivot_row *) ht_get(&w->rows, key);
+    if (!row) {
+      row = xcalloc(1, sizeof(struct pivot_row));
+      ht_put(&w->rows, key, row);
+    }
+    col = intern_pivot(&w->cols, *pivstr);
+    add_values(&w->conf, line,
+               row_cells(row, col, w->cols.n, w->conf.n_values),
+               fieldbuf, fieldbuf_sz);
+  }
+}
+
+static void *pivot_worker_main(void *arg) {
+  struct pivot_worker *w = arg;
+  struct pivot_batch *b;
+  char *fieldbuf = xmalloc(MAX_FIELD_LEN), *pivstr = NULL;
+  size_t pivstr_sz = 0;
+
+  for (;;) {
+    pthread_mutex_lock(&w->lock);
+    while (w->head == NULL && ! w->done)
+      pthread_cond_wait(&w->cond, &w->lock);
+    if ((b = w->head) == NULL) {
+      pthread_mutex_unlock(&w->lock);
+      break;
+    }
+    if ((w->head = b->next) == NULL)
+      w->tail = NULL;
+    w->queued--;
+    w->busy = 1;
+    pthread_cond_broadcast(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+
+    pivot_batch_lines(w, b, &pivstr, &pivstr_sz, fieldbuf, MAX_FIELD_LEN);
+    free(b->buf);
+    free(b);
+
+    pthread_mutex_lock(&w->lock);
+    w->busy = 0;
+    pthread_cond_broadcast(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+  }
+
+  free(fieldbuf);
+  if (pivstr)
+    free(pivstr);
+  return NULL;
+}
+
+/* hands the batch the reader has been filling to its worker, waiting if the
+ * worker's queue is full. */
+static void queue_batch(struct pivot_worker *w) {
+  struct pivot_batch *b = w->filling;
+
+  if (b == NULL)
+    return;
+  w->filling = NULL;
+  pthread_mutex_lock(&w->lock);
+  while (w->queued >= PIVOT_QUEUE_LEN)
+    pthread_cond_wait(&w->cond, &w->lock);
+  if (w->tail)
+    w->tail->next = b;
+  else
+    w->head = b;
+  w->tail = b;
+  w->queued++;
+  pthread_cond_broadcast(&w->cond);
+  pthread_mutex_unlock(&w->lock);
+}
+
+/* appends a line and its key string to its worker's batch. */
+static void batch_line(struct pivot_worker *w, const char *keystr,
+                       const char *line) {
+  struct pivot_batch *b;
+  size_t key_len = strlen(keystr) + 1, line_len = strlen(line) + 1;
+
+  if (w->filling && w->filling->len + key_len + line_len > PIVOT_BATCH_SZ)
+    queue_batch(w);
+  if ((b = w->filling) == NULL) {
+    b = w->filling = xcalloc(1, sizeof(struct pivot_batch));
+    b->buf = xmalloc(key_len + line_len > PIVOT_BATCH_SZ ?
+                     key_len + line_len : PIVOT_BATCH_SZ);
+  }
+  memcpy(b->buf + b->len, keystr, key_len);
+  memcpy(b->buf + b->len + key_len, line, line_len);
+  b->len += key_len + line_len;
+}
+
+/* waits until every line read so far has been added to the workers' rows,
+ * so that their fields can be reconfigured for the next file. */
+static void drain_workers(struct pivot_worker *workers, int nthreads) {
+  int i;
+
+  for (i = 0; i < nthreads; i++) {
+    struct pivot_worker *w = &(workers[i]);
+    queue_batch(w);
+    pthread_mutex_lock(&w->lock);
+    while (w->head || w->busy)
+      pthread_cond_wait(&w->cond, &w->lock);
+    pthread_mutex_unlock(&w->lock);
+  }
+}
+
+/* points each worker at the main config's fields, keeping its precisions. */
+static void share_conf(struct pivot_worker *workers, int nthreads,
+                       struct pivot_conf *conf) {
+  int i, *precisions;
+
+  for (i = 0; i < nthreads; i++) {
+    precisions = workers[i].conf.value_precisions;
+    workers[i].conf = *conf;
+    workers[i].conf.value_precisions = precisions;
+  }
+}
+
+/* with --threads, the reader hashes each line's key to pick the worker
+ * which owns its row.  each worker interns its own columns; at the end they
+ * are merged into one dictionary, and each worker's column ids are mapped
+ * to the merged output order.  returns the exit status for main(). */
+static int pivot_threaded(struct cmdargs *args, int argc, char *argv[],
+                          int optind, dbfr_t *in_reader,
+                          struct pivot_conf *conf, char **headers,
+                          size_t key_hash_sz, char *fieldbuf,
+                          size_t fieldbuf_sz) {
+  int nthreads = atoi(args->threads), i, j, retval = EXIT_OKAY;
+  struct pivot_worker *workers = xcalloc(nthreads, sizeof(*workers));
+  struct pivot_columns cols;    /* the merged pivot strings */
+  struct pivot_entry *entries;
+  size_t *col_order, **local_order, n_entries = 0, k, n;
+  char *keystr = NULL, empty_string[] = "", **keys;
+  size_t keystr_sz = 0;
+  void *id;
+  FILE *fin;
+
+  for (i = 0; i < nthreads; i++) {
+    struct pivot_worker *w = &(workers[i]);
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->cond, NULL);
+    w->conf.value_precisions = xcalloc(conf->n_values, sizeof(int));
+    ht_init(&w->rows, key_hash_sz / nthreads + 1, NULL, free_row);
+    ht_init(&w->cols.ids, PIVOT_HASH_SZ, NULL, NULL);
+  }
+  share_conf(workers, nthreads, conf);
+  for (i = 0; i < nthreads; i++) {
+    if (pthread_create(&(workers[i].thread), NULL, pivot_worker_main,
+                       &(workers[i])) != 0) {
+      fprintf(stderr, "%s: failed to start a thread.\n", argv[0]);
+      return EXIT_HELP;
+    }
+  }
+
+  if (!conf->n_keys)
+    keystr = empty_string;
+
+  while (in_reader != NULL) {
+    while (dbfr_getline(in_reader) > 0) {
+      chomp(in_reader->current_line);
+      if (conf->n_keys) {
+        if (realloc_if_needed(&keystr, &keystr_sz,
+                              in_reader->current_line_sz) == NULL) {
+          fprintf(stderr, "%s: out of memory.\n", getenv("_"));
+          break;
+        }
+        extract_fields_to_string(in_reader->current_line, keystr, keystr_sz,
+                                 conf->keys, conf->n_keys, delim);
+      }
+      batch_line(&(workers[sdbm((unsigned char *) keystr) % nthreads]),
+                 keystr, in_reader->current_line);
+    }
+    dbfr_close(in_reader);
+
+    in_reader = NULL;
+    if ((fin = nextfile(argc, argv, &optind, "r")) != NULL) {
+      in_reader = dbfr_init(fin);
+      /* the workers still use the old fields until their queues empty. */
+      drain_workers(workers, nthreads);
+      if (configure_pivot(conf, args, in_reader->next_line, delim) != 0) {
+        fprintf(stderr, "%s: error parsing input field arguments.\n", argv[0]);
+        retval = EXIT_HELP;
+        break;
+      }
+      share_conf(workers, nthreads, conf);
+      if (args->keep_header)
+        dbfr_getline(in_reader);
+    }
+  }
+
+  for (i = 0; i < nthreads; i++) {
+    struct pivot_worker *w = &(workers[i]);
+    queue_batch(w);
+    pthread_mutex_lock(&w->lock);
+    w->done = 1;
+    pthread_cond_broadcast(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+  }
+  for (i = 0; i < nthreads; i++)
+    pthread_join(workers[i].thread, NULL);
+  if (retval != EXIT_OKAY)
+    return retval;
+
+  /* merge the columns and precisions, and find each merged column's id in
+     each worker, if the worker has it. */
+  memset(&cols, 0, sizeof(cols));
+  ht_init(&cols.ids, PIVOT_HASH_SZ, NULL, NULL);
+  for (i = 0; i < nthreads; i++) {
+    for (k = 0; k < workers[i].cols.n; k++)
+      intern_pivot(&cols, workers[i].cols.strings[k]);
+    for (j = 0; j < conf->n_values; j++) {
+      if (conf->value_precisions[j] < workers[i].conf.value_precisions[j])
+        conf->value_precisions[j] = workers[i].conf.value_precisions[j];
+    }
+    n_entries += workers[i].rows.nelems;
+  }
+  col_order = column_order(&cols);
+  local_order = xmalloc(sizeof(size_t *) * nthreads);
+  for (i = 0; i < nthreads; i++) {
+    local_order[i] = xmalloc(sizeof(size_t) * (cols.n ? cols.n : 1));
+    for (k = 0; k < cols.n; k++) {
+      id = ht_get(&workers[i].cols.ids, cols.strings[col_order[k]]);
+      local_order[i][k] = id ? (size_t) id - 1 : (size_t) -1;
+    }
+  }
+
+  if (args->keep_header)
+    print_pivot_header(conf, headers, &cols, col_order,
+                       fieldbuf, fieldbuf_sz);
+
+  /* the keys are sorted together, key first so that key_strcmp applies. */
+  entries = xmalloc(sizeof(struct pivot_entry) * (n_entries ? n_entries : 1));
+  for (n_entries = 0, i = 0; i < nthreads; i++) {
+    keys = xmalloc(sizeof(char *) * (workers[i].rows.nelems + 1));
+    n = ht_keys(&workers[i].rows, keys);
+    for (k = 0; k < n; k++) {
+      entries[n_entries].key = keys[k];
+      entries[n_entries++].worker = i;
+    }
+    free(keys);
+  }
+  qsort(entries, n_entries, sizeof(struct pivot_entry),
+        (int (*)(const void *, const void *)) key_strcmp);
+  for (k = 0; k < n_entries; k++) {
+    struct pivot_worker *w = &(workers[entries[k].worker]);
+    print_row(conf, entries[k].key, ht_get(&w->rows, entries[k].key),
+              cols.n, local_order[entries[k].worker]);
+  }
+
+  for (i = 0; i < nthreads; i++) {
+    struct pivot_worker *w = &(workers[i]);
+    ht_destroy(&w->rows);
+    ht_destroy(&w->cols.ids);
+    for (k = 0; k < w->cols.n; k++)
+      free(w->cols.strings[k]);
+    if (w->cols.strings)
+      free(w->cols.strings);
+    free(w->conf.value_precisions);
+    pthread_mutex_destroy(&w->lock);
+    pthread_cond_destroy(&w->cond);
+    free(local_order[i]);
+  }
+  ht_destroy(&cols.ids);
+  for (k = 0; k < cols.n; k++)
+    free(cols.strings[k]);
+  if (cols.strings)
+    free(cols.strings);
+  free(col_order);
+  free(local_order);
+  free(entries);
+  free(workers);
+  if (keystr != empty_string && keystr)
+    free(keystr);
+  return EXIT_OKAY;
+}
+
+#else
+
+static int pivot_threaded(struct cmdargs *args, int argc, char *argv[],
+                          int optind, dbfr_t *in_reader,
+                          struct pivot_conf *conf, char **headers,
+                          size_t key_hash_sz, char *fieldbuf,
+                          size_t fieldbuf_sz) {
+  return EXIT_HELP;
+}
+
+#endif /* HAVE_PTHREAD_H */
+
 /** @brief  
   * 
   * @param args contains the parsed cmd-line options & arguments.
@@ -71,21 +768,19 @@ void free_hash(void *t) {
   */
 int pivot(struct cmdargs *args, int argc, char *argv[], int optind) {
 
-  int i, j, tmplen;
+  int i, j, retval;
 
   char default_delim[] = { 0xFE, 0x00 };
 
-  hashtbl_t key_hash;           /* outer hash */
-  hashtbl_t *pivot_hash;        /* pointer for inner hashes */
+  hashtbl_t key_hash;           /* key string -> pivot_row */
+  struct pivot_row *row;
 
   struct pivot_conf conf;
-  /* variables for keeping track of the unique pivot strings */
-  hashtbl_t uniq_pivots;        /* set of all pivot strings */
-  char **pivot_array;           /* list of all pivot keys */
+  struct pivot_columns cols;    /* the distinct pivot strings */
+  size_t *col_order;            /* column ids in output order */
   size_t n_key_strings;         /* number of distinct key strings */
-  size_t n_pivot_keys;          /* number of distinct pivot field values */
 
-  double *line_values;          /* array of values */
+  double *line_values;          /* accumulators for the current line */
 
   char *keystr, *pivstr;        /* hash key strings */
   size_t keystr_sz, pivstr_sz;
@@ -98,7 +793,9 @@ int pivot(struct cmdargs *args, int argc, char *argv[], int optind) {
 
   FILE *fin;                    /* input file */
   dbfr_t *in_reader;
-  size_t max_line_sz = 0;
+  int first_arg;                /* index of the first input file in argv */
+  char *first_file;             /* input file to sample for --sample-size */
+  size_t key_hash_sz;           /* initial size of the outer hash */
 
   char empty_string[] = "";
 
@@ -111,6 +808,35 @@ int pivot(struct cmdargs *args, int argc, char *argv[], int optind) {
 
   delim = args->delim;
 
+  if ((args->columns || args->columns_file) && !args->sorted) {
+    fprintf(stderr, "%s: --columns and --columns-file require --sorted.\n",
+            argv[0]);
+    return EXIT_HELP;
+  }
+  if (args->columns && args->columns_file) {
+    fprintf(stderr, "%s: --columns and --columns-file cannot be used "
+            "together.\n", argv[0]);
+    return EXIT_HELP;
+  }
+  if (args->threads) {
+    if (atoi(args->threads) < 1) {
+      fprintf(stderr, "%s: -T must be a positive integer.\n", argv[0]);
+      return EXIT_HELP;
+    }
+#ifndef HAVE_PTHREAD_H
+    fprintf(stderr, "%s was compiled without thread support.\n", argv[0]);
+    return EXIT_HELP;
+#endif
+    if (args->sorted) {
+      fprintf(stderr, "%s: --threads and --sorted cannot be used together.\n",
+              argv[0]);
+      return EXIT_HELP;
+    }
+  }
+
+  first_arg = optind;
+  first_file = optind < argc ? argv[optind] : NULL;
+
   /* get first input file pointer - either trailing arg or stdin */
   if (optind == argc)
     fin = stdin;
@@ -141,6 +867,22 @@ int pivot(struct cmdargs *args, int argc, char *argv[], int optind) {
   fieldbuf = xmalloc(MAX_FIELD_LEN);
   fieldbuf_sz = MAX_FIELD_LEN;
 
+  memset(&cols, 0, sizeof(cols));
+  ht_init(&cols.ids, PIVOT_HASH_SZ, NULL, NULL);
+
+  /* --sorted needs all of the columns before the first row is printed. */
+  if (args->sorted) {
+    if (args->columns || args->columns_file)
+      retval = load_columns(args, &cols);
+    else
+      retval = scan_columns(args, argc, argv, first_arg, &conf, &cols,
+                            fieldbuf, fieldbuf_sz);
+    if (retval != 0)
+      return args->columns_file ? EXIT_FILE_ERR : EXIT_HELP;
+    /* the scan leaves the fields configured for the last file. */
+    configure_pivot(&conf, args, in_reader->next_line, delim);
+  }
+
   /* extract headers from first line of input if necessary */
   if (args->keep_header) {
 
@@ -174,109 +916,66 @@ int pivot(struct cmdargs *args, int argc, char *argv[], int optind) {
   keystr = pivstr = NULL;
   keystr_sz = pivstr_sz = 0;
 
-  ht_init(&key_hash, KEY_HASH_SZ, NULL, free_hash);
-  ht_init(&uniq_pivots, PIVOT_HASH_SZ, NULL, NULL);
-  n_key_strings = 0;
-  n_pivot_keys = 0;
-
   /* no keys specified?  set keystr to an empty string */
   if (!conf.n_keys) {
     keystr = empty_string;
   }
 
-  while (fin != NULL) {
-
-    while (dbfr_getline(in_reader) > 0) {
-      int value_in_hash = 1;
-      int pivot_in_hash = 1;
-
-      chomp(in_reader->current_line);
-      if (conf.n_keys) {
-        /* this could validly return NULL if both sizes are 0 the first time thru,
-           when keystr is still NULL, but that shouldn't happen */
-        if (realloc_if_needed(&keystr, &keystr_sz,
-                              in_reader->current_line_sz) == NULL) {
-          fprintf(stderr, "%s: out of memory.\n", getenv("_"));
-          break;
-        }
-      }
-
-      if (conf.n_pivots) {
-        if (realloc_if_needed(&pivstr, &pivstr_sz,
-                              in_reader->current_line_sz) == NULL) {
-          fprintf(stderr, "%s: out of memory.\n", getenv("_"));
-          break;
-        }
-      }
-
-      /* make key string from keys[] */
-      if (conf.n_keys)
-        extract_fields_to_string(in_reader->current_line, keystr, keystr_sz,
-                                 conf.keys, conf.n_keys, delim);
-
-      /* make key string from pivots[] */
-      extract_fields_to_string(in_reader->current_line, pivstr, pivstr_sz,
-                               conf.pivots, conf.n_pivots, delim);
+  if (args->sorted) {
+    if (args->keep_header) {
+      col_order = column_order(&cols);
+      print_pivot_header(&conf, headers, &cols, col_order,
+                         fieldbuf, fieldbuf_sz);
+      free(col_order);
+    }
+    retval = pivot_sorted(args, argc, argv, optind, in_reader, &conf, &cols,
+                          conf.n_keys ? NULL : keystr, fieldbuf, fieldbuf_sz);
+    free(fieldbuf);
+    return retval;
+  }
 
-#ifdef CRUSH_DEBUG
-      if (n_keys)
-        fprintf(stderr, "key string: %s\n", keystr);
-      if (n_pivots)
-        fprintf(stderr, "pivot string: %s\n", pivstr);
-#endif
+  /* presizing the outer hash avoids rehashing it over and over as it
+     grows. */
+  key_hash_sz = hll_presize(args->expected_keys, args->sample_size,
+                            first_file, args->keep_header,
+                            conf.keys, conf.n_keys, delim, KEY_HASH_SZ);
+  if (key_hash_sz == 0) {
+    fprintf(stderr, "%s: --expected-keys and --sample-size must be positive "
+            "numbers.\n", argv[0]);
+    return EXIT_HELP;
+  }
 
-      /* get hashtable value */
-      pivot_hash = (hashtbl_t *) ht_get(&key_hash, keystr);
-      if (!pivot_hash) {
-        pivot_hash = xmalloc(sizeof(hashtbl_t));
-        ht_init(pivot_hash, PIVOT_HASH_SZ, NULL, free);
-        pivot_in_hash = 0;
-      }
+  if (args->threads)
+    return pivot_threaded(args, argc, argv, optind, in_reader, &conf, headers,
+                          key_hash_sz, fieldbuf, fieldbuf_sz);
 
-      line_values = ht_get(pivot_hash, pivstr);
-      if (!line_values) {
-        line_values = xmalloc(sizeof(double) * conf.n_values);
-        memset(line_values, 0, sizeof(double) * conf.n_values);
-        value_in_hash = 0;
-      }
+  ht_init(&key_hash, key_hash_sz, NULL, free_row);
 
+  while (fin != NULL) {
 
-      /* add in values */
-      for (i = 0; i < conf.n_values; i++) {
-        tmplen =
-          get_line_field(fieldbuf, in_reader->current_line, fieldbuf_sz - 1,
-                         conf.values[i], delim);
-        if (tmplen > 0) {
-          line_values[i] += atof(fieldbuf);
+    while (dbfr_getline(in_reader) > 0) {
+      size_t col;
 
-          /* remember the greatest input floating-point precision for each
-           * field */
-          tmplen = float_str_precision(fieldbuf);
-          if (conf.value_precisions[i] < tmplen) {
-#ifdef CRUSH_DEBUG
-            fprintf(stderr, "setting precision to %d for field %d\n", tmplen,
-                    i);
-#endif
-            conf.value_precisions[i] = tmplen;
-          }
-        }
+      chomp(in_reader->current_line);
+      if (line_strings(&conf, in_reader, &keystr, &keystr_sz,
+                       &pivstr, &pivstr_sz) != 0) {
+        fprintf(stderr, "%s: out of memory.\n", getenv("_"));
+        break;
       }
 
-      /* store hashtable value */
-      if (!value_in_hash)
-        ht_put(pivot_hash, pivstr, line_values);
-
-      if (!pivot_in_hash) {
-        ht_put(&key_hash, keystr, pivot_hash);
+      /* find the row and the column's accumulators within it */
+      row = (struct pivot_row *) ht_get(&key_hash, keystr);
+      if (!row) {
+        row = xcalloc(1, sizeof(struct pivot_row));
+        ht_put(&key_hash, keystr, row);
       }
+      col = intern_pivot(&cols, pivstr);
+      line_values = row_cells(row, col, cols.n, conf.n_values);
 
-      /* store the pivot key string for later use */
-      ht_put(&uniq_pivots, pivstr, (void *) 1);
+      add_values(&conf, in_reader->current_line, line_values,
+                 fieldbuf, fieldbuf_sz);
     }
 
-    if (in_reader->current_line_sz > max_line_sz)
-      max_line_sz = in_reader->current_line_sz;
-
     dbfr_close(in_reader);
     fin = nextfile(argc, argv, &optind, "r");
     if (fin) {
@@ -293,17 +992,13 @@ int pivot(struct cmdargs *args, int argc, char *argv[], int optind) {
   }
 
   n_key_strings = key_hash.nelems;
-  n_pivot_keys = uniq_pivots.nelems;
 
   /* sort the collection of all pivot key strings */
-  pivot_array = xmalloc(sizeof(char *) * n_pivot_keys);
-  ht_keys(&uniq_pivots, pivot_array);
-  qsort(pivot_array, n_pivot_keys, sizeof(char *),
-        (int (*)(const void *, const void *)) key_strcmp);
+  col_order = column_order(&cols);
 #ifdef CRUSH_DEBUG
   fprintf(stderr, "sorted pivot strings:\n");
-  for (i = 0; i < n_pivot_keys; i++) {
-    fprintf(stderr, "\t%s\n", pivot_array[i]);
+  for (i = 0; i < cols.n; i++) {
+    fprintf(stderr, "\t%s\n", cols.strings[col_order[i]]);
   }
 #endif
 
@@ -311,43 +1006,8 @@ int pivot(struct cmdargs *args, int argc, char *argv[], int optind) {
 
   /* print headers separate from data if necessary */
   if (args->keep_header) {
-    char *pivot_label;
-
-    /* assumption - the largest line of input has a greater length
-       than the combined length of all pivot field values and a 3-char
-       separator.  safe assumption?  probably not if every input field
-       is used as a pivot field. */
-    pivot_label = xmalloc(max_line_sz);
-
-    if (conf.n_keys) {
-      for (i = 0; i < conf.n_keys; i++)
-        printf("%s%s", headers[conf.keys[i]], delim);
-    }
-    for (i = 0; i < n_pivot_keys; i++) {
-      pivot_label[0] = 0x00;
-
-      /* get the current pivot field values & build a label with them */
-      for (j = 0; j < conf.n_pivots; j++) {
-        get_line_field(fieldbuf, pivot_array[i], fieldbuf_sz - 1, j, delim);
-        strcat(pivot_label, fieldbuf);
-        if (j != conf.n_pivots - 1)
-          strcat(pivot_label, " - ");
-      }
-
-      /* get the value field labels & print them with the pivot label */
-      for (j = 0; j < conf.n_values; j++) {
-        printf("%s: %s", pivot_label, headers[conf.values[j]]);
-        if (j != conf.n_values - 1)
-          fputs(delim, stdout);
-      }
-      /* TODO: segfault is happening around here */
-      if (i != n_pivot_keys - 1)
-        fputs(delim, stdout);
-
-    }
-    fputs("\n", stdout);
-
-    free(pivot_label);
+    print_pivot_header(&conf, headers, &cols, col_order,
+                       fieldbuf, fieldbuf_sz);
 
     /* free each header string - don't need them anymore */
     for (i = 0; i < n_headers; i++)
@@ -358,22 +1018,6 @@ int pivot(struct cmdargs *args, int argc, char *argv[], int optind) {
 
   {
     char **key_array;
-    llist_node_t *key_node;
-    llist_t *key_list;
-    char *empty_value_string;
-
-    /* construct string for empty value set.  this should be big enough for
-       n_values worth of zeros (of the appropriate precision) and delimiters
-       in between.  here we'll just guess that a precision of 8 is enough. */
-    empty_value_string = xmalloc((sizeof(char) * conf.n_values * 8) +
-                                 (strlen(delim) * conf.n_values));
-    empty_value_string[0] = 0x00;
-    for (i = 0; i < conf.n_values; i++) {
-      sprintf(empty_value_string, "%s%.*f", empty_value_string,
-              conf.value_precisions[i], 0.0F);
-      if (i != conf.n_values - 1)
-        strcat(empty_value_string, delim);
-    }
 
     key_array = xmalloc(sizeof(char *) * n_key_strings);
     j = ht_keys(&key_hash, key_array);
@@ -386,56 +1030,46 @@ int pivot(struct cmdargs *args, int argc, char *argv[], int optind) {
           (int (*)(const void *, const void *)) key_strcmp);
 
     /* loop through all key strings */
-    for (i = 0; i < n_key_strings; i++) {
-      int k;
-      pivot_hash = ht_get(&key_hash, key_array[i]);
-
-      if (n_key_strings > 0)
-        printf("%s%s", key_array[i], delim);
-
-      /* loop through all possible pivot-string inner hashtable keys */
-      for (k = 0; k < n_pivot_keys; k++) {
-        /* loop through all values */
-        line_values = ht_get(pivot_hash, pivot_array[k]);
-        if (!line_values)
-          fputs(empty_value_string, stdout);
-        else {
-          for (j = 0; j < conf.n_values; j++) {
-            printf("%.*f%s", conf.value_precisions[j], line_values[j],
-                   j != conf.n_values - 1 ? delim : "");
-          }
-        }
-        if (k != n_pivot_keys - 1)
-          fputs(delim, stdout);
-      }
-      fputs("\n", stdout);
-
-    }
-    free(empty_value_string);
+    for (i = 0; i < n_key_strings; i++)
+      print_row(&conf, key_array[i], ht_get(&key_hash, key_array[i]),
+                cols.n, col_order);
     free(key_array);
   }
 
   /* CLEANUP SECTION */
   ht_destroy(&key_hash);
-  ht_destroy(&uniq_pivots);
+  ht_destroy(&cols.ids);
+  for (i = 0; i < cols.n; i++)
+    free(cols.strings[i]);
+  if (cols.strings)
+    free(cols.strings);
+  free(col_order);
 
   if (keystr && keystr != empty_string)
     free(keystr);
   if (pivstr)
     free(pivstr);
-  if (pivot_array)
-    free(pivot_array);
   if (fieldbuf)
     free(fieldbuf);
 
   return EXIT_OKAY;
 }
 
+/* expand_nums() tokenizes its argument in place, but the fields are
+ * configured again for each input file. */
+static ssize_t expand_field_list(const char *arg, int **array, size_t *sz) {
+  char *copy = xstrdup(arg);
+  ssize_t n = expand_nums(copy, array, sz);
+  free(copy);
+  return n;
+}
+
 int configure_pivot(struct pivot_conf *conf, struct cmdargs *args,
                     const char *header, const char *delim) {
   conf->n_keys = 0;
   if (args->keys) {
-    conf->n_keys = expand_nums(args->keys, &(conf->keys), &(conf->keys_sz));
+    conf->n_keys = expand_field_list(args->keys, &(conf->keys),
+                                     &(conf->keys_sz));
   } else if (args->key_labels) {
     conf->n_keys = expand_label_list(args->key_labels, header, delim,
                                      &(conf->keys), &(conf->keys_sz));
@@ -448,8 +1082,8 @@ int configure_pivot(struct pivot_conf *conf, struct cmdargs *args,
 
   conf->n_pivots = 0;
   if (args->pivots) {
-    conf->n_pivots = expand_nums(args->pivots, &(conf->pivots),
-                                 &(conf->pivots_sz));
+    conf->n_pivots = expand_field_list(args->pivots, &(conf->pivots),
+                                       &(conf->pivots_sz));
   } else if (args->pivot_labels) {
     conf->n_pivots = expand_label_list(args->pivot_labels, header, delim,
                                        &(conf->pivots), &(conf->pivots_sz));
@@ -462,8 +1096,8 @@ int configure_pivot(struct pivot_conf *conf, struct cmdargs *args,
 
   conf->n_values = 0;
   if (args->values) {
-    conf->n_values = expand_nums(args->values, &(conf->values),
-                                 &(conf->values_sz));
+    conf->n_values = expand_field_list(args->values, &(conf->values),
+                                       &(conf->values_sz));
   } else if (args->value_labels) {
     conf->n_values = expand_label_list(args->value_labels, header, delim,
                                        &(conf->values), &(conf->values_sz));
@@ -473,7 +1107,9 @@ int configure_pivot(struct pivot_conf *conf, struct cmdargs *args,
     return -1;
   else
     decrement_values(conf->values, conf->n_values);
-  conf->value_precisions = xcalloc(conf->n_values, sizeof(int));
+  /* precisions carry over from one input file to the next. */
+  if (!conf->value_precisions)
+    conf->value_precisions = xcalloc(conf->n_values, sizeof(int));
   return 0;
 }
 
@@ -0,0 +1,45 @@
+test_number=03
+description="sorted input"
+
+input=$test_dir/test_00.in
+
+subtest=1
+expected=$test_dir/test_00.expected
+output=$test_dir/test_$test_number.$subtest.output
+$bin -s -k -f 1 -p 2 -v 3 $input > $output
+if [ $? -ne 0 ] || [ "`diff -q $output $expected`" ]; then
+  test_status $test_number $subtest "$description (columns found)" FAIL
+else
+  test_status $test_number $subtest "$description (columns found)" PASS
+  rm $output
+fi
+
+subtest=2
+expected=$test_dir/test_$test_number.expected
+output=$test_dir/test_$test_number.$subtest.output
+$bin -s -k -f 1 -p 2 -v 3 -c "Two Key 4,Two Key 5" < $input > $output
+if [ $? -ne 0 ] || [ "`diff -q $output $expected`" ]; then
+  test_status $test_number $subtest "$description (columns)" FAIL
+else
+  test_status $test_number $subtest "$description (columns)" PASS
+  rm $output
+fi
+
+subtest=3
+output=$test_dir/test_$test_number.$subtest.output
+$bin -s -k -f 1 -p 2 -v 3 -C $test_dir/test_$test_number.columns \
+  $input > $output
+if [ $? -ne 0 ] || [ "`diff -q $output $expected`" ]; then
+  test_status $test_number $subtest "$description (columns file)" FAIL
+else
+  test_status $test_number $subtest "$description (columns file)" PASS
+  rm $output
+fi
+
+subtest=4
+$bin -s -k -f 1 -p 2 -v 3 $input $input > /dev/null 2>&1
+if [ $? -eq 0 ]; then
+  test_status $test_number $subtest "$description (unsorted input)" FAIL
+else
+  test_status $test_number $subtest "$description (unsorted input)" PASS
+fi
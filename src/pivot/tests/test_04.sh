@@ -0,0 +1,36 @@
+test_number=04
+description="threads"
+
+input=$test_dir/test_01.in
+expected=$test_dir/test_01.expected
+
+subtest=1
+output=$test_dir/test_$test_number.$subtest.output
+$bin -T 3 -k -f 1 -p 3,6 -v 4,5 $input > $output
+if [ $? -ne 0 ] || [ "`diff -q $output $expected`" ]; then
+  test_status $test_number $subtest "$description (one file)" FAIL
+else
+  test_status $test_number $subtest "$description (one file)" PASS
+  rm $output
+fi
+
+subtest=2
+output=$test_dir/test_$test_number.$subtest.output
+$bin -T 2 -k -f 1 -p 2 -v 3 $test_dir/test_00.in $test_dir/test_00.in \
+  > $output &&
+  $bin -k -f 1 -p 2 -v 3 $test_dir/test_00.in $test_dir/test_00.in \
+  > $output.single
+if [ $? -ne 0 ] || [ "`diff -q $output $output.single`" ]; then
+  test_status $test_number $subtest "$description (several files)" FAIL
+else
+  test_status $test_number $subtest "$description (several files)" PASS
+  rm $output $output.single
+fi
+
+subtest=3
+$bin -T 2 -s -k -f 1 -p 2 -v 3 $test_dir/test_00.in > /dev/null 2>&1
+if [ $? -eq 0 ]; then
+  test_status $test_number $subtest "$description (with --sorted)" FAIL
+else
+  test_status $test_number $subtest "$description (with --sorted)" PASS
+fi